@@ -0,0 +1,426 @@
+#ifndef ANEL_H
+#define ANEL_H
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#include "readln.h"
+#include "outbuf.h"
+#include "bytes.h"
+
+/*
+ * Anel (ring buffer) em memória partilhada, alternativa aos FIFOs entre um
+ * componente interno e o router (node <id> -a <capacidade> ..., ver
+ * controlador.c).
+ *
+ * Cada anel é uma fila de bytes com um só escritor e um só leitor: o anel de
+ * entrada de um nó é escrito pelo router (que junta tudo o que vai para o nó,
+ * de todas as ligações e dos injects) e lido pelo componente; o de saída é
+ * escrito pelo componente e lido pelo router. Os registos passam por memcpy
+ * de e para a região partilhada, sem chamadas ao sistema enquanto houver
+ * dados (ou espaço) dos dois lados.
+ *
+ * A região é um memfd (não fica nada em ./tmp nem é escrito no disco),
+ * criado pelo controlador e herdado pelo processo do nó, tal como o eventfd
+ * do anel. Os componentes recebem "<memfd>,<eventfd>" nas variáveis de
+ * ambiente ANEL_ENV_ENTRADA e ANEL_ENV_SAIDA (ver anel_componente).
+ *
+ * Quem não pode avançar (leitor com o anel vazio, escritor com o anel cheio)
+ * marca que está à espera e volta a verificar antes de dormir; o outro lado
+ * só faz uma chamada ao sistema se vir a marca. Um componente dorme num
+ * futex (bloqueia como num read/write); o router não pode bloquear, por isso
+ * espera pelo eventfd do anel no seu epoll.
+ *
+ * As posições (cabeca, cauda) contam bytes desde o início e nunca voltam
+ * atrás; a capacidade é uma potência de 2.
+ */
+
+#define ANEL_ENV_ENTRADA "ANEL_ENTRADA"
+#define ANEL_ENV_SAIDA   "ANEL_SAIDA"
+#define ANEL_MINIMO      4096      // capacidade mínima (bytes)
+#define ANEL_MAXIMO      (1 << 30) // capacidade máxima (bytes)
+#define ANEL_CAB         4096      // bytes do cabeçalho (antes dos dados)
+
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 1U
+#endif
+
+enum { ANEL_ACORDADO, ANEL_FUTEX, ANEL_EVENTFD }; // como espera cada lado
+
+/*
+ * Cabeçalho partilhado (as posições em linhas de cache separadas)
+ */
+typedef struct anel_cab {
+    uint64_t cabeca;          // bytes escritos (só o escritor a altera)
+    char     pad1[56];
+    uint64_t cauda;           // bytes lidos (só o leitor a altera)
+    char     pad2[56];
+    uint32_t escritas;        // futex do leitor (muda quando é acordado)
+    uint32_t leituras;        // futex do escritor
+    int      espera_leitor;   // ANEL_FUTEX ou ANEL_EVENTFD se está à espera
+    int      espera_escritor;
+    int      fechado;         // 1 se não vai ser escrito mais nada
+    uint64_t cap;
+} *AnelCab;
+
+typedef struct anel {
+    AnelCab  cab;
+    char*    dados;
+    uint64_t cap;   // potência de 2
+    int      fd;    // memfd da região
+    int      efd;   // eventfd (acorda o router)
+} *Anel;
+
+/*
+ * @brief Converte uma capacidade (bytes, ver bytes.h), arredondada para a
+ *        potência de 2 seguinte
+ *
+ * @return Capacidade ou 0 se for inválida
+ */
+size_t anel_capacidade(const char* s) {
+    size_t cap = ANEL_MINIMO, v = bytes_converte(s, ANEL_MAXIMO);
+
+    if (v == 0) return 0;
+
+    while (cap < v) cap *= 2;
+
+    return cap;
+}
+
+static long anel_futex(uint32_t* p, int op, uint32_t v) {
+    return syscall(SYS_futex, p, op, v, NULL, NULL, 0);
+}
+
+/*
+ * @brief Mapeia a região de um anel
+ */
+static Anel anel_mapeia(int fd, int efd, uint64_t cap) {
+    Anel a;
+    void* r = mmap(NULL, ANEL_CAB + cap, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    if (r == MAP_FAILED) return NULL;
+
+    a = malloc(sizeof(struct anel));
+    a->cab = r;
+    a->dados = (char*) r + ANEL_CAB;
+    a->cap = cap;
+    a->fd = fd;
+    a->efd = efd;
+
+    return a;
+}
+
+/*
+ * @brief Cria um anel vazio (controlador)
+ *
+ * @param cap Capacidade (potência de 2, ver anel_capacidade)
+ *
+ * @return Anel ou NULL em caso de erro
+ */
+Anel anel_cria(size_t cap) {
+    int fd, efd;
+    Anel a;
+
+    fd = syscall(SYS_memfd_create, "anel", MFD_CLOEXEC);
+    if (fd == -1) { perror("memfd_create"); return NULL; }
+
+    if (ftruncate(fd, ANEL_CAB + cap) == -1 ||
+        (efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) == -1) {
+        perror("anel");
+        close(fd);
+        return NULL;
+    }
+
+    if ((a = anel_mapeia(fd, efd, cap)) == NULL) {
+        perror("mmap anel");
+        close(fd);
+        close(efd);
+        return NULL;
+    }
+
+    a->cab->cap = cap;
+
+    return a;
+}
+
+/*
+ * @brief Desfaz um anel (controlador, depois de o router o largar)
+ */
+void anel_liberta(Anel a) {
+    if (a == NULL) return;
+
+    munmap(a->cab, ANEL_CAB + a->cap);
+    close(a->fd);
+    close(a->efd);
+    free(a);
+}
+
+/*
+ * @brief Descrição de um anel para a variável de ambiente de um componente
+ *        ("<memfd>,<eventfd>"); os descritores deixam de fechar no exec
+ *
+ * Só deve ser chamada no processo filho, antes do exec.
+ */
+void anel_herda(Anel a, char* env, size_t n) {
+    fcntl(a->fd, F_SETFD, 0);
+    fcntl(a->efd, F_SETFD, 0);
+    snprintf(env, n, "%d,%d", a->fd, a->efd);
+}
+
+/*
+ * @brief Abre um anel herdado do controlador (componente)
+ *
+ * @return Anel ou NULL se a variável não existir ou for inválida
+ */
+static Anel anel_abre(const char* env) {
+    int fd, efd;
+    off_t tam;
+
+    if (env == NULL || sscanf(env, "%d,%d", &fd, &efd) != 2) return NULL;
+
+    tam = lseek(fd, 0, SEEK_END);
+    if (tam <= ANEL_CAB) return NULL;
+
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    fcntl(efd, F_SETFD, FD_CLOEXEC);
+
+    return anel_mapeia(fd, efd, tam - ANEL_CAB);
+}
+
+/*
+ * @brief Bytes por ler
+ */
+static inline uint64_t anel_ocupado(Anel a) {
+    return __atomic_load_n(&a->cab->cabeca, __ATOMIC_ACQUIRE) -
+           __atomic_load_n(&a->cab->cauda, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * @brief Acorda o outro lado se estiver à espera
+ *
+ * @param espera Marca de espera do outro lado
+ * @param seq    Palavra do futex do outro lado
+ */
+static void anel_acorda(Anel a, int* espera, uint32_t* seq) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(espera, __ATOMIC_RELAXED) == ANEL_ACORDADO) return;
+
+    switch (__atomic_exchange_n(espera, ANEL_ACORDADO, __ATOMIC_SEQ_CST)) {
+    case ANEL_FUTEX:
+        __atomic_add_fetch(seq, 1, __ATOMIC_SEQ_CST);
+        anel_futex(seq, FUTEX_WAKE, 1);
+        break;
+    case ANEL_EVENTFD:
+        eventfd_write(a->efd, 1);
+        break;
+    }
+}
+
+/*
+ * @brief Marca que um lado vai esperar e volta a verificar se pode avançar
+ *        (para que uma escrita ou leitura feita entretanto não se perca)
+ *
+ * @param espera Marca de espera deste lado
+ * @param modo   ANEL_FUTEX ou ANEL_EVENTFD
+ * @param leitor 1 se é o leitor (espera por dados), 0 se é o escritor
+ *
+ * @return 1 se já pode avançar (não deve esperar)
+ */
+static int anel_arma(Anel a, int* espera, int modo, int leitor) {
+    uint64_t ocupado;
+
+    __atomic_store_n(espera, modo, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    ocupado = anel_ocupado(a);
+
+    if (leitor ? ocupado > 0 || __atomic_load_n(&a->cab->fechado, __ATOMIC_ACQUIRE)
+               : ocupado < a->cap) {
+        __atomic_store_n(espera, ANEL_ACORDADO, __ATOMIC_RELAXED);
+        return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * @brief Escreve o que couber sem bloquear
+ *
+ * @return Bytes escritos
+ */
+size_t anel_escreve_nb(Anel a, const char* buf, size_t n) {
+    AnelCab c = a->cab;
+    uint64_t cabeca = c->cabeca, pos, k;
+    size_t livre = a->cap - (cabeca - __atomic_load_n(&c->cauda, __ATOMIC_ACQUIRE));
+
+    if (n > livre) n = livre;
+    if (n == 0) return 0;
+
+    pos = cabeca & (a->cap - 1);
+    k = a->cap - pos < n ? a->cap - pos : n;
+
+    memcpy(a->dados + pos, buf, k);
+    memcpy(a->dados, buf + k, n - k);
+
+    __atomic_store_n(&c->cabeca, cabeca + n, __ATOMIC_RELEASE);
+    anel_acorda(a, &c->espera_leitor, &c->escritas);
+
+    return n;
+}
+
+/*
+ * @brief Lê o que houver sem bloquear
+ *
+ * @return Bytes lidos
+ */
+size_t anel_le_nb(Anel a, char* buf, size_t n) {
+    AnelCab c = a->cab;
+    uint64_t cauda = c->cauda, pos, k;
+    size_t ocupado = __atomic_load_n(&c->cabeca, __ATOMIC_ACQUIRE) - cauda;
+
+    if (n > ocupado) n = ocupado;
+    if (n == 0) return 0;
+
+    pos = cauda & (a->cap - 1);
+    k = a->cap - pos < n ? a->cap - pos : n;
+
+    memcpy(buf, a->dados + pos, k);
+    memcpy(buf + k, a->dados, n - k);
+
+    __atomic_store_n(&c->cauda, cauda + n, __ATOMIC_RELEASE);
+    anel_acorda(a, &c->espera_escritor, &c->leituras);
+
+    return n;
+}
+
+/*
+ * @brief Router: prepara a espera (no eventfd) por dados num anel de saída
+ *
+ * @return 1 se já há dados (não deve esperar)
+ */
+int anel_espera_dados(Anel a) {
+    return anel_arma(a, &a->cab->espera_leitor, ANEL_EVENTFD, 1);
+}
+
+/*
+ * @brief Router: prepara a espera (no eventfd) por espaço num anel de
+ *        entrada
+ *
+ * @return 1 se já há espaço (não deve esperar)
+ */
+int anel_espera_espaco(Anel a) {
+    return anel_arma(a, &a->cab->espera_escritor, ANEL_EVENTFD, 0);
+}
+
+/*
+ * @brief Router: descarta os avisos pendentes do eventfd
+ */
+void anel_limpa(Anel a) {
+    eventfd_t v;
+    eventfd_read(a->efd, &v);
+}
+
+/*
+ * @brief Marca que não vai ser escrito mais nada: o leitor recebe EOF depois
+ *        de ler o que ainda houver
+ */
+void anel_fecha(Anel a) {
+    __atomic_store_n(&a->cab->fechado, 1, __ATOMIC_RELEASE);
+    anel_acorda(a, &a->cab->espera_leitor, &a->cab->escritas);
+}
+
+/*
+ * @brief Componente: lê, bloqueando (no futex) enquanto o anel estiver vazio
+ *
+ * @return Bytes lidos, 0 se o anel foi fechado e está vazio
+ */
+static ssize_t anel_le(void* arg, void* buf, size_t n) {
+    Anel a = arg;
+    AnelCab c = a->cab;
+    uint32_t seq;
+    size_t r;
+
+    for (;;) {
+        if ((r = anel_le_nb(a, buf, n)) > 0) return r;
+
+        seq = __atomic_load_n(&c->escritas, __ATOMIC_SEQ_CST);
+
+        if (anel_arma(a, &c->espera_leitor, ANEL_FUTEX, 1)) {
+            if (anel_ocupado(a) == 0 && __atomic_load_n(&c->fechado, __ATOMIC_ACQUIRE)) {
+                return anel_le_nb(a, buf, n); // escrito antes de fechar
+            }
+            continue;
+        }
+
+        anel_futex(&c->escritas, FUTEX_WAIT, seq);
+    }
+}
+
+/*
+ * @brief Componente: escreve tudo, bloqueando (no futex) enquanto o anel
+ *        estiver cheio
+ *
+ * @return 0
+ */
+static int anel_escreve(void* arg, const char* buf, size_t n) {
+    Anel a = arg;
+    AnelCab c = a->cab;
+    uint32_t seq;
+    size_t w;
+
+    while (n > 0) {
+        if ((w = anel_escreve_nb(a, buf, n)) > 0) {
+            buf += w;
+            n -= w;
+            continue;
+        }
+
+        seq = __atomic_load_n(&c->leituras, __ATOMIC_SEQ_CST);
+
+        if (!anel_arma(a, &c->espera_escritor, ANEL_FUTEX, 0)) {
+            anel_futex(&c->leituras, FUTEX_WAIT, seq);
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * @brief Componente: indica se a próxima leitura teria de esperar
+ */
+static int anel_vazio(void* arg) {
+    Anel a = arg;
+    return anel_ocupado(a) == 0 && !__atomic_load_n(&a->cab->fechado, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * @brief Liga a entrada (fd 0, lida com o readln) e a saída (o buffer de
+ *        saída) de um componente aos anéis que o controlador lhe passou, se
+ *        o nó usar anéis (sem as variáveis de ambiente, nada muda)
+ *
+ * @param o Buffer de saída do componente
+ */
+void anel_componente(Outbuf o) {
+    Anel a;
+
+    if ((a = anel_abre(getenv(ANEL_ENV_ENTRADA))) != NULL) {
+        readln_fonte(0, anel_le, anel_vazio, a);
+    }
+
+    if ((a = anel_abre(getenv(ANEL_ENV_SAIDA))) != NULL) {
+        outbuf_destino(o, anel_escreve, a);
+    }
+}
+
+#endif
@@ -0,0 +1,131 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <pthread.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "comum.h"
+
+/* Débito da rede com os nós ligados ao router por FIFOs ou por anéis em
+memória partilhada (node <id> -a <capacidade>, ver anel.h), para vários
+tamanhos de registo. Corre o ./controlador (é preciso fazer make antes) com a
+cadeia
+
+	f (const) -> g (filter) -> h (const) -> sink (tee)
+
+injeta no nó f cerca de MB megabytes de registos de cada tamanho e mede o
+tempo até o último registo chegar ao sink. Os três componentes usam os FIFOs
+ou os anéis; o sink (comando externo) usa sempre o FIFO.
+
+utilização: ./bench_anel [MB] [capacidade dos anéis]
+*/
+
+#define CONFIG "./tmp/bench_anel.cfg"
+#define DADOS "./tmp/bench_anel.txt"
+#define RESPOSTAS "./tmp/bench_anel.out"
+#define SINK "./tmp/bench_anel.fifo"
+
+/*
+ * @brief Corre a cadeia com os registos que estão em DADOS
+ *
+ * @param anel Opção dos nós ("" para os FIFOs, e.g. "-a 1m " para anéis)
+ * @param n    Registos injetados
+ *
+ * @return Segundos desde o inject até o sink ter todos os registos
+ */
+double corre(const char* anel, long n) {
+	struct sink s = { 0, 0 };
+	pthread_t th;
+	char* args[] = { "controlador", "-b", CONFIG, NULL };
+	int cmd, ctl;
+	double t;
+	FILE* f;
+
+	f = fopen(CONFIG, "w");
+	fprintf(f, "node f %sconst x\nnode g %sfilter 1 > 0\nnode h %sconst y\n"
+	           "node sink tee %s\nconnect f g\nconnect g h\nconnect h sink\n",
+	        anel, anel, anel, SINK);
+	fclose(f);
+
+	unlink(SINK);
+	mkfifo(SINK, 0666);
+
+	ctl = comum_controlador(args, RESPOSTAS, 1, &cmd);
+
+	s.fd = open(SINK, O_RDONLY);
+	pthread_create(&th, NULL, le_sink, &s);
+
+	t = agora();
+	dprintf(cmd, "inject f cat %s\nshutdown --drain\n", DADOS);
+	close(cmd);
+
+	pthread_join(th, NULL);
+	t = agora() - t;
+
+	waitpid(ctl, NULL, 0);
+	kill(-ctl, SIGKILL);
+	close(s.fd);
+	unlink(SINK);
+
+	if (s.recebidos != n) {
+		fprintf(stderr, "%s: o sink recebeu %ld de %ld registos\n",
+		        *anel ? "anéis" : "FIFOs", s.recebidos, n);
+	}
+
+	return t;
+}
+
+int main(int argc, char const *argv[]){
+
+	double mb = argc > 1 ? atof(argv[1]) : 32;
+	const char* cap = argc > 2 ? argv[2] : "1m";
+	int tamanhos[] = { 16, 64, 256, 1024, 4096 };
+	int i, t;
+	long n, r;
+	double tf, ta;
+	char anel[64], reg[8192];
+	FILE* f;
+
+	if (comum_pronto(NULL) != 0) return 1;
+
+	snprintf(anel, sizeof(anel), "-a %s ", cap);
+
+	printf("cadeia de 3 componentes, %.0f MB por tamanho, anéis de %s\n", mb, cap);
+	printf("%8s %9s %12s %12s %12s %12s %8s\n", "bytes", "registos",
+	       "FIFO reg/s", "FIFO MB/s", "anel reg/s", "anel MB/s", "anel/FIFO");
+
+	for (i = 0; i < (int) (sizeof(tamanhos) / sizeof(int)); i++) {
+		t = tamanhos[i];
+		n = mb * 1024 * 1024 / t;
+
+		/* Registos "<i>:aaa...a\n" com t bytes (o filter deixa-os passar) */
+
+		f = fopen(DADOS, "w");
+		for (r = 0; r < n; r++) {
+			int k = sprintf(reg, "%ld:", r + 1);
+			memset(reg + k, 'a', t - k - 1);
+			reg[t - 1] = '\n';
+			fwrite(reg, 1, t, f);
+		}
+		fclose(f);
+
+		tf = corre("", n);
+		ta = corre(anel, n);
+
+		printf("%8d %9ld %12.0f %12.1f %12.0f %12.1f %8.2f\n", t, n,
+		       n / tf, n * (double) t / tf / 1e6, n / ta,
+		       n * (double) t / ta / 1e6, tf / ta);
+	}
+
+	unlink(CONFIG);
+	unlink(DADOS);
+	unlink(RESPOSTAS);
+
+	return 0;
+}
@@ -0,0 +1,140 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "comum.h"
+
+/* Tempo de arranque de uma rede grande a partir de um ficheiro de
+configuração. Corre o ./controlador (é preciso fazer make antes) com a rede
+
+	f (const s) -> cadeias de 3 nós (filter -> window -> const) -> sink (tee)
+
+com cerca de 1000 nós e um inject de um registo no nó f no fim do ficheiro.
+Mede-se o tempo desde que o controlador é criado até o registo chegar ao sink
+por todas as cadeias, com o ficheiro interpretado linha a linha e aplicado de
+uma vez (-b). Com -b mostra também o tempo até a rede estar pronta escrito
+pelo controlador. Com poucos CPUs, os processos dos nós arrancam quase em série
+nos dois casos.
+
+utilização: ./bench_arranque [nós]
+*/
+
+#define CONFIG "./tmp/bench_arranque.cfg"
+#define DADOS "./tmp/bench_arranque.txt"
+#define RESPOSTAS "./tmp/bench_arranque.out"
+#define SINK "./tmp/bench_arranque.fifo"
+
+/*
+ * @brief Corre o controlador com a opção dada (ou nenhuma) até o sink receber
+ *        um registo de cada cadeia (ou passarem 30 s sem registos)
+ *
+ * @return Número de registos recebidos pelo sink
+ */
+int corre(const char* opcao, int cadeias, double* t) {
+	char* args[] = { "controlador", (char*) opcao, CONFIG, NULL };
+	int cmd, ctl, sink, i, recebidos = 0;
+	char buf[65536], linha[256];
+	struct pollfd p;
+	ssize_t r;
+	FILE* f;
+
+	unlink(SINK);
+	mkfifo(SINK, 0666);
+
+	if (opcao == NULL) { // só o ficheiro de configuração
+		args[1] = CONFIG;
+		args[2] = NULL;
+	}
+
+	*t = agora();
+	ctl = comum_controlador(args, RESPOSTAS, 1, &cmd);
+
+	/* O tee do sink só abre o FIFO depois de o nó ser criado */
+
+	sink = open(SINK, O_RDONLY);
+	p.fd = sink;
+	p.events = POLLIN;
+
+	while (recebidos < cadeias && poll(&p, 1, 30000) > 0) {
+		if ((r = read(sink, buf, sizeof(buf))) <= 0) break;
+		recebidos += conta_linhas(buf, r);
+	}
+
+	*t = agora() - *t;
+
+	/* O controlador só escreve as respostas quando termina, ao receber EOF */
+
+	close(cmd);
+	for (i = 0; i < 50 && waitpid(ctl, NULL, WNOHANG) == 0; i++) usleep(100000);
+
+	kill(-ctl, SIGKILL);
+	waitpid(ctl, NULL, 0);
+	close(sink);
+
+	printf("%-24s %9d %9.1f  ", opcao ? "aplicado de uma vez (-b)" :
+	       "linha a linha", recebidos, *t * 1e3);
+
+	f = fopen(RESPOSTAS, "r");
+	linha[0] = '\0';
+	while (f && fgets(linha, sizeof(linha), f) && strncmp(linha, "Rede pronta:", 12));
+	if (f) fclose(f);
+	printf("%s", strncmp(linha, "Rede pronta:", 12) ? "-\n" : linha + 13);
+
+	unlink(SINK);
+
+	return recebidos;
+}
+
+int main(int argc, char const *argv[]){
+
+	int nos = argc > 1 ? atoi(argv[1]) : 1000;
+	int cadeias = (nos - 2) / 3, i;
+	double t, tlote;
+	FILE* f;
+
+	if (comum_pronto(NULL) != 0) return 1;
+
+	if (cadeias < 1) cadeias = 1;
+
+	f = fopen(DADOS, "w");
+	fprintf(f, "1:5\n");
+	fclose(f);
+
+	/* Nós primeiro, ligações depois e o inject no fim (como no redeNotas) */
+
+	f = fopen(CONFIG, "w");
+	fprintf(f, "node f const s\nnode sink tee %s\n", SINK);
+	for (i = 0; i < cadeias; i++) {
+		fprintf(f, "node f%d filter 1 > 0\nnode w%d window 1 avg 2\n"
+		           "node c%d const %d\n", i, i, i, i);
+	}
+	for (i = 0; i < cadeias; i++) {
+		fprintf(f, "connect f f%d\nconnect f%d w%d\nconnect w%d c%d\n"
+		           "connect c%d sink\n", i, i, i, i, i, i);
+	}
+	fprintf(f, "inject f cat %s\n", DADOS);
+	fclose(f);
+
+	printf("%d nós (%d cadeias), um registo por cadeia, %ld CPUs\n",
+	       3 * cadeias + 2, cadeias, sysconf(_SC_NPROCESSORS_ONLN));
+	printf("%-24s %9s %9s  %s\n", "modo", "registos", "ms", "rede pronta (-b)");
+
+	if (corre(NULL, cadeias, &t) != cadeias) printf("linha a linha: faltam registos\n");
+	if (corre("-b", cadeias, &tlote) != cadeias) printf("-b: faltam registos\n");
+
+	printf("aceleração: %.2fx\n", t / tlote);
+
+	unlink(CONFIG);
+	unlink(DADOS);
+	unlink(RESPOSTAS);
+
+	return 0;
+}
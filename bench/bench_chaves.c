@@ -0,0 +1,104 @@
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "../window.h"
+
+/* Micro-benchmark das janelas por chave (window ... --by <coluna>, ver
+window.h): passa pelo operador R registos "<chave>:<valor>" com K chaves
+diferentes (por omissão 4M registos e 1M chaves, por uma ordem que espalha
+as chaves) e mede os registos por segundo e a memória por chave, para avg e
+max com janelas de 4 e 32 linhas. A memória é a reservada pelo operador
+(pool, tabela e zona das chaves) e o aumento do RSS do processo. Por fim
+repete com um limite de memória abaixo do necessário, para medir o custo de
+tirar as chaves que há mais tempo não aparecem.
+
+utilização: ./bench_chaves [registos] [chaves]
+*/
+
+double agora() {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+/* Memória residente do processo (bytes) */
+
+static long rss() {
+	long paginas = 0, residentes = 0;
+	FILE* f = fopen("/proc/self/statm", "r");
+
+	if (f == NULL) return 0;
+	if (fscanf(f, "%ld %ld", &paginas, &residentes) != 2) residentes = 0;
+	fclose(f);
+
+	return residentes * sysconf(_SC_PAGESIZE);
+}
+
+static char*  linhas;  // registos seguidos, separados por '\n'
+static size_t* inicio; // início de cada registo
+
+/*
+ * @brief Passa os registos pelo operador e mostra os resultados
+ */
+static void corre(const char* op, const char* janela, const char* mem, long r, long k) {
+	char const* args[] = { "window", "2", op, janela, "--by", "1", "--mem", mem };
+	const char* out;
+	long i, m0 = rss();
+	double t;
+	Window w = window_init(8, args);
+
+	t = agora();
+	for (i = 0; i < r; i++) {
+		window_process(w, linhas + inicio[i], inicio[i + 1] - inicio[i], &out);
+	}
+	t = agora() - t;
+
+	printf("%-4s %6s %6s %12.0f %10u %10lld %12.1f %12.1f\n", op, janela, mem,
+	       r / t, w->chaves->nchaves, w->chaves->saidas,
+	       (double) window_memoria(w) / w->chaves->nchaves,
+	       (double) (rss() - m0) / w->chaves->nchaves);
+
+	window_free(w);
+}
+
+int main(int argc, char const *argv[]){
+
+	long r = argc > 1 ? atol(argv[1]) : 4000000;
+	long k = argc > 2 ? atol(argv[2]) : 1000000;
+	long i, c;
+	size_t n = 0;
+
+	linhas = malloc(r * 32);
+	inicio = malloc(sizeof(size_t) * (r + 1));
+
+	/* A chave do registo i é (i * p) % k, com p primo: cada chave aparece
+	   r / k vezes, com as outras pelo meio */
+
+	srand(42);
+	for (i = 0; i < r; i++) {
+		c = (i * 1000003L) % k;
+		inicio[i] = n;
+		n += sprintf(linhas + n, "sensor%ld:%d\n", c, rand() % 10000 - 5000);
+	}
+	inicio[r] = n;
+
+	printf("%ld registos, %ld chaves\n", r, k);
+	printf("%-4s %6s %6s %12s %10s %10s %12s %12s\n", "op", "janela", "mem",
+	       "registos/s", "chaves", "saídas", "B/chave", "RSS B/chave");
+
+	corre("avg", "4", "1g", r, k);
+	corre("max", "4", "1g", r, k);
+	corre("avg", "32", "1g", r, k);
+	corre("max", "32", "1g", r, k);
+	corre("avg", "4", "32m", r, k);
+
+	free(linhas);
+	free(inicio);
+
+	return 0;
+}
@@ -0,0 +1,170 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <pthread.h>
+#include <signal.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "comum.h"
+
+/* Tempo que uma rede grande demora a terminar. Corre o ./controlador (é
+preciso fazer make antes) com a rede
+
+	f (const s) -> cadeias de 3 nós (filter -> window -> const) -> sink (tee)
+
+com cerca de 500 nós, criada de uma vez (-b), e injeta registos no nó f. Depois
+termina a rede de três maneiras:
+
+	remove            um remove por nó (como até aqui) e EOF no stdin
+	shutdown          todos os processos terminados de uma vez
+	shutdown --drain  os registos que estão na rede chegam ao sink
+
+Mede-se o tempo desde o comando até o controlador terminar e verifica-se se
+ficaram processos da rede ou FIFOs em ./tmp. Nos dois primeiros casos espera-se
+primeiro que os registos cheguem ao sink; com --drain, o shutdown é pedido logo
+a seguir ao inject e o sink tem de receber todos os registos.
+
+utilização: ./bench_encerra [nós] [registos]
+*/
+
+#define CONFIG "./tmp/bench_encerra.cfg"
+#define DADOS "./tmp/bench_encerra.txt"
+#define RESPOSTAS "./tmp/bench_encerra.out"
+#define SINK "./tmp/bench_encerra.fifo"
+
+/*
+ * @brief Conta (e apaga) os FIFOs dos nós que ficaram em ./tmp
+ */
+int fifos() {
+	DIR* d = opendir("./tmp");
+	struct dirent* e;
+	char nome[300];
+	size_t l;
+	int n = 0;
+
+	while (d && (e = readdir(d)) != NULL) {
+		l = strlen(e->d_name);
+		if (e->d_name[0] >= '0' && e->d_name[0] <= '9' &&
+		    ((l > 2 && !strcmp(e->d_name + l - 2, "in")) ||
+		     (l > 3 && !strcmp(e->d_name + l - 3, "out")))) {
+			snprintf(nome, sizeof(nome), "./tmp/%s", e->d_name);
+			unlink(nome);
+			n++;
+		}
+	}
+	if (d) closedir(d);
+
+	return n;
+}
+
+/*
+ * @brief Corre o controlador e termina a rede da maneira indicada
+ *
+ * @param modo    "remove", "shutdown" ou "shutdown --drain"
+ * @param nomes   Nomes dos nós (para os remove)
+ * @param nos     Número de nós
+ * @param esperado Registos que o sink tem de receber
+ */
+void corre(const char* modo, char** nomes, int nos, long esperado) {
+	struct sink s = { 0, 0 };
+	pthread_t th;
+	char* args[] = { "controlador", "-b", CONFIG, NULL };
+	int cmd, ctl, i, restos;
+	double t;
+
+	unlink(SINK);
+	mkfifo(SINK, 0666);
+
+	ctl = comum_controlador(args, RESPOSTAS, 1, &cmd);
+
+	s.fd = open(SINK, O_RDONLY);
+	pthread_create(&th, NULL, le_sink, &s);
+
+	dprintf(cmd, "inject f cat %s\n", DADOS);
+
+	if (strcmp(modo, "shutdown --drain")) {
+		for (i = 0; i < 3000 && s.recebidos < esperado; i++) usleep(10000);
+	}
+
+	t = agora();
+
+	if (strcmp(modo, "remove") == 0) {
+		for (i = 0; i < nos; i++) dprintf(cmd, "remove %s\n", nomes[i]);
+	}
+	else {
+		dprintf(cmd, "%s\n", modo);
+	}
+
+	close(cmd);
+	waitpid(ctl, NULL, 0);
+
+	t = agora() - t;
+
+	/* Processos da rede que ficaram (estão na sessão do controlador) */
+
+	restos = kill(-ctl, 0) == 0;
+	kill(-ctl, SIGKILL);
+
+	pthread_join(th, NULL);
+	close(s.fd);
+
+	printf("%-18s %9.1f %9ld %9ld %10s %6d\n", modo, t * 1e3, s.recebidos,
+	       esperado, restos ? "sim" : "não", fifos());
+
+	unlink(SINK);
+}
+
+int main(int argc, char const *argv[]){
+
+	int nos = argc > 1 ? atoi(argv[1]) : 500;
+	long registos = argc > 2 ? atol(argv[2]) : 2000;
+	int cadeias = (nos - 2) / 3, i, n = 0;
+	char** nomes;
+	char nome[32];
+	FILE* f;
+
+	if (comum_pronto(NULL) != 0) return 1;
+
+	if (cadeias < 1) cadeias = 1;
+
+	f = fopen(DADOS, "w");
+	for (i = 0; i < registos; i++) fprintf(f, "%d:5\n", i + 1);
+	fclose(f);
+
+	nomes = malloc(sizeof(char*) * (3 * cadeias + 2));
+	nomes[n++] = "f";
+
+	f = fopen(CONFIG, "w");
+	fprintf(f, "node f const s\nnode sink tee %s\n", SINK);
+	for (i = 0; i < cadeias; i++) {
+		fprintf(f, "node f%d filter 1 > 0\nnode w%d window 1 avg 2\n"
+		           "node c%d const %d\n", i, i, i, i);
+		fprintf(f, "connect f f%d\nconnect f%d w%d\nconnect w%d c%d\n"
+		           "connect c%d sink\n", i, i, i, i, i, i);
+		sprintf(nome, "f%d", i); nomes[n++] = strdup(nome);
+		sprintf(nome, "w%d", i); nomes[n++] = strdup(nome);
+		sprintf(nome, "c%d", i); nomes[n++] = strdup(nome);
+	}
+	nomes[n++] = "sink";
+	fclose(f);
+
+	printf("%d nós (%d cadeias), %ld registos injetados\n", n, cadeias, registos);
+	printf("%-18s %9s %9s %9s %10s %6s\n", "modo", "ms", "sink", "esperado",
+	       "processos", "FIFOs");
+
+	corre("remove", nomes, n, registos * cadeias);
+	corre("shutdown", nomes, n, registos * cadeias);
+	corre("shutdown --drain", nomes, n, registos * cadeias);
+
+	unlink(CONFIG);
+	unlink(DADOS);
+	unlink(RESPOSTAS);
+
+	return 0;
+}
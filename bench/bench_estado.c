@@ -0,0 +1,134 @@
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "../window.h"
+
+/* Custo de passar o estado de um window ao processo que o substitui (change
+de um window para outro window e checkpoint, ver window.h). Enche um window
+com R registos e compara o tempo de o guardar (window_guarda) e de o
+restaurar num window novo (window_restaura) com o tempo que o window novo
+levaria a reconstruir as mesmas janelas a partir do texto (voltar a processar
+as linhas que as encheram, o que também obrigaria a guardá-las). Corre com uma
+janela só (avg com R linhas) e com janelas por chave (--by, R / 16 chaves com
+16 linhas cada).
+
+utilização: ./bench_estado [registos]
+*/
+
+#define ESTADO "./tmp/bench_estado.bin"
+
+double agora() {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static char*  linhas;  // registos seguidos, separados por '\n'
+static size_t* inicio; // início de cada registo
+
+/*
+ * @brief Passa os registos pelo operador
+ *
+ * @return Segundos
+ */
+static double processa(Window w, long r) {
+	const char* out;
+	double t = agora();
+	long i;
+
+	for (i = 0; i < r; i++) {
+		window_process(w, linhas + inicio[i], inicio[i + 1] - inicio[i], &out);
+	}
+
+	return agora() - t;
+}
+
+/*
+ * @brief Enche um window, guarda-o, restaura-o num window novo e reconstrói-o
+ *        num terceiro a partir do texto, e mostra os tempos
+ */
+static void corre(const char* nome, int argc, char const* args[], long r) {
+	Window w = window_init(argc, args), n;
+	struct stat st;
+	double tg, tr, tt;
+	size_t nresto;
+	char* resto;
+	long janelas;
+
+	processa(w, r);
+
+	tg = agora();
+	if (window_guarda(w, ESTADO, NULL, 0) != 0) {
+		fprintf(stderr, "%s: não foi possível guardar o estado\n", nome);
+		window_free(w);
+		return;
+	}
+	tg = agora() - tg;
+	stat(ESTADO, &st);
+
+	n = window_init(argc, args);
+	tr = agora();
+	janelas = window_restaura(n, ESTADO, &resto, &nresto);
+	tr = agora() - tr;
+	free(resto);
+	window_free(n);
+
+	n = window_init(argc, args);
+	tt = processa(n, r);
+	window_free(n);
+
+	printf("%-16s %10ld %10.1f %10.1f %12.1f %12.1f %8.1f\n", nome, janelas,
+	       st.st_size / 1e6, tg * 1e3, tr * 1e3, tt * 1e3, tt / tr);
+
+	window_free(w);
+	unlink(ESTADO);
+}
+
+int main(int argc, char const *argv[]){
+
+	long r = argc > 1 ? atol(argv[1]) : 1000000;
+	long i;
+	size_t n = 0;
+	char linhasjanela[32], linhaschave[] = "16";
+
+	if (access("./tmp", W_OK) != 0) {
+		fprintf(stderr, "é preciso fazer make antes\n");
+		return 1;
+	}
+
+	linhas = malloc(r * 32);
+	inicio = malloc(sizeof(size_t) * (r + 1));
+
+	/* Registos "sensor<c>:<valor>" com r / 16 chaves (cada uma 16 vezes) */
+
+	srand(42);
+	for (i = 0; i < r; i++) {
+		inicio[i] = n;
+		n += sprintf(linhas + n, "sensor%ld:%d\n", (i * 1000003L) % (r / 16 > 0 ? r / 16 : 1),
+		             rand() % 10000 - 5000);
+	}
+	inicio[r] = n;
+
+	snprintf(linhasjanela, sizeof(linhasjanela), "%ld", r);
+
+	char const* unica[] = { "window", "2", "avg", linhasjanela };
+	char const* chaves[] = { "window", "2", "avg", linhaschave, "--by", "1", "--mem", "1g" };
+
+	printf("%ld registos\n", r);
+	printf("%-16s %10s %10s %10s %12s %12s %8s\n", "window", "janelas", "MB",
+	       "guarda ms", "restaura ms", "do texto ms", "ganho");
+
+	corre("avg (1 janela)", 4, unica, r);
+	corre("avg --by", 8, chaves, r);
+
+	free(linhas);
+	free(inicio);
+
+	return 0;
+}
@@ -0,0 +1,128 @@
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <time.h>
+
+#include "../fanout.h"
+
+/* Comparação do débito do fanout linha a linha (com uma escrita por linha,
+modo latency, e com escritas agrupadas, modo throughput) com o fanout por
+tee/splice, para 1, 4 e 16 saídas. Um processo produtor escreve as linhas num pipe e cada
+saída é lida (e descartada) por um processo consumidor.
+
+utilização: ./bench_fanout [linhas]
+*/
+
+double agora() {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+/*
+ * @brief Corre um fanout de 'linhas' linhas para 'numouts' saídas
+ *
+ * @param tee  1 para usar o fanout_tee
+ * @param modo Modo dos buffers de saída do fanout_linhas
+ *
+ * @return Tempo que o fanout demorou, em segundos
+ */
+double corre(int tee, int modo, long linhas, int numouts) {
+	int i, in[2], outs[numouts][2], fdos[numouts], binarios[numouts];
+	volatile int stop = 0;
+	char buf[PIPE_BUF];
+	long l, total = 0;
+	int status, erros = 0;
+	double t;
+
+	/* Total de bytes que cada consumidor deve receber */
+
+	for (l = 0; l < linhas; l++) {
+		total += snprintf(buf, PIPE_BUF, "aluno%ld:%ld:%ld:MEDIA\n", l, l % 20, l % 7);
+	}
+
+	pipe(in);
+
+	/* Produtor: blocos de linhas completas de até PIPE_BUF bytes */
+
+	if (fork() == 0) {
+		int n = 0;
+		close(in[0]);
+		for (l = 0; l < linhas; l++) {
+			if (n > PIPE_BUF - 64) { write(in[1], buf, n); n = 0; }
+			n += sprintf(buf + n, "aluno%ld:%ld:%ld:MEDIA\n", l, l % 20, l % 7);
+		}
+		write(in[1], buf, n);
+		_exit(0);
+	}
+	close(in[1]);
+
+	/* Consumidores */
+
+	for (i = 0; i < numouts; i++) {
+		pipe(outs[i]);
+		if (fork() == 0) {
+			for (l = 0; l < i; l++) close(fdos[l]);
+			long recebidos = 0, r;
+			close(outs[i][1]);
+			while ((r = read(outs[i][0], buf, PIPE_BUF)) > 0) recebidos += r;
+			_exit(recebidos != total);
+		}
+		close(outs[i][0]);
+		fdos[i] = outs[i][1];
+		binarios[i] = 0;
+	}
+
+	t = agora();
+
+	if (!tee || fanout_tee(in[0], fdos, binarios, numouts, &stop, &stats_nulo) == -1) {
+		fanout_linhas(in[0], fdos, binarios, numouts, &stop, modo, &stats_nulo);
+	}
+
+	for (i = 0; i < numouts; i++) close(fdos[i]);
+	while (wait(&status) > 0) {
+		if (!WIFEXITED(status) || WEXITSTATUS(status)) erros++;
+	}
+
+	t = agora() - t;
+
+	if (erros) printf("ERRO: %d saídas não receberam todos os dados\n", erros);
+
+	close(in[0]);
+	readln_reset(in[0]);
+
+	return t;
+}
+
+int main(int argc, char const *argv[]){
+
+	long linhas = argc > 1 ? atol(argv[1]) : 1000000;
+	int saidas[] = { 1, 4, 16 };
+	int i;
+	double tl, tb, tt, mb;
+
+	printf("%-7s %14s %14s %14s %8s\n", "saídas", "latency MB/s",
+	       "throughput MB/s", "tee MB/s", "tee/lat");
+
+	for (i = 0; i < 3; i++) {
+		tl = corre(0, OUTBUF_LATENCIA, linhas, saidas[i]);
+		tb = corre(0, OUTBUF_DEBITO, linhas, saidas[i]);
+		tt = corre(1, OUTBUF_DEBITO, linhas, saidas[i]);
+
+		/* Cada linha tem ~22 bytes; conta-se o volume total escrito */
+
+		mb = linhas * 22.0 * saidas[i] / 1e6;
+		printf("%-7d %14.1f %15.1f %14.1f %7.2fx\n", saidas[i],
+		       mb / tl, mb / tb, mb / tt, tl / tt);
+	}
+
+	return 0;
+}
@@ -0,0 +1,162 @@
+#include <sys/types.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../field.h"
+
+/* Micro-benchmark do tokenizador de colunas:
+compara, em linhas largas (60 colunas por omissão), o ciclo de sscanf antigo
+(percorre e copia todas as colunas), um ciclo de memchr a partir do início e
+o tokenizador do field.h (SWAR, pára na coluna pedida), a obter a coluna 2, a
+do meio e a última de cada linha. Depois compara a conversão dos valores
+(contadores de 64 bits, reais com 3 casas decimais e reais com expoente)
+pelo strtoll/strtod com o campos_converte.
+
+utilização: ./bench_field [linhas] [colunas]
+*/
+
+double agora() {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+/* Ciclo antigo do filter/window */
+static long antigo(char* linha, int coluna) {
+	char field[101];
+	char print[101] = "";
+	char* ptr = linha;
+	int s, cut = 0;
+
+	while (sscanf(ptr, "%100[^:]%n", field, &s) == 1) {
+		cut++;
+		if (cut == coluna) strcpy(print, field);
+		ptr += s;
+		if (*ptr != ':') break;
+		++ptr;
+	}
+
+	return atoi(print);
+}
+
+/* memchr de separador em separador */
+static long com_memchr(const char* linha, size_t len, int coluna) {
+	const char* p = linha;
+	const char* fim = linha + len;
+	const char* sep;
+	int i;
+
+	for (i = 1; i < coluna; i++) {
+		sep = memchr(p, ':', fim - p);
+		if (sep == NULL) return 0;
+		p = sep + 1;
+	}
+
+	sep = memchr(p, ':', fim - p);
+	return campos_atoi(p, (sep ? sep : fim) - p);
+}
+
+int main(int argc, char const *argv[]){
+
+	long linhas = argc > 1 ? atol(argv[1]) : 200000;
+	int colunas = argc > 2 ? atoi(argv[2]) : 60;
+	int pedidas[3] = { 2, colunas / 2, colunas };
+	long i, soma[3];
+	int j, k, v;
+	double t;
+	const char* campo;
+	size_t tam;
+	Campos c = campos_init(':');
+
+	/* Linhas de teste com colunas de 1 a 12 carateres */
+
+	char** dados = malloc(sizeof(char*) * linhas);
+	size_t* tams = malloc(sizeof(size_t) * linhas);
+	char linha[16 * 1024];
+
+	srand(7);
+	for (i = 0; i < linhas; i++) {
+		size_t n = 0;
+		for (j = 1; j <= colunas; j++) {
+			v = rand();
+			n += sprintf(linha + n, "%s%.*d", j > 1 ? ":" : "", 1 + v % 12, v % 1000);
+		}
+		dados[i] = strdup(linha);
+		tams[i] = n;
+	}
+
+	printf("%ld linhas de %d colunas (%.0f bytes por linha)\n", linhas, colunas,
+	       (double) (tams[0] + tams[linhas / 2]) / 2);
+	printf("%-8s %16s %16s %16s\n", "coluna", "sscanf linhas/s", "memchr linhas/s", "field.h linhas/s");
+
+	for (k = 0; k < 3; k++) {
+		int col = pedidas[k];
+
+		t = agora(); soma[0] = 0;
+		for (i = 0; i < linhas; i++) soma[0] += antigo(dados[i], col);
+		double t0 = agora() - t;
+
+		t = agora(); soma[1] = 0;
+		for (i = 0; i < linhas; i++) soma[1] += com_memchr(dados[i], tams[i], col);
+		double t1 = agora() - t;
+
+		t = agora(); soma[2] = 0;
+		for (i = 0; i < linhas; i++) {
+			campos_linha(c, dados[i], tams[i]);
+			campos_coluna(c, col, &campo, &tam);
+			soma[2] += campos_atoi(campo, tam);
+		}
+		double t2 = agora() - t;
+
+		printf("%-8d %16.0f %16.0f %16.0f%s\n", col, linhas / t0, linhas / t1, linhas / t2,
+		       soma[0] == soma[1] && soma[1] == soma[2] ? "" : "  (resultados diferentes!)");
+	}
+
+	/* Conversão dos valores (cada um com '\0', para o strtoll/strtod) */
+
+	const char* nomes[3] = { "int64", "real", "expoente" };
+	long n = linhas * 10, erros;
+	char* valores = malloc(n * 32);
+	long lv;
+	double rv, somar[2];
+
+	printf("\n%-8s %18s %18s\n", "valores", "strtod valores/s", "field.h valores/s");
+
+	for (k = 0; k < 3; k++) {
+		for (i = 0; i < n; i++) {
+			char* p = valores + i * 32;
+			v = rand();
+			if (k == 0) sprintf(p, "%lld", (long long) v * 1000003 * (v % 7 + 1));
+			else if (k == 1) sprintf(p, "%.3f", (v % 2000000) / 7.0 - 100000);
+			else sprintf(p, "%.6e", v / 3.0);
+		}
+
+		t = agora(); somar[0] = 0;
+		for (i = 0; i < n; i++) {
+			char* p = valores + i * 32;
+			somar[0] += k == 0 ? (double) strtoll(p, NULL, 10) : strtod(p, NULL);
+		}
+		double t0 = agora() - t;
+
+		t = agora(); somar[1] = 0;
+		for (i = 0; i < n; i++) {
+			char* p = valores + i * 32;
+			if (campos_converte(p, strlen(p), &lv, &rv) == CAMPOS_INT) somar[1] += lv;
+			else somar[1] += rv;
+		}
+		double t1 = agora() - t;
+
+		for (erros = i = 0; i < n; i++) { // resultados exatamente iguais
+			char* p = valores + i * 32;
+			int tipo = campos_converte(p, strlen(p), &lv, &rv);
+			erros += tipo == CAMPOS_INT ? lv != strtoll(p, NULL, 10) : rv != strtod(p, NULL);
+		}
+
+		printf("%-8s %18.0f %18.0f%s\n", nomes[k], n / t0, n / t1,
+		       erros == 0 ? "" : "  (resultados diferentes!)");
+	}
+
+	return 0;
+}
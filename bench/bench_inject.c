@@ -0,0 +1,245 @@
+#define _GNU_SOURCE // splice
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <pthread.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "../injeta.h"
+#include "comum.h"
+
+/* Débito e ritmo do inject de um ficheiro: inject <id> cat <ficheiro> contra
+injectfile <id> <ficheiro> [--rate R] (ver injeta.h).
+
+Primeiro, só o escritor: copia um ficheiro com cerca de MB megabytes de
+registos de 16 a 200 bytes para um pipe lido por outra thread, com read/write
+(o que o cat faz), com o injeta_ficheiro (splice) e com o injeta_ficheiro em
+blocos atómicos (nó com outros escritores), e mede o tempo e o CPU da thread
+que escreve.
+
+Depois, a rede: corre o ./controlador (é preciso fazer make antes) com a
+cadeia
+
+	f (const) -> sink (tee)
+
+injeta o mesmo ficheiro no nó f e mede o tempo até o último registo chegar ao sink e o tempo de CPU de todos os
+processos (controlador, inject, const e tee). Como o resto da rede é o mesmo
+nos dois casos, a diferença de CPU é a do inject. Depois injeta um décimo do
+ficheiro com o injectfile a um ritmo em registos/s e a um ritmo em bytes/s
+abaixo do débito máximo, e compara o ritmo medido com o pedido.
+
+utilização: ./bench_inject [MB]
+*/
+
+#define CONFIG "./tmp/bench_inject.cfg"
+#define DADOS "./tmp/bench_inject.txt"
+#define PARTE "./tmp/bench_inject_parte.txt"
+#define RESPOSTAS "./tmp/bench_inject.out"
+#define SINK "./tmp/bench_inject.fifo"
+
+/*
+ * @brief Corre o comando de inject no nó f
+ *
+ * @param inject Comando (e.g. "injectfile f ./tmp/x.txt --rate 10k")
+ * @param n      Registos injetados
+ * @param cpu    Fica com o tempo de CPU (s) da rede
+ *
+ * @return Segundos desde o inject até o sink ter todos os registos
+ */
+static int canal[2];
+
+/*
+ * @brief Lê o pipe até ao EOF (outra thread)
+ */
+void* le_canal(void* arg) {
+	char buf[65536];
+
+	(void) arg;
+	while (read(canal[0], buf, sizeof(buf)) > 0);
+
+	return NULL;
+}
+
+static double cpu_thread() {
+	struct rusage u;
+	getrusage(RUSAGE_THREAD, &u);
+	return u.ru_utime.tv_sec + u.ru_stime.tv_sec +
+	       (u.ru_utime.tv_usec + u.ru_stime.tv_usec) / 1e6;
+}
+
+/*
+ * @brief Copia DADOS para um pipe (0 read/write, 1 splice, 2 blocos atómicos)
+ *
+ * @param cpu Fica com o tempo de CPU (s) da thread que escreve
+ *
+ * @return Segundos até o leitor ter tudo
+ */
+double copia(int modo, double* cpu) {
+	char buf[131072];
+	pthread_t th;
+	Injecao inj;
+	ssize_t r;
+	double t, c;
+	int fd = open(DADOS, O_RDONLY);
+
+	memset(&inj, 0, sizeof(Injecao));
+	inj.atomico = modo == 2;
+
+	pipe(canal);
+	pthread_create(&th, NULL, le_canal, NULL);
+
+	t = agora();
+	c = cpu_thread();
+
+	if (modo == 0) {
+		while ((r = read(fd, buf, sizeof(buf))) > 0) write(canal[1], buf, r);
+	}
+	else injeta_ficheiro(fd, canal[1], &inj);
+
+	*cpu = cpu_thread() - c;
+	close(canal[1]);
+	pthread_join(th, NULL);
+	t = agora() - t;
+
+	close(canal[0]);
+	close(fd);
+
+	return t;
+}
+
+double corre(const char* inject, long n, double* cpu) {
+	struct sink s = { 0, 0 };
+	struct rusage u0, u1;
+	pthread_t th;
+	char* args[] = { "controlador", "-b", CONFIG, NULL };
+	int cmd, ctl;
+	double t;
+	FILE* f;
+
+	f = fopen(CONFIG, "w");
+	fprintf(f, "node f const x\nnode sink tee %s\nconnect f sink\n", SINK);
+	fclose(f);
+
+	unlink(SINK);
+	mkfifo(SINK, 0666);
+
+	getrusage(RUSAGE_CHILDREN, &u0);
+	ctl = comum_controlador(args, RESPOSTAS, 1, &cmd);
+
+	s.fd = open(SINK, O_RDONLY);
+	pthread_create(&th, NULL, le_sink, &s);
+
+	t = agora();
+	dprintf(cmd, "%s\nshutdown --drain\n", inject);
+	close(cmd);
+
+	pthread_join(th, NULL);
+	t = agora() - t;
+
+	waitpid(ctl, NULL, 0);
+	kill(-ctl, SIGKILL);
+
+	getrusage(RUSAGE_CHILDREN, &u1);
+	*cpu = u1.ru_utime.tv_sec - u0.ru_utime.tv_sec + u1.ru_stime.tv_sec -
+	       u0.ru_stime.tv_sec + (u1.ru_utime.tv_usec - u0.ru_utime.tv_usec +
+	       u1.ru_stime.tv_usec - u0.ru_stime.tv_usec) / 1e6;
+	close(s.fd);
+	unlink(SINK);
+
+	if (s.recebidos != n) {
+		fprintf(stderr, "\"%s\": o sink recebeu %ld de %ld registos\n",
+		        inject, s.recebidos, n);
+	}
+
+	return t;
+}
+
+int main(int argc, char const *argv[]){
+
+	double mb = argc > 1 ? atof(argv[1]) : 256;
+	long n, np, bytes = 0, bytesp = 0;
+	double tc, tf, t, ritmo, cc, cf, c;
+	char reg[256], inject[256];
+	int k;
+	FILE* f, *p;
+
+	if (comum_pronto(NULL) != 0) return 1;
+
+	/* Registos "<i>:aaa...a\n" de 16 a 200 bytes (a primeira décima parte
+	   também vai para PARTE) */
+
+	srand(42);
+	f = fopen(DADOS, "w");
+	p = fopen(PARTE, "w");
+	for (n = np = 0; bytes < mb * 1024 * 1024; n++) {
+		int t = 16 + rand() % 185;
+		k = sprintf(reg, "%ld:", n);
+		memset(reg + k, 'a', t - k - 1);
+		reg[t - 1] = '\n';
+		fwrite(reg, 1, t, f);
+		bytes += t;
+		if (bytesp < bytes / 10) {
+			fwrite(reg, 1, t, p);
+			bytesp += t;
+			np++;
+		}
+	}
+	fclose(f);
+	fclose(p);
+
+	printf("inject de %ld registos (%.0f MB)\n", n, bytes / 1e6);
+	printf("%-28s %12s %10s %10s\n", "escritor -> pipe", "reg/s", "MB/s", "CPU s");
+
+	const char* modos[] = { "read/write (cat)", "injectfile (splice)",
+	                        "injectfile (atómico)" };
+
+	for (k = 0; k < 3; k++) {
+		t = copia(k, &c);
+		printf("%-28s %12.0f %10.1f %10.3f\n", modos[k], n / t, bytes / t / 1e6, c);
+	}
+
+	printf("\n");
+	printf("%-28s %12s %10s %10s\n", "rede (const -> tee)", "reg/s", "MB/s", "CPU s");
+
+	/* A rede: o CPU é o de todos os processos */
+
+	snprintf(inject, sizeof(inject), "inject f cat %s", DADOS);
+	tc = corre(inject, n, &cc);
+	printf("%-28s %12.0f %10.1f %10.3f\n", "inject cat", n / tc, bytes / tc / 1e6, cc);
+
+	snprintf(inject, sizeof(inject), "injectfile f %s", DADOS);
+	tf = corre(inject, n, &cf);
+	printf("%-28s %12.0f %10.1f %10.3f\n", "injectfile", n / tf, bytes / tf / 1e6, cf);
+	printf("injectfile/cat: débito %.2f, CPU %.2f\n", tc / tf, cf / cc);
+
+	/* Ritmos: metade do débito máximo medido */
+
+	printf("\n%-28s %12s %12s %8s\n", "ritmo (1/10 do ficheiro)", "pedido",
+	       "medido", "erro %");
+
+	ritmo = n / tf / 2;
+	snprintf(inject, sizeof(inject), "injectfile f %s --rate %.0f", PARTE, ritmo);
+	t = corre(inject, np, &c);
+	printf("%-28s %12.0f %12.0f %8.2f\n", "registos/s", ritmo, np / t,
+	       100 * (np / t - ritmo) / ritmo);
+
+	ritmo = bytes / tf / 2;
+	snprintf(inject, sizeof(inject), "injectfile f %s --rate %.0fb", PARTE, ritmo);
+	t = corre(inject, np, &c);
+	printf("%-28s %12.0f %12.0f %8.2f\n", "bytes/s", ritmo, bytesp / t,
+	       100 * (bytesp / t - ritmo) / ritmo);
+
+	unlink(CONFIG);
+	unlink(DADOS);
+	unlink(PARTE);
+	unlink(RESPOSTAS);
+
+	return 0;
+}
@@ -0,0 +1,158 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <pthread.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "comum.h"
+
+/* Um destino lento num fanout, com cada política da ligação para ele
+(connect ... --cap <bytes> --overflow <política>, ver router.h). Corre o
+./controlador (é preciso fazer make antes) com
+
+	f (const) -> rapido (tee)
+	          -> lento (tee, lido a LENTO bytes/s)
+
+injeta no nó f R registos (por omissão 500k, que o sink lento lê antes do
+prazo do shutdown --drain) e mede o tempo até o último chegar ao sink rápido
+e quantos chegam ao sink lento até ao fim (o resto foi descartado). Com
+block, o destino lento atrasa o rápido; com as outras políticas, não.
+
+utilização: ./bench_politica [registos]
+*/
+
+#define CONFIG "./tmp/bench_politica.cfg"
+#define DADOS "./tmp/bench_politica.txt"
+#define RESPOSTAS "./tmp/bench_politica.out"
+#define RAPIDO "./tmp/bench_politica_rapido.fifo"
+#define LENTO_FIFO "./tmp/bench_politica_lento.fifo"
+
+#define LENTO (4 << 20) // bytes/s lidos pelo sink lento
+
+struct sink_ritmo {
+	int    fd;
+	int    lento;     // 1 se lê a LENTO bytes/s
+	long   recebidos;
+	long   esperados; // o sink rápido regista o tempo quando os tiver todos
+	double fim;
+};
+
+/*
+ * @brief Conta as linhas que chegam a um sink até ao EOF (o tee terminou)
+ */
+void* le_sink_ritmo(void* arg) {
+	struct sink_ritmo* s = arg;
+	struct timespec pausa = { 0, 1000000 }; // 1 ms
+	char buf[65536];
+	ssize_t r;
+	size_t n = s->lento ? LENTO / 1000 : sizeof(buf);
+
+	while ((r = read(s->fd, buf, n)) > 0) {
+		s->recebidos += conta_linhas(buf, r);
+		if (s->recebidos == s->esperados && s->fim == 0) s->fim = agora();
+		if (s->lento) nanosleep(&pausa, NULL);
+	}
+
+	return NULL;
+}
+
+/*
+ * @brief Corre a rede com a ligação para o sink lento com as opções dadas
+ *
+ * @param opcoes Opções do connect (e.g. "--cap 256k --overflow spill")
+ * @param n      Registos injetados
+ * @param lentos Fica com os registos que chegaram ao sink lento
+ * @param total  Fica com os segundos até o sink lento ter terminado
+ *
+ * @return Segundos desde o inject até o sink rápido ter todos os registos
+ */
+double corre(const char* opcoes, long n, long* lentos, double* total) {
+	struct sink_ritmo r = { 0, 0, 0, n, 0 }, l = { 0, 1, 0, -1, 0 };
+	pthread_t tr, tl;
+	char* args[] = { "controlador", "-b", CONFIG, NULL };
+	int cmd, ctl;
+	double t;
+	FILE* f;
+
+	f = fopen(CONFIG, "w");
+	fprintf(f, "node f const x\nnode rapido tee %s\nnode lento tee %s\n"
+	           "connect f rapido\nconnect f lento %s\n", RAPIDO, LENTO_FIFO, opcoes);
+	fclose(f);
+
+	unlink(RAPIDO);
+	unlink(LENTO_FIFO);
+	mkfifo(RAPIDO, 0666);
+	mkfifo(LENTO_FIFO, 0666);
+
+	ctl = comum_controlador(args, RESPOSTAS, 1, &cmd);
+
+	r.fd = open(RAPIDO, O_RDONLY);
+	l.fd = open(LENTO_FIFO, O_RDONLY);
+	pthread_create(&tr, NULL, le_sink_ritmo, &r);
+	pthread_create(&tl, NULL, le_sink_ritmo, &l);
+
+	t = agora();
+	dprintf(cmd, "injectfile f %s\nshutdown --drain\n", DADOS);
+	close(cmd);
+
+	pthread_join(tr, NULL);
+	pthread_join(tl, NULL);
+	*total = agora() - t;
+
+	waitpid(ctl, NULL, 0);
+	kill(-ctl, SIGKILL);
+	close(r.fd);
+	close(l.fd);
+	unlink(RAPIDO);
+	unlink(LENTO_FIFO);
+
+	if (r.recebidos != n) {
+		fprintf(stderr, "\"%s\": o sink rápido recebeu %ld de %ld registos\n",
+		        opcoes, r.recebidos, n);
+	}
+
+	*lentos = l.recebidos;
+
+	return (r.fim > 0 ? r.fim : agora()) - t;
+}
+
+int main(int argc, char const *argv[]){
+
+	long n = argc > 1 ? atol(argv[1]) : 500000;
+	const char* opcoes[] = { "", "--cap 256k --overflow drop-newest",
+	                         "--cap 256k --overflow drop-oldest",
+	                         "--cap 256k --overflow spill" };
+	const char* nomes[] = { "block", "drop-newest", "drop-oldest", "spill" };
+	long r, lentos;
+	double t, total;
+	int i;
+	FILE* f;
+
+	if (comum_pronto(NULL) != 0) return 1;
+
+	f = fopen(DADOS, "w");
+	for (r = 0; r < n; r++) fprintf(f, "%ld:aaaaaaaaaaaaaaaaaaaa\n", r);
+	fclose(f);
+
+	printf("destino lento (%d MB/s) num fanout, %ld registos\n", LENTO >> 20, n);
+	printf("%-12s %14s %12s %12s %14s\n", "política", "rápido reg/s",
+	       "rápido s", "lento reg", "lento fim s");
+
+	for (i = 0; i < (int) (sizeof(opcoes) / sizeof(char*)); i++) {
+		t = corre(opcoes[i], n, &lentos, &total);
+		printf("%-12s %14.0f %12.3f %12ld %14.3f\n", nomes[i], n / t, t, lentos,
+		       total);
+	}
+
+	unlink(CONFIG);
+	unlink(DADOS);
+	unlink(RESPOSTAS);
+
+	return 0;
+}
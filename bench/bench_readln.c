@@ -0,0 +1,99 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <time.h>
+
+#include "../readln.h"
+
+/* Micro-benchmark do leitor de linhas:
+compara a leitura caratere a caratere (implementação antiga) com o readln()
+com buffer e com o readln_view() sem cópias, sobre o mesmo ficheiro.
+
+utilização: ./bench_readln [linhas] [colunas]
+*/
+
+/* readln antigo: um read() por byte */
+ssize_t readln_byte(int fildes, void* buf, size_t nbyte) {
+	int i, n;
+
+	for (i = 0; i < nbyte - 1; i++) {
+		n = read(fildes, buf+i, 1);
+		if (n == -1) return -1;
+		if (n == 0) break;
+		if (((char*) buf)[i] == '\n') break;
+	}
+
+	((char*) buf)[i] = '\0';
+
+	return i;
+}
+
+double agora() {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+void resultado(const char* nome, long linhas, long bytes, double t) {
+	printf("%-14s %10.0f linhas/s %8.1f MB/s\n", nome, linhas / t,
+	       bytes / t / 1e6);
+}
+
+int main(int argc, char const *argv[]){
+
+	long linhas = argc > 1 ? atol(argv[1]) : 200000;
+	int colunas = argc > 2 ? atoi(argv[2]) : 4;
+	char path[] = "/tmp/bench_readlnXXXXXX";
+	char buffer[PIPE_BUF];
+	char* line;
+	long i, n, total;
+	int j, fd;
+	double t;
+
+	/* Gerar o ficheiro de teste */
+
+	fd = mkstemp(path);
+	FILE* f = fdopen(dup(fd), "w");
+	for (i = 0; i < linhas; i++) {
+		for (j = 0; j < colunas; j++) {
+			fprintf(f, "%s%ld", j ? ":" : "", (i * 31 + j) % 1000);
+		}
+		fputc('\n', f);
+	}
+	fclose(f);
+
+	/* Caratere a caratere (com um número de linhas menor, é muito lento) */
+
+	long poucas = linhas / 10 ? linhas / 10 : 1;
+	lseek(fd, 0, SEEK_SET);
+	t = agora(); total = 0;
+	for (i = 0; i < poucas && (n = readln_byte(fd, buffer, PIPE_BUF)) > 0; i++) {
+		total += n + 1;
+	}
+	resultado("readln antigo", i, total, agora() - t);
+
+	/* Com buffer, copiando a linha */
+
+	lseek(fd, 0, SEEK_SET);
+	readln_reset(fd);
+	t = agora(); total = 0;
+	for (i = 0; (n = readln(fd, buffer, PIPE_BUF)) > 0; i++) total += n + 1;
+	resultado("readln", i, total, agora() - t);
+
+	/* Vista sobre o buffer, sem cópias */
+
+	lseek(fd, 0, SEEK_SET);
+	readln_reset(fd);
+	t = agora(); total = 0;
+	for (i = 0; (n = readln_view(fd, &line)) > 0; i++) total += n;
+	resultado("readln_view", i, total, agora() - t);
+
+	unlink(path);
+
+	return 0;
+}
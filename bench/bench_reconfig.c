@@ -0,0 +1,218 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <pthread.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "comum.h"
+
+/* Reconfiguração contínua da rede com registos a passar. Corre o ./controlador
+(é preciso fazer make antes) com a rede
+
+	1 (const x) -> 2 (tee)                    sempre ligado
+	1 -> 3 (tee)                              liga/desliga
+	1 -> 4 (const y) -> 5 (tee)               liga/desliga, change do nó 4
+
+e, enquanto passam os registos numerados injetados no nó 1, vai alternando
+connect/disconnect 1 3, connect/disconnect 1 4 e change 4 a cada 0.2-1 ms.
+
+Verifica-se que o nó 2 recebe todos os registos, por ordem e sem duplicados,
+e que os nós 3 e 5 recebem registos inteiros e estritamente crescentes (sem
+duplicados nem linhas partidas). No fim mostra a latência das edições medida
+pelo router (comando stats). Corre também com um processo de fanout por ligação
+(-p) para comparação; se o nó 2 deixar de receber registos durante 5 s, faltam
+registos.
+
+utilização: ./bench_reconfig [registos]
+*/
+
+#define DADOS "./tmp/bench_reconfig.txt"
+#define CONFIG "./tmp/bench_reconfig.cfg"
+#define RESPOSTAS "./tmp/bench_reconfig.out"
+
+struct sink_ordem {
+	const char* fifo;
+	const char* sufixo;  // o que vem depois do número em cada registo
+	int todos;           // 1 se tem de receber todos os registos por ordem
+	int fd;
+	volatile long recebidos;
+	long erros;
+};
+
+/*
+ * @brief Lê e verifica os registos que chegam a um tee
+ */
+void* le_sink_ordem(void* arg) {
+	struct sink_ordem* s = arg;
+	char buf[65536], linha[256], *p;
+	long ultimo = -1, v;
+	size_t n = 0, suf = strlen(s->sufixo);
+	ssize_t r, j;
+
+	while ((r = read(s->fd, buf, sizeof(buf))) > 0) {
+		for (j = 0; j < r; j++) {
+			if (buf[j] != '\n') {
+				if (n < sizeof(linha) - 1) linha[n++] = buf[j];
+				continue;
+			}
+
+			linha[n] = '\0';
+			v = strtol(linha, &p, 10);
+
+			if (p == linha || strlen(p) != suf || strcmp(p, s->sufixo) ||
+			    v <= ultimo || (s->todos && v != ultimo + 1)) {
+				if (s->erros++ < 3) fprintf(stderr, "%s: \"%s\" depois de %ld\n",
+				                            s->fifo, linha, ultimo);
+			}
+
+			ultimo = v;
+			s->recebidos++;
+			n = 0;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * @brief Corre o controlador com a opção dada (ou nenhuma), reconfigurando a
+ *        rede até o nó 2 receber todos os registos
+ *
+ * @return 0 em caso de sucesso, -1 se houve registos perdidos ou errados
+ */
+int corre(const char* opcao, long registos) {
+	struct sink_ordem sinks[] = {
+		{ "./tmp/bench_reconfig2.fifo", ":x", 1 },
+		{ "./tmp/bench_reconfig3.fifo", ":x", 0 },
+		{ "./tmp/bench_reconfig5.fifo", ":x:y", 0 },
+	};
+	const char* edicao[] = { "connect 1 3", "disconnect 1 4", "disconnect 1 3",
+	                         "change 4 const y", "connect 1 4", "change 4 const y" };
+	pthread_t th[3];
+	char* args[] = { "controlador", (char*) opcao, CONFIG, NULL };
+	int cmd, ctl, i, estado = 0;
+	long edicoes = 0, antes = 0, erros = 0;
+	double t, progresso;
+	char linha[256];
+	FILE* f;
+
+	f = fopen(CONFIG, "w");
+	fprintf(f, "node 1 const x\nnode 2 tee %s\nnode 3 tee %s\nnode 4 const y\n"
+	           "node 5 tee %s\nconnect 1 2 4\nconnect 4 5\n",
+	        sinks[0].fifo, sinks[1].fifo, sinks[2].fifo);
+	fclose(f);
+
+	for (i = 0; i < 3; i++) {
+		unlink(sinks[i].fifo);
+		mkfifo(sinks[i].fifo, 0666);
+	}
+
+	if (opcao == NULL) { // só o ficheiro de configuração
+		args[1] = CONFIG;
+		args[2] = NULL;
+	}
+
+	ctl = comum_controlador(args, RESPOSTAS, 1, &cmd);
+	fcntl(cmd, F_SETFL, O_NONBLOCK);
+	signal(SIGPIPE, SIG_IGN);
+
+	/* Os tee só abrem os FIFOs depois de os nós serem criados */
+
+	for (i = 0; i < 3; i++) {
+		sinks[i].fd = open(sinks[i].fifo, O_RDONLY);
+		pthread_create(&th[i], NULL, le_sink_ordem, &sinks[i]);
+	}
+	sleep(1); // resto da configuração
+
+	t = progresso = agora();
+
+	dprintf(cmd, "inject 1 cat %s\n", DADOS);
+
+	while (sinks[0].recebidos < registos) {
+		/* Os comandos têm menos de PIPE_BUF bytes e o pipe é não bloqueante:
+		   ou são escritos inteiros ou não são escritos (o controlador ainda não
+		   leu os anteriores) */
+
+		if (dprintf(cmd, "%s\n", edicao[estado % 6]) > 0) {
+			estado++;
+			edicoes++;
+		}
+
+		usleep(200 + rand() % 800);
+
+		if (sinks[0].recebidos != antes) {
+			antes = sinks[0].recebidos;
+			progresso = agora();
+		}
+		else if (agora() - progresso > 5) {
+			break;
+		}
+	}
+
+	t = agora() - t;
+
+	/* O controlador só escreve as respostas (incluindo o stats) quando
+	   termina, ao receber EOF. Se estiver bloqueado, é terminado ao fim de
+	   5 s */
+
+	dprintf(cmd, "stats\n");
+	close(cmd);
+	for (i = 0; i < 50 && waitpid(ctl, NULL, WNOHANG) == 0; i++) usleep(100000);
+
+	kill(-ctl, SIGKILL);
+	waitpid(ctl, NULL, 0);
+
+	for (i = 0; i < 3; i++) {
+		pthread_join(th[i], NULL);
+		close(sinks[i].fd);
+		erros += sinks[i].erros;
+	}
+
+	printf("%-22s %9ld %9.0f %9ld %9ld %9ld %7ld  ", opcao ? "fanout por ligação (-p)" : "router",
+	       edicoes, edicoes / t, sinks[0].recebidos, sinks[1].recebidos,
+	       sinks[2].recebidos, erros);
+
+	f = fopen(RESPOSTAS, "r");
+	linha[0] = '\0';
+	while (f && fgets(linha, sizeof(linha), f) && strncmp(linha, "router:", 7));
+	if (f) fclose(f);
+	printf("%s", strncmp(linha, "router:", 7) ? "-\n" : linha + 8);
+
+	for (i = 0; i < 3; i++) unlink(sinks[i].fifo);
+
+	return sinks[0].recebidos == registos && erros == 0 ? 0 : -1;
+}
+
+int main(int argc, char const *argv[]){
+
+	long registos = argc > 1 ? atol(argv[1]) : 2000000;
+	long i;
+	FILE* f;
+
+	if (comum_pronto(NULL) != 0) return 1;
+
+	f = fopen(DADOS, "w");
+	for (i = 0; i < registos; i++) fprintf(f, "%ld\n", i);
+	fclose(f);
+
+	srand(7);
+
+	printf("%ld registos, reconfiguração a cada 0.2-1 ms\n", registos);
+	printf("%-22s %9s %9s %9s %9s %9s %7s  %s\n", "modo", "edições", "edições/s",
+	       "nó 2", "nó 3", "nó 5", "erros", "latência no router");
+
+	if (corre(NULL, registos) == -1) printf("router: registos perdidos ou errados\n");
+	if (corre("-p", registos) == -1) printf("-p: registos perdidos ou errados\n");
+
+	unlink(DADOS);
+	unlink(CONFIG);
+	unlink(RESPOSTAS);
+
+	return 0;
+}
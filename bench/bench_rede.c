@@ -0,0 +1,148 @@
+#include <sys/types.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../rede.h"
+
+/* Custo do registo da rede (rede.h) numa topologia gerada com dezenas de
+milhares de nós: nós com nomes (add), cada um ligado a alguns nós ao acaso
+(connect) e depois todos removidos por ordem aleatória (remove), com as
+ligações que chegam a cada nó encontradas pelo índice inverso.
+
+Para comparação, o remove do registo antigo (arrays indexados pelo ID, como
+se tivessem um lugar por nó): as ligações que chegam ao nó são procuradas
+percorrendo as saídas de todos os nós. Como isto é O(nós x grau) por remove,
+só se mede uma amostra de removes.
+
+Não inclui o custo dos processos, FIFOs e router, que é o mesmo nos dois
+casos.
+
+utilização: ./bench_rede [nós] [ligações por nó]
+*/
+
+#define AMOSTRA 200 // removes medidos no registo antigo
+
+typedef struct saidas {
+	int* outs;
+	int numouts;
+} Saidas;
+
+double agora() {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+/*
+ * @brief Tira um destino das saídas de um nó (como o disconnect)
+ */
+void tira(Saidas* s, int b) {
+	int i;
+
+	for (i = 0; i < s->numouts; i++) {
+		if (s->outs[i] == b) {
+			s->outs[i] = s->outs[--s->numouts];
+			return;
+		}
+	}
+}
+
+int main(int argc, char const *argv[]){
+
+	int nos = argc > 1 ? atoi(argv[1]) : 50000;
+	int grau = argc > 2 ? atoi(argv[2]) : 4;
+	int i, j, k, a, *ins, *ordem, *alvo;
+	long ligacoes = 0, encontradas = 0;
+	char nome[32];
+	double t, tadd, tcon, trem, tvelho;
+	Saidas* con;
+
+	if (nos > REDE_MAXNOS) nos = REDE_MAXNOS;
+
+	con = calloc(nos, sizeof(Saidas));
+	ordem = malloc(sizeof(int) * nos);
+	alvo = malloc(sizeof(int) * nos * grau);
+
+	srand(7);
+	for (i = 0; i < nos * grau; i++) alvo[i] = rand() % nos;
+	for (i = 0; i < nos; i++) ordem[i] = i;
+	for (i = nos - 1; i > 0; i--) {
+		j = rand() % (i + 1);
+		a = ordem[i]; ordem[i] = ordem[j]; ordem[j] = a;
+	}
+
+	/* add: nós com nomes (lugar i para o nó "no<i>") */
+
+	t = agora();
+	for (i = 0; i < nos; i++) {
+		sprintf(nome, "no%d", i);
+		rede_cria(nome);
+	}
+	tadd = agora() - t;
+
+	/* connect: cada nó (procurado pelo nome) ligado a grau nós ao acaso */
+
+	t = agora();
+	for (i = 0; i < nos; i++) {
+		sprintf(nome, "no%d", i);
+		a = rede_procura(nome);
+		con[a].outs = malloc(sizeof(int) * grau);
+		for (j = 0; j < grau; j++) {
+			sprintf(nome, "no%d", alvo[i * grau + j]);
+			con[a].outs[con[a].numouts++] = rede_procura(nome);
+			rede_entra(con[a].outs[j], a);
+			ligacoes++;
+		}
+	}
+	tcon = agora() - t;
+
+	/* remove no registo antigo: amostra, sem alterar a rede */
+
+	t = agora();
+	for (i = 0; i < AMOSTRA && i < nos; i++) {
+		a = ordem[i];
+		for (j = 0; j < nos; j++) {
+			for (k = 0; k < con[j].numouts; k++) {
+				if (con[j].outs[k] == a) { encontradas++; break; }
+			}
+		}
+	}
+	tvelho = (agora() - t) / (i > 0 ? i : 1);
+	encontradas /= i > 0 ? i : 1;
+
+	/* remove: saídas do nó, ligações que chegam a ele e o nome */
+
+	t = agora();
+	for (i = 0; i < nos; i++) {
+		sprintf(nome, "no%d", ordem[i]);
+		a = rede_procura(nome);
+
+		for (j = 0; j < con[a].numouts; j++) rede_sai(con[a].outs[j], a);
+		con[a].numouts = 0;
+
+		while (rede_entradas(a, &ins) > 0) {
+			tira(&con[ins[0]], a);
+			rede_sai(a, ins[0]);
+		}
+
+		rede_apaga(a);
+	}
+	trem = agora() - t;
+
+	printf("%d nós, %ld ligações\n", nos, ligacoes);
+	printf("%-28s %12s %12s\n", "operação", "ops/s", "µs/op");
+	printf("%-28s %12.0f %12.2f\n", "add", nos / tadd, tadd * 1e6 / nos);
+	printf("%-28s %12.0f %12.2f\n", "connect (por ligação)", ligacoes / tcon,
+	       tcon * 1e6 / ligacoes);
+	printf("%-28s %12.0f %12.2f\n", "remove (índice inverso)", nos / trem,
+	       trem * 1e6 / nos);
+	printf("%-28s %12.0f %12.2f\n", "remove (percorre a rede)", 1 / tvelho,
+	       tvelho * 1e6);
+	printf("ligações que chegam a cada nó (amostra): %ld\n", encontradas);
+	printf("todos os nós removidos: %s\n",
+	       rede_procura("no0") == -1 && rede_nlivres == nos ? "sim" : "não");
+
+	return 0;
+}
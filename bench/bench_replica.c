@@ -0,0 +1,124 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <pthread.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "comum.h"
+
+/* Débito de um nó pesado com réplicas (node <id> -p <N>[:<coluna>] [-o], ver
+replica.h). Corre o ./controlador (é preciso fazer make antes) com a cadeia
+
+	f (const) -> g (spawn true, com N réplicas) -> sink (tee)
+
+em que o spawn executa um comando por registo (o nó que satura), injeta no
+nó f R registos e mede o tempo até o último chegar ao sink, com 1, 2, 4 e 8
+réplicas, em round-robin, pelo hash da coluna 1 e com a ordem da entrada.
+O ganho depende dos núcleos disponíveis.
+
+utilização: ./bench_replica [registos]
+*/
+
+#define CONFIG "./tmp/bench_replica.cfg"
+#define DADOS "./tmp/bench_replica.txt"
+#define RESPOSTAS "./tmp/bench_replica.out"
+#define SINK "./tmp/bench_replica.fifo"
+
+/*
+ * @brief Corre a cadeia com os registos que estão em DADOS
+ *
+ * @param opcoes Opções do nó g (e.g. "-p 4:1 -o ")
+ * @param n      Registos injetados
+ *
+ * @return Segundos desde o inject até o sink ter todos os registos
+ */
+double corre(const char* opcoes, long n) {
+	struct sink s = { 0, 0 };
+	pthread_t th;
+	char* args[] = { "controlador", "-b", CONFIG, NULL };
+	int cmd, ctl;
+	double t;
+	FILE* f;
+
+	f = fopen(CONFIG, "w");
+	fprintf(f, "node f const x\nnode g %sspawn true\nnode sink tee %s\n"
+	           "connect f g\nconnect g sink\n", opcoes, SINK);
+	fclose(f);
+
+	unlink(SINK);
+	mkfifo(SINK, 0666);
+
+	ctl = comum_controlador(args, RESPOSTAS, 1, &cmd);
+
+	s.fd = open(SINK, O_RDONLY);
+	pthread_create(&th, NULL, le_sink, &s);
+
+	t = agora();
+	dprintf(cmd, "inject f cat %s\nshutdown --drain\n", DADOS);
+	close(cmd);
+
+	pthread_join(th, NULL);
+	t = agora() - t;
+
+	waitpid(ctl, NULL, 0);
+	kill(-ctl, SIGKILL);
+	close(s.fd);
+	unlink(SINK);
+
+	if (s.recebidos != n) {
+		fprintf(stderr, "\"%s\": o sink recebeu %ld de %ld registos\n",
+		        opcoes, s.recebidos, n);
+	}
+
+	return t;
+}
+
+int main(int argc, char const *argv[]){
+
+	long n = argc > 1 ? atol(argv[1]) : 5000;
+	int replicas[] = { 1, 2, 4, 8 };
+	const char* modos[] = { "", ":1", " -o" };
+	const char* nomes[] = { "round-robin", "hash", "ordem" };
+	int i, j;
+	long r;
+	double t, base = 0;
+	char opcoes[64];
+	FILE* f;
+
+	if (comum_pronto(NULL) != 0) return 1;
+
+	/* Registos "<chave>:<i>" com 64 chaves diferentes */
+
+	f = fopen(DADOS, "w");
+	for (r = 0; r < n; r++) fprintf(f, "k%ld:%ld\n", r % 64, r);
+	fclose(f);
+
+	printf("spawn true com réplicas, %ld registos, %ld núcleos\n", n,
+	       sysconf(_SC_NPROCESSORS_ONLN));
+	printf("%-12s %8s %12s %8s\n", "junção", "réplicas", "reg/s", "ganho");
+
+	for (j = 0; j < (int) (sizeof(modos) / sizeof(char*)); j++) {
+		for (i = 0; i < (int) (sizeof(replicas) / sizeof(int)); i++) {
+			if (replicas[i] == 1) opcoes[0] = '\0';
+			else snprintf(opcoes, sizeof(opcoes), "-p %d%s ", replicas[i], modos[j]);
+
+			t = corre(opcoes, n);
+			if (replicas[i] == 1) base = t;
+
+			printf("%-12s %8d %12.0f %8.2f\n", nomes[j], replicas[i], n / t,
+			       base / t);
+		}
+	}
+
+	unlink(CONFIG);
+	unlink(DADOS);
+	unlink(RESPOSTAS);
+
+	return 0;
+}
@@ -0,0 +1,199 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "comum.h"
+
+/* Trocas de contexto por milhão de registos com as ligações servidas pelo
+router (por omissão) e com um processo de fanout por ligação (-p). Corre o
+./controlador (é preciso fazer make antes) com uma cadeia de 4 componentes
+que acaba num tee para um FIFO lido aqui, mais pares de nós ligados mas
+parados (como numa topologia grande em que só parte da rede tem tráfego).
+
+As trocas de contexto (voluntárias e não voluntárias) são somadas em todas as
+threads de todos os processos da sessão do controlador, entre o inject e a
+chegada do último registo.
+
+utilização: ./bench_router [registos] [pares parados]
+*/
+
+#define DADOS "./tmp/bench_router.txt"
+#define CONFIG "./tmp/bench_router.cfg"
+#define SAIDA "./tmp/bench_router.fifo"
+
+/*
+ * @brief Soma as trocas de contexto das threads de um processo
+ */
+long long trocas_processo(const char* pid) {
+	char path[512], linha[256];
+	long long total = 0, v;
+	struct dirent* t;
+	DIR* d;
+	FILE* f;
+
+	sprintf(path, "/proc/%s/task", pid);
+	if ((d = opendir(path)) == NULL) return 0;
+
+	while ((t = readdir(d)) != NULL) {
+		if (t->d_name[0] == '.') continue;
+		sprintf(path, "/proc/%s/task/%s/status", pid, t->d_name);
+		if ((f = fopen(path, "r")) == NULL) continue;
+		while (fgets(linha, sizeof(linha), f)) {
+			if (sscanf(linha, "voluntary_ctxt_switches: %lld", &v) == 1 ||
+			    sscanf(linha, "nonvoluntary_ctxt_switches: %lld", &v) == 1) {
+				total += v;
+			}
+		}
+		fclose(f);
+	}
+
+	closedir(d);
+
+	return total;
+}
+
+/*
+ * @brief Soma as trocas de contexto de todos os processos de uma sessão
+ *
+ * @param procs Onde se coloca o número de processos da sessão
+ */
+long long trocas_sessao(int sid, int* procs) {
+	char path[512], stat[1024];
+	long long total = 0;
+	struct dirent* p;
+	char* fim;
+	int fd, n, s;
+	DIR* d = opendir("/proc");
+
+	*procs = 0;
+
+	while ((p = readdir(d)) != NULL) {
+		if (p->d_name[0] < '0' || p->d_name[0] > '9') continue;
+
+		sprintf(path, "/proc/%s/stat", p->d_name);
+		if ((fd = open(path, O_RDONLY)) == -1) continue;
+		n = read(fd, stat, sizeof(stat) - 1);
+		close(fd);
+		if (n <= 0) continue;
+		stat[n] = '\0';
+
+		/* Campos depois do nome (que pode ter espaços): estado, ppid, pgrp,
+		   sessão */
+
+		fim = strrchr(stat, ')');
+		if (fim == NULL || sscanf(fim + 2, "%*c %*d %*d %d", &s) != 1) continue;
+
+		if (s == sid) {
+			total += trocas_processo(p->d_name);
+			(*procs)++;
+		}
+	}
+
+	closedir(d);
+
+	return total;
+}
+
+/*
+ * @brief Corre o controlador com a opção dada (ou nenhuma) e mede
+ *
+ * @return 0 em caso de sucesso, -1 se não chegaram todos os registos
+ */
+int corre(const char* opcao, long registos, int parados) {
+	char* args[] = { "controlador", (char*) opcao, CONFIG, NULL };
+	int cmd, ctl, fd, procs, i;
+	long recebidas = 0;
+	long long t0, t1;
+	ssize_t r;
+	char buf[65536];
+	double t;
+	FILE* f;
+
+	unlink(SAIDA);
+	mkfifo(SAIDA, 0666);
+
+	f = fopen(CONFIG, "w");
+	fprintf(f, "node 1 filter 2 >= 0\nnode 2 window 3 sum 10\nnode 3 const 7\n"
+	           "node 4 filter 5 > -1\nnode 5 tee %s\n", SAIDA);
+	fprintf(f, "connect 1 2\nconnect 2 3\nconnect 3 4\nconnect 4 5\n");
+	for (i = 0; i < parados; i++) {
+		fprintf(f, "node %d const x\nnode %d const y\nconnect %d %d\n",
+		        100 + 2 * i, 101 + 2 * i, 100 + 2 * i, 101 + 2 * i);
+	}
+	fclose(f);
+
+	if (opcao == NULL) { // só o ficheiro de configuração
+		args[1] = CONFIG;
+		args[2] = NULL;
+	}
+
+	ctl = comum_controlador(args, "/dev/null", 1, &cmd);
+
+	/* O tee só abre o FIFO depois de o nó ser criado */
+
+	fd = open(SAIDA, O_RDONLY);
+	sleep(1); // resto da configuração
+
+	t0 = trocas_sessao(ctl, &procs);
+	t = agora();
+
+	dprintf(cmd, "inject 1 cat %s\n", DADOS);
+
+	while (recebidas < registos && (r = read(fd, buf, sizeof(buf))) > 0) {
+		recebidas += conta_linhas(buf, r);
+	}
+
+	t = agora() - t;
+	t1 = trocas_sessao(ctl, &procs);
+
+	kill(-ctl, SIGKILL);
+	waitpid(ctl, NULL, 0);
+	close(fd);
+	close(cmd);
+	usleep(200000); // os filhos da sessão também terminam
+
+	if (recebidas < registos) return -1;
+
+	printf("%-22s %9d %12.0f %18.0f\n", opcao ? "fanout por ligação (-p)" : "router",
+	       procs, registos / t, (t1 - t0) * 1e6 / registos);
+
+	return 0;
+}
+
+int main(int argc, char const *argv[]){
+
+	long registos = argc > 1 ? atol(argv[1]) : 1000000;
+	int parados = argc > 2 ? atoi(argv[2]) : 50;
+	long i;
+	FILE* f;
+
+	if (comum_pronto(NULL) != 0) return 1;
+
+	f = fopen(DADOS, "w");
+	for (i = 0; i < registos; i++) {
+		fprintf(f, "r%ld:%ld:%ld:%ld:%ld\n", i, i % 1000, i % 7, i % 13, i % 100);
+	}
+	fclose(f);
+
+	printf("%ld registos, cadeia de 4 componentes, %d ligações paradas\n",
+	       registos, parados);
+	printf("%-22s %9s %12s %18s\n", "modo", "processos", "registos/s",
+	       "trocas/M registos");
+
+	if (corre(NULL, registos, parados) == -1) printf("router: faltam registos\n");
+	if (corre("-p", registos, parados) == -1) printf("-p: faltam registos\n");
+
+	unlink(DADOS);
+	unlink(CONFIG);
+	unlink(SAIDA);
+
+	return 0;
+}
@@ -0,0 +1,105 @@
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <limits.h>
+#include <time.h>
+
+/* Comparação do débito do spawn a lançar um processo por linha (com -j 1 e
+-j 8) com o modo coprocesso (-c, com 1 e 64 linhas à espera de resposta).
+Corre o ./spawn (é preciso fazer make antes): um processo escreve as linhas no
+seu stdin e conta-se o tempo até chegarem todas as linhas de saída.
+
+utilização: ./bench_spawn [linhas fork] [linhas coprocesso]
+*/
+
+double agora() {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+/*
+ * @brief Corre o spawn com os argumentos dados sobre 'linhas' linhas
+ *
+ * @return Linhas por segundo (0 se não chegaram todas as linhas)
+ */
+double corre(char* args[], long linhas) {
+	int in[2], out[2], prod, sp;
+	long l, recebidas = 0;
+	ssize_t r, i;
+	char buf[PIPE_BUF];
+	double t;
+
+	pipe(in);
+	pipe(out);
+
+	/* Produtor: escreve as linhas e fica à espera (o spawn não pode receber
+	   EOF, porque nesse caso fica a ler em ciclo) */
+
+	if ((prod = fork()) == 0) {
+		int n = 0;
+		close(in[0]); close(out[0]); close(out[1]);
+		for (l = 0; l < linhas; l++) {
+			if (n > PIPE_BUF - 64) { write(in[1], buf, n); n = 0; }
+			n += sprintf(buf + n, "linha%ld:%ld:%ld\n", l, l % 20, l % 7);
+		}
+		write(in[1], buf, n);
+		pause();
+		_exit(0);
+	}
+
+	t = agora();
+
+	if ((sp = fork()) == 0) {
+		dup2(in[0], 0);
+		dup2(out[1], 1);
+		close(in[0]); close(in[1]); close(out[0]); close(out[1]);
+		execv("./spawn", args);
+		perror("exec ./spawn");
+		_exit(1);
+	}
+
+	close(in[0]); close(in[1]); close(out[1]);
+
+	while (recebidas < linhas && (r = read(out[0], buf, PIPE_BUF)) > 0) {
+		for (i = 0; i < r; i++) recebidas += buf[i] == '\n';
+	}
+
+	t = agora() - t;
+
+	kill(sp, SIGKILL);
+	kill(prod, SIGKILL);
+	waitpid(sp, NULL, 0);
+	waitpid(prod, NULL, 0);
+	close(out[0]);
+
+	return recebidas == linhas ? linhas / t : 0;
+}
+
+int main(int argc, char const *argv[]){
+
+	long lfork = argc > 1 ? atol(argv[1]) : 2000;
+	long lco = argc > 2 ? atol(argv[2]) : 200000;
+
+	char* fork1[] = { "spawn", "true", NULL };
+	char* fork8[] = { "spawn", "-j", "8", "true", NULL };
+	char* co1[]   = { "spawn", "-c", "cat", NULL };
+	char* co64[]  = { "spawn", "-c", "-j", "64", "cat", NULL };
+
+	double f1 = corre(fork1, lfork);
+	double f8 = corre(fork8, lfork);
+	double c1 = corre(co1, lco);
+	double c64 = corre(co64, lco);
+
+	printf("%-32s %12s %8s\n", "modo", "linhas/s", "ganho");
+	printf("%-32s %12.0f %7.2fx\n", "processo por linha (-j 1)", f1, 1.0);
+	printf("%-32s %12.0f %7.2fx\n", "processo por linha (-j 8)", f8, f8 / f1);
+	printf("%-32s %12.0f %7.2fx\n", "coprocesso (-c)", c1, c1 / f1);
+	printf("%-32s %12.0f %7.2fx\n", "coprocesso (-c -j 64)", c64, c64 / f1);
+
+	return 0;
+}
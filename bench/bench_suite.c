@@ -0,0 +1,487 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <pthread.h>
+#include <signal.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "comum.h"
+
+/* Débito e latência de redes inteiras, de forma reproduzível. Corre o
+./controlador (é preciso fazer make antes, e o bench/gera) com cada uma das
+topologias:
+
+	redeenunciado, redeNotas, redeListaUID   as redes de testes/
+	cadeia32                                 32 nós em série (filter/const)
+	leque16                                  um nó ligado a 16 sinks
+
+Nas redes de testes/ tiram-se os inject, os tee escrevem para FIFOs lidos por
+este programa, o spawn corre um cat em modo coprocesso (-c) em vez do comando
+original (o shutdown -n do redeenunciado) e os nós sem saídas que não são tee
+ficam ligados a um sink, para nenhum registo ficar parado. As fontes (nós sem
+ligações a chegar) recebem registos do bench/gera com uma coluna com o instante
+em que foram gerados.
+
+Para cada rede mede-se:
+
+	registos_s            registos injetados por segundo, com o gera a
+	                      escrever tão depressa quanto a rede aceita
+	cpu_us_registo        tempo de CPU (utilizador + sistema) dos processos
+	                      da rede (sem o gera) por registo injetado
+	latencia_us           p50/p99/máximo do gera até aos sinks, a um ritmo
+	                      fixo (-r), abaixo da saturação
+	latencia_saturada_us  o mesmo durante a medição do débito (inclui o tempo
+	                      nas filas)
+
+O resultado é escrito em JSON (-o, por omissão no stdout) com um resumo em
+texto no stderr. As opções depois de -- são passadas ao controlador (e.g.
+-- -e -j 4). As sementes do gera são fixas, por isso os registos são sempre os
+mesmos.
+
+utilização: ./bench_suite [-o ficheiro.json] [-n registos] [-r registos/s]
+                          [-- opções do controlador]
+*/
+
+#define CONFIG "./tmp/bench_suite.cfg"
+#define RESPOSTAS "./tmp/bench_suite.out"
+#define SINK "./tmp/bench_suite%d.fifo"
+#define COLUNAS 3        // colunas do gera (o instante é a seguinte)
+#define MAXSINKS 64
+#define MAXFONTES 64
+#define PARADO 500000000LL  // ns sem registos nos sinks para dar a fase por terminada
+#define PRAZO 60000000000LL // ns máximos por fase
+
+enum { FICHEIRO, CADEIA, LEQUE };
+
+typedef struct topologia {
+	const char* nome;
+	int         tipo;
+	const char* ficheiro; // FICHEIRO
+	int         n;        // CADEIA e LEQUE
+} Topologia;
+
+static Topologia topologias[] = {
+	{ "redeenunciado", FICHEIRO, "testes/redeenunciado.txt", 0 },
+	{ "redeNotas",     FICHEIRO, "testes/redeNotas.txt",     0 },
+	{ "redeListaUID",  FICHEIRO, "testes/redeListaUID.txt",  0 },
+	{ "cadeia32",      CADEIA,   NULL,                       32 },
+	{ "leque16",       LEQUE,    NULL,                       16 },
+};
+
+/* Latências (µs) recebidas numa fase */
+typedef struct amostra {
+	unsigned* lat;
+	long      n, cap;
+} Amostra;
+
+/* Estado partilhado com a thread que lê os sinks */
+static int sinkfd[MAXSINKS], nsinks;
+static Amostra amostras[2];
+static volatile int fase;
+static volatile long recebidos;
+static volatile long long ultimo; // instante do último registo recebido
+
+/*
+ * @brief Latência de uma linha que chegou a um sink, pela coluna do instante
+ */
+static void regista(const char* linha, long long t) {
+	Amostra* a = &amostras[fase];
+	const char* p = linha;
+	long long ts;
+	int i;
+
+	for (i = 0; i < COLUNAS && p != NULL; i++) {
+		p = strchr(p, ':');
+		if (p) p++;
+	}
+	if (p == NULL || (ts = atoll(p)) <= 0) return;
+
+	if (a->n == a->cap) {
+		a->cap = a->cap ? a->cap * 2 : 65536;
+		a->lat = realloc(a->lat, sizeof(unsigned) * a->cap);
+	}
+	a->lat[a->n++] = (t - ts) / 1000;
+}
+
+/*
+ * @brief Lê os sinks até todos terminarem (EOF), separando as linhas
+ */
+void* le_sinks(void* arg) {
+	struct pollfd p[MAXSINKS];
+	static char linha[MAXSINKS][4096];
+	int len[MAXSINKS] = { 0 }, abertos = nsinks, i;
+	char buf[65536];
+	long long t;
+	ssize_t r, k;
+
+	(void) arg;
+
+	for (i = 0; i < nsinks; i++) {
+		p[i].fd = sinkfd[i];
+		p[i].events = POLLIN;
+	}
+
+	while (abertos > 0 && poll(p, nsinks, -1) > 0) {
+		for (i = 0; i < nsinks; i++) {
+			if (p[i].fd < 0 || p[i].revents == 0) continue;
+
+			if ((r = read(p[i].fd, buf, sizeof(buf))) <= 0) {
+				p[i].fd = -1;
+				abertos--;
+				continue;
+			}
+
+			t = agora_ns();
+			for (k = 0; k < r; k++) {
+				if (buf[k] != '\n') {
+					if (len[i] < (int) sizeof(linha[i]) - 1) linha[i][len[i]++] = buf[k];
+					continue;
+				}
+				linha[i][len[i]] = '\0';
+				len[i] = 0;
+				regista(linha[i], t);
+				recebidos++;
+			}
+			ultimo = t;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * @brief Tempo de CPU (µs) dos processos da sessão do controlador, sem o gera
+ */
+double cpu_sessao(pid_t sid) {
+	DIR* d = opendir("/proc");
+	struct dirent* e;
+	char nome[300], buf[1024], *p;
+	unsigned long ut, st;
+	long sessao;
+	double total = 0;
+	FILE* f;
+
+	while (d && (e = readdir(d)) != NULL) {
+		if (e->d_name[0] < '0' || e->d_name[0] > '9') continue;
+
+		snprintf(nome, sizeof(nome), "/proc/%s/stat", e->d_name);
+		if ((f = fopen(nome, "r")) == NULL) continue;
+		if (fgets(buf, sizeof(buf), f) && (p = strrchr(buf, ')')) != NULL &&
+		    strstr(buf, "(gera)") == NULL &&
+		    sscanf(p + 2, "%*c %*d %*d %ld %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+		           &sessao, &ut, &st) == 3 && sessao == sid) {
+			total += (ut + st) * 1e6 / sysconf(_SC_CLK_TCK);
+		}
+		fclose(f);
+	}
+	if (d) closedir(d);
+
+	return total;
+}
+
+/*
+ * @brief Procura um nome numa lista (ou acrescenta-o)
+ *
+ * @return Índice do nome na lista
+ */
+int nome_indice(char nomes[][32], int* n, const char* nome) {
+	int i;
+
+	for (i = 0; i < *n; i++) if (!strcmp(nomes[i], nome)) return i;
+	snprintf(nomes[*n], 32, "%s", nome);
+	return (*n)++;
+}
+
+/*
+ * @brief Escreve o ficheiro de configuração de uma topologia
+ *
+ * @param fontes  Nomes dos nós que recebem os registos do gera
+ * @return Número de nós, ou -1 se o ficheiro da topologia não existir
+ */
+int escreve_config(Topologia* t, char fontes[][32], int* nfontes) {
+	char nomes[256][32], linha[1024], copia[1024], sink[64], *tok, *a, *cmd;
+	int entra[256] = { 0 }, sai[256] = { 0 }, tee[256] = { 0 };
+	int n = 0, i, k;
+	FILE *in, *f;
+
+	*nfontes = 0;
+	nsinks = 0;
+
+	if ((f = fopen(CONFIG, "w")) == NULL) return -1;
+
+	if (t->tipo == CADEIA) {
+		for (i = 1; i < t->n; i++) {
+			if (i % 2) fprintf(f, "node %d filter 2 >= 0\n", i);
+			else fprintf(f, "node %d const c%d\n", i, i);
+		}
+		sprintf(sink, SINK, nsinks++);
+		fprintf(f, "node %d tee %s\n", t->n, sink);
+		for (i = 1; i < t->n; i++) fprintf(f, "connect %d %d\n", i, i + 1);
+		strcpy(fontes[(*nfontes)++], "1");
+		fclose(f);
+		return t->n;
+	}
+
+	if (t->tipo == LEQUE) {
+		fprintf(f, "node 1 filter 2 >= 0\n");
+		for (i = 0; i < t->n; i++) {
+			sprintf(sink, SINK, nsinks++);
+			fprintf(f, "node %d tee %s\n", i + 2, sink);
+		}
+		fprintf(f, "connect 1");
+		for (i = 0; i < t->n; i++) fprintf(f, " %d", i + 2);
+		fprintf(f, "\n");
+		strcpy(fontes[(*nfontes)++], "1");
+		fclose(f);
+		return t->n + 1;
+	}
+
+	if ((in = fopen(t->ficheiro, "r")) == NULL) {
+		fclose(f);
+		return -1;
+	}
+
+	while (fgets(linha, sizeof(linha), in)) {
+		strcpy(copia, linha);
+		if ((tok = strtok(copia, " \t\n")) == NULL) continue;
+
+		if (!strcmp(tok, "node") && (a = strtok(NULL, " \t\n")) != NULL &&
+		    (cmd = strtok(NULL, " \t\n")) != NULL) {
+			k = nome_indice(nomes, &n, a);
+			if (!strcmp(cmd, "tee")) {
+				tee[k] = 1;
+				sprintf(sink, SINK, nsinks++);
+				fprintf(f, "node %s tee %s\n", a, sink);
+			}
+			else if (!strcmp(cmd, "spawn")) fprintf(f, "node %s spawn -c cat\n", a);
+			else fputs(linha, f);
+		}
+		else if (!strcmp(tok, "connect") && (a = strtok(NULL, " \t\n")) != NULL) {
+			sai[nome_indice(nomes, &n, a)] = 1;
+			while ((tok = strtok(NULL, " \t\n")) != NULL) entra[nome_indice(nomes, &n, tok)] = 1;
+			fputs(linha, f);
+		}
+	}
+	fclose(in);
+
+	/* Nós sem saídas que não são tee: ligados a um sink */
+
+	for (i = 0, k = n; i < k; i++) {
+		if (!sai[i] && !tee[i]) {
+			sprintf(sink, SINK, nsinks);
+			fprintf(f, "node sink%d tee %s\nconnect %s sink%d\n", nsinks, sink, nomes[i], nsinks);
+			nsinks++;
+			n++;
+		}
+		if (!entra[i]) strcpy(fontes[(*nfontes)++], nomes[i]);
+	}
+
+	fclose(f);
+	return n;
+}
+
+/*
+ * @brief Espera que os registos deixem de chegar aos sinks
+ *
+ * @return Instante do último registo recebido
+ */
+long long espera_fim(long long t0, long esperado) {
+	long long t;
+
+	while (1) {
+		usleep(10000);
+		t = agora_ns();
+		if (t - t0 > PRAZO) break;
+		if (recebidos >= esperado && ultimo > 0 && t - ultimo > PARADO) break;
+		if (recebidos < esperado && ultimo > 0 && t - ultimo > 4 * PARADO) break;
+	}
+
+	return ultimo;
+}
+
+int compara(const void* a, const void* b) {
+	unsigned x = *(const unsigned*) a, y = *(const unsigned*) b;
+	return x < y ? -1 : x > y;
+}
+
+/*
+ * @brief Escreve os percentis de uma amostra em JSON
+ */
+void percentis(FILE* f, const char* nome, Amostra* a) {
+	if (a->n == 0) {
+		fprintf(f, "\"%s\": null", nome);
+		return;
+	}
+	qsort(a->lat, a->n, sizeof(unsigned), compara);
+	fprintf(f, "\"%s\": {\"p50\": %u, \"p99\": %u, \"max\": %u}", nome,
+	        a->lat[a->n / 2], a->lat[(long) (a->n * 0.99)], a->lat[a->n - 1]);
+}
+
+/*
+ * @brief Corre o controlador com uma topologia e escreve o resultado em JSON
+ *
+ * @return 0 em caso de sucesso, -1 se a topologia não pôde ser medida
+ */
+int corre(Topologia* t, char** opcoes, int nopcoes, long registos, double taxa, FILE* json, int primeira) {
+	char fontes[MAXFONTES][32], sink[64];
+	char* args[64];
+	int cmd, ctl, nos, nfontes, i, n = 0;
+	long registos2, esperado;
+	long long t0, tfim;
+	double cpu0, cpu1, debito;
+	pthread_t th;
+
+	if ((nos = escreve_config(t, fontes, &nfontes)) == -1) {
+		fprintf(stderr, "%-14s ficheiro %s não encontrado\n", t->nome, t->ficheiro);
+		return -1;
+	}
+
+	for (i = 0; i < nsinks; i++) {
+		sprintf(sink, SINK, i);
+		unlink(sink);
+		mkfifo(sink, 0666);
+	}
+
+	args[n++] = "controlador";
+	for (i = 0; i < nopcoes && n < 60; i++) args[n++] = opcoes[i];
+	args[n++] = "-b";
+	args[n++] = CONFIG;
+	args[n] = NULL;
+
+	ctl = comum_controlador(args, RESPOSTAS, 1, &cmd);
+
+	/* Os tee só abrem os FIFOs depois de a rede ser criada */
+
+	for (i = 0; i < nsinks; i++) {
+		sprintf(sink, SINK, i);
+		sinkfd[i] = open(sink, O_RDONLY);
+	}
+
+	memset(amostras, 0, sizeof(amostras));
+	fase = 0;
+	recebidos = 0;
+	ultimo = 0;
+	pthread_create(&th, NULL, le_sinks, NULL);
+
+	/* Débito: registos tão depressa quanto a rede aceita */
+
+	cpu0 = cpu_sessao(ctl);
+	t0 = agora_ns();
+	for (i = 0; i < nfontes; i++) {
+		dprintf(cmd, "inject %s ./bench/gera -c %d -n %ld -s %d -t\n", fontes[i], COLUNAS, registos, i + 1);
+	}
+	tfim = espera_fim(t0, 1);
+	cpu1 = cpu_sessao(ctl);
+	debito = tfim > t0 ? registos * nfontes / ((tfim - t0) / 1e9) : 0;
+	esperado = recebidos;
+
+	/* Latência: ritmo fixo, abaixo da saturação, durante 2 s */
+
+	registos2 = taxa * 2 / nfontes;
+	fase = 1;
+	ultimo = 0;
+	recebidos = 0;
+	t0 = agora_ns();
+	for (i = 0; i < nfontes; i++) {
+		dprintf(cmd, "inject %s ./bench/gera -c %d -n %ld -r %.0f -s %d -t\n", fontes[i],
+		        COLUNAS, registos2, taxa / nfontes, i + 1);
+	}
+	espera_fim(t0, esperado * registos2 / (registos > 0 ? registos : 1));
+
+	dprintf(cmd, "shutdown\n");
+	close(cmd);
+	waitpid(ctl, NULL, 0);
+	kill(-ctl, SIGKILL);
+
+	pthread_join(th, NULL);
+	for (i = 0; i < nsinks; i++) {
+		close(sinkfd[i]);
+		sprintf(sink, SINK, i);
+		unlink(sink);
+	}
+
+	fprintf(json, "%s\n    {\"nome\": \"%s\", \"nos\": %d, \"fontes\": %d, \"sinks\": %d, "
+	        "\"registos_s\": %.0f, \"cpu_us_registo\": %.2f, \"saidas\": %ld,\n     ",
+	        primeira ? "" : ",", t->nome, nos, nfontes, nsinks, debito,
+	        (cpu1 - cpu0) / (registos * nfontes), esperado);
+	percentis(json, "latencia_us", &amostras[1]);
+	fprintf(json, ",\n     ");
+	percentis(json, "latencia_saturada_us", &amostras[0]);
+	fprintf(json, "}");
+
+	fprintf(stderr, "%-14s %5d %12.0f %10.2f %10ld", t->nome, nos, debito,
+	        (cpu1 - cpu0) / (registos * nfontes), esperado);
+	if (amostras[1].n > 0) {
+		fprintf(stderr, " %10u %10u %10u\n", amostras[1].lat[amostras[1].n / 2],
+		        amostras[1].lat[(long) (amostras[1].n * 0.99)], amostras[0].n > 0 ?
+		        amostras[0].lat[(long) (amostras[0].n * 0.99)] : 0);
+	}
+	else fprintf(stderr, " %10s %10s %10s\n", "-", "-", "-");
+
+	free(amostras[0].lat);
+	free(amostras[1].lat);
+
+	return 0;
+}
+
+int main(int argc, char* argv[]){
+
+	long registos = 200000;
+	double taxa = 10000;
+	char* saida = NULL;
+	char opcoes[256] = "";
+	int opt, i, primeira = 1;
+	FILE* json = stdout;
+
+	while ((opt = getopt(argc, argv, "o:n:r:")) != -1) {
+		if (opt == 'o') saida = optarg;
+		else if (opt == 'n') registos = atol(optarg);
+		else if (opt == 'r') taxa = atof(optarg);
+		else {
+			fprintf(stderr, "utilização: %s [-o ficheiro.json] [-n registos] [-r registos/s] "
+			        "[-- opções do controlador]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if (comum_pronto("./bench/gera") != 0) return 1;
+
+	if (saida && (json = fopen(saida, "w")) == NULL) {
+		perror(saida);
+		return 1;
+	}
+
+	for (i = optind; i < argc; i++) {
+		if (i > optind) strncat(opcoes, " ", sizeof(opcoes) - strlen(opcoes) - 1);
+		strncat(opcoes, argv[i], sizeof(opcoes) - strlen(opcoes) - 1);
+	}
+
+	fprintf(json, "{\"controlador\": \"%s\", \"registos\": %ld, \"taxa\": %.0f, \"cpus\": %ld,\n"
+	        " \"topologias\": [", opcoes, registos, taxa, sysconf(_SC_NPROCESSORS_ONLN));
+
+	fprintf(stderr, "%ld registos por fonte, latência a %.0f registos/s, controlador:%s%s\n",
+	        registos, taxa, opcoes[0] ? " " : " sem opções", opcoes);
+	fprintf(stderr, "%-14s %5s %12s %10s %10s %10s %10s %10s\n", "rede", "nós", "registos/s",
+	        "CPU µs/reg", "saídas", "p50 µs", "p99 µs", "p99 sat.");
+
+	for (i = 0; i < (int) (sizeof(topologias) / sizeof(Topologia)); i++) {
+		if (corre(&topologias[i], argv + optind, argc - optind, registos, taxa, json, primeira) == 0) {
+			primeira = 0;
+		}
+	}
+
+	fprintf(json, "\n ]}\n");
+	if (json != stdout) fclose(json);
+
+	unlink(CONFIG);
+	unlink(RESPOSTAS);
+
+	return 0;
+}
@@ -0,0 +1,179 @@
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../window.h"
+
+/* Micro-benchmark do operador window:
+compara a implementação antiga (desloca o array e percorre toda a janela em
+cada linha, O(linhas)) com a janela circular incremental, para tamanhos de
+janela de 10 a 10^7. Antes das medições confirma que ambas dão os mesmos
+resultados para janelas pequenas (incluindo o aquecimento do avg).
+Só se mede a atualização do agregado (sem a leitura da coluna).
+
+utilização: ./bench_window [linhas] [janela máxima]
+*/
+
+/* Implementação antiga (o array tem linhas+1 posições) */
+
+typedef struct antiga {
+	int op, linhas, first, res;
+	int* stored;
+} Antiga;
+
+static void antiga_init(Antiga* a, int op, int linhas) {
+	a->op = op;
+	a->linhas = linhas;
+	a->first = 0;
+	a->res = 0;
+	a->stored = calloc(linhas + 1, sizeof(int));
+}
+
+static int antiga_valor(Antiga* a, int v) {
+	int i, r = 0;
+
+	a->res = v;
+	for (i = a->linhas; i >= 1; i--) a->stored[i] = a->stored[i-1];
+	a->stored[0] = v;
+
+	switch (a->op) {
+		case W_AVG:
+			if (a->first == 0) { a->first++; r = 0; break; }
+			if (a->first == 1) { a->first++; r = a->stored[0]; break; }
+			if (a->first < a->linhas) {
+				for (i = 0; i < a->first; i++) r += a->stored[i];
+				r /= a->first;
+				a->first++;
+				break;
+			}
+			for (i = 0; i < a->linhas; i++) r += a->stored[i];
+			r /= a->linhas;
+			break;
+		case W_MAX:
+		case W_MIN:
+			if (a->first == 0) { a->first++; for (i = 0; i < a->linhas; i++) a->stored[i] = a->res; }
+			r = a->stored[0];
+			for (i = 1; i < a->linhas; i++) {
+				if (a->op == W_MAX ? r < a->stored[i] : r > a->stored[i]) r = a->stored[i];
+			}
+			break;
+		case W_SUM:
+			for (i = 0; i < a->linhas; i++) r += a->stored[i];
+			break;
+	}
+
+	return r;
+}
+
+static const char* nomes[] = { "", "avg", "max", "min", "sum" };
+
+double agora() {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+/* Linhas de teste "i:valor\n" (valores entre -5000 e 4999) */
+
+#define NTESTE 65536
+
+static char  linhas_teste[NTESTE][24];
+static int   tam_teste[NTESTE];
+static int   val_teste[NTESTE];
+
+static Window nova(int op, long linhas) {
+	char tam[24];
+	char const* args[] = { "window", "2", nomes[op], tam };
+
+	sprintf(tam, "%ld", linhas);
+	return window_init(4, args);
+}
+
+/* Confirma que as duas implementações dão os mesmos resultados */
+
+static int confere() {
+	int op, k, i, erros = 0;
+	const char* out;
+	ssize_t n;
+
+	for (op = W_AVG; op <= W_SUM; op++) {
+		for (k = 1; k <= 40; k++) {
+			Window w = nova(op, k);
+			Antiga a;
+			antiga_init(&a, op, k);
+
+			for (i = 0; i < 2000; i++) {
+				int esperado = antiga_valor(&a, val_teste[i]);
+				n = window_process(w, linhas_teste[i], tam_teste[i], &out);
+				long long obtido = atoll(memrchr(out, ':', n - 1) + 1);
+				if (obtido != esperado && erros++ < 5) {
+					printf("diferente: %s %d linha %d: %lld != %d\n",
+					       nomes[op], k, i, obtido, esperado);
+				}
+			}
+			free(a.stored);
+		}
+	}
+
+	return erros;
+}
+
+int main(int argc, char const *argv[]){
+
+	long total = argc > 1 ? atol(argv[1]) : 2000000;
+	long maxjanela = argc > 2 ? atol(argv[2]) : 10000000;
+	long janela, i, n;
+	int op;
+	double t;
+
+	srand(42);
+	for (i = 0; i < NTESTE; i++) {
+		val_teste[i] = rand() % 10000 - 5000;
+		tam_teste[i] = sprintf(linhas_teste[i], "%ld:%d\n", i, val_teste[i]);
+	}
+
+	if (confere() != 0) {
+		printf("os resultados não coincidem com a implementação antiga\n");
+		return 1;
+	}
+	printf("resultados iguais aos da implementação antiga (janelas 1..40)\n\n");
+
+	printf("%-4s %10s %16s %16s\n", "op", "janela", "antiga linhas/s", "nova linhas/s");
+
+	for (op = W_AVG; op <= W_SUM; op++) {
+		for (janela = 10; janela <= maxjanela; janela *= 10) {
+
+			/* A janela é preenchida pelo menos duas vezes */
+
+			n = total > 2 * janela ? total : 2 * janela;
+
+			Window w = nova(op, janela);
+			t = agora();
+			for (i = 0; i < n; i++) do_op(w, w->j, (Valor) { .i = val_teste[i % NTESTE] });
+			double nova_ls = n / (agora() - t);
+			window_free(w);
+
+			/* A antiga só até 10^5 e com menos linhas (é O(janela)) */
+
+			if (janela <= 100000) {
+				long m = 200000000 / janela;
+				if (m > n) m = n;
+				Antiga a;
+				antiga_init(&a, op, janela);
+				t = agora();
+				for (i = 0; i < m; i++) antiga_valor(&a, val_teste[i % NTESTE]);
+				double antiga_ls = m / (agora() - t);
+				free(a.stored);
+				printf("%-4s %10ld %16.0f %16.0f\n", nomes[op], janela, antiga_ls, nova_ls);
+			}
+			else {
+				printf("%-4s %10ld %16s %16.0f\n", nomes[op], janela, "-", nova_ls);
+			}
+		}
+	}
+
+	return 0;
+}
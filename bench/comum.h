@@ -0,0 +1,109 @@
+#ifndef COMUM_H
+#define COMUM_H
+
+#include <sys/types.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <time.h>
+
+/* Funções comuns aos benchmarks e aos testes que correm o controlador: o
+relógio, a verificação de que o make já foi feito, o arranque do controlador
+a ler os comandos de um pipe e a contagem das linhas que chegam a um sink (um
+FIFO escrito por um tee da rede). */
+
+struct sink {
+	int fd;
+	volatile long recebidos;
+};
+
+long long agora_ns() {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+double agora() {
+	return agora_ns() / 1e9;
+}
+
+/*
+ * @brief Verifica que o controlador (e o programa extra, se houver) já foram
+ *        compilados e que há ./tmp
+ *
+ * @param extra Outro executável necessário (e.g. "./bench/gera") ou NULL
+ *
+ * @return 0 se estiver tudo, -1 (com uma mensagem) se não estiver
+ */
+int comum_pronto(const char* extra) {
+	if (access("./controlador", X_OK) != 0 || access("./tmp", W_OK) != 0 ||
+	    (extra != NULL && access(extra, X_OK) != 0)) {
+		fprintf(stderr, "é preciso fazer make%s antes\n", extra ? " e make bench" : "");
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * @brief Lança o controlador a ler os comandos de um pipe
+ *
+ * @param args      Argumentos (args[0] é "controlador", terminados por NULL)
+ * @param respostas Ficheiro para onde vai o stdout do controlador
+ * @param sessao    1 para o controlador ficar numa sessão própria (para que a
+ *                  rede possa ser terminada com kill(-pid, ...))
+ * @param cmd       Onde se coloca o descritor onde se escrevem os comandos
+ *
+ * @return PID do controlador
+ */
+pid_t comum_controlador(char* const args[], const char* respostas, int sessao,
+                        int* cmd) {
+	int p[2], fd;
+	pid_t ctl;
+
+	pipe(p);
+
+	if ((ctl = fork()) == 0) {
+		if (sessao) setsid();
+		dup2(p[0], 0);
+		close(p[0]); close(p[1]);
+		fd = open(respostas, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		dup2(fd, 1);
+		close(fd);
+		execv("./controlador", args);
+		perror("exec ./controlador");
+		_exit(1);
+	}
+
+	close(p[0]);
+	*cmd = p[1];
+
+	return ctl;
+}
+
+/*
+ * @brief Número de linhas num bloco
+ */
+long conta_linhas(const char* buf, ssize_t n) {
+	long linhas = 0;
+	ssize_t i;
+
+	for (i = 0; i < n; i++) linhas += buf[i] == '\n';
+
+	return linhas;
+}
+
+/*
+ * @brief Conta as linhas que chegam ao sink até ao EOF (o tee terminou)
+ */
+void* le_sink(void* arg) {
+	struct sink* s = arg;
+	char buf[65536];
+	ssize_t r;
+
+	while ((r = read(s->fd, buf, sizeof(buf))) > 0) s->recebidos += conta_linhas(buf, r);
+
+	return NULL;
+}
+
+#endif
@@ -0,0 +1,194 @@
+#include <sys/types.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <math.h>
+#include <time.h>
+
+/* Gerador de registos sintéticos para os benchmarks (e para injetar numa rede
+com o inject). Escreve no stdout linhas com colunas numéricas separadas por
+':', com a distribuição de valores de cada coluna escolhida com -d:
+
+	seq             1, 2, 3, ...
+	uni:A:B         inteiros uniformes entre A e B
+	norm:M:D        normal de média M e desvio D (arredondada)
+	zipf:N:S        zipf entre 1 e N com expoente S (poucos valores muito
+	                frequentes, como chaves reais)
+	const:V         sempre V
+
+As distribuições são separadas por vírgulas, uma por coluna; a última repete-se
+nas colunas que faltarem. Com -t, cada linha leva mais uma coluna no fim com o
+instante em que foi escrita (ns, CLOCK_MONOTONIC), para medir a latência de
+ponta a ponta: os componentes só acrescentam colunas no fim, por isso essa
+coluna mantém a posição até à saída da rede.
+
+Com -r, as linhas são escritas ao ritmo pedido (registos/s), em lotes de 1 ms
+escritos de uma vez; sem -r, tão depressa quanto o destino as aceitar.
+
+utilização: ./gera [-c colunas] [-n registos] [-r registos/s] [-d dist,...]
+                   [-s semente] [-t]
+*/
+
+#define GERA_LOTE 1000000 // ns entre lotes (com -r)
+
+enum { SEQ, UNI, NORM, ZIPF, CONST };
+
+typedef struct dist {
+	int     tipo;
+	double  a, b;
+	double* cdf; // distribuição acumulada (zipf)
+	long    n;
+} Dist;
+
+/*
+ * @brief Lê uma distribuição (e.g. "uni:0:20")
+ *
+ * @return 0 em caso de sucesso, -1 se for inválida
+ */
+int dist_le(const char* s, Dist* d) {
+	long i;
+	double soma = 0;
+
+	memset(d, 0, sizeof(Dist));
+
+	if (!strcmp(s, "seq")) d->tipo = SEQ;
+	else if (sscanf(s, "uni:%lf:%lf", &d->a, &d->b) == 2) d->tipo = UNI;
+	else if (sscanf(s, "norm:%lf:%lf", &d->a, &d->b) == 2) d->tipo = NORM;
+	else if (sscanf(s, "const:%lf", &d->a) == 1) d->tipo = CONST;
+	else if (sscanf(s, "zipf:%lf:%lf", &d->a, &d->b) == 2 && d->a >= 1) {
+		d->tipo = ZIPF;
+		d->n = d->a;
+		d->cdf = malloc(sizeof(double) * d->n);
+		for (i = 0; i < d->n; i++) d->cdf[i] = soma += 1 / pow(i + 1, d->b);
+		for (i = 0; i < d->n; i++) d->cdf[i] /= soma;
+	}
+	else return -1;
+
+	return 0;
+}
+
+/*
+ * @brief Número aleatório em [0, 1) (xorshift64*, reprodutível pela semente)
+ */
+static unsigned long long gera_estado = 88172645463325252ULL;
+
+double aleatorio() {
+	gera_estado ^= gera_estado >> 12;
+	gera_estado ^= gera_estado << 25;
+	gera_estado ^= gera_estado >> 27;
+	return ((gera_estado * 2685821657736338717ULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/*
+ * @brief Valor seguinte de uma coluna
+ */
+long dist_valor(Dist* d, long seq) {
+	double u, v;
+	long ini, fim, meio;
+
+	switch (d->tipo) {
+	case SEQ:
+		return seq;
+	case UNI:
+		return d->a + (long) (aleatorio() * (d->b - d->a + 1));
+	case NORM: // Box-Muller
+		u = aleatorio();
+		v = aleatorio();
+		return lround(d->a + d->b * sqrt(-2 * log(1 - u)) * cos(2 * M_PI * v));
+	case ZIPF:
+		u = aleatorio();
+		for (ini = 0, fim = d->n - 1; ini < fim; ) {
+			meio = (ini + fim) / 2;
+			if (d->cdf[meio] < u) ini = meio + 1;
+			else fim = meio;
+		}
+		return ini + 1;
+	default:
+		return d->a;
+	}
+}
+
+long long agora_ns() {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+/*
+ * @brief Mostra a utilização
+ *
+ * @return 1
+ */
+int uso(const char* prog) {
+	fprintf(stderr, "utilização: %s [-c colunas] [-n registos] [-r registos/s] "
+	        "[-d dist,...] [-s semente] [-t]\n", prog);
+	return 1;
+}
+
+int main(int argc, char* argv[]){
+
+	int colunas = 3, tempo = 0, opt, i, k = 0;
+	long registos = 1000000, r = 0;
+	double taxa = 0;
+	char* dists = "seq,uni:0:20,uni:0:6000";
+	char* p;
+	long long t0, t, devidos;
+	struct timespec pausa = { 0, GERA_LOTE };
+	static char saida[1 << 16];
+	Dist d[64];
+
+	while ((opt = getopt(argc, argv, "c:n:r:d:s:t")) != -1) {
+		if (opt == 'c') colunas = atoi(optarg);
+		else if (opt == 'n') registos = atol(optarg);
+		else if (opt == 'r') taxa = atof(optarg);
+		else if (opt == 'd') dists = optarg;
+		else if (opt == 's') gera_estado ^= strtoull(optarg, NULL, 10) * 0x9E3779B97F4A7C15ULL;
+		else if (opt == 't') tempo = 1;
+		else return uso(argv[0]);
+	}
+
+	if (colunas < 1 || colunas > 64) { fprintf(stderr, "gera: 1 a 64 colunas\n"); return 1; }
+
+	/* Distribuições das colunas (a última repete-se) */
+
+	dists = strdup(dists);
+	for (p = strtok(dists, ","); p != NULL && k < colunas; p = strtok(NULL, ","), k++) {
+		if (dist_le(p, &d[k]) == -1) { fprintf(stderr, "gera: distribuição inválida: %s\n", p); return 1; }
+	}
+	if (k == 0) return uso(argv[0]); // -d sem distribuições (e.g. -d ',')
+	for (i = k; i < colunas; i++) d[i] = d[k - 1];
+
+	setvbuf(stdout, saida, _IOFBF, sizeof(saida));
+
+	t0 = agora_ns();
+
+	while (r < registos) {
+
+		/* Com -r, escrevem-se as linhas devidas até agora e espera-se pelo
+		   lote seguinte */
+
+		if (taxa > 0) {
+			devidos = (agora_ns() - t0) * taxa / 1e9;
+			if (r >= devidos) {
+				fflush(stdout);
+				nanosleep(&pausa, NULL);
+				continue;
+			}
+		}
+		else devidos = registos;
+
+		for (; r < registos && r < devidos; r++) {
+			t = tempo ? agora_ns() : 0;
+			for (i = 0; i < colunas; i++) {
+				printf(i == 0 ? "%ld" : ":%ld", dist_valor(&d[i], r + 1));
+			}
+			if (tempo) printf(":%lld", t);
+			putchar('\n');
+		}
+	}
+
+	fflush(stdout);
+
+	return 0;
+}
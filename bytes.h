@@ -0,0 +1,38 @@
+#ifndef BYTES_H
+#define BYTES_H
+
+#include <sys/types.h>
+#include <stdlib.h>
+
+/*
+ * Tamanhos em bytes escritos nas opções dos comandos (e.g. connect ... --cap,
+ * node ... -a e window ... --mem): um número com um sufixo k, m ou g opcional
+ * (potências de 1024), e.g. 512k, 64m ou 1.5g.
+ */
+
+/*
+ * @brief Converte um tamanho em bytes
+ *
+ * @param s   Tamanho (número com sufixo k, m ou g opcional)
+ * @param max Maior tamanho aceite
+ *
+ * @return Bytes ou 0 se for inválido (menos de 1 byte ou mais do que max)
+ */
+size_t bytes_converte(const char* s, size_t max) {
+    char* fim;
+    double v;
+
+    if (s == NULL) return 0;
+
+    v = strtod(s, &fim);
+
+    if (*fim == 'k' || *fim == 'K') { v *= 1024; fim++; }
+    else if (*fim == 'm' || *fim == 'M') { v *= 1024 * 1024; fim++; }
+    else if (*fim == 'g' || *fim == 'G') { v *= 1024 * 1024 * 1024; fim++; }
+
+    if (fim == s || *fim != '\0' || v < 1 || v > (double) max) return 0;
+
+    return (size_t) v;
+}
+
+#endif
@@ -8,32 +8,52 @@
 #include <limits.h>
 
 #include "readln.h"
+#include "const.h"
+#include "outbuf.h"
+#include "stats.h"
+#include "traco.h"
+#include "anel.h"
 
 /* Este programa reproduz as linhas acrescentando uma nova coluna sempre com o mesmo valor: 
 utilização ./a.out const
 input: a:b:c
 output: a:b:c:const
+Com -d <separador> as colunas são separadas por outro caratere que não ':'.
 */
 
 int main(int argc, char const *argv[]){
 
-	
+	Const c = const_init(argc, argv);
+	const char* print;
+	char* buffer;
+	ssize_t n, m;
+	Outbuf o = outbuf_init(1, outbuf_modo_env()); //escritas agrupadas (ver outbuf.h)
+	Stats s = stats_abre(); //contadores do nó (ver stats.h)
+	Carimbo tr = traco_abre(); //carimbos do traçado (ver traco.h)
 
-	char buffer[PIPE_BUF];
-	char print[PIPE_BUF];
+	if (c == NULL) { fprintf(stderr, "utilização: const [-d <separador>] <valor>\n"); return 1; }
 
-	int n;
+	o->stats = s;
 
-	while((n = readln(0,buffer,PIPE_BUF)) >= 0) {	
+	anel_componente(o); //anéis em vez dos FIFOs, se o nó os usar (ver anel.h)
+
+	while((n = stats_readln(s,0,&buffer)) > 0) {	
 		if(n!=0) {
 
-		sprintf(print,"%s:%s\n",buffer,argv[1]); //acrescentar resto :const
-		write(1,print,strlen(print)); //write stdout
+		if (readln_marca(buffer,n)) { outbuf_write(o,buffer,n); outbuf_idle(o,0); continue; } //marca de ordem das réplicas (ver replica.h)
+		if (traco_e(buffer,n)) { traco_entrada(&tr,buffer); continue; } //carimbo do registo seguinte
+
+		m = const_process(c, buffer, n, &print); //acrescentar resto :const
+		if (tr.ativo && traco_saida(&tr,m > 0)) outbuf_write(o,tr.buf,TRACO_TAM); //o carimbo vai à frente da saída
+		if (m > 0) outbuf_write(o,print,m); //write stdout
 				
 	   }
+	   outbuf_idle(o,0); //escreve o que estiver acumulado antes de esperar por input
 
 	}
 
-  return 0; //nunca aqui vai chegar, mas é menos um warning ao compilar
+  outbuf_flush(o); //fim do input (EOF): escrever o que estiver acumulado
+
+  return 0;
 
-}
\ No newline at end of file
+}
@@ -0,0 +1,86 @@
+#ifndef CONST_H
+#define CONST_H
+
+#include <sys/types.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "field.h"
+
+/*
+ * Operador const: reproduz as linhas acrescentando uma nova coluna sempre com
+ * o mesmo valor.
+ *
+ * Usado pelo programa const e pelo motor de execução do controlador.
+ */
+
+typedef struct constop {
+    const char* valor; // valor da coluna acrescentada
+    size_t      tam;   // tamanho do valor
+    char        delim; // separador das colunas
+    char*       out;   // buffer da linha de saída
+    size_t      cap;   // capacidade do buffer
+} *Const;
+
+/*
+ * @brief Cria o estado do operador a partir dos argumentos
+ *
+ *        e.g. const [-d <separador>] <valor>
+ *
+ * @return Estado do operador ou NULL se os argumentos forem inválidos
+ */
+Const const_init(int argc, char const* argv[]) {
+    Const c;
+    char delim;
+    int salta = campos_opcao(argc, argv, &delim);
+
+    argc -= salta;
+    argv += salta;
+
+    if (argc < 2) return NULL;
+
+    c = malloc(sizeof(struct constop));
+    c->delim = delim;
+    c->valor = argv[1];
+    c->tam = strlen(argv[1]);
+    c->cap = 256;
+    c->out = malloc(c->cap);
+
+    return c;
+}
+
+/*
+ * @brief Processa uma linha
+ *
+ * @param c    Estado do operador
+ * @param line Linha de entrada (com ou sem '\n' no fim)
+ * @param len  Tamanho da linha
+ * @param out  Onde se coloca o ponteiro para a linha de saída (válida até à
+ *             próxima chamada)
+ *
+ * @return Tamanho da linha de saída (com '\n') ou 0 se não houver saída
+ */
+ssize_t const_process(Const c, const char* line, size_t len, const char** out) {
+    size_t n;
+
+    if (len > 0 && line[len - 1] == '\n') len--;
+    if (len == 0) return 0; // linhas vazias são ignoradas
+
+    n = len + c->tam + 2;
+
+    if (n > c->cap) {
+        while (n > c->cap) c->cap *= 2;
+        c->out = realloc(c->out, c->cap);
+    }
+
+    memcpy(c->out, line, len);
+    c->out[len] = c->delim;
+    memcpy(c->out + len + 1, c->valor, c->tam); //acrescentar resto :const
+    c->out[n - 1] = '\n';
+
+    *out = c->out;
+
+    return n;
+}
+
+#endif
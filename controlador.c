@@ -1,3 +1,5 @@
+#define _GNU_SOURCE // tee, splice
+
 #include <stdio.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -7,12 +9,30 @@
 #include <limits.h> // PIPE_BUF
 #include <signal.h>
 #include <sys/wait.h>
+#include <errno.h>
+#include <glob.h>
 
 #include "readln.h"
+#include "fanout.h"
+#include "outbuf.h"
+#include "engine.h"
+#include "stats.h"
+#include "router.h"
+#include "traco.h"
+#include "rede.h"
+#include "anel.h"
+#include "replica.h"
+#include "injeta.h"
 
 #define MAX_SIZE   PIPE_BUF
 #define SMALL_SIZE 32
 
+#define PRAZO_DRENO 5000 // ms que o shutdown --drain espera por cada nível da
+                         // rede antes de terminar os processos com SIGKILL
+
+#define PRAZO_ESTADO 5000 // ms que o checkpoint e o change esperam que um
+                          // window guarde o seu estado
+
 
 /******************************************************************************
  *                           VARIÁVEIS GLOBAIS                                *
@@ -20,43 +40,121 @@
 
 int busy = 0; // indica se se está a processar um comando (main e interpretador)
 
-/* Estes arrays podiam ser apenas um */
-int nodes[MAX_SIZE];    // array que indica se nó existe na rede
-int nodespid[MAX_SIZE]; // array com os PIDs dos nós
+/* Estes arrays podiam ser apenas um. São indexados pelo lugar do nó no
+   registo da rede (ver rede.h), que também diz que nós existem */
+int nodespid[REDE_MAXNOS]; // array com os PIDs dos nós
+int nodesfd[REDE_MAXNOS];  // FIFO in de cada nó, mantido aberto pelo
+                           // controlador para que o nó não receba EOF quando
+                           // um fanout que lhe escreve é substituído
+int nodesmodo[REDE_MAXNOS]; // modo de escrita de cada nó (node <id> -m <modo>):
+                            // OUTBUF_DEBITO ou OUTBUF_LATENCIA (ver outbuf.h)
+int nodesexterno[REDE_MAXNOS]; // 1 se o componente é um comando externo (o
+                               // seu output é descartado)
+int nodesinterno[REDE_MAXNOS]; // 1 se o componente é const, filter ou window
+                               // (processo ou tarefa do motor), que aceita os
+                               // carimbos do traçado (ver traco.h)
+Anel nodesanel[REDE_MAXNOS][2]; // anéis de entrada e de saída de cada nó
+                                // (node <id> -a <capacidade>, ver anel.h), ou
+                                // NULL se o nó usa os FIFOs
+int nodesreplicas[REDE_MAXNOS][3]; // réplicas de cada nó (node <id> -p
+                                   // <N>[:<coluna>] [-o], ver replica.h):
+                                   // número (1 sem réplicas), coluna da chave
+                                   // e 1 se a junção mantém a ordem
+int nodesjanela[REDE_MAXNOS]; // 1 se o componente é um window sem réplicas
+                              // (processo ou tarefa do motor), que guarda o
+                              // seu estado a pedido (ver window.h)
+char* nodesrestauro[REDE_MAXNOS]; // ficheiro com o estado que o próximo
+                                  // processo do nó restaura (ou NULL)
+
+int* injetores = NULL; // PIDs dos processos dos injects que podem ainda estar
+int ninjetores = 0;    // a escrever (para o shutdown)
+int capinjetores = 0;
+int* injnos = NULL;    // nó em que escreve cada inject
+int* injciclos = NULL; // 1 se o inject é um injectfile --loop (não termina
+                       // sozinho)
+InjetaPartilha* injpartilha = NULL; // região partilhada com cada injectfile
+                                    // (NULL num inject), ver injeta.h
+
+volatile int stopfan = 0; // serve para parar o fanout (conexão entre os nós)
+                          // sem ser necessário fazê-lo abruptamente (i.e. com
+                          // SIGKILL)
+
+int fanprocessos = 0; // se for 1, cada ligação é servida por um processo de
+                      // fanout em vez do router (opções -p e -l do
+                      // controlador, ver router.h)
+
+int fanlinhas = 0; // se for 1, os fanouts copiam linha a linha em vez de usar
+                   // o tee (opção -l do controlador)
+
+int porlote = 0; // se for 1, os comandos node e connect do início do
+                 // ficheiro de configuração são aplicados de uma vez
+                 // (opção -b do controlador, ver aplica_config)
 
-int stopfan = 0; // serve para parar o fanout (conexão entre os nós) sem ser
-                 // necessário fazê-lo abruptamente (i.e. com SIGKILL)
+/*
+ * Última leitura dos contadores de cada nó (ver stats.h), feita pelo comando
+ * stats: as taxas são calculadas a partir da diferença para esta leitura
+ */
+struct stats_ant {
+    struct stats comp;
+    struct stats fanout;
+    long long quando; // ns (relógio monótono)
+} statsant[REDE_MAXNOS];
 
 /*
  * Estrutura que configura um fanout
  */
 typedef struct fanout {
-    int pid;     // pid do fanout
+    int pid;     // pid do fanout (0 se for servido pelo router ou pelo motor)
     int* outs;   // array de IDs dos nós do output
     int numouts; // número de nós de output
 } *Fanout;
 
+/*
+ * Opções de um comando node ou change (ver opcoes_node)
+ */
+typedef struct opcoes_no {
+    int modo;        // modo de escrita (-m): OUTBUF_DEBITO ou OUTBUF_LATENCIA
+    size_t anel;     // capacidade dos anéis (-a), 0 para usar os FIFOs
+    int replicas[3]; // réplicas (-p e -o), como em nodesreplicas
+    const char* estado; // ficheiro com o estado a restaurar (-r) ou NULL
+} OpcoesNo;
+
 /*
  * Vetor de fanouts que corresponde ao conjunto de todas as conexões entre nós
- * da rede. O índice deste array indica o ID do nó IN do fanout.
+ * da rede. O índice deste array indica o ID (lugar) do nó IN do fanout. As
+ * conexões que chegam a cada nó estão no índice inverso do registo (rede.h).
  * 
  * Se o fanout que tem o nó X como IN estiver ativo, a posição X do array é
  * diferente de NULL e tem uma struct do tipo fanout, corresponde à conexão
  * (fanout) que parte deste mesmo nó.
  */
-Fanout connections[MAX_SIZE];
+Fanout connections[REDE_MAXNOS];
+
+/*
+ * Capacidade e política de uma ligação (connect ... --cap <bytes> --overflow
+ * <política>, ver router.h)
+ */
+typedef struct limite {
+    int    destino;  // ID do nó OUT
+    size_t cap;      // capacidade (0 para a da omissão, ROUTER_FILA)
+    int    politica; // ROUTER_BLOQUEIA, ROUTER_DESCARTA_ANTIGOS, ...
+} Limite;
+
+Limite* nodeslimites[REDE_MAXNOS]; // ligações que partem de cada nó com
+int nodesnlimites[REDE_MAXNOS];    // capacidade ou política diferentes das da
+                                   // omissão (mantêm-se quando as ligações são
+                                   // refeitas, e.g. num change)
                               
 /*
  * @brief Inicializa as variáveis globais da rede
  *
- * Iniciliza os nós a 0 e as conexões a NULL.
+ * Iniciliza as conexões a NULL.
  */
 void init_network()
 {
     int i;
 
-    for (i = 0; i < MAX_SIZE; i++) {
-        nodes[i] = 0;
+    for (i = 0; i < REDE_MAXNOS; i++) {
         connections[i] = NULL;
     }
 }
@@ -66,7 +164,10 @@ void init_network()
  *
  * Esta função faz uma escrita de um caratere para o FIFO do nó cujo ID é
  * passado como parâmetro. Serve para desbloquear a leitura/escrita do FIFO e
- * permitir que este termine com sucesso.
+ * permitir que este termine com sucesso. Se o fanout já não estiver a ler
+ * (e.g. o window terminou depois de entregar o estado num change e o fanout
+ * recebeu EOF) ou se o FIFO estiver cheio (o fanout não está à espera de
+ * input), não há nada a desbloquear.
  *
  * @param n ID do nó cujo FIFO se pretende desbloquear
  *
@@ -77,8 +178,10 @@ void desbloqueia(int n)
     char fifo[SMALL_SIZE];
 
     sprintf(fifo, "./tmp/%dout", n);
-    fd = open(fifo, O_WRONLY);
-    write(fd, "-", 1);
+    fd = open(fifo, O_WRONLY | O_NONBLOCK);
+    if (fd == -1) return; // ENXIO: ninguém a ler
+    write(fd, "-\n", 2);
+    close(fd); // senão o próximo fanout do nó nunca recebia EOF
 }
 
 
@@ -124,12 +227,28 @@ void stop_fanout()
     stopfan = 1;
 }
 
+/*
+ * @brief Indica se um nó aceita registos binários à entrada: com o traçado,
+ *        os componentes internos recebem os carimbos (ver traco.h)
+ *
+ * Os registos binários (ver readln.h) não são entregues aos nós que
+ * não os aceitam.
+ */
+int aceita_binario(int n)
+{
+    return traco_regiao != NULL && nodesinterno[n];
+}
+
 /*
  * @brief Executa um fanout
  *
  * Definimos como fanout uma função que recebe um input e repete o que conseguir
  * ler desse input para um ou mais outputs recebidos como parâmetro.
  *
+ * Por omissão a cópia é feita dentro do kernel (fanout_tee); caso o tee não
+ * seja suportado, ou o controlador tenha sido invocado com -l, é feita linha a
+ * linha (fanout_linhas). Ver fanout.h.
+ *
  * Quando se quiser matar um fanout, é recebido um SIGUSR1 que coloca a variável
  * global stopfan a 1, fazendo parar o ciclo de escrita nas saídas. Com isto,
  * evita-se matar o processo abruptamente (i.e. com recurso ao SIGKILL) e
@@ -141,8 +260,8 @@ void stop_fanout()
  */
 void fanout(int input, int outputs[], int numouts)
 {
-    int i, fdi, fdos[numouts], bytes;
-    char in[SMALL_SIZE], out[SMALL_SIZE], buffer[MAX_SIZE], aux[SMALL_SIZE];
+    int i, fdi, fdos[numouts], binarios[numouts];
+    char in[SMALL_SIZE], out[SMALL_SIZE], aux[SMALL_SIZE];
 
     signal(SIGUSR1, stop_fanout);
 
@@ -154,6 +273,8 @@ void fanout(int input, int outputs[], int numouts)
     
     if (fdi == -1) perror("open fifo in fanout");
 
+    readln_reset(fdi); // o descritor pode ter sido usado pelo controlador
+
     /* Abrir FIFOs de saída */
 
     for (i = 0; i < numouts; i++) {
@@ -161,84 +282,252 @@ void fanout(int input, int outputs[], int numouts)
         sprintf(out, "./tmp/%sin", aux);
 	    fdos[i] = open(out, O_WRONLY);
 	    if (fdos[i] == -1) perror("open fifo out fanout");
+        binarios[i] = aceita_binario(outputs[i]);
+    }
+
+    /* Com o traçado, os carimbos são vistos registo a registo (ver traco.h) */
+
+    if (traco_regiao != NULL) {
+        fanout_origem = input;
+        fanout_destinos = outputs;
     }
     
     /* Escrever nos FIFOs de saída */
-    
-    while (!stopfan && (bytes = readln(fdi, buffer, PIPE_BUF)) > 0) {
-        if (strcmp(buffer, "-")) { // ignora a escrita da função desbloqueia
-            for (i = 0; i < numouts; i++) {
-                    write(fdos[i], buffer, bytes);
-            }   
-        }
+
+    if (fanlinhas || traco_regiao != NULL ||
+        fanout_tee(fdi, fdos, binarios, numouts, &stopfan, stats_no(input, 1)) == -1) {
+        fanout_linhas(fdi, fdos, binarios, numouts, &stopfan, nodesmodo[input],
+                      stats_no(input, 1));
     }
     
     _exit(0); //quando recebe o signal para fazer stop e saí do ciclo
 }
 
 
-/******************************************************************************
- *                        COMANDOS DO CONTROLADOR                             *
- ******************************************************************************/
+/*
+ * @brief Define a capacidade e a política da ligação de um nó para outro (as
+ *        da omissão tiram a ligação da lista)
+ *
+ * @param n        ID do nó IN
+ * @param destino  ID do nó OUT
+ * @param cap      Capacidade (0 para a da omissão)
+ * @param politica Política (ver router.h)
+ */
+void limite_define(int n, int destino, size_t cap, int politica)
+{
+    int i;
+
+    for (i = 0; i < nodesnlimites[n] && nodeslimites[n][i].destino != destino; i++);
+
+    if (cap == 0 && politica == ROUTER_BLOQUEIA) {
+        if (i < nodesnlimites[n]) nodeslimites[n][i] = nodeslimites[n][--nodesnlimites[n]];
+        return;
+    }
+
+    if (i == nodesnlimites[n]) {
+        nodeslimites[n] = realloc(nodeslimites[n], sizeof(Limite) * (i + 1));
+        nodesnlimites[n]++;
+    }
+
+    nodeslimites[n][i].destino = destino;
+    nodeslimites[n][i].cap = cap;
+    nodeslimites[n][i].politica = politica;
+}
 
 /*
- * @brief Comando que adiciona um nó à rede
+ * @brief Capacidade e política da ligação de um nó para outro
+ */
+Limite limite_procura(int n, int destino)
+{
+    Limite l = { destino, 0, ROUTER_BLOQUEIA };
+    int i;
+
+    for (i = 0; i < nodesnlimites[n]; i++) {
+        if (nodeslimites[n][i].destino == destino) return nodeslimites[n][i];
+    }
+
+    return l;
+}
+
+/*
+ * @brief Aumenta o FIFO de entrada de um nó (F_SETPIPE_SZ) para a capacidade
+ *        de uma ligação que chega a ele, até ao máximo do sistema
+ *        (/proc/sys/fs/pipe-max-size). O FIFO nunca diminui.
+ */
+void aumenta_fifo(int n, size_t cap)
+{
+    static long maximo = 0;
+    FILE* f;
+
+    if (cap == 0 || engine_has(n) || nodesanel[n][0] != NULL) return;
+
+    if (maximo == 0) {
+        f = fopen("/proc/sys/fs/pipe-max-size", "r");
+        if (f == NULL || fscanf(f, "%ld", &maximo) != 1) maximo = 1 << 20;
+        if (f != NULL) fclose(f);
+    }
+
+    if (cap > (size_t) maximo) cap = maximo;
+
+    if (fcntl(nodesfd[n], F_GETPIPE_SZ) < (long) cap) {
+        fcntl(nodesfd[n], F_SETPIPE_SZ, (int) cap);
+    }
+}
+
+/*
+ * @brief Avisa os injectfile que escrevem num nó de que ele vai ter outro
+ *        escritor (uma ligação ou outro inject), antes de este começar: os
+ *        injects passam a blocos atómicos (ver injeta_avisa)
+ */
+void avisa_injetores(int n)
+{
+    int i;
+
+    for (i = 0; i < ninjetores; i++) {
+        if (injnos[i] != n || injpartilha[i] == NULL || injetores[i] <= 0) continue;
+
+        if (injeta_avisa(injpartilha[i], injetores[i],
+                         stats_agora() + PRAZO_DRENO * 1000000LL) == -1) {
+            fprintf(stderr, "inject %d: o bloco em curso não terminou a tempo\n",
+                    injetores[i]);
+        }
+    }
+}
+
+/*
+ * @brief Substitui a conexão (fanout) que parte de um nó
  *
- *        e.g. node <id> <cmd> <args...>
+ * Por omissão as ligações são servidas pelo router (router.h): os destinos
+ * da rota do nó são substituídos diretamente, sem processos. Se o nó for uma
+ * tarefa do motor de execução, são as saídas da tarefa que são substituídas.
  *
- * Primeiro, esta função verifica se o nó já existe na rede (se não existir dá
- * erro). Depois cria um processo filho para executar o componente/filtro, bem
- * como dois FIFOs (pipes com nome) de entrada e saida de dados no nó. Os nomes
- * destes pipes são "Xin" e "Xout" em que X é o ID do nó.
+ * Com fanouts em processos (opções -p e -l), caso exista uma conexão a partir
+ * do nó, o seu processo é terminado (deixando terminar qualquer escrita que
+ * esteja a ser feita). Depois, se houver OUTS, é criado um novo fanout para
+ * eles. Em todos os casos, a conexão é registada na lista global e no índice
+ * inverso (rede.h).
  *
- * Por fim, adiciona o nó criado à rede.
+ * Cada ligação leva a sua capacidade e política (limite_procura) para o
+ * router, e a capacidade aumenta também o FIFO de entrada do OUT.
  *
- * @param options Array com os campos do comando (secções separadas por espaço)
- * @param flag    Flag que indica se o output do nó deverá ser descartado
+ * @param n       ID do nó IN
+ * @param outs    Array com os IDs dos nós do output
+ * @param numouts Número de nós do output (0 para terminar a conexão)
  *
  * @return 0 em caso de sucesso
  *         1 em caso de erro
- *         2 caso já exista o nó na rede
  */
-int add_node(char** options, int flag)
+int set_fanout(int n, int* outs, int numouts)
 {
-    int n;
+    int i, pid = 0, qs[numouts > 0 ? numouts : 1];
+    int politicas[numouts > 0 ? numouts : 1];
+    size_t caps[numouts > 0 ? numouts : 1];
+    Limite l;
 
-    /* Verificar se o nó já existe na rede */
+    for (i = 0; i < numouts; i++) {
+        avisa_injetores(outs[i]); // antes de a ligação começar a escrever
+        qs[i] = aceita_binario(outs[i]);
+        traco_aresta(n, outs[i], 1); // histograma da ligação (traçado)
+
+        l = limite_procura(n, outs[i]);
+        caps[i] = l.cap;
+        politicas[i] = l.politica;
+        aumenta_fifo(outs[i], l.cap);
+    }
 
-    n = atoi(options[1]);
-    
-    if (nodes[n] != 0) {
-        return 2;
+    if (engine_has(n)) {
+        engine_connect(n, outs, numouts);
+    }
+    else if (router_ativo()) {
+        if (router_liga(n, outs, qs, caps, politicas, numouts,
+                        stats_no(n, 1)) != 0) return 1;
+    }
+    else if (connections[n] != NULL) {
+        kill(connections[n]->pid, SIGUSR1);
+        desbloqueia(n);
+        waitpid(connections[n]->pid, NULL, 0);
     }
 
-    /* Criar filho para correr o componente */
+    if (connections[n] != NULL) {
+        for (i = 0; i < connections[n]->numouts; i++) {
+            rede_sai(connections[n]->outs[i], n);
+        }
+        free(connections[n]->outs);
+        free(connections[n]);
+        connections[n] = NULL;
+    }
+
+    if (numouts == 0) return 0;
+
+    if (!engine_has(n) && !router_ativo()) {
+        pid = fork();
+
+        if (pid == -1) { perror("fork fanout"); return 1; }
+
+        if (pid == 0) {
+            /* O fanout não fica com os FIFOs in dos outros nós (abertos pelo
+               controlador), para que recebam EOF quando os seus escritores
+               terminam (shutdown --drain) */
+
+            for (i = 0; i < rede_fim(); i++) {
+                if (rede_nome(i) != NULL && !engine_has(i)) close(nodesfd[i]);
+            }
+
+            fanout(n, outs, numouts);
+        }
+    }
+
+    connections[n] = create_fanout(pid, outs, numouts);
+
+    for (i = 0; i < numouts; i++) rede_entra(outs[i], n);
+
+    return 0;
+}
+
+
+/******************************************************************************
+ *                        COMANDOS DO CONTROLADOR                             *
+ ******************************************************************************/
 
+/*
+ * @brief Cria o processo que corre o componente de um nó
+ *
+ * O componente lê do FIFO "Xin" e escreve no FIFO "Xout" (ou no /dev/null,
+ * se for um comando externo), que já têm de existir.
+ *
+ * @param n       ID do nó
+ * @param options Array com os campos do comando (options[2] é o componente)
+ * @param flag    Flag que indica se o componente é um comando externo
+ */
+void lanca_no(int n, char** options, int flag)
+{
     nodespid[n] = fork();
     
     if (nodespid[n] == -1) perror("fork no node");
     
     if (nodespid[n] == 0) {
 
-        char in[SMALL_SIZE], out[SMALL_SIZE];
         int fdi, fdo;
+        char in[SMALL_SIZE], out[SMALL_SIZE];
+        
+        /* Abrir o FIFO in e o FIFO out (ou o /dev/null) */
 
-        /* Criar FIFO in */
-
-        sprintf(in, "./tmp/%sin", options[1]); // string com o nome do FIFO
-        mkfifo(in, 0666);
+        sprintf(in, "./tmp/%din", n);
+        if (flag == 0) sprintf(out, "./tmp/%dout", n);
+        else strcpy(out, "/dev/null");
 
-        /* Caso não seja para descartar o output, cria-se o FIFO out */
+        /* Com anéis, o componente não lê nem escreve nos descritores 0 e 1
+           (recebe os anéis nas variáveis de ambiente) */
 
-        if (flag == 0) {
-            sprintf(out, "./tmp/%sout", options[1]); // string com o nome do FIFO
-            mkfifo(out, 0666);
-        }
-        else { /* Caso seja para descartar o output, deve-se usar o /dev/null */
+        if (nodesanel[n][0] != NULL) {
+            char env[SMALL_SIZE];
+            anel_herda(nodesanel[n][0], env, sizeof(env));
+            setenv(ANEL_ENV_ENTRADA, env, 1);
+            anel_herda(nodesanel[n][1], env, sizeof(env));
+            setenv(ANEL_ENV_SAIDA, env, 1);
+            strcpy(in, "/dev/null");
             strcpy(out, "/dev/null");
         }
-        
-        /* Abrir o FIFO in e o FIFO out (ou o /dev/null) */
 
         fdi = open(in, O_RDONLY);
         fdo = open(out, O_WRONLY);
@@ -250,451 +539,1525 @@ int add_node(char** options, int flag)
         dup2(fdo, 1);
         close(fdo);
         
+        /* Modo de escrita do componente (lido pelo outbuf.h) */
+
+        setenv(OUTBUF_ENV, outbuf_nome(nodesmodo[n]), 1);
+
+        /* Contadores do nó (lidos pelo stats.h) */
+
+        if (stats_regiao != NULL) {
+            char lugar[SMALL_SIZE];
+            sprintf(lugar, "%d", n);
+            setenv(STATS_ENV, STATS_FICHEIRO, 1);
+            setenv(STATS_ENV_NO, lugar, 1);
+        }
+
+        /* Histogramas do traçado (lidos pelo traco.h) */
+
+        if (traco_regiao != NULL) setenv(TRACO_ENV, TRACO_FICHEIRO, 1);
+
+        /* Estado a restaurar (lido pelo window) */
+
+        if (nodesrestauro[n] != NULL) setenv(WINDOW_ESTADO_ENV, nodesrestauro[n], 1);
+
         /* Adicionar "./" ao nome do componente e executá-lo */
 
+        char cmd[SMALL_SIZE];
+
         if (!flag) {
-            char cmd[SMALL_SIZE];
             sprintf(cmd, "./%s", options[2]);
             options[2] = cmd;
         }
 
+        /* Com réplicas, o processo do nó não executa o componente: lança as
+           réplicas e fica a repartir e a juntar os registos (ver replica.h) */
+
+        if (nodesreplicas[n][0] > 1) {
+            replica_fecha_herdados();
+            readln_reset(0); // o descritor foi usado pelo controlador
+            _exit(replica_corre(&options[2], nodesreplicas[n][0],
+                                nodesreplicas[n][1], nodesreplicas[n][2],
+                                nodesinterno[n]));
+        }
+
 		execvp(options[2], &options[2]);
+        perror("exec node");
+        _exit(1);
     }
 
-    /* Acrescentar o nó à rede */
-
-    nodes[n] = 1;
-    
-    return 0;
+    free(nodesrestauro[n]); // só o primeiro processo restaura o estado
+    nodesrestauro[n] = NULL;
 }
 
 /*
- * @brief Comando que faz a conexão entre dois ou mais nós da rede
- *
- *        e.g. connect <id> <ids...>
- * 
- * Primeiro verifica se já existia uma conexão cujo IN seja igual ao recebido em
- * options. Em caso afirmativo, guarda os IDs dos nós do output dessa conexão e
- * mata a conexão. Deixando terminar qualquer escrita que esteja a ser feita.
- * 
- * Em todos os casos (caso existisse ou não uma conexão anterior), são
- * adicionados os nós de output recebidos (em options) e é criada uma nova
- * conexão que liga os nós recebidos (mais os nós pré-existentes, caso seja esse
- * o caso).
+ * @brief Capacidade dos anéis que um nó vai de facto usar: só os componentes
+ *        internos que correm como processos (sem réplicas), com o router,
+ *        trocam registos por anéis
  *
- * @param options    Array com campos do comando (secções separadas por espaço)
- * @param numoptions Tamanho do array com os campos do comando (options)
+ * @param options Array com os campos do comando
+ * @param flag    Flag que indica se o output do nó é descartado
+ * @param op      Opções do nó (a capacidade pedida é 0 sem a opção -a)
  *
- * @return 0 em caso de sucesso
- *         1 em caso de erro 
+ * @return Capacidade ou 0 se o nó usa os FIFOs
  */
-int connect(char** options, int numoptions)
+size_t transporte_anel(char** options, int flag, OpcoesNo* op)
 {
-    int i, j = 0, n, pid, numouts;
-    Fanout f;
-
-    n = atoi(options[1]); // ID do nó IN recebido (em options)
-
-    numouts = numoptions - 2; // número de OUTS recebido corresponde ao tamanho
-                              // de options (numoptions), subtraido de 2:
-                              // "connect" (options[0]) e "<nó IN>" (options[1])
-
-    int outs[numouts]; // array que conterá os IDs dos OUTS da nova conexão
-
-    /* Caso já exista uma conexão a partir do IN recebido (em options) */
-
-    if (connections[n] != NULL) {
-
-        /* Guarda-se os OUTS da conexão pré-existente */
-
-        numouts += connections[n]->numouts;
-
-        for (i = 0; i < connections[n]->numouts; i++) {
-        	outs[j] = connections[n]->outs[i];
-            j++;
-   		}
-
-        /* Mata-se o processo da conexão pré-existente */
-
-        kill(connections[n]->pid, SIGUSR1);
-        desbloqueia(n);
-        waitpid(connections[n]->pid, NULL, 0);
-        connections[n] = NULL;
-    }
-
-    /* Adiciona-se os novos OUTS ao array outs */
-    
-    for (i = 2; i < numoptions; i++) {
-        outs[j] = atoi(options[i]);
-        j++;
-    }
-
-    /* Cria-se o processo da nova conexão com o array de outs criado,
-       adicionando-o à lista global das conexões */
-
-    pid = fork();
+    if (flag || !router_ativo() || engine_nworkers > 0) return 0;
+    if (op->replicas[0] > 1) return 0;
+    if (strcmp(options[2], "const") && strcmp(options[2], "filter") &&
+        strcmp(options[2], "window")) return 0;
 
-    if (pid == -1) { perror("fork no connect"); return 1; } 
-
-    if (pid == 0) {
-        fanout(n, outs, numouts);
-    }
+    return op->anel;
+}
 
-    else {
-        f = create_fanout(pid, outs, numouts);
-        connections[n] = f;
-    }
-    
-    return 0;
+/*
+ * @brief Desfaz os anéis de um nó (depois de o router os largar)
+ */
+void liberta_aneis(int n)
+{
+    anel_liberta(nodesanel[n][0]);
+    anel_liberta(nodesanel[n][1]);
+    nodesanel[n][0] = nodesanel[n][1] = NULL;
 }
 
 /*
- * @brief Comando que desfaz a conexão entre dois nós da rede
+ * @brief Comando que adiciona um nó à rede
  *
- *        e.g. disconnect <id1> <id2>
+ *        e.g. node <id> [-m latency|throughput] [-a <capacidade>]
+ *                  [-p <N>[:<coluna>] [-o]] [-r <ficheiro>] <cmd> <args...>
+ *
+ * A opção -m (retirada pelo interpretador, ver opcoes_node) escolhe se o nó
+ * agrupa as linhas que escreve (throughput, por omissão) ou se escreve cada
+ * linha logo que é produzida (latency).
+ *
+ * A opção -a faz com que o nó troque os registos com o router por dois anéis
+ * em memória partilhada com a capacidade dada (bytes, e.g. 1m), em vez dos
+ * FIFOs (ver anel.h e router.h). Só se aplica aos componentes internos que
+ * correm como processos com o router (é ignorada nos comandos externos, com
+ * o motor de execução e com -p ou -l). O FIFO de entrada mantém-se para os
+ * injects.
  *
- * Primeiro verifica se existia alguma conexão para o IN recebido em options
- * (caso não haja é retornado erro). Depois, verifica se esse IN tem o OUT
- * recebido em options como output (caso não tenha é retornado erro). Após isso,
- * se apenas houver esse OUT na conexão pré-existente, então essa conexão é
- * terminada e a função termina. Caso contrário, são guardados os restantes outs
- * da conexão pré-existente e é criada uma nova conexão com apenas esses outs
- * (e sem o OUT retirado).
+ * A opção -p corre N réplicas do componente (ver replica.h): o processo do nó
+ * reparte os registos por elas, em round-robin ou pelo hash da coluna dada
+ * (os registos com a mesma chave vão para a mesma réplica), e junta as suas
+ * saídas, pela ordem de chegada ou, com -o, pela ordem da entrada. Um nó com
+ * réplicas corre sempre como processo (também com o motor de execução) e usa
+ * os FIFOs.
+ *
+ * A opção -r faz com que um window comece com o estado guardado num ficheiro
+ * pelo comando checkpoint (ver window.h), em vez de começar vazio. É ignorada
+ * nos outros componentes e com réplicas.
+ *
+ * O ID do nó pode ser qualquer nome sem espaços.
+ *
+ * Primeiro, esta função verifica se o nó já existe na rede (se existir dá
+ * erro) e regista-o (rede.h). Depois cria um processo filho para executar o
+ * componente/filtro, bem como dois FIFOs (pipes com nome) de entrada e saida
+ * de dados no nó. Os nomes destes pipes são "Xin" e "Xout" em que X é o lugar
+ * do nó no registo.
  *
  * @param options Array com os campos do comando (secções separadas por espaço)
+ * @param flag    Flag que indica se o output do nó deverá ser descartado
+ * @param op      Opções do nó (modo de escrita, anéis, réplicas e estado)
+ * @param lanca   0 para só registar o nó e criar os FIFOs (o processo é
+ *                criado depois com lanca_no, ver aplica_config)
  *
  * @return 0 em caso de sucesso
  *         1 em caso de erro
- *         2 caso os nós não estejam previamente conectados
+ *         2 caso já exista o nó na rede
+ *         3 caso a rede já tenha REDE_MAXNOS nós
  */
-int disconnect(char** options)
+int add_node(char** options, int flag, OpcoesNo* op, int lanca)
 {
-    int a, b, numouts, pid, i, j = 0, exists = 0;
-    Fanout f;
+    int n;
+    size_t anel;
 
-    a = atoi(options[1]);
-    b = atoi(options[2]);
+    /* Verificar se o nó já existe na rede e registá-lo */
 
-    /* Verificar se existe alguma conexão para o IN (a) recebido */
+    if (rede_procura(options[1]) != -1) {
+        return 2;
+    }
 
-    if (connections[a] != NULL) {
-        
-        numouts = connections[a]->numouts;
+    if ((n = rede_cria(options[1])) == -1) {
+        return 3;
+    }
 
-        /* Verificar se a conexão tem OUT (b) como saída */
+    nodesmodo[n] = op->modo;
+    memcpy(nodesreplicas[n], op->replicas, sizeof(nodesreplicas[n]));
 
-        for (i = 0; i < numouts; i++) {
-            if (connections[a]->outs[i] == b) {
-                exists = 1;
-            }
-        }
+    /* Contadores do nó a zero (também os do fanout que parte dele) */
 
-        if (!exists) { // A conexão não tem OUT (b) com saída
-            return 2;
-        }
+    stats_zera(n);
+    traco_zera(n);
+    memset(&statsant[n], 0, sizeof(struct stats_ant));
+    statsant[n].quando = stats_agora();
 
-        /* Se a conexão apenas tiver OUT (b) como saída, pode ser terminada 
-           diretamente */
+    nodesexterno[n] = flag;
+    nodesinterno[n] = !flag && engine_builtin(options[2]);
+    nodesjanela[n] = !flag && strcmp(options[2], "window") == 0 &&
+                     op->replicas[0] <= 1;
 
-        if (numouts == 1) {
-            kill(connections[a]->pid, SIGUSR1);
-            desbloqueia(a);
-            waitpid(connections[a]->pid, NULL, 0);
-            connections[a] = NULL;
-            return 0;
+    /* Com o motor de execução ativo, os componentes internos correm como
+       tarefas do controlador (menos os que têm réplicas) */
+
+    if (!flag && engine_nworkers > 0 && engine_builtin(options[2]) &&
+        op->replicas[0] <= 1) {
+        if (engine_add(n, &options[2], nodesmodo[n]) != 0) {
+            rede_apaga(n);
+            return 1;
         }
-        else {
+        if (nodesjanela[n] && op->estado != NULL) engine_restaura(n, op->estado);
+        nodespid[n] = 0;
+        return 0;
+    }
 
-            /* Guarda-se os OUTS da conexão pré-existente para todos os OUTS
-               cujo ID seja diferente do ID do OUT que vamos retirar (b) */
+    free(nodesrestauro[n]);
+    nodesrestauro[n] = nodesjanela[n] && op->estado != NULL ? strdup(op->estado) : NULL;
 
-            numouts--;
-            int outs[numouts];
+    /* Criar FIFO in (antes do fork, para que um connect logo a seguir já o
+       encontre) e mantê-lo aberto para leitura e escrita. No Linux, abrir um
+       FIFO com O_RDWR não bloqueia */
 
-            for (i = 0; i < connections[a]->numouts; i++) {
-                if (connections[a]->outs[i] != b) {
-                    outs[j] = connections[a]->outs[i]; 
-                    j++;
-                }
-            }
+    char in[SMALL_SIZE], out[SMALL_SIZE];
 
-            /* Mata-se o processo da conexão pré-existente */
+    sprintf(in, "./tmp/%din", n); // string com o nome do FIFO
+    mkfifo(in, 0666);
+    nodesfd[n] = open(in, O_RDWR | O_CLOEXEC);
 
-            kill(connections[a]->pid, SIGUSR1);
-            desbloqueia(a);
-            waitpid(connections[a]->pid, NULL, 0);
-            connections[a] = NULL;
+    /* Caso não seja para descartar o output, cria-se o FIFO out (senão o
+       componente escreve no /dev/null) */
 
-            /* Cria-se uma nova conexão com o array de outs criado anteriormente
-               (sem o OUT que retirámos (b)) */
+    if (flag == 0) {
+        sprintf(out, "./tmp/%dout", n); // string com o nome do FIFO
+        mkfifo(out, 0666);
+    }
 
-            pid = fork();
+    /* Anéis do nó (o router passa a servi-lo por eles) */
 
-            if (pid == -1) { perror("fork node"); return 1; }
+    nodesanel[n][0] = nodesanel[n][1] = NULL;
 
-            if (pid == 0) {
-                fanout(a, outs, numouts);
-            }
+    if ((anel = transporte_anel(options, flag, op)) > 0) {
+        nodesanel[n][0] = anel_cria(anel);
+        nodesanel[n][1] = anel_cria(anel);
 
-            else {
-                f = create_fanout(pid, outs, numouts);
-                connections[a] = f;
-            }
+        if (nodesanel[n][0] == NULL || nodesanel[n][1] == NULL ||
+            router_aneis_no(n, nodesanel[n][0], nodesanel[n][1]) != 0) {
+            liberta_aneis(n);
         }
     }
-    else { // IN (a) não existe
-        return 2;
-    }
 
+    /* Criar filho para correr o componente */
+
+    if (lanca) lanca_no(n, options, flag);
+    
     return 0;
 }
 
 /*
- * @brief Comando que injeta a entrada de um nó da rede com o resultado da
- *        execução de um outro comando (do sistema Unix)
- * 
- *        e.g. inject <id> <cmd> <args...>
+ * @brief Acrescenta OUTS à conexão que parte de um nó
  *
- * Abre o FIFO de entrada do nó recebido em options e, de seguida, cria um filho
- * que execute o comando e escreve lá o resultado da execução do mesmo.
+ * Caso já exista uma conexão a partir do nó, os seus OUTS mantêm-se e os novos
+ * são acrescentados no fim (os que já lá estão não são repetidos).
  *
- * @param options Array com os campos do comando (secções separadas por espaço)
+ * @param n       ID do nó IN
+ * @param novos   Array com os IDs dos novos OUTS
+ * @param nnovos  Número de novos OUTS
  *
  * @return 0 em caso de sucesso
  *         1 em caso de erro
- *         2 caso não exista o nó na rede
+ *         2 caso todos os OUTS já estejam ligados ao nó
  */
-int inject(char** options)
+int liga(int n, int* novos, int nnovos)
 {
-    int a, fd, pid;
-    char in[SMALL_SIZE];
+    int i, j = 0, k, numouts = nnovos;
 
-    /* Verificar se o nó recebido existe na rede */
+    if (connections[n] != NULL) numouts += connections[n]->numouts;
 
-    a = atoi(options[1]);
+    int outs[numouts > 0 ? numouts : 1]; // IDs dos OUTS da nova conexão
 
-    if (nodes[a] == 0) {
-        return 2;
+    /* Caso já exista uma conexão a partir do IN, guarda-se os OUTS da conexão
+       pré-existente */
+
+    if (connections[n] != NULL) {
+        for (i = 0; i < connections[n]->numouts; i++) {
+            outs[j] = connections[n]->outs[i];
+            j++;
+        }
     }
 
-    /* Cria-se a string do FIFO IN do nó recebido, abrindo-o para escrita */
+    /* Adiciona-se os novos OUTS ao array outs (os que já estão ligados ao IN
+       não são repetidos) */
 
-    sprintf(in, "./tmp/%sin", options[1]);
+    for (i = 0; i < nnovos; i++) {
+        outs[j] = novos[i];
+        for (k = 0; outs[k] != outs[j]; k++);
+        if (k == j) j++;
+    }
 
-    fd = open(in, O_WRONLY);
+    if (connections[n] != NULL && j == connections[n]->numouts) return 2;
 
-    if (fd == -1) { perror("open inject"); return 1; }
+    /* Substitui-se a conexão pré-existente pela nova */
+
+    return set_fanout(n, outs, j);
+}
+
+/*
+ * @brief Lê uma opção de um comando connect (--cap <bytes> ou --overflow
+ *        block|drop-oldest|drop-newest|spill)
+ *
+ * @param options  Campos do comando
+ * @param i        Campo a ler (avança para o último campo da opção)
+ * @param cap      Onde se coloca a capacidade
+ * @param politica Onde se coloca a política
+ *
+ * @return 1 se o campo é uma opção, 0 se não for (é um nó) ou -1 se a opção
+ *         for inválida
+ */
+int opcao_ligacao(char** options, int* i, size_t* cap, int* politica)
+{
+    if (strcmp(options[*i], "--cap") == 0) {
+        if (options[*i + 1] == NULL || (*cap = router_capacidade(options[*i + 1])) == 0) {
+            return -1;
+        }
+    }
+    else if (strcmp(options[*i], "--overflow") == 0) {
+        if (options[*i + 1] == NULL || (*politica = router_politica(options[*i + 1])) == -1) {
+            return -1;
+        }
+    }
+    else return 0;
+
+    (*i)++;
+
+    return 1;
+}
+
+/*
+ * @brief Comando que faz a conexão entre dois ou mais nós da rede
+ *
+ *        e.g. connect <id> <ids...> [--cap <bytes>]
+ *                     [--overflow block|drop-oldest|drop-newest|spill]
+ * 
+ * Primeiro verifica se já existia uma conexão cujo IN seja igual ao recebido em
+ * options. Em caso afirmativo, guarda os IDs dos nós do output dessa conexão e
+ * mata a conexão. Deixando terminar qualquer escrita que esteja a ser feita.
+ * 
+ * Em todos os casos (caso existisse ou não uma conexão anterior), são
+ * adicionados os nós de output recebidos (em options) e é criada uma nova
+ * conexão que liga os nós recebidos (mais os nós pré-existentes, caso seja esse
+ * o caso).
+ *
+ * As opções aplicam-se às ligações para os nós recebidos (ver router.h): a
+ * capacidade (bytes na fila do OUT, que também aumenta o seu FIFO) e a
+ * política quando a fila passa dela. Sem opções, as ligações novas ficam com
+ * as da omissão (1 MB, block). Com opções, as ligações que já existiam mudam
+ * de capacidade e de política. Só o router aplica outras políticas além de
+ * block (os fanouts em processos e as tarefas do motor bloqueiam sempre).
+ *
+ * @param options    Array com campos do comando (secções separadas por espaço)
+ * @param numoptions Tamanho do array com os campos do comando (options)
+ *
+ * @return 0 em caso de sucesso
+ *         1 em caso de erro 
+ *         2 caso os nós já estejam conectados
+ *         3 caso algum dos nós não exista na rede
+ *         4 caso alguma opção seja inválida
+ *         5 caso a política não possa ser aplicada (a ligação não é servida
+ *           pelo router)
+ */
+int connect(char** options, int numoptions)
+{
+    int i, j, n, numouts = 0, politica = ROUTER_BLOQUEIA, opcoes = 0, ret;
+    size_t cap = 0;
+
+    n = rede_procura(options[1]); // ID do nó IN recebido (em options)
+
+    if (n == -1) return 3;
+
+    int outs[numoptions > 2 ? numoptions - 2 : 1];
+
+    for (i = 2; i < numoptions; i++) {
+        if ((ret = opcao_ligacao(options, &i, &cap, &politica)) == -1) return 4;
+        if (ret == 1) opcoes = 1;
+        else if ((outs[numouts++] = rede_procura(options[i])) == -1) return 3;
+    }
+
+    if (politica != ROUTER_BLOQUEIA && (!router_ativo() || engine_has(n))) {
+        return 5;
+    }
+
+    /* As ligações novas ficam com as opções (ou as da omissão); as que já
+       existiam só mudam se houver opções */
+
+    for (i = 0; i < numouts; i++) {
+        for (j = 0; connections[n] != NULL && j < connections[n]->numouts &&
+                    connections[n]->outs[j] != outs[i]; j++);
+
+        if (opcoes || connections[n] == NULL || j == connections[n]->numouts) {
+            limite_define(n, outs[i], cap, politica);
+        }
+    }
+
+    ret = liga(n, outs, numouts);
+
+    if (ret == 2 && opcoes) {
+        numouts = connections[n]->numouts;
+        memcpy(outs, connections[n]->outs, sizeof(int) * numouts);
+        ret = set_fanout(n, outs, numouts);
+    }
+
+    return ret;
+}
+
+/*
+ * @brief Desfaz a conexão entre dois nós da rede
+ *
+ * Primeiro verifica se existia alguma conexão para o IN (caso não haja é
+ * retornado erro). Depois, verifica se esse IN tem o OUT como output (caso não
+ * tenha é retornado erro). Após isso, se apenas houver esse OUT na conexão
+ * pré-existente, então essa conexão é terminada e a função termina. Caso
+ * contrário, são guardados os restantes outs da conexão pré-existente e é
+ * criada uma nova conexão com apenas esses outs (e sem o OUT retirado).
+ *
+ * @param a ID do nó IN
+ * @param b ID do nó OUT
+ *
+ * @return 0 em caso de sucesso
+ *         1 em caso de erro
+ *         2 caso os nós não estejam previamente conectados
+ */
+int desliga(int a, int b)
+{
+    int numouts, i, j = 0, exists = 0;
+
+    /* Verificar se existe alguma conexão para o IN (a) recebido */
+
+    if (connections[a] != NULL) {
+        
+        numouts = connections[a]->numouts;
+
+        /* Verificar se a conexão tem OUT (b) como saída */
+
+        for (i = 0; i < numouts; i++) {
+            if (connections[a]->outs[i] == b) {
+                exists = 1;
+            }
+        }
+
+        if (!exists) { // A conexão não tem OUT (b) com saída
+            return 2;
+        }
+
+        /* Guarda-se os OUTS da conexão pré-existente para todos os OUTS cujo
+           ID seja diferente do ID do OUT que vamos retirar (b). Se apenas
+           houver esse OUT, a conexão é simplesmente terminada */
+
+        numouts--;
+        int outs[numouts > 0 ? numouts : 1];
+
+        for (i = 0; i < connections[a]->numouts; i++) {
+            if (connections[a]->outs[i] != b) {
+                outs[j] = connections[a]->outs[i]; 
+                j++;
+            }
+        }
+
+        return set_fanout(a, outs, numouts);
+    }
+    else { // IN (a) não existe
+        return 2;
+    }
+}
+
+/*
+ * @brief Comando que desfaz a conexão entre dois nós da rede
+ *
+ *        e.g. disconnect <id1> <id2>
+ *
+ * @param options Array com os campos do comando (secções separadas por espaço)
+ *
+ * @return 0 em caso de sucesso
+ *         1 em caso de erro
+ *         2 caso os nós não existam ou não estejam previamente conectados
+ */
+int disconnect(char** options)
+{
+    int a, b;
+
+    a = rede_procura(options[1]);
+    b = rede_procura(options[2]);
+
+    if (a == -1 || b == -1) return 2;
+
+    return desliga(a, b);
+}
+
+/*
+ * @brief Guarda o PID de um inject (os injects que já terminaram saem da
+ *        lista)
+ *
+ * @param pid      PID do processo do inject
+ * @param no       Nó em que escreve
+ * @param ciclo    1 se só termina quando lhe for pedido (injectfile --loop)
+ * @param partilha Região partilhada com o inject (NULL se não houver)
+ */
+void guarda_injetor(int pid, int no, int ciclo, InjetaPartilha partilha)
+{
+    int i;
+
+    for (i = 0; i < ninjetores; i++) {
+        if (waitpid(injetores[i], NULL, WNOHANG) != 0) {
+            if (injpartilha[i] != NULL) {
+                munmap(injpartilha[i], sizeof(struct injeta_partilha));
+            }
+            ninjetores--;
+            injetores[i] = injetores[ninjetores];
+            injnos[i] = injnos[ninjetores];
+            injpartilha[i] = injpartilha[ninjetores];
+            injciclos[i--] = injciclos[ninjetores];
+        }
+    }
+
+    if (ninjetores == capinjetores) {
+        capinjetores = capinjetores > 0 ? 2 * capinjetores : 16;
+        injetores = realloc(injetores, sizeof(int) * capinjetores);
+        injnos = realloc(injnos, sizeof(int) * capinjetores);
+        injciclos = realloc(injciclos, sizeof(int) * capinjetores);
+        injpartilha = realloc(injpartilha, sizeof(InjetaPartilha) * capinjetores);
+    }
+
+    injetores[ninjetores] = pid;
+    injnos[ninjetores] = no;
+    injpartilha[ninjetores] = partilha;
+    injciclos[ninjetores++] = ciclo;
+}
+
+/*
+ * @brief Comando que injeta a entrada de um nó da rede com o resultado da
+ *        execução de um outro comando (do sistema Unix)
+ * 
+ *        e.g. inject <id> <cmd> <args...>
+ *
+ * Abre o FIFO de entrada do nó recebido em options e, de seguida, cria um filho
+ * que execute o comando e escreve lá o resultado da execução do mesmo.
+ *
+ * Com o traçado (opção -t), se o nó aceitar carimbos, o comando escreve num
+ * pipe e o filho copia as linhas para o FIFO, com um carimbo à frente de uma
+ * em cada N (ver traco.h).
+ *
+ * @param options Array com os campos do comando (secções separadas por espaço)
+ *
+ * @return 0 em caso de sucesso
+ *         1 em caso de erro
+ *         2 caso não exista o nó na rede
+ */
+int inject(char** options)
+{
+    int a, fd, pid;
+    char in[SMALL_SIZE];
+
+    /* Verificar se o nó recebido existe na rede */
+
+    a = rede_procura(options[1]);
+
+    if (a == -1) {
+        return 2;
+    }
+
+    /* Cria-se a string do FIFO IN do nó recebido, abrindo-o para escrita */
+
+    sprintf(in, "./tmp/%din", a);
+
+    fd = open(in, O_WRONLY);
+
+    if (fd == -1) { perror("open inject"); return 1; }
+
+    avisa_injetores(a); // um escritor novo para os injectfile do nó
 
     /* Cria-se o processo responsável pelo inject no FIFO IN do nó */
 
     pid = fork(); 
 
-    if (pid == -1) { perror("fork inject"); return 1; }
+    if (pid == -1) { perror("fork inject"); return 1; }
+
+    /* Redireciona-se o output do processo para o FIFO e executa-se o comando
+       recebido */
+
+    if (pid == 0) {
+        int p[2];
+
+        if (traco_amostra > 0 && nodesinterno[a] && pipe(p) == 0) {
+            if (fork() == 0) {
+                dup2(p[1], 1);
+                close(p[0]); close(p[1]); close(fd);
+                execvp(options[2], &options[2]);
+                perror("exec inject");
+                _exit(1);
+            }
+            close(p[1]);
+            traco_injeta(p[0], fd, traco_amostra);
+            wait(NULL);
+            _exit(0);
+        }
+
+        dup2(fd, 1);
+        close(fd);
+        execvp(options[2], &options[2]);
+        perror("exec inject");
+        _exit(1);
+    }
+
+    close(fd); // só o processo do inject escreve no FIFO
+
+    guarda_injetor(pid, a, 0, NULL);
+
+    return 0;
+}
+
+/*
+ * @brief Comando que injeta um ficheiro na entrada de um nó da rede, sem
+ *        processos externos
+ *
+ *        e.g. injectfile <id> <ficheiro> [--rate <R>] [--loop]
+ *
+ * O ficheiro e o FIFO IN do nó são abertos aqui e o envio é feito por um
+ * filho do controlador, sem exec (ver injeta.h). Os blocos só têm de ser
+ * atómicos se o nó tiver outros escritores: ligações que lhe chegam ou outros
+ * injects ainda a correr, agora ou depois (o inject é avisado pela região
+ * partilhada, ver avisa_injetores).
+ *
+ * @param options Array com os campos do comando (secções separadas por espaço)
+ *
+ * @return 0 em caso de sucesso
+ *         1 em caso de erro
+ *         2 caso não exista o nó na rede
+ *         3 caso as opções sejam inválidas
+ *         4 caso o ficheiro não exista ou não seja um ficheiro regular
+ */
+int injectfile(char** options)
+{
+    int a, i, fd, fdi, pid, *ins;
+    char in[SMALL_SIZE];
+    struct stat st;
+    Injecao inj;
+
+    if (options[1] == NULL || options[2] == NULL) return 3;
+
+    a = rede_procura(options[1]);
+
+    if (a == -1) return 2;
+
+    if (injeta_opcoes(&options[3], &inj) == -1) return 3;
+
+    fdi = open(options[2], O_RDONLY);
+
+    if (fdi == -1 || fstat(fdi, &st) == -1 || !S_ISREG(st.st_mode)) {
+        if (fdi != -1) close(fdi);
+        return 4;
+    }
+
+    inj.amostra = traco_amostra > 0 && nodesinterno[a] ? traco_amostra : 0;
+    inj.atomico = rede_entradas(a, &ins) > 0;
+
+    for (i = 0; i < ninjetores; i++) {
+        if (injnos[i] == a && waitpid(injetores[i], NULL, WNOHANG) == 0) {
+            inj.atomico = 1;
+        }
+    }
+
+    sprintf(in, "./tmp/%din", a);
+
+    fd = open(in, O_WRONLY);
+
+    if (fd == -1) { perror("open injectfile"); close(fdi); return 1; }
+
+    avisa_injetores(a);
+    inj.partilha = injeta_partilha(inj.atomico);
+
+    pid = fork();
+
+    if (pid == -1) {
+        perror("fork injectfile");
+        if (inj.partilha != NULL) munmap(inj.partilha, sizeof(struct injeta_partilha));
+        close(fd);
+        close(fdi);
+        return 1;
+    }
+
+    if (pid == 0) {
+        dup2(fdi, 0);
+        dup2(fd, 1);
+        replica_fecha_herdados();
+        _exit(injeta_ficheiro(0, 1, &inj));
+    }
+
+    close(fd);
+    close(fdi);
+
+    guarda_injetor(pid, a, inj.ciclo, inj.partilha);
+
+    return 0;
+}
+
+/*
+ * @brief Comando que remove um nó da rede
+ *
+ *        e.g. remove <id>
+ *
+ * Esta função remove todas as ligações do nó a remover existentes na rede,
+ * matando, posteriormente, o processo que se encontrava a executar o processo 
+ * relativo ao nó removido. As conexões que chegam ao nó vêm do índice inverso
+ * do registo (rede.h), por isso o custo é proporcional ao grau do nó.
+ *
+ * @param options Array com os campos do comando (secções separadas por espaço)
+ *
+ * @return 0 em caso de sucesso
+ *         1 em caso de erro
+ *         2 caso o nó não exista na rede
+ */
+int remove_node(char** options) {
+
+    int a;
+    int* ins;
+    char in[SMALL_SIZE], out[SMALL_SIZE];
+
+    /* Verificar se o nó recebido existe na rede */
+
+    a = rede_procura(options[1]);
+
+    if (a == -1) {
+        return 2;
+    }
+
+    /* Verificar se o nó recebido se encontra ligado a algum outro nó da rede
+       (i.e. se existe alguma conexão a partir daquele nó). Se sim, mata-se essa
+       conexão */
+
+    set_fanout(a, NULL, 0);
+
+    /* Desfazer as conexões que têm o nó que queremos remover como OUT (cada
+       disconnect retira a conexão do índice inverso) */
+
+    while (rede_entradas(a, &ins) > 0) {
+        if (desliga(ins[0], a) != 0) break;
+    }
+
+    /* Todas as conexões do nó foram removidas, por isso pode-se remover o nó da
+       rede, matando o seu processo e fechando os seus FIFOs (apagando-os) */
+
+    if (router_ativo()) router_remove(a);
+    liberta_aneis(a);
+
+    if (engine_has(a)) { // tarefa do motor: não há processo
+        engine_remove(a);
+        rede_apaga(a);
+        return 0;
+    }
+
+    sprintf(in, "./tmp/%din", a);
+    sprintf(out, "./tmp/%dout", a);
+    unlink(in);
+    unlink(out); // pode não existir (comando externo)
+
+    close(nodesfd[a]);
+    kill(nodespid[a], SIGKILL);
+    waitpid(nodespid[a], NULL, 0); //esperar que o processo do nó termine
+    rede_apaga(a); // o registo da rede deixa de ter o nó que foi removido
+
+    return 0;
+}
+
+/*
+ * @brief Pede a um window que guarde o seu estado num ficheiro e espera que
+ *        o guarde (até PRAZO_ESTADO ms)
+ *
+ * Num processo, o pedido vai pelo FIFO de entrada do nó, atrás dos registos
+ * que já lá estão (ver window.h). Com termina, o processo termina depois de
+ * guardar o estado, que leva também o que o processo já tinha lido e ainda
+ * não processou, e espera-se que termine (sem o recolher: isso fica para quem
+ * o substitui). O pedido leva o pid do processo: se não for atendido a tempo,
+ * o processo que o substituir ignora-o. Uma tarefa do motor guarda o estado
+ * logo (engine_guarda).
+ *
+ * @param n        ID do nó
+ * @param ficheiro Ficheiro onde o window guarda o estado
+ * @param termina  1 para o processo terminar depois de guardar o estado
+ *
+ * @return 0 em caso de sucesso ou 1 se o estado não foi guardado a tempo
+ */
+int pede_estado(int n, const char* ficheiro, int termina)
+{
+    char pedido[PIPE_BUF], in[SMALL_SIZE];
+    long long prazo = stats_agora() + PRAZO_ESTADO * 1000000LL;
+    int fd, existe, terminou;
+    siginfo_t info;
+    ssize_t r;
+    size_t k;
+
+    if (engine_has(n)) return engine_guarda(n, ficheiro) == 0 ? 0 : 1;
+
+    /* O pedido é escrito de uma vez (atómico no FIFO, que o router também
+       escreve) e sem bloquear: com o FIFO cheio, espera-se até ao prazo */
+
+    if (WINDOW_ESTADO_CAB + strlen(ficheiro) > PIPE_BUF) return 1;
+
+    sprintf(in, "./tmp/%din", n);
+    if ((fd = open(in, O_WRONLY | O_NONBLOCK | O_CLOEXEC)) == -1) return 1;
+
+    unlink(ficheiro);
+    k = window_pedido(pedido, ficheiro, termina, nodespid[n]);
+
+    while ((r = write(fd, pedido, k)) == -1 && (errno == EAGAIN || errno == EINTR) &&
+           stats_agora() < prazo) {
+        usleep(200);
+    }
+
+    close(fd);
+    if (r != (ssize_t) k) return 1;
+
+    do {
+        existe = access(ficheiro, F_OK) == 0;
+        info.si_pid = 0;
+        terminou = termina && waitid(P_PID, nodespid[n], &info,
+                                     WEXITED | WNOHANG | WNOWAIT) == 0 &&
+                   info.si_pid != 0;
+
+        if (existe && (!termina || terminou)) return 0;
+        if (terminou) return 1; // terminou sem guardar o estado
+
+        usleep(200);
+    } while (stats_agora() < prazo);
+
+    return 1;
+}
+
+/*
+ * @brief Comando que guarda o estado de um window num ficheiro
+ *
+ *        e.g. checkpoint <id> <ficheiro>
+ *
+ * O window continua a correr. O ficheiro pode ser dado a um novo nó (node
+ * <id> -r <ficheiro> window ...) ou a um change, que começa com estas janelas
+ * em vez de vazio. O change de um window para outro window já passa o estado
+ * sem este comando. É escrito o tamanho do ficheiro e o tempo que demorou.
+ *
+ * @param options Array com os campos do comando (secções separadas por espaço)
+ *
+ * @return 0 em caso de sucesso
+ *         1 em caso de erro
+ *         2 caso o nó não exista na rede
+ *         3 caso o nó não seja um window (sem réplicas)
+ */
+int checkpoint(char** options)
+{
+    int a;
+    long long t0 = stats_agora();
+    struct stat st;
+
+    if (options[1] == NULL || options[2] == NULL) return 1;
+
+    a = rede_procura(options[1]);
+
+    if (a == -1) return 2;
+    if (!nodesjanela[a]) return 3;
+
+    if (pede_estado(a, options[2], 0) != 0 || stat(options[2], &st) != 0) {
+        return 1;
+    }
+
+    printf("Estado guardado em %s (%lld bytes, %.1f ms)\n", options[2],
+           (long long) st.st_size, (stats_agora() - t0) / 1e6);
+
+    return 0;
+}
+
+/*
+ * @brief Substitui o processo de um nó sem desfazer as suas ligações (usada
+ *        pelo change quando as ligações são servidas pelo router)
+ *
+ * Os FIFOs do nó mantêm-se (o controlador e o router têm-nos abertos), por
+ * isso o que ainda estiver no FIFO de entrada ou na fila do router para o nó
+ * vai para o novo processo, e o que o processo antigo já escreveu no FIFO de
+ * saída continua a ser entregue. Só se perdem os registos que estavam dentro
+ * do processo antigo (a não ser que um window entregue o seu estado, ver
+ * change). As ligações que chegam ao nó e as que partem dele são
+ * redefinidas no router, porque o novo comando pode aceitar ou não os
+ * registos binários (ver aceita_binario).
+ *
+ * @param a       ID do nó
+ * @param options Array com os campos do comando (secções separadas por espaço)
+ * @param flag    Flag que indica se o output do nó deverá ser descartado
+ *
+ * @return 0 em caso de sucesso
+ */
+int substitui_no(int a, char** options, int flag)
+{
+    int i, n, numins, *ins;
+    char out[SMALL_SIZE];
+
+    kill(nodespid[a], SIGKILL);
+    waitpid(nodespid[a], NULL, 0);
+    router_corta(a);
+
+    stats_zera(a);
+    traco_zera(a);
+    memset(&statsant[a], 0, sizeof(struct stats_ant));
+    statsant[a].quando = stats_agora();
+
+    nodesexterno[a] = flag;
+    nodesinterno[a] = !flag && engine_builtin(options[2]);
+    nodesjanela[a] = !flag && strcmp(options[2], "window") == 0 &&
+                     nodesreplicas[a][0] <= 1;
+
+    if (flag == 0) {
+        sprintf(out, "./tmp/%dout", a);
+        mkfifo(out, 0666); // pode ainda não existir (o nó era externo)
+    }
+
+    lanca_no(a, options, flag);
+
+    /* A conexão que parte do nó e as que chegam a ele (copiadas, porque o
+       set_fanout altera o índice inverso) */
+
+    numins = rede_entradas(a, &ins);
+    int nos[numins + 1];
+    memcpy(nos, ins, sizeof(int) * numins);
+    nos[numins] = a;
+
+    for (i = 0; i <= numins; i++) {
+        if (connections[nos[i]] == NULL) continue;
+
+        n = connections[nos[i]]->numouts;
+        int outs[n];
+        memcpy(outs, connections[nos[i]]->outs, sizeof(int) * n);
+        set_fanout(nos[i], outs, n);
+    }
+
+    return 0;
+}
+
+/*
+ * @brief Comando que altera o componente/filtro a ser executado por um nó da
+ *        rede
+ *
+ *        e.g. change <id> [-m latency|throughput] [-a <capacidade>]
+ *                    [-p <N>[:<coluna>] [-o]] [-r <ficheiro>] <cmd> <args...>
+ *
+ * Caso exista, remove o nó pré-existente (com o mesmo ID) da rede e cria um
+ * novo nó (também com o mesmo ID) que executará o novo comando, refazendo as
+ * conexões que partem dele e as que chegam a ele (índice inverso, rede.h).
+ * Com o router (e sem o motor de execução), só o processo do nó é substituído
+ * (ver substitui_no), a não ser que o nó passe a usar anéis em vez dos FIFOs
+ * ou o contrário (ou a capacidade dos anéis mude).
+ *
+ * Se um window passar a ser outro window (e.g. com outro tamanho), o antigo
+ * guarda o seu estado (ver pede_estado) e o novo começa com ele, em vez de
+ * começar com as janelas vazias. Como o pedido vai no FIFO de entrada, o
+ * antigo processa todos os registos que chegaram antes do change e o que já
+ * tinha lido a seguir passa para o novo, pelo que, com o router, nenhum
+ * registo se perde. Com a opção -r, o novo window começa antes com o estado
+ * desse ficheiro.
+ *
+ * @param options Array com os campos do comando (secções separadas por espaço)
+ * @param flag    Indica se o output do novo nó criado deve ser descartado
+ *                (parâmetro da função add_node)
+ * @param op      Opções do novo nó (modo de escrita, anéis e réplicas)
+ *
+ * @return 0 em caso de sucesso
+ *         1 em caso de erro
+ *         2 caso o nó não exista na rede
+ */
+int change(char** options, int flag, OpcoesNo* op) {
+    int a, b, numouts = 0, numins, i, *ins, janela;
+    char estado[SMALL_SIZE];
+
+    /* Verificar se o nó recebido existe na rede */
+
+    a = rede_procura(options[1]);
+
+    if (a == -1) {
+        return 2;
+    }
+
+    /* Um window que passa a outro window entrega-lhe o seu estado */
+
+    janela = !flag && strcmp(options[2], "window") == 0 && op->replicas[0] <= 1;
+
+    if (janela && nodesjanela[a] && op->estado == NULL) {
+        sprintf(estado, "./tmp/%destado", a);
+        if (pede_estado(a, estado, 1) == 0) op->estado = estado;
+    }
+
+    if (router_ativo() && engine_nworkers == 0 &&
+        (nodesanel[a][0] != NULL ? nodesanel[a][0]->cap : 0) ==
+        transporte_anel(options, flag, op)) {
+        nodesmodo[a] = op->modo;
+        memcpy(nodesreplicas[a], op->replicas, sizeof(nodesreplicas[a]));
+        free(nodesrestauro[a]);
+        nodesrestauro[a] = janela && op->estado != NULL ? strdup(op->estado) : NULL;
+        return substitui_no(a, options, flag);
+    }
+
+    /* Guardar os OUTS da conexão cuja entrada (IN) corresponda ao nó recebido,
+       caso exista, e os nós que se ligam a ele */
+
+    if (connections[a] != NULL) numouts = connections[a]->numouts;
+
+    int outs[numouts > 0 ? numouts : 1];
+
+    for (i = 0; i < numouts; i++) {
+        outs[i] = connections[a]->outs[i];
+    }
+
+    numins = rede_entradas(a, &ins);
+    int entradas[numins > 0 ? numins : 1];
+    memcpy(entradas, ins, sizeof(int) * numins);
+
+    /* Remover o nó antigo da rede e adicionar um nó que executará o novo
+       comando (o lugar no registo pode mudar) */
+
+    remove_node(options);
+    if (add_node(options, flag, op, 1) != 0) return 1;
+
+    b = rede_procura(options[1]);
+
+    for (i = 0; i < numouts; i++) {
+        if (outs[i] == a) outs[i] = b;
+    }
+
+    /* Refazer a conexão (fanout) a partir do novo nó e as que chegam a ele */
+
+    if (numouts > 0 && set_fanout(b, outs, numouts) != 0) return 1;
+
+    for (i = 0; i < numins; i++) {
+        if (entradas[i] != a) liga(entradas[i], &b, 1);
+    }
+
+    return 0;
+}
+
+
+/*
+ * @brief Escreve uma linha da tabela do comando stats
+ *
+ * @param nome Nome da linha (ID do nó ou do fanout)
+ * @param a    Contadores na leitura anterior
+ * @param d    Contadores agora
+ * @param ns   Tempo entre as duas leituras
+ */
+void stats_tabela(const char* nome, struct stats* a, struct stats* d, long long ns)
+{
+    double seg = ns > 0 ? ns / 1e9 : 1;
+    char spawn[SMALL_SIZE] = "-";
+
+    if (d->spawns > a->spawns) {
+        sprintf(spawn, "%.2f", (double) (d->nsspawn - a->nsspawn) /
+                               (d->spawns - a->spawns) / 1e6);
+    }
+
+    printf("%-6s %10.0f %10.0f %9.1f %9.1f %10.0f %7.1f%% %7.1f%% %9s\n", nome,
+           (d->entrada - a->entrada) / seg,
+           (d->saida - a->saida) / seg,
+           (d->bentrada - a->bentrada) / seg / 1024,
+           (d->bsaida - a->bsaida) / seg / 1024,
+           (d->descartados - a->descartados) / seg,
+           100.0 * (d->nsleitura - a->nsleitura) / (ns > 0 ? ns : 1),
+           100.0 * (d->nsescrita - a->nsescrita) / (ns > 0 ? ns : 1),
+           spawn);
+}
+
+/*
+ * @brief Comando que mostra as taxas de cada nó (e do fanout que parte dele)
+ *        desde o último stats (ou desde a criação do nó)
+ *
+ *        e.g. stats [id]
+ *
+ * Colunas: linhas lidas e escritas por segundo, KB lidos e escritos por
+ * segundo, linhas descartadas por segundo (no filter, ou no fanout de uma
+ * tarefa do motor uma linha maior do que a fila), percentagem do tempo à
+ * espera de input e a escrever, e latência média dos comandos do spawn (ms).
+ * As linhas escritas por um fanout são somadas por saída.
+ *
+ * Com o router, segue-se o estado de cada ligação (router_ligacoes): a
+ * política e a capacidade, os KB na fila do destino (de todas as ligações
+ * para ele), à espera na fila da ligação e no disco, e, desde que a ligação
+ * existe, os registos descartados e os MB que foram para o disco.
+ *
+ * @param options Array com os campos do comando (secções separadas por espaço)
+ *
+ * @return 0 em caso de sucesso
+ *         1 em caso de erro (contadores indisponíveis)
+ *         2 caso o nó não exista na rede
+ */
+int stats(char** options)
+{
+    int i, n, ini = 0, fim = rede_fim();
+    long long agora;
+    char nome[2 * MAX_SIZE + 4];
+    struct stats comp, fan;
+    RouterLigacao* ls;
+
+    if (stats_regiao == NULL) return 1;
+
+    if (options[1] != NULL) {
+        ini = rede_procura(options[1]);
+        if (ini == -1) return 2;
+        fim = ini + 1;
+    }
+
+    printf("%-6s %10s %10s %9s %9s %10s %8s %8s %9s\n", "nó", "lin ent/s",
+           "lin saí/s", "KB ent/s", "KB saí/s", "desc/s", "espera", "escrita",
+           "spawn ms");
+
+    for (i = ini; i < fim; i++) {
+        if (rede_nome(i) == NULL) continue;
+
+        agora = stats_agora();
+        stats_le(stats_no(i, 0), &comp);
+        stats_le(stats_no(i, 1), &fan);
+
+        sprintf(nome, "%s", rede_nome(i));
+        stats_tabela(nome, &statsant[i].comp, &comp, agora - statsant[i].quando);
+
+        if (connections[i] != NULL) {
+            sprintf(nome, "%s->", rede_nome(i));
+            stats_tabela(nome, &statsant[i].fanout, &fan,
+                         agora - statsant[i].quando);
+        }
+
+        statsant[i].comp = comp;
+        statsant[i].fanout = fan;
+        statsant[i].quando = agora;
+    }
+
+    if (router_ativo() && (n = router_ligacoes(options[1] != NULL ? ini : -1, &ls)) > 0) {
+        printf("%-14s %-12s %9s %9s %9s %9s %11s %9s\n", "ligação", "política",
+               "cap KB", "fila KB", "espera KB", "disco KB", "descartados",
+               "disco MB");
+
+        for (i = 0; i < n; i++) {
+            sprintf(nome, "%s->%s", rede_nome(ls[i].origem), rede_nome(ls[i].destino));
+            printf("%-12s %-11s %9.1f %9.1f %9.1f %9.1f %11llu %9.1f\n", nome,
+                   router_politicas[ls[i].politica], ls[i].cap / 1024.0,
+                   ls[i].fila / 1024.0, ls[i].espera / 1024.0, ls[i].disco / 1024.0,
+                   ls[i].descartados, ls[i].derramados / 1048576.0);
+        }
+
+        free(ls);
+    }
+
+    if (router_edicoes > 0) {
+        printf("router: %llu edições, %.1f µs em média, %.1f µs no máximo\n",
+               router_edicoes, router_nsedicoes / 1e3 / router_edicoes,
+               router_maxedicao / 1e3);
+    }
+
+    return 0;
+}
+
+/*
+ * @brief Escreve uma linha da tabela do comando latency (nada se o
+ *        histograma não tiver amostras)
+ */
+void latency_tabela(const char* nome, Histo h)
+{
+    struct histo c;
+
+    histo_le(h, &c);
+    if (c.n == 0) return;
+
+    printf("%-14s %9llu %9.1f %9.1f %9.1f %9.1f %9.1f\n", nome, c.n,
+           c.soma / 1e3 / c.n, histo_percentil(&c, 0.5) / 1e3,
+           histo_percentil(&c, 0.99) / 1e3, histo_percentil(&c, 0.999) / 1e3,
+           c.max / 1e3);
+}
+
+/*
+ * @brief Comando que mostra os histogramas de latência do traçado (opção -t)
+ *        desde a criação de cada nó
+ *
+ *        e.g. latency [id]
+ *
+ * Por cada nó: o tempo no nó (desde que o registo lhe foi entregue até à
+ * saída do componente) e o total (desde o inject até à saída do nó, ou até à
+ * entrega, se o nó não for interno, e.g. um tee no fim de um caminho). Por
+ * cada ligação A->B: o tempo desde a saída de A até à entrega a B. Os valores
+ * estão em µs, com o erro dos baldes dos histogramas (ver traco.h).
+ *
+ * @param options Array com os campos do comando (secções separadas por espaço)
+ *
+ * @return 0 em caso de sucesso
+ *         1 em caso de erro (traçado desligado)
+ *         2 caso o nó não exista na rede
+ */
+int latency(char** options)
+{
+    int i, ini = 0, fim = rede_fim();
+    char nome[MAX_SIZE + 8];
+    TracoAresta a;
+
+    if (traco_regiao == NULL) return 1;
+
+    if (options[1] != NULL) {
+        ini = rede_procura(options[1]);
+        if (ini == -1) return 2;
+        fim = ini + 1;
+    }
+
+    printf("%-14s %9s %9s %9s %9s %9s %9s\n", "nó", "amostras", "média",
+           "p50", "p99", "p99.9", "máx");
+
+    for (i = ini; i < fim; i++) {
+        if (rede_nome(i) == NULL) continue;
+
+        sprintf(nome, "%s", rede_nome(i));
+        latency_tabela(nome, traco_no(i, 0));
+        sprintf(nome, "%s total", rede_nome(i));
+        latency_tabela(nome, traco_no(i, 1));
+    }
+
+    for (i = 0; i < TRACO_MAXARESTAS; i++) {
+        a = &traco_regiao->arestas[i];
+        if (!a->usada || a->origem < ini || a->origem >= fim) continue;
+        if (rede_nome(a->origem) == NULL || rede_nome(a->destino) == NULL) continue;
+
+        sprintf(nome, "%s->%s", rede_nome(a->origem), rede_nome(a->destino));
+        latency_tabela(nome, &a->h);
+    }
+
+    return 0;
+}
+
 
-    /* Redireciona-se o output do processo para o FIFO e executa-se o comando
-       recebido */
+/*
+ * @brief Espera que os processos terminem até um prazo; os que ainda
+ *        estiverem a correr no fim do prazo são terminados com SIGKILL
+ *
+ * Os processos são recolhidos pela ordem em que terminam (não um a um).
+ *
+ * @param pids  Array com os PIDs (os que forem recolhidos ficam a 0)
+ * @param n     Número de PIDs
+ * @param prazo Instante limite (ns, ver stats_agora)
+ *
+ * @return Número de processos terminados com SIGKILL
+ */
+int espera_processos(int* pids, int n, long long prazo)
+{
+    int i, vivos, mortos = 0;
 
-    if (pid == 0) {
-        dup2(fd, 1);
-        close(fd);
-        execvp(options[2], &options[2]);
-        perror("exec inject");
-        return 1;
+    do {
+        for (i = vivos = 0; i < n; i++) {
+            if (pids[i] <= 0) continue;
+            if (waitpid(pids[i], NULL, WNOHANG) == 0) vivos++;
+            else pids[i] = 0;
+        }
+        if (vivos > 0) usleep(200);
+    } while (vivos > 0 && stats_agora() < prazo);
+
+    for (i = 0; i < n; i++) {
+        if (pids[i] > 0) {
+            kill(pids[i], SIGKILL);
+            waitpid(pids[i], NULL, 0);
+            pids[i] = 0;
+            mortos++;
+        }
     }
 
-    return 0;
+    return mortos;
 }
 
 /*
- * @brief Comando que remove um nó da rede
+ * @brief Espera que já não haja registos a caminho de um nó (no router ou,
+ *        se for uma tarefa do motor, nas suas filas) até um prazo
+ */
+void espera_entrada(int n, long long prazo)
+{
+    while (stats_agora() < prazo) {
+        if ((!router_ativo() || !router_escreve(n)) &&
+            (!engine_has(n) || engine_vazia(n))) return;
+        usleep(200);
+    }
+}
+
+/*
+ * @brief Comando que termina a rede (e depois o controlador)
  *
- *        e.g. remove <id>
+ *        e.g. shutdown [--drain]
  *
- * Esta função remove todas as ligações do nó a remover existentes na rede,
- * matando, posteriormente, o processo que se encontrava a executar o processo 
- * relativo ao nó removido.
+ * Sem --drain, todos os processos (nós, fanouts e injects) são terminados com
+ * SIGKILL de uma vez e recolhidos à medida que terminam.
  *
- * @param options Array com os campos do comando (secções separadas por espaço)
+ * Com --drain, os registos que já estão na rede chegam ao fim: primeiro
+ * esperam-se os injects e depois a rede é fechada por ordem topológica, um
+ * nível de cada vez (os nós sem ligações a chegar, depois os que só recebem
+ * desses, ...). Para cada nível:
+ *   1. espera-se que o router (ou o motor) já não tenha registos para os nós
+ *      e fecha-se o FIFO in de cada nó no controlador. Os nós recebem EOF,
+ *      escrevem o que lhes falta e terminam (as tarefas do motor são
+ *      retiradas quando as suas filas ficam vazias);
+ *   2. os processos do nível são recolhidos à medida que terminam;
+ *   3. o que ficou nos FIFOs de saída é entregue (router_drena ou o fim dos
+ *      fanouts, que recebem EOF).
+ * Os nós cujo output não vai para lado nenhum são terminados logo. Cada nível
+ * tem PRAZO_DRENO ms: o que não terminar a tempo (e.g. nós num ciclo, que
+ * ficam todos no último nível) é terminado com SIGKILL.
+ *
+ * Em ambos os casos, os FIFOs são apagados (unlink) e é escrito o tempo que
+ * a rede demorou a terminar.
+ *
+ * @param drena 1 para deixar os registos chegar ao fim (--drain)
  *
  * @return 0 em caso de sucesso
- *         1 em caso de erro
- *         2 caso o nó não exista na rede
  */
-int remove_node(char** options) {
+int encerra(int drena)
+{
+    int i, k, n, fim = rede_fim(), nos = 0, niveis = 0, forcados = 0;
+    int inicio = 0, nordem = 0, fimnivel, np, *grau, *ordem, *pids, *ins;
+    long long t0 = stats_agora(), prazo;
+    char fifo[SMALL_SIZE];
+    glob_t disco;
 
-    int a, numouts, i, j, f1, f2, devnull;
-    char in[SMALL_SIZE], out[SMALL_SIZE], tmp[SMALL_SIZE];
-    char* args[3];
+    grau = malloc(sizeof(int) * (fim > 0 ? fim : 1));
+    ordem = malloc(sizeof(int) * (fim > 0 ? fim : 1));
+    pids = malloc(sizeof(int) * (fim > 0 ? fim : 1));
 
-    /* Verificar se o nó recebido existe na rede */
+    for (i = 0; i < fim; i++) {
+        if (rede_nome(i) != NULL) nos++;
+    }
 
-    a = atoi(options[1]);
+    if (drena) {
 
-    if (nodes[a] == 0) {
-        return 2;
-    }
+        /* Os injects são a origem dos registos: terminam primeiro (os que
+           enviam um ficheiro em ciclo param no fim do bloco em que estão) */
 
-    /* Verificar se o nó recebido se encontra ligado a algum outro nó da rede
-       (i.e. se existe alguma conexão a partir daquele nó). Se sim, mata-se essa
-       conexão */
+        for (i = 0; i < ninjetores; i++) {
+            if (injciclos[i]) kill(injetores[i], SIGTERM);
+        }
 
-    if (connections[a] != NULL) { 
-        kill(connections[a]->pid, SIGUSR1);
-        desbloqueia(a);
-        waitpid(connections[a]->pid, NULL, 0);
-        connections[a] = NULL; 
-    } 
+        forcados += espera_processos(injetores, ninjetores,
+                                     t0 + PRAZO_DRENO * 1000000LL);
+        ninjetores = 0;
 
-    /* Percorrer todas as conexões da rede para encontrar aquelas que têm o nó
-       que queremos remover como OUT */
+        /* Primeiro nível: os nós sem ligações a chegar (o grau de cada nó é
+           o número de ligações que lhe chegam de nós ainda por fechar, -1
+           depois de entrar na ordem) */
 
-    for (i = 0; i < MAX_SIZE; i++) {
-        if (connections[i] != NULL) { 
-            
-            numouts = connections[i]->numouts;
+        for (i = 0; i < fim; i++) {
+            grau[i] = rede_nome(i) != NULL ? rede_entradas(i, &ins) : -1;
+            if (grau[i] == 0) {
+                grau[i] = -1;
+                ordem[nordem++] = i;
+            }
+        }
 
-            for(j = 0; j < numouts ; j++) {
+        while (inicio < nos) {
+            if (inicio == nordem) { // só restam ciclos: todos juntos
+                for (i = 0; i < fim; i++) {
+                    if (grau[i] > 0) {
+                        grau[i] = -1;
+                        ordem[nordem++] = i;
+                    }
+                }
+            }
 
-                /* Caso uma conexão tenha o nó como OUT, faz-se o disconnect
-                   entre esse nó e o nó da entrada dessa conexão */
+            fimnivel = nordem;
+            prazo = stats_agora() + PRAZO_DRENO * 1000000LL;
+            niveis++;
 
-                if (connections[i]->outs[j] == a) {
+            /* 1. Fechar a entrada dos nós do nível */
 
-                    /* Criar array de options do disconnect e sua executá-lo */
-                    
-            	    args[0] = strdup("disconnect");
-                    sprintf(tmp, "%d", i);
-                    args[1] = strdup(tmp);
-                    args[2] = strdup(options[1]);
+            for (k = inicio, np = 0; k < fimnivel; k++) {
+                n = ordem[k];
+                espera_entrada(n, prazo);
 
-                    disconnect(args); // disconnect i j
-                    break;
+                if (engine_has(n)) {
+                    engine_remove(n);
+                    continue;
                 }
-            } 
-    	}
-    }
 
-    /* Todas as conexões do nó foram removidas, por isso pode-se remover o nó da
-       rede, matando o seu processo e fechando os seus FIFOs (apagando-os) */
+                close(nodesfd[n]);
+                if (nodesanel[n][0] != NULL) router_fecha(n); // EOF no anel
 
-    sprintf(in, "./tmp/%sin", options[1]);
-    sprintf(out, "./tmp/%sout", options[1]);
-    
-    f1 = fork();
+                if (!nodesexterno[n] && connections[n] == NULL) {
+                    kill(nodespid[n], SIGKILL); // o output perdia-se
+                }
 
-    if (f1 == -1) { perror("fork remove in"); return 1; }
+                pids[np++] = nodespid[n];
+                nodespid[n] = 0;
+            }
 
-    if (f1 == 0) {
-        devnull = open("/dev/null", O_WRONLY);
-        dup2(devnull, 1); // output para /dev/null
-        dup2(devnull, 2); // stderr para /dev/null
-        close(devnull);        
-        execlp("rm", "rm", in, NULL);
-    } 
-    else {
-        waitpid(f1, NULL, 0);
-    }
+            /* 2. Recolher os processos do nível */
 
-    f2 = fork();
+            forcados += espera_processos(pids, np, prazo);
 
-    if (f2 == -1) { perror("fork remove out"); return 1; } 
+            /* 3. Entregar o que ficou nos FIFOs de saída e passar aos nós
+               seguintes os que já não têm ligações a chegar */
 
-    if (f2 == 0) {
-        devnull = open("/dev/null", O_WRONLY);
-        dup2(devnull, 1); // output para /dev/null
-        dup2(devnull, 2); // putput para /dev/null
-        close(devnull);
-        execlp("rm", "rm", out, NULL);
-    }
-    else {
-        waitpid(f2, NULL, 0);
-    }
+            for (k = inicio, np = 0; k < fimnivel; k++) {
+                n = ordem[k];
+                if (connections[n] == NULL) continue;
 
-    kill(nodespid[a], SIGKILL);
-    waitpid(nodespid[a], NULL, 0); //esperar que o processo do nó termine
-    nodes[a] = 0; // array dos nós da rede deixa de ter o nó que foi removido
+                if (connections[n]->pid > 0) pids[np++] = connections[n]->pid;
+                else if (router_ativo()) router_drena(n);
+                connections[n]->pid = 0;
 
-    return 0;
-}
+                for (i = 0; i < connections[n]->numouts; i++) {
+                    if (grau[connections[n]->outs[i]] > 0 &&
+                        --grau[connections[n]->outs[i]] == 0) {
+                        grau[connections[n]->outs[i]] = -1;
+                        ordem[nordem++] = connections[n]->outs[i];
+                    }
+                }
+            }
 
-/*
- * @brief Comando que altera o componente/filtro a ser executado por um nó da
- *        rede
- *
- *        e.g. change <id> <cmd> <args...>
- *
- * Caso exista, remove o nó pré-existente (com o mesmo ID) da rede e cria um
- * novo nó (também com o mesmo ID) que executará o novo comando, mantendo todas
- * as conexões previamente existentes.
- *
- * @param options Array com os campos do comando (secções separadas por espaço)
- * @param flag    Indica se o output do novo nó criado deve ser descartado
- *                (parâmetro da função add_node)
- *
- * @return 0 em caso de sucesso
- *         1 em caso de erro
- *         2 caso o nó não exista na rede
- */
-int change(char** options, int flag) {
-    int a, numouts, pid, i;
-	Fanout f;
+            forcados += espera_processos(pids, np, prazo);
 
-    /* Verificar se o nó recebido existe na rede */
+            inicio = fimnivel;
+        }
+    }
 
-    a = atoi(options[1]);
+    /* Terminar tudo o que ainda estiver a correr e recolher todos os filhos */
 
-    if (nodes[a] == 0) {
-        return 2;
+    for (i = 0; i < fim; i++) {
+        if (rede_nome(i) == NULL) continue;
+        if (nodespid[i] > 0) kill(nodespid[i], SIGKILL);
+        if (connections[i] != NULL && connections[i]->pid > 0) {
+            kill(connections[i]->pid, SIGKILL);
+        }
     }
 
-    /* Verificar se existe alguma conexão cuja entrada (IN) corresponda ao nó
-       recebido */
+    for (i = 0; i < ninjetores; i++) kill(injetores[i], SIGKILL);
 
-    if (connections[a] != NULL) {
+    while (wait(NULL) > 0 || errno == EINTR);
 
-        /* Guardar os OUTS da conexão pré-existente */
+    /* Apagar os FIFOs */
+
+    for (i = 0; i < fim; i++) {
+        if (rede_nome(i) == NULL) continue;
+        sprintf(fifo, "./tmp/%din", i);
+        unlink(fifo);
+        sprintf(fifo, "./tmp/%dout", i);
+        unlink(fifo);
+        sprintf(fifo, "./tmp/%destado", i); // estado entregue por um change
+        unlink(fifo);
+    }
 
-    	numouts = connections[a]->numouts;
-    	int outs[numouts];
+    /* Sem o --drain, os registos que as ligações tinham no disco perdem-se */
 
-    	for (i = 0; i < numouts; i++) {
-    		outs[i] = connections[a]->outs[i];
-    	}
-	
-        /* Remover o nó antigo da rede e adicionar um nó que executará o novo
-           comando */
+    if (glob("./tmp/*.disco", 0, NULL, &disco) == 0) {
+        for (i = 0; i < (int) disco.gl_pathc; i++) unlink(disco.gl_pathv[i]);
+        globfree(&disco);
+    }
 
-	    remove_node(options);
-        add_node(options, flag);
+    if (drena) {
+        printf("Rede terminada: %d nós, %d níveis, %d processos terminados à "
+               "força, %.1f ms\n", nos, niveis, forcados,
+               (stats_agora() - t0) / 1e6);
+    }
+    else {
+        printf("Rede terminada: %d nós, %.1f ms\n", nos,
+               (stats_agora() - t0) / 1e6);
+    }
 
-	    /* Criar um processo que executará a conexão (fanout) relativa à
-           execução do novo comando do nó */
+    free(grau);
+    free(ordem);
+    free(pids);
 
-	    pid = fork();
+    return 0;
+}
 
-	    if (pid == -1) { perror("fork change"); return 1; }
+/******************************************************************************
+ *                      INTERPRETADOR DE COMANDOS                             *
+ ******************************************************************************/
 
-	    if (pid == 0) {
-            fanout(a, outs, numouts);
+/*
+ * @brief Retira as opções do nó dos campos de um comando node ou change
+ *
+ *        e.g. node <id> -m latency -a 1m -p 4:2 -o -r <ficheiro> <cmd> <args...>
+ *
+ * @param options    Array com os campos do comando (o NULL final incluído)
+ * @param numoptions Número de campos
+ * @param op         Onde se colocam as opções do nó
+ *
+ * @return Número de campos que ficam, -1 se o modo for inválido, -2 se a
+ *         capacidade for inválida, -3 se as réplicas forem inválidas, -4 se
+ *         não for possível ler o ficheiro do estado ou -5 se, retiradas as
+ *         opções, não ficar o comando do nó
+ */
+int opcoes_node(char** options, int numoptions, OpcoesNo* op)
+{
+    int k;
+
+    op->modo = OUTBUF_DEBITO;
+    op->anel = 0;
+    op->replicas[0] = 1;
+    op->replicas[1] = op->replicas[2] = 0;
+    op->estado = NULL;
+
+    while (numoptions > 2 && options[2] != NULL &&
+           (strcmp(options[2], "-m") == 0 || strcmp(options[2], "-a") == 0 ||
+            strcmp(options[2], "-p") == 0 || strcmp(options[2], "-o") == 0 ||
+            strcmp(options[2], "-r") == 0)) {
+        k = 2; // campos da opção
+
+        if (options[2][1] == 'm') {
+            if (numoptions < 4) return -1;
+            op->modo = outbuf_modo(options[3]);
+            if (op->modo == -1) return -1;
+        }
+        else if (options[2][1] == 'a') {
+            if (numoptions < 4) return -2;
+            op->anel = anel_capacidade(options[3]);
+            if (op->anel == 0) return -2;
+        }
+        else if (options[2][1] == 'p') {
+            if (numoptions < 4 || replica_spec(options[3], &op->replicas[0],
+                                               &op->replicas[1]) != 0) {
+                return -3;
+            }
+        }
+        else if (options[2][1] == 'r') {
+            if (numoptions < 4) return -4;
+            op->estado = options[3];
+            if (access(op->estado, R_OK) != 0) return -4;
         }
-	    
         else {
-	        f = create_fanout(pid, outs, numouts);
-	        connections[a] = f;
-	    }
-    }
-    else { /* A saída do nó recebido não está ligada a mais nenhum nó da rede */
-        remove_node(options);
-        add_node(options, flag);
+            op->replicas[2] = 1;
+            k = 1;
+        }
+
+        memmove(&options[2], &options[2 + k],
+                sizeof(char*) * (numoptions - 1 - k));
+        numoptions -= k;
     }
 
-    return 0;
+    if (numoptions < 3 || options[2] == NULL) return -5; // sem comando
+
+    return numoptions;
 }
 
+/*
+ * @brief Mensagem de erro das opções do nó (ver opcoes_node)
+ */
+void erro_opcoes_node(int r)
+{
+    if (r == -2) printf("Erro: Capacidade dos anéis inválida (-a <bytes>)\n");
+    else if (r == -3) printf("Erro: Réplicas inválidas (-p <N>[:<coluna>], "
+                             "até %d)\n", REPLICA_MAX);
+    else if (r == -4) printf("Erro: Ficheiro do estado inválido (-r <ficheiro>)\n");
+    else if (r == -5) printf("Erro: Falta o comando do nó (node <id> [opções] <cmd> <args...>)\n");
+    else printf("Erro: Modo de escrita inválido (latency ou throughput)\n");
+}
 
-/******************************************************************************
- *                      INTERPRETADOR DE COMANDOS                             *
- ******************************************************************************/
+/*
+ * @brief Indica se o componente de um nó é um comando externo (cujo output é
+ *        descartado) em vez de um dos componentes do trabalho
+ */
+int comando_externo(const char* cmd)
+{
+    return strcmp(cmd, "const") && strcmp(cmd, "filter") &&
+           strcmp(cmd, "window") && strcmp(cmd, "spawn");
+}
 
 /*
  * @brief Interpretador dos comandos do controlador
@@ -708,6 +2071,7 @@ int change(char** options, int flag) {
 int interpretador(char* cmdline)
 {
     int i = 0, ret = 0;
+    OpcoesNo op;
     char* options[MAX_SIZE];
 
     /* Separa a linha recebida pelos espaços */
@@ -723,17 +2087,17 @@ int interpretador(char* cmdline)
     /* Node */
 
     if (strcmp(options[0], "node") == 0) {
-        if (strcmp(options[2], "const") && strcmp(options[2], "filter") &&
-            strcmp(options[2], "window") && strcmp(options[2], "spawn")) {
-
-            ret = add_node(options, 1);
-        }
-        else {
-            ret = add_node(options, 0);
+        if ((i = opcoes_node(options, i, &op)) < 0) {
+            erro_opcoes_node(i);
+            busy = 0;
+            return 1;
         }
 
+        ret = add_node(options, comando_externo(options[2]), &op, 1);
+
         if (ret == 0) printf("Nó criado com sucesso\n");
         else if (ret == 2) printf("Erro: Já existe o nó na rede\n");
+        else if (ret == 3) printf("Erro: A rede já tem %d nós\n", REDE_MAXNOS);
     }
 
     /* Connect */
@@ -743,6 +2107,12 @@ int interpretador(char* cmdline)
 
         if (ret == 0) printf("Nós conectados com sucesso\n");
         else if (ret == 2) printf("Erro: Os nós já se encontram conectados\n");
+        else if (ret == 3) printf("Erro: O nó não existe na rede\n");
+        else if (ret == 4) printf("Erro: Opções inválidas (--cap <bytes>[k|m|g], "
+                                  "--overflow block|drop-oldest|drop-newest|spill)\n");
+        else if (ret == 5) printf("Erro: Só o router aplica outras políticas além "
+                                  "de block (o controlador sem -p nem -l, e a partir "
+                                  "de nós que não são tarefas do motor)\n");
     }
 
     /* Disconnect */
@@ -763,6 +2133,17 @@ int interpretador(char* cmdline)
         else if (ret == 2) printf("Erro: O nó não existe na rede\n");
     }
 
+    /* Injectfile */
+
+    else if (strcmp(options[0], "injectfile") == 0) {
+        ret = injectfile(options);
+
+        if (ret == 0) printf("Inject executado com sucesso\n");
+        else if (ret == 2) printf("Erro: O nó não existe na rede\n");
+        else if (ret == 3) printf("Erro: Opções inválidas (injectfile <id> <ficheiro> [--rate <R>[k|m|g][b]] [--loop])\n");
+        else if (ret == 4) printf("Erro: O ficheiro não existe ou não é um ficheiro regular\n");
+    }
+
     /* Remove */
 
     else if (strcmp(options[0], "remove") == 0) {
@@ -775,28 +2156,76 @@ int interpretador(char* cmdline)
     /* Change */
 
     else if (strcmp(options[0], "change") == 0) {
-        if (strcmp(options[2], "const") && strcmp(options[2], "filter") &&
-            strcmp(options[2], "window") && strcmp(options[2], "spawn")) {
-
-            ret = change(options, 1);
-        }
-        else {
-            ret = change(options, 0);
+        if ((i = opcoes_node(options, i, &op)) < 0) {
+            erro_opcoes_node(i);
+            busy = 0;
+            return 1;
         }
 
+        ret = change(options, comando_externo(options[2]), &op);
+
         if (ret == 0) printf("Comando do nó alterado com sucesso\n");
         else if (ret == 2) printf("Erro: O nó não existe na rede\n");
     }
 
+    /* Checkpoint */
+
+    else if (strcmp(options[0], "checkpoint") == 0) {
+        ret = checkpoint(options);
+
+        if (ret == 1) printf("Erro: O estado não foi guardado (checkpoint <id> <ficheiro>)\n");
+        else if (ret == 2) printf("Erro: O nó não existe na rede\n");
+        else if (ret == 3) printf("Erro: O nó não é um window\n");
+    }
+
+    /* Stats */
+
+    else if (strcmp(options[0], "stats") == 0) {
+        ret = stats(options);
+
+        if (ret == 1) printf("Erro: Contadores indisponíveis\n");
+        else if (ret == 2) printf("Erro: O nó não existe na rede\n");
+    }
+
+    /* Latency */
+
+    else if (strcmp(options[0], "latency") == 0) {
+        ret = latency(options);
+
+        if (ret == 1) printf("Erro: Traçado desligado (opção -t)\n");
+        else if (ret == 2) printf("Erro: O nó não existe na rede\n");
+    }
+
+    /* Shutdown (o controlador termina) */
+
+    else if (strcmp(options[0], "shutdown") == 0) {
+        if (options[1] != NULL && strcmp(options[1], "--drain")) {
+            printf("Erro: Opção inválida (--drain)\n");
+            busy = 0;
+            return 1;
+        }
+
+        encerra(options[1] != NULL);
+        exit(0);
+    }
+
     /* Modo de teste (Ctrl-D para regressar ao menu) */
 
 	else if (strcmp(options[0], "debug") == 0) {
 		int fdp, p;
-		char backs[MAX_SIZE];
+		char backs[MAX_SIZE], in[SMALL_SIZE];
+		char* pending;
 
-		fdp = open("./tmp/1in", O_WRONLY);
+		sprintf(in, "./tmp/%din", rede_procura("1"));
+		fdp = open(in, O_WRONLY);
 
 		write (1, "* MODO DE DEBUGGING (Ctrl-D para sair) *\n", 41);
+
+        /* O que já foi lido do stdin pelo readln também faz parte do input */
+
+        p = readln_take(0, &pending);
+        if (p > 0) write(fdp, pending, p);
+
         while(((p = read(0, backs, PIPE_BUF)) > 0)) {
 			write(fdp, backs, p);
 		}
@@ -817,6 +2246,214 @@ int interpretador(char* cmdline)
     return ret;
 }
 
+/*
+ * Nó de um lote de comandos node/connect aplicado de uma vez (aplica_config)
+ */
+typedef struct lote {
+    int    n;       // lugar do nó (-1 se o comando node falhou)
+    int    flag;    // 1 se o componente é um comando externo
+    char** options; // campos do comando node
+    int*   outs;    // destinos das ligações que partem do nó
+    int    numouts, cap;
+} Lote;
+
+/*
+ * @brief Aplica um ficheiro de configuração, com os comandos node e connect do
+ *        início do ficheiro aplicados de uma vez (opção -b)
+ *
+ * Em vez de cada comando ser interpretado à vez, os comandos node e connect
+ * até ao primeiro comando de outro tipo (normalmente o inject) são lidos todos
+ * antes de se criar o que quer que seja. A rede é depois criada por fases:
+ *   1. todos os nós são registados e todos os FIFOs são criados (o FIFO in de
+ *      cada nó fica aberto no controlador, ver add_node);
+ *   2. os processos dos nós são criados todos seguidos, antes das ligações
+ *      (o fork fica mais caro com cada descritor aberto pelo router). Cada
+ *      processo fica bloqueado no open do FIFO out até haver quem o leia;
+ *   3. as ligações de cada nó (somadas de todos os connect) são criadas com um
+ *      só set_fanout, enquanto os processos arrancam em paralelo. O router
+ *      abre os FIFOs sem bloquear e os fanouts (-p) são processos à parte.
+ * A rede está pronta quando todos os processos fizeram o exec (o lado de
+ * escrita de um pipe com O_CLOEXEC fecha-se em todos). Os nós cujo output não
+ * vai para lado nenhum ficam bloqueados até haver uma ligação (como no modo
+ * linha a linha), por isso não contam para a espera. No fim é escrito o tempo
+ * até a rede estar pronta e o resto do ficheiro é interpretado linha a linha.
+ *
+ * @param fd Descritor do ficheiro de configuração
+ *
+ * @return 0 em caso de sucesso
+ */
+int aplica_config(int fd)
+{
+    int i, j, k, n, numoptions, ret, resto = 0, numlote = 0, caplote = 0;
+    int nos = 0, ligacoes = 0, espera = 0, pronto[2], *indice, politica;
+    size_t cap;
+    OpcoesNo op;
+    long long t0 = stats_agora();
+    char buffer[MAX_SIZE], c;
+    char *linha, **options;
+    Lote* lote = NULL;
+    Lote* l;
+
+    /* Ler os comandos node e connect do início do ficheiro */
+
+    while (readln(fd, buffer, MAX_SIZE) > 0) {
+        if (strncmp(buffer, "node ", 5) && strncmp(buffer, "connect ", 8)) {
+            resto = 1;
+            break;
+        }
+
+        linha = strdup(buffer);
+        options = malloc(sizeof(char*) * (strlen(linha) / 2 + 2));
+        options[numoptions = 0] = strtok(linha, " ");
+        while (options[numoptions] != NULL) {
+            options[++numoptions] = strtok(NULL, " ");
+        }
+
+        if (numlote == caplote) {
+            caplote = caplote > 0 ? 2 * caplote : 64;
+            lote = realloc(lote, sizeof(Lote) * caplote);
+        }
+
+        l = &lote[numlote++];
+        memset(l, 0, sizeof(Lote));
+        l->options = options;
+        l->n = -1;
+
+        /* 1. Registar o nó e criar os seus FIFOs (sem o processo) */
+
+        if (strcmp(options[0], "node") == 0) {
+            if ((ret = opcoes_node(options, numoptions, &op)) < 0) {
+                erro_opcoes_node(ret);
+                continue;
+            }
+
+            l->flag = comando_externo(options[2]);
+            ret = add_node(options, l->flag, &op, 0);
+
+            if (ret == 0) l->n = rede_procura(options[1]);
+            else if (ret == 2) printf("Erro: Já existe o nó na rede\n");
+            else if (ret == 3) printf("Erro: A rede já tem %d nós\n", REDE_MAXNOS);
+        }
+    }
+
+    /* Destinos de cada nó, a partir dos connect (indice: lugar -> nó do lote) */
+
+    indice = malloc(sizeof(int) * (rede_fim() > 0 ? rede_fim() : 1));
+    for (i = 0; i < rede_fim(); i++) indice[i] = -1;
+    for (i = 0; i < numlote; i++) {
+        if (lote[i].n != -1) indice[lote[i].n] = i;
+    }
+
+    for (i = 0; i < numlote; i++) {
+        options = lote[i].options;
+        if (strcmp(options[0], "connect") || options[1] == NULL) continue;
+
+        if ((n = rede_procura(options[1])) == -1 || indice[n] == -1) {
+            printf("Erro: O nó não existe na rede\n");
+            continue;
+        }
+
+        l = &lote[indice[n]];
+
+        /* Opções das ligações (connect ... --cap/--overflow) */
+
+        cap = 0;
+        politica = ROUTER_BLOQUEIA;
+
+        for (j = 2; options[j] != NULL; j++) {
+            if ((ret = opcao_ligacao(options, &j, &cap, &politica)) != 0) {
+                if (ret == -1) {
+                    printf("Erro: Opções inválidas (--cap <bytes>[k|m|g], "
+                           "--overflow block|drop-oldest|drop-newest|spill)\n");
+                    break;
+                }
+            }
+        }
+
+        if (options[j] != NULL) continue;
+
+        if (politica != ROUTER_BLOQUEIA && (!router_ativo() || engine_has(n))) {
+            printf("Erro: Só o router aplica outras políticas além de block\n");
+            continue;
+        }
+
+        for (j = 2; options[j] != NULL; j++) {
+            if (opcao_ligacao(options, &j, &cap, &politica) != 0) continue;
+
+            if ((k = rede_procura(options[j])) == -1) {
+                printf("Erro: O nó não existe na rede\n");
+                continue;
+            }
+            if (l->numouts == l->cap) {
+                l->cap = l->cap > 0 ? 2 * l->cap : 4;
+                l->outs = realloc(l->outs, sizeof(int) * l->cap);
+            }
+            l->outs[l->numouts++] = k;
+            limite_define(n, k, cap, politica);
+        }
+    }
+
+    /* 2. Lançar os processos dos nós (o pipe só fica aberto nos que vão ter
+       uma ligação, os outros não chegam ao exec) */
+
+    pipe2(pronto, O_CLOEXEC);
+
+    for (i = 0; i < numlote; i++) {
+        l = &lote[i];
+        if (l->n == -1) continue;
+        nos++;
+
+        if (!engine_has(l->n) && (l->flag || l->numouts > 0)) {
+            lanca_no(l->n, l->options, l->flag);
+            espera++;
+        }
+    }
+
+    close(pronto[1]);
+
+    for (i = 0; i < numlote; i++) {
+        l = &lote[i];
+        if (l->n != -1 && !engine_has(l->n) && !l->flag && l->numouts == 0) {
+            lanca_no(l->n, l->options, l->flag);
+        }
+    }
+
+    /* 3. Criar as ligações, uma vez por nó, e esperar que todos os processos
+       façam o exec */
+
+    for (i = 0; i < numlote; i++) {
+        l = &lote[i];
+        if (l->numouts > 0 && liga(l->n, l->outs, l->numouts) == 0) {
+            ligacoes += connections[l->n]->numouts;
+        }
+    }
+
+    while (read(pronto[0], &c, 1) > 0);
+    close(pronto[0]);
+
+    printf("Rede pronta: %d nós, %d ligações, %d processos, %.1f ms\n", nos,
+           ligacoes, espera, (stats_agora() - t0) / 1e6);
+
+    for (i = 0; i < numlote; i++) {
+        free(lote[i].options[0]); // a linha (os campos apontam para ela)
+        free(lote[i].options);
+        free(lote[i].outs);
+    }
+    free(lote);
+    free(indice);
+
+    /* O resto do ficheiro é interpretado linha a linha */
+
+    if (resto) {
+        do {
+            busy = 1;
+            interpretador(buffer);
+        } while (readln(fd, buffer, MAX_SIZE) > 0);
+    }
+
+    return 0;
+}
+
 
 /******************************************************************************
  *                                 MAIN                                       *
@@ -829,25 +2466,81 @@ int interpretador(char* cmdline)
  * ficheiro de configuração. Neste caso, este ficheiro é lido e os comandos são
  * interpretados.
  *
+ *        e.g. controlador [-p] [-l] [-e] [-b] [-j workers] [-t N] [config]
+ *
+ * Opções:
+ *   -p  cada ligação é servida por um processo de fanout (em vez do router)
+ *   -l  como -p, mas os fanouts copiam as linhas pelo espaço do utilizador
+ *       (sem tee)
+ *   -e  os componentes const, filter e window correm dentro do controlador
+ *       (motor de execução, ver engine.h)
+ *   -j  número de workers do motor de execução (por omissão 2)
+ *   -b  os comandos node e connect do início do ficheiro de configuração são
+ *       aplicados de uma vez, com os nós lançados em paralelo (ver
+ *       aplica_config)
+ *   -t  traçado da latência: um em cada N registos injetados leva um carimbo
+ *       e o comando latency mostra os histogramas (ver traco.h)
+ *
  * Em todos os casos, o controlador permanece em execução, à espera que receba
- * mais comandos do stdin.
+ * mais comandos do stdin. No fim do stdin (EOF ou uma linha vazia), se as
+ * ligações ou os componentes correm dentro do controlador (router ou motor),
+ * a rede é fechada como com shutdown --drain depois de os injects terminarem;
+ * com -p/-l e sem -e, a rede continua a correr sem o controlador.
  *
  * @return 0 em caso de sucesso
  *         1 em caso de erro
  */
 int main(int argc, char* argv[])
 {
-    int fd, bytes;
+    int i, fd, bytes, opt, vivos, motor = 0, workers = 2;
+    long long prazo;
     char buffer[MAX_SIZE];
 
+    /* Opções da linha de comandos */
+
+    while ((opt = getopt(argc, argv, "plebj:t:")) != -1) {
+        if (opt == 'p') fanprocessos = 1;
+        else if (opt == 'l') fanlinhas = fanprocessos = 1;
+        else if (opt == 'e') motor = 1;
+        else if (opt == 'b') porlote = 1;
+        else if (opt == 'j') workers = atoi(optarg);
+        else if (opt == 't' && atoi(optarg) > 0) traco_amostra = atoi(optarg);
+        else {
+            fprintf(stderr, "utilização: %s [-p] [-l] [-e] [-b] [-j workers] "
+                    "[-t N] [config]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (motor && engine_init(workers) != 0) return 1;
+    if (!fanprocessos && router_init() != 0) return 1;
+
+    argc -= optind - 1;
+    argv += optind - 1;
+
     /* Inicializa as variáveis globais da rede */
 
     init_network();
 
+    /* Região partilhada dos contadores dos nós (comando stats) */
+
+    if (stats_cria(STATS_FICHEIRO) == -1) perror("contadores (stats)");
+
+    /* Região dos histogramas do traçado (comando latency) */
+
+    if (traco_amostra > 0 && traco_cria(TRACO_FICHEIRO) == -1) {
+        perror("histogramas (latency)");
+        traco_amostra = 0;
+    }
+
     /* Caso seja passado um ficheiro de configuração como argumento, este é lido
        e os comando são interpretados sequencialmente (linha a linha) */
 
-    if (argc == 2) {
+    if (argc == 2 && porlote) {
+        fd = open(argv[1], O_RDONLY);
+        aplica_config(fd);
+    }
+    else if (argc == 2) {
         fd = open(argv[1], O_RDONLY);
         
         while (readln(fd, buffer, MAX_SIZE) > 0) {
@@ -866,11 +2559,35 @@ int main(int argc, char* argv[])
         }
     }
 
-    /* Lê comandos do stdin até receber EOF (Ctrl-D) */
+    /* Lê comandos do stdin até receber EOF (Ctrl-D) ou uma linha vazia */
 
     while ((bytes = readln(0, buffer, MAX_SIZE)) > 0) {
         interpretador(buffer);
     }
 
+    /* O router e o motor são threads do controlador: se ele terminasse, a
+       rede parava com registos a meio. Por isso, no EOF, a rede é terminada
+       como com um shutdown --drain: os injects têm PRAZO_DRENO ms para
+       acabar e os que ainda estiverem a correr recebem SIGTERM (e SIGKILL se
+       também não acabarem no prazo do encerra; os injectfile --loop param no
+       fim do bloco em que estão) */
+
+    if (router_ativo() || engine_ativo()) {
+        prazo = stats_agora() + PRAZO_DRENO * 1000000LL;
+        do {
+            for (i = vivos = 0; i < ninjetores; i++) {
+                if (injciclos[i] || injetores[i] <= 0) continue;
+                if (waitpid(injetores[i], NULL, WNOHANG) == 0) vivos++;
+                else injetores[i] = 0;
+            }
+            if (vivos > 0) usleep(200);
+        } while (vivos > 0 && stats_agora() < prazo);
+
+        for (i = 0; i < ninjetores; i++) {
+            if (!injciclos[i] && injetores[i] > 0) kill(injetores[i], SIGTERM);
+        }
+        encerra(1);
+    }
+
     return 0;
 }
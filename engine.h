@@ -0,0 +1,1086 @@
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+
+#include "const.h"
+#include "filter.h"
+#include "window.h"
+#include "outbuf.h"
+#include "stats.h"
+#include "traco.h"
+#include "rede.h"
+
+/*
+ * Motor de execução dentro do controlador (controlador -e).
+ *
+ * Os nós que correm componentes sem efeitos externos (const, filter e window)
+ * deixam de ser processos: passam a ser tarefas executadas por um pequeno
+ * conjunto de threads (workers). Cada ligação entre duas tarefas é uma fila
+ * SPSC sem locks (um produtor, a tarefa de origem, e um consumidor, a tarefa
+ * de destino), pelo que as linhas já não passam pelo kernel entre nós.
+ *
+ * Tudo o resto continua a usar processos e FIFOs:
+ *  - cada tarefa tem o FIFO "Xin", lido por uma thread de entrada (ingress),
+ *    para que o inject e os fanouts de nós externos continuem a funcionar;
+ *  - uma ligação de uma tarefa para um nó externo (e.g. tee) escreve
+ *    diretamente no FIFO "Xin" desse nó, com as linhas agrupadas num buffer
+ *    de saída (outbuf.h) que é escrito no fim de cada passo da tarefa. O FIFO
+ *    é escrito sem bloquear (os workers têm o lock de leitura da topologia):
+ *    o que não couber fica na ligação e é escrito antes do resto, e enquanto
+ *    lá estiver a linha seguinte fica pendente, como com uma fila cheia;
+ *  - os nós externos e o spawn (que já faz um fork por linha) continuam a ser
+ *    processos, com os seus fanouts.
+ *
+ * A topologia (tarefas e ligações) é protegida por um rwlock: os workers e a
+ * thread de entrada usam-na com o lock de leitura, os comandos do controlador
+ * alteram-na com o lock de escrita. Cada tarefa só é executada por um worker
+ * de cada vez (flag ocupada).
+ *
+ * Cada tarefa atualiza os contadores do seu nó na região do controlador
+ * (stats.h): os do componente para as linhas processadas e os do fanout para
+ * as linhas entregues às saídas (filas ou FIFOs).
+ *
+ * Com o traçado (traco.h), o carimbo de uma linha chega pelo FIFO como uma
+ * linha à parte e vai pelas filas na mesma entrada que a linha que carimba
+ * (à frente dela); não é escrito nos FIFOs dos nós externos.
+ */
+
+#define ENGINE_FILA   (1 << 20) // capacidade de cada fila, em bytes
+#define ENGINE_LOTE   256       // linhas processadas de cada vez por tarefa
+#define ENGINE_MAXW   16        // número máximo de workers
+#define ENGINE_BLOCO  65536     // leitura do FIFO de entrada
+
+
+/******************************************************************************
+ *                          FILA SPSC SEM LOCKS                               *
+ ******************************************************************************/
+
+/*
+ * Fila circular de bytes com um produtor e um consumidor. Cada registo ocupa
+ * 4 bytes com o tamanho seguidos dos dados (alinhado a 4 bytes) e está sempre
+ * contíguo: se não couber até ao fim do buffer, escreve-se a marca SPSC_VOLTA
+ * e o registo começa no início.
+ *
+ * head e tail são contadores que só crescem; a posição no buffer é o valor
+ * módulo a capacidade (potência de 2).
+ */
+
+#define SPSC_VOLTA 0xFFFFFFFFu
+
+typedef struct spsc {
+    _Atomic size_t head;  // escrito apenas pelo produtor
+    char pad1[64 - sizeof(size_t)];
+    _Atomic size_t tail;  // escrito apenas pelo consumidor
+    char pad2[64 - sizeof(size_t)];
+    size_t cap;
+    char*  data;
+} *Spsc;
+
+/*
+ * @brief Cria uma fila com a capacidade indicada (potência de 2)
+ */
+Spsc spsc_create(size_t cap) {
+    Spsc q = malloc(sizeof(struct spsc));
+
+    atomic_init(&q->head, 0);
+    atomic_init(&q->tail, 0);
+    q->cap = cap;
+    q->data = malloc(cap);
+
+    return q;
+}
+
+void spsc_destroy(Spsc q) {
+    free(q->data);
+    free(q);
+}
+
+static size_t spsc_tamanho(size_t len) {
+    return (4 + len + 3) & ~(size_t) 3;
+}
+
+/*
+ * @brief Coloca um registo na fila (só pode ser chamada pelo produtor)
+ *
+ * @return 0 em caso de sucesso
+ *         -1 se a fila estiver cheia
+ *         -2 se o registo for maior do que metade da fila (nunca caberia)
+ */
+int spsc_push(Spsc q, const char* rec, size_t len) {
+    size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+    size_t need = spsc_tamanho(len);
+    size_t pos = head & (q->cap - 1);
+    size_t livre = q->cap - (head - tail);
+    size_t fim = q->cap - pos;
+    uint32_t l = len;
+
+    if (need > q->cap / 2) return -2;
+
+    if (need > fim) { // não cabe até ao fim: salta para o início
+        if (fim + need > livre) return -1;
+        l = SPSC_VOLTA;
+        memcpy(q->data + pos, &l, 4);
+        head += fim;
+        pos = 0;
+        l = len;
+    }
+    else if (need > livre) {
+        return -1;
+    }
+
+    memcpy(q->data + pos, &l, 4);
+    memcpy(q->data + pos + 4, rec, len);
+
+    atomic_store_explicit(&q->head, head + need, memory_order_release);
+
+    return 0;
+}
+
+/*
+ * @brief Devolve o primeiro registo da fila sem o retirar (só pode ser
+ *        chamada pelo consumidor)
+ *
+ * @return Tamanho do registo ou -1 se a fila estiver vazia
+ */
+ssize_t spsc_peek(Spsc q, const char** rec) {
+    size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&q->head, memory_order_acquire);
+    size_t pos;
+    uint32_t l;
+
+    if (tail == head) return -1;
+
+    pos = tail & (q->cap - 1);
+    memcpy(&l, q->data + pos, 4);
+
+    if (l == SPSC_VOLTA) {
+        tail += q->cap - pos;
+        atomic_store_explicit(&q->tail, tail, memory_order_release);
+        if (tail == head) return -1;
+        pos = 0;
+        memcpy(&l, q->data, 4);
+    }
+
+    *rec = q->data + pos + 4;
+
+    return l;
+}
+
+/*
+ * @brief Retira o registo devolvido pelo último spsc_peek
+ */
+void spsc_pop(Spsc q) {
+    size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    uint32_t l;
+
+    memcpy(&l, q->data + (tail & (q->cap - 1)), 4);
+    atomic_store_explicit(&q->tail, tail + spsc_tamanho(l),
+                          memory_order_release);
+}
+
+int spsc_vazia(Spsc q) {
+    return atomic_load_explicit(&q->tail, memory_order_relaxed) ==
+           atomic_load_explicit(&q->head, memory_order_acquire);
+}
+
+
+/******************************************************************************
+ *                            TAREFAS E LIGAÇÕES                              *
+ ******************************************************************************/
+
+typedef ssize_t (*Operador)(void* estado, const char* line, size_t len,
+                            const char** out);
+
+/*
+ * Ligação de uma tarefa para um nó. Se o destino for outra tarefa, as linhas
+ * vão pela fila; se for um nó externo, são escritas no seu FIFO de entrada.
+ */
+typedef struct edge {
+    Spsc q;      // fila (NULL se o destino for externo)
+    int  fd;     // FIFO de entrada do destino externo (-1 se for uma tarefa)
+    int  dst;    // ID do nó de destino
+    Outbuf ob;   // linhas por escrever no FIFO (destino externo)
+    char*  resto; // bytes que o FIFO não aceitou (escritos antes dos outros)
+    size_t restolen, restocap;
+    Histo traco; // histograma da ligação (traco.h, NULL sem traçado)
+    _Atomic int fechada; // a origem deixou de escrever (disconnect)
+} *Edge;
+
+typedef struct task {
+    int      id;
+    char**   args;    // cópia dos argumentos do componente
+    void*    estado;  // estado do operador
+    Operador op;
+    int      modo;    // modo de escrita para os nós externos (outbuf.h)
+    Stats    st;      // contadores do componente (stats.h)
+    Stats    stfan;   // contadores das saídas
+
+    int      fdin;    // FIFO de entrada (lido pela thread de entrada)
+    int      fdw;     // escritor do próprio FIFO, para nunca haver EOF
+    Spsc     ingress; // linhas lidas do FIFO de entrada
+    char*    inbuf;   // linha incompleta lida do FIFO
+    size_t   inlen, incap;
+    char*    ingpend; // linha lida do FIFO à espera de espaço na fila
+    size_t   ingpendlen;
+
+    Edge*    ins;     // ligações de entrada (vindas de outras tarefas)
+    int      nins, capins;
+    Edge*    outs;    // ligações de saída
+    int      nouts, capouts;
+
+    atomic_flag ocupada; // a tarefa está a ser executada por um worker
+
+    /* Linha de saída que ainda não foi entregue a todas as saídas (uma das
+       filas estava cheia) */
+    int      pendente;
+    char*    pend;
+    size_t   pendlen, pendcap;
+    char*    entregue; // entregue[i] == 1 se outs[i] já recebeu a linha
+    size_t   pendtraco; // bytes do carimbo à frente da linha pendente
+
+    Carimbo  car;     // carimbo da próxima linha (traco.h)
+} *Task;
+
+static Task engine_tasks[REDE_MAXNOS]; // tarefas indexadas pelo ID do nó
+static Task* engine_lista = NULL;   // tarefas (lista compacta para os workers)
+static int engine_ntasks = 0;
+static int engine_captasks = 0;
+static int engine_gen = 0;          // muda sempre que a topologia muda
+
+static pthread_rwlock_t engine_topo;
+static pthread_t engine_workers[ENGINE_MAXW];
+static pthread_t engine_entrada;
+static int engine_nworkers = 0;
+static volatile int engine_stop = 0;
+
+static ssize_t op_const(void* e, const char* l, size_t n, const char** o) {
+    return const_process(e, l, n, o);
+}
+
+static ssize_t op_filter(void* e, const char* l, size_t n, const char** o) {
+    return filter_process(e, l, n, o);
+}
+
+static ssize_t op_window(void* e, const char* l, size_t n, const char** o) {
+    return window_process(e, l, n, o);
+}
+
+/*
+ * @brief Indica se o motor de execução está a correr (opção -e)
+ */
+int engine_ativo() {
+    return engine_nworkers > 0;
+}
+
+/*
+ * @brief Indica se um componente pode ser executado pelo motor
+ */
+int engine_builtin(const char* cmd) {
+    return !strcmp(cmd, "const") || !strcmp(cmd, "filter") ||
+           !strcmp(cmd, "window");
+}
+
+/*
+ * @brief Indica se o nó é uma tarefa do motor
+ */
+int engine_has(int id) {
+    return engine_nworkers > 0 && id >= 0 && id < REDE_MAXNOS &&
+           engine_tasks[id] != NULL;
+}
+
+static void engine_lock() { pthread_rwlock_wrlock(&engine_topo); }
+static void engine_unlock() { pthread_rwlock_unlock(&engine_topo); }
+
+/*
+ * @brief Destino do buffer de uma ligação para um nó externo: escreve no FIFO
+ *        sem bloquear e guarda o que não for aceite
+ *
+ * Uma escrita de até PIPE_BUF bytes entra toda ou não entra, por isso os
+ * registos nunca ficam partidos entre escritores. Se o leitor fechou o FIFO,
+ * as linhas perdem-se (tal como com o nó terminado).
+ */
+static int edge_escreve(void* arg, const char* buf, size_t n) {
+    Edge e = arg;
+    ssize_t w = 0;
+
+    if (e->restolen == 0) {
+        w = write(e->fd, buf, n);
+        if (w == -1) {
+            if (errno != EAGAIN && errno != EINTR) return -1;
+            w = 0;
+        }
+    }
+
+    if ((size_t) w < n) {
+        if (e->restolen + n - w > e->restocap) {
+            if (e->restocap == 0) e->restocap = PIPE_BUF;
+            while (e->restolen + n - w > e->restocap) e->restocap *= 2;
+            e->resto = realloc(e->resto, e->restocap);
+        }
+        memcpy(e->resto + e->restolen, buf + w, n - w);
+        e->restolen += n - w;
+    }
+
+    return 0;
+}
+
+/*
+ * @brief Escreve, sem bloquear, o que o FIFO de uma ligação para um nó
+ *        externo não tinha aceitado
+ *
+ * Cada escrita tem só registos completos e no máximo PIPE_BUF bytes (ou um
+ * registo maior sozinho), para continuar a ser atómica.
+ *
+ * @return 1 se já não ficou nada por escrever, 0 se o FIFO continua cheio
+ */
+static int edge_despeja(Edge e) {
+    ssize_t w;
+    size_t n;
+    char* nl;
+
+    while (e->restolen > 0) {
+        n = e->restolen < PIPE_BUF ? e->restolen : PIPE_BUF;
+        if ((nl = memrchr(e->resto, '\n', n)) == NULL) {
+            nl = memchr(e->resto, '\n', e->restolen);
+        }
+        n = nl != NULL ? (size_t) (nl - e->resto + 1) : e->restolen;
+
+        w = write(e->fd, e->resto, n);
+        if (w == -1) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN) return 0;
+            e->restolen = 0; // o leitor fechou o FIFO
+            break;
+        }
+
+        memmove(e->resto, e->resto + w, e->restolen - w);
+        e->restolen -= w;
+    }
+
+    return 1;
+}
+
+/*
+ * @brief Entrega a linha pendente a todas as saídas que ainda não a receberam
+ *
+ * @return 1 se foi entregue a todas, 0 se alguma fila (ou FIFO) estiver cheia
+ */
+static int task_emite(Task t) {
+    int i, r;
+    Edge e;
+
+    for (i = 0; i < t->nouts; i++) {
+        if (t->entregue[i]) continue;
+
+        e = t->outs[i];
+
+        if (e->q == NULL) { // nó externo: buffer do FIFO, sem o carimbo
+            if (!edge_despeja(e)) return 0;
+            if (t->pendtraco) traco_entrega(t->pend, t->id, e->dst, 0, stats_agora());
+            outbuf_write(e->ob, t->pend + t->pendtraco, t->pendlen - t->pendtraco);
+        }
+        else {
+            r = spsc_push(e->q, t->pend, t->pendlen);
+            if (r == -1) return 0;
+            if (r == -2) { // nunca caberia na fila: perde-se e é contada
+                fprintf(stderr, "motor: linha demasiado grande\n");
+                stats_soma(&t->stfan->descartados, 1);
+            }
+            else {
+                stats_soma(&t->stfan->saida, 1);
+                stats_soma(&t->stfan->bsaida, t->pendlen - t->pendtraco);
+            }
+        }
+
+        t->entregue[i] = 1;
+    }
+
+    t->pendente = 0;
+
+    return 1;
+}
+
+/*
+ * @brief Guarda uma linha de saída como pendente e tenta entregá-la
+ *
+ * A linha é sempre copiada, porque pode apontar para a fila de entrada (o
+ * filter devolve a própria linha) ou para o estado do operador.
+ *
+ * @param tam Tamanho do carimbo em t->car.buf que vai à frente da linha (0
+ *            sem carimbo)
+ */
+static int task_saida(Task t, const char* out, size_t len, size_t tam) {
+    if (len + tam > t->pendcap) {
+        while (len + tam > t->pendcap) t->pendcap *= 2;
+        t->pend = realloc(t->pend, t->pendcap);
+    }
+
+    memcpy(t->pend, t->car.buf, tam);
+    memcpy(t->pend + tam, out, len);
+    t->pendlen = len + tam;
+    t->pendtraco = tam;
+    t->pendente = 1;
+    memset(t->entregue, 0, t->nouts);
+
+    stats_soma(&t->stfan->entrada, 1);
+    stats_soma(&t->stfan->bentrada, len);
+
+    return task_emite(t);
+}
+
+/*
+ * @brief Executa uma tarefa: processa até ENGINE_LOTE linhas das suas filas
+ *
+ * @return Número de linhas processadas
+ */
+static int task_step(Task t) {
+    int i, n = 0;
+    ssize_t len, m;
+    size_t tam;
+    const char* rec;
+    const char* out;
+    Spsc q;
+    Edge e;
+
+    for (i = 0; i < t->nouts; i++) {
+        if (t->outs[i]->q == NULL) edge_despeja(t->outs[i]);
+    }
+
+    if (t->pendente && !task_emite(t)) return 0;
+
+    /* Primeiro a fila do FIFO de entrada, depois as ligações */
+
+    for (i = -1; i < t->nins && n < ENGINE_LOTE; i++) {
+        q = i < 0 ? t->ingress : t->ins[i]->q;
+
+        while (n < ENGINE_LOTE && (len = spsc_peek(q, &rec)) >= 0) {
+
+            /* Carimbo do traçado: sozinho (vindo do FIFO) ou à frente da
+               linha (vindo de outra tarefa, que já conta a ligação) */
+
+            if (traco_e(rec, len)) {
+                traco_entrada(&t->car, rec);
+                if (i >= 0) {
+                    histo_regista(t->ins[i]->traco, stats_agora() - t->car.ultimo);
+                    t->car.ultimo = stats_agora();
+                }
+                if (len == TRACO_TAM) {
+                    spsc_pop(q);
+                    continue;
+                }
+                rec += TRACO_TAM;
+                len -= TRACO_TAM;
+            }
+
+            m = t->op(t->estado, rec, len, &out);
+            n++;
+
+            stats_soma(&t->st->entrada, 1);
+            stats_soma(&t->st->bentrada, len);
+            if (m > 0) {
+                stats_soma(&t->st->saida, 1);
+                stats_soma(&t->st->bsaida, m);
+            }
+            else {
+                stats_soma(&t->st->descartados, 1);
+            }
+
+            tam = t->car.ativo ? traco_saida(&t->car, m > 0 && t->nouts > 0) : 0;
+
+            if (m > 0 && t->nouts > 0 && !task_saida(t, out, m, tam)) {
+                spsc_pop(q);
+                return n;
+            }
+
+            spsc_pop(q);
+        }
+    }
+
+    /* Fim do passo: o que ficou acumulado para os nós externos é escrito */
+
+    for (i = 0; i < t->nouts; i++) {
+        if (t->outs[i]->q == NULL) outbuf_flush(t->outs[i]->ob);
+    }
+
+    /* Ligações fechadas pela origem são libertadas quando ficam vazias */
+
+    for (i = 0; i < t->nins; i++) {
+        e = t->ins[i];
+        if (atomic_load(&e->fechada) && spsc_vazia(e->q)) {
+            memmove(t->ins + i, t->ins + i + 1, sizeof(Edge) * (t->nins - i - 1));
+            t->nins--;
+            i--;
+            spsc_destroy(e->q);
+            free(e);
+        }
+    }
+
+    return n;
+}
+
+/*
+ * @brief Ciclo de um worker
+ *
+ * Percorre todas as tarefas (cada worker começa num ponto diferente) e executa
+ * as que estiverem livres. Quando não há trabalho, dorme cada vez mais tempo
+ * (até 1 ms).
+ */
+static void* engine_worker(void* arg) {
+    int k, feito, w = (intptr_t) arg;
+    long espera = 0;
+    Task t;
+    struct timespec ts;
+
+    while (!engine_stop) {
+        feito = 0;
+
+        pthread_rwlock_rdlock(&engine_topo);
+
+        for (k = 0; k < engine_ntasks; k++) {
+            t = engine_lista[(k + w) % engine_ntasks];
+            if (!atomic_flag_test_and_set(&t->ocupada)) {
+                feito += task_step(t);
+                atomic_flag_clear(&t->ocupada);
+            }
+        }
+
+        pthread_rwlock_unlock(&engine_topo);
+
+        if (feito) {
+            espera = 0;
+        }
+        else {
+            espera = espera ? espera * 2 : 20000;
+            if (espera > 1000000) espera = 1000000;
+            ts.tv_sec = 0;
+            ts.tv_nsec = espera;
+            nanosleep(&ts, NULL);
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * @brief Lê as linhas disponíveis no FIFO de uma tarefa para a sua fila
+ *
+ * Só lê do FIFO quando a linha pendente (se houver) já entrou na fila.
+ */
+static void task_entrada(Task t) {
+    ssize_t n;
+    char* nl;
+    char* ini;
+
+    if (t->ingpendlen > 0) {
+        if (spsc_push(t->ingress, t->ingpend, t->ingpendlen) == -1) return;
+        t->ingpendlen = 0;
+    }
+
+    if (t->inlen == t->incap) {
+        t->incap *= 2;
+        t->inbuf = realloc(t->inbuf, t->incap);
+    }
+
+    n = read(t->fdin, t->inbuf + t->inlen, t->incap - t->inlen);
+    if (n <= 0) return;
+    t->inlen += n;
+
+    /* Passar as linhas completas para a fila */
+
+    ini = t->inbuf;
+    while ((nl = memchr(ini, '\n', t->inbuf + t->inlen - ini)) != NULL) {
+        n = nl - ini + 1;
+
+        if (spsc_push(t->ingress, ini, n) == -1) { // fila cheia
+            t->ingpend = realloc(t->ingpend, n);
+            memcpy(t->ingpend, ini, n);
+            t->ingpendlen = n;
+            ini += n;
+            break;
+        }
+
+        ini += n;
+    }
+
+    t->inlen -= ini - t->inbuf;
+    memmove(t->inbuf, ini, t->inlen);
+}
+
+/*
+ * @brief Thread de entrada: lê os FIFOs "Xin" de todas as tarefas com poll
+ */
+static void* engine_ingress(void* arg) {
+    int i, n = 0, cap = 0, gen = -1;
+    struct pollfd* pfds = NULL;
+    int* ids = NULL;
+    Task t;
+
+    while (!engine_stop) {
+
+        /* Reconstruir a lista de descritores quando a topologia muda */
+
+        pthread_rwlock_rdlock(&engine_topo);
+
+        if (gen != engine_gen) {
+            if (engine_ntasks > cap) {
+                cap = engine_ntasks * 2;
+                pfds = realloc(pfds, sizeof(struct pollfd) * cap);
+                ids = realloc(ids, sizeof(int) * cap);
+            }
+            for (i = 0; i < engine_ntasks; i++) {
+                pfds[i].fd = engine_lista[i]->fdin;
+                ids[i] = engine_lista[i]->id;
+            }
+            n = engine_ntasks;
+            gen = engine_gen;
+        }
+
+        /* Uma tarefa com uma linha pendente não lê mais até ter espaço */
+
+        for (i = 0; i < n; i++) {
+            t = engine_tasks[ids[i]];
+            pfds[i].events = (t && t->ingpendlen == 0) ? POLLIN : 0;
+        }
+
+        pthread_rwlock_unlock(&engine_topo);
+
+        poll(pfds, n, 10);
+
+        pthread_rwlock_rdlock(&engine_topo);
+
+        if (gen == engine_gen) {
+            for (i = 0; i < n; i++) {
+                t = engine_tasks[ids[i]];
+                if (t && ((pfds[i].revents & POLLIN) || t->ingpendlen > 0)) {
+                    task_entrada(t);
+                }
+            }
+        }
+
+        pthread_rwlock_unlock(&engine_topo);
+    }
+
+    free(pfds);
+    free(ids);
+
+    return NULL;
+}
+
+
+/******************************************************************************
+ *                        INTERFACE PARA O CONTROLADOR                        *
+ ******************************************************************************/
+
+/*
+ * @brief Inicia o motor com o número de workers indicado
+ *
+ * @return 0 em caso de sucesso
+ *         1 em caso de erro
+ */
+int engine_init(int nworkers) {
+    int i;
+    pthread_rwlockattr_t attr;
+
+    if (nworkers < 1) nworkers = 1;
+    if (nworkers > ENGINE_MAXW) nworkers = ENGINE_MAXW;
+
+    /* Os comandos do controlador (escritores) não podem ficar à espera que
+       os workers deixem de ler a topologia */
+
+    pthread_rwlockattr_init(&attr);
+    pthread_rwlockattr_setkind_np(&attr,
+                                  PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    pthread_rwlock_init(&engine_topo, &attr);
+
+    for (i = 0; i < nworkers; i++) {
+        if (pthread_create(&engine_workers[i], NULL, engine_worker,
+                           (void*) (intptr_t) i)) {
+            perror("pthread_create");
+            return 1;
+        }
+    }
+
+    engine_nworkers = nworkers;
+
+    if (pthread_create(&engine_entrada, NULL, engine_ingress, NULL)) {
+        perror("pthread_create");
+        return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * @brief Liberta os argumentos de uma tarefa que não chegou a ser criada e a
+ *        própria tarefa
+ */
+static void task_desfaz(Task t) {
+    int i;
+
+    for (i = 0; t->args[i] != NULL; i++) free(t->args[i]);
+    free(t->args);
+    free(t);
+}
+
+/*
+ * @brief Cria uma tarefa para um nó
+ *
+ * @param id   ID do nó
+ * @param argv Componente e argumentos (argv[0] é o nome do componente)
+ * @param modo Modo de escrita para os nós externos (OUTBUF_DEBITO ou
+ *             OUTBUF_LATENCIA)
+ *
+ * @return 0 em caso de sucesso
+ *         1 em caso de erro
+ */
+int engine_add(int id, char** argv, int modo) {
+    int argc, i;
+    char in[32];
+    Task t;
+
+    for (argc = 0; argv[argc] != NULL; argc++);
+
+    t = calloc(1, sizeof(struct task));
+    t->id = id;
+    t->modo = modo;
+    t->st = stats_no(id, 0);
+    t->stfan = stats_no(id, 1);
+    t->args = malloc(sizeof(char*) * (argc + 1));
+    for (i = 0; i < argc; i++) t->args[i] = strdup(argv[i]);
+    t->args[argc] = NULL;
+
+    if (!strcmp(argv[0], "const")) {
+        t->estado = const_init(argc, (char const**) t->args);
+        t->op = op_const;
+    }
+    else if (!strcmp(argv[0], "filter")) {
+        t->estado = filter_init(argc, (char const**) t->args);
+        t->op = op_filter;
+    }
+    else {
+        t->estado = window_init(argc, (char const**) t->args);
+        t->op = op_window;
+    }
+
+    if (t->estado == NULL) {
+        task_desfaz(t);
+        return 1;
+    }
+
+    /* FIFO de entrada, aberto sem bloquear (e com um escritor próprio para
+       que o poll não acorde com EOF quando os outros escritores fecham) */
+
+    sprintf(in, "./tmp/%din", id);
+    mkfifo(in, 0666);
+    t->fdin = open(in, O_RDONLY | O_NONBLOCK);
+    t->fdw = t->fdin == -1 ? -1 : open(in, O_WRONLY | O_NONBLOCK);
+
+    if (t->fdin == -1 || t->fdw == -1) {
+        perror("open fifo motor");
+        if (t->fdin != -1) close(t->fdin);
+        if (t->op == op_window) window_free(t->estado);
+        task_desfaz(t);
+        return 1;
+    }
+
+    t->ingress = spsc_create(ENGINE_FILA);
+    t->incap = ENGINE_BLOCO;
+    t->inbuf = malloc(t->incap);
+    t->pendcap = 256;
+    t->pend = malloc(t->pendcap);
+    t->car.no = traco_no(id, 0);
+    t->car.total = traco_no(id, 1);
+    atomic_flag_clear(&t->ocupada);
+
+    engine_lock();
+
+    if (engine_ntasks == engine_captasks) {
+        engine_captasks = engine_captasks ? engine_captasks * 2 : 16;
+        engine_lista = realloc(engine_lista, sizeof(Task) * engine_captasks);
+    }
+    engine_lista[engine_ntasks++] = t;
+    engine_tasks[id] = t;
+    engine_gen++;
+
+    engine_unlock();
+
+    return 0;
+}
+
+/*
+ * @brief Retira uma ligação da lista de saídas de uma tarefa (com o lock de
+ *        escrita)
+ *
+ * Uma ligação para outra tarefa fica marcada como fechada e é libertada pelo
+ * destino quando este já tiver lido tudo o que lá estava. A linha pendente
+ * continua pendente para as outras saídas.
+ *
+ * O que ainda não foi escrito no FIFO de um nó externo é escrito antes de o
+ * fechar (aqui a bloquear, como antes do disconnect).
+ */
+static void task_retira_saida(Task t, int i) {
+    Edge e = t->outs[i];
+
+    if (e->q == NULL) {
+        fcntl(e->fd, F_SETFL, fcntl(e->fd, F_GETFL) & ~O_NONBLOCK);
+        outbuf_flush(e->ob);
+        edge_despeja(e);
+        outbuf_free(e->ob);
+        free(e->resto);
+        close(e->fd);
+        free(e);
+    }
+    else {
+        atomic_store(&e->fechada, 1);
+    }
+
+    t->outs[i] = t->outs[--t->nouts];
+    t->entregue[i] = t->entregue[t->nouts];
+}
+
+/*
+ * @brief Define as saídas de uma tarefa (substitui as anteriores)
+ *
+ * As ligações que se mantêm não são tocadas; as que saem são fechadas sem
+ * perder as linhas que já estavam nas filas. A linha pendente (se houver)
+ * mantém-se: só as ligações retiradas deixam de a receber e as novas também
+ * a recebem.
+ *
+ * @param id      ID do nó de origem (tarefa)
+ * @param outs    IDs dos nós de destino
+ * @param numouts Número de destinos
+ *
+ * @return 0 em caso de sucesso
+ *         1 em caso de erro
+ */
+int engine_connect(int id, int* outs, int numouts) {
+    int i, j, fds[numouts > 0 ? numouts : 1];
+    char out[32];
+    Task t = engine_tasks[id], d;
+    Edge e;
+
+    /* Os FIFOs dos destinos externos são abertos antes de se tomar o lock,
+       porque o open bloqueia até o nó abrir o FIFO para leitura */
+
+    for (i = 0; i < numouts; i++) {
+        fds[i] = -1;
+        if (!engine_has(outs[i])) {
+            for (j = 0; j < t->nouts; j++) {
+                if (t->outs[j]->dst == outs[i]) break;
+            }
+            if (j == t->nouts) {
+                sprintf(out, "./tmp/%din", outs[i]);
+                fds[i] = open(out, O_WRONLY);
+                if (fds[i] == -1) perror("open fifo out motor");
+            }
+        }
+    }
+
+    engine_lock();
+
+    /* Retirar as saídas que não estão no novo conjunto */
+
+    for (j = 0; j < t->nouts; j++) {
+        for (i = 0; i < numouts && outs[i] != t->outs[j]->dst; i++);
+        if (i == numouts) task_retira_saida(t, j--);
+    }
+
+    /* Acrescentar as novas */
+
+    for (i = 0; i < numouts; i++) {
+        for (j = 0; j < t->nouts && t->outs[j]->dst != outs[i]; j++);
+        if (j < t->nouts) continue;
+
+        e = calloc(1, sizeof(struct edge));
+        e->dst = outs[i];
+        e->fd = fds[i];
+        e->traco = traco_aresta(id, outs[i], 0); // criada pelo controlador
+        if (fds[i] != -1) {
+            fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+            e->ob = outbuf_init(fds[i], t->modo);
+            e->ob->stats = t->stfan;
+            e->ob->escreve = edge_escreve; // o limite continua a ser PIPE_BUF
+            e->ob->destino = e;
+        }
+
+        if (fds[i] == -1) {
+            d = engine_tasks[outs[i]];
+            if (d == NULL) { free(e); continue; }
+
+            e->q = spsc_create(ENGINE_FILA);
+
+            if (d->nins == d->capins) {
+                d->capins = d->capins ? d->capins * 2 : 4;
+                d->ins = realloc(d->ins, sizeof(Edge) * d->capins);
+            }
+            d->ins[d->nins++] = e;
+        }
+
+        if (t->nouts == t->capouts) {
+            t->capouts = t->capouts ? t->capouts * 2 : 4;
+            t->outs = realloc(t->outs, sizeof(Edge) * t->capouts);
+            t->entregue = realloc(t->entregue, t->capouts);
+        }
+        t->entregue[t->nouts] = 0;
+        t->outs[t->nouts++] = e;
+    }
+
+    engine_gen++;
+
+    engine_unlock();
+
+    return 0;
+}
+
+/*
+ * @brief Remove a tarefa de um nó
+ *
+ * As ligações de outras tarefas para esta são retiradas das suas saídas e as
+ * linhas que estavam nas filas perdem-se (tal como com o SIGKILL de um nó).
+ */
+void engine_remove(int id) {
+    int i, j;
+    char in[32];
+    Task t = engine_tasks[id], o;
+    Edge e;
+
+    engine_lock();
+
+    for (i = 0; i < engine_ntasks; i++) {
+        if (engine_lista[i] == t) engine_lista[i--] = engine_lista[--engine_ntasks];
+    }
+    engine_tasks[id] = NULL;
+
+    /* Ligações de outras tarefas para esta */
+
+    for (i = 0; i < engine_ntasks; i++) {
+        o = engine_lista[i];
+        for (j = 0; j < o->nouts; j++) {
+            if (o->outs[j]->dst == id) {
+                o->outs[j] = o->outs[--o->nouts];
+                o->entregue[j] = o->entregue[o->nouts];
+                j--;
+            }
+        }
+    }
+
+    for (i = 0; i < t->nins; i++) {
+        e = t->ins[i];
+        spsc_destroy(e->q);
+        free(e);
+    }
+
+    /* Ligações desta tarefa para outras (ficam fechadas para o destino) */
+
+    while (t->nouts > 0) task_retira_saida(t, 0);
+
+    engine_gen++;
+
+    engine_unlock();
+
+    close(t->fdin);
+    close(t->fdw);
+    sprintf(in, "./tmp/%din", id);
+    unlink(in);
+
+    for (i = 0; t->args[i] != NULL; i++) free(t->args[i]);
+    free(t->args);
+    spsc_destroy(t->ingress);
+    free(t->inbuf);
+    free(t->ingpend);
+    free(t->pend);
+    free(t->ins);
+    free(t->outs);
+    free(t->entregue);
+    if (t->op == op_window) window_free(t->estado); // janelas por chave (--by)
+    free(t); // o estado dos outros operadores fica (não têm destrutor)
+}
+
+/*
+ * @brief Indica se a tarefa de um nó já processou tudo o que lhe chegou (o
+ *        FIFO de entrada e as filas estão vazios e não há linhas pendentes)
+ *
+ * Com o lock de escrita nenhum worker está a meio de um passo, por isso o que
+ * a tarefa já escreveu para os nós externos está nos seus FIFOs ou ainda nas
+ * ligações (o que os FIFOs não aceitaram).
+ */
+int engine_vazia(int id) {
+    Task t = engine_tasks[id];
+    int i, n = 0, vazia;
+
+    engine_lock();
+
+    ioctl(t->fdin, FIONREAD, &n);
+    vazia = n == 0 && t->ingpendlen == 0 && spsc_vazia(t->ingress) &&
+            !t->pendente;
+
+    for (i = 0; vazia && i < t->nins; i++) vazia = spsc_vazia(t->ins[i]->q);
+    for (i = 0; vazia && i < t->nouts; i++) vazia = t->outs[i]->restolen == 0;
+
+    engine_unlock();
+
+    return vazia;
+}
+
+/*
+ * @brief Guarda o estado de uma tarefa window num ficheiro (ver window.h)
+ *
+ * Com o lock de escrita nenhum worker está a meio de um passo, por isso o
+ * estado é o da tarefa depois da última linha que processou.
+ *
+ * @return 0 em caso de sucesso ou -1 em caso de erro (ou se a tarefa não for
+ *         um window)
+ */
+int engine_guarda(int id, const char* ficheiro) {
+    Task t = engine_tasks[id];
+    int r;
+
+    if (t == NULL || t->op != op_window) return -1;
+
+    engine_lock();
+    r = window_guarda(t->estado, ficheiro, NULL, 0);
+    engine_unlock();
+
+    return r;
+}
+
+/*
+ * @brief Restaura o estado de uma tarefa window guardado num ficheiro (o
+ *        resto da entrada, que só existe se o estado veio de um processo que
+ *        terminou, não é usado)
+ *
+ * @return Número de janelas restauradas ou -1 em caso de erro
+ */
+long engine_restaura(int id, const char* ficheiro) {
+    Task t = engine_tasks[id];
+    char* resto;
+    size_t n;
+    long r;
+
+    if (t == NULL || t->op != op_window) return -1;
+
+    engine_lock();
+    r = window_restaura(t->estado, ficheiro, &resto, &n);
+    engine_unlock();
+
+    free(resto);
+
+    return r;
+}
+
+#endif
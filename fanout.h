@@ -0,0 +1,505 @@
+#ifndef FANOUT_H
+#define FANOUT_H
+
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <limits.h>
+
+#include "readln.h"
+#include "outbuf.h"
+#include "stats.h"
+#include "traco.h"
+
+/*
+ * Ciclos de cópia de um fanout: tudo o que é lido do descritor de entrada é
+ * repetido em cada um dos descritores de saída.
+ *
+ * Há dois modos:
+ *
+ *  - fanout_linhas(): lê linha a linha para o espaço do utilizador e copia
+ *    cada linha para o buffer de saída de cada saída (N+1 cópias de cada
+ *    byte). Funciona com qualquer tipo de descritor e é o modo de recurso.
+ *
+ *  - fanout_tee(): a entrada e as saídas têm de ser pipes/FIFOs. Os dados são
+ *    duplicados dentro do kernel com tee(2) e consumidos da entrada com
+ *    splice(2) para /dev/null. Só se copia uma vez cada bloco para o espaço do
+ *    utilizador, para encontrar o fim da última linha completa: cada bloco
+ *    entregue termina sempre numa fronteira de linha e tem no máximo PIPE_BUF
+ *    bytes, para que nenhuma linha seja partida entre saídas.
+ *
+ * Em ambos os modos a linha "-" (escrita pela desbloqueia do controlador) não
+ * é repetida.
+ *
+ * Os registos podem ser binários (carimbos, marcas e pedidos de estado no meio
+ * das linhas, ver
+ * readln.h). Cada saída indica se aceita binarios; as que não aceitam só
+ * recebem as linhas.
+ *
+ * As linhas lidas e escritas (somadas por saída) e os tempos à espera da
+ * entrada e nas escritas vão para os contadores do fanout (stats.h).
+ *
+ * Com o traçado (traco.h), o controlador usa sempre o fanout_linhas e indica
+ * os IDs da origem e dos destinos, para que os carimbos contem nos
+ * histogramas das ligações.
+ */
+
+#define FANOUT_CHUNK PIPE_BUF
+
+int  fanout_origem = -1;       // ID do nó de origem (traçado)
+int* fanout_destinos = NULL;   // IDs dos destinos (traçado, NULL sem ele)
+
+/*
+ * @brief Escreve um bloco numa saída, repetindo até estar todo escrito
+ */
+static void fanout_write(int fd, const char* buf, size_t n) {
+    ssize_t w;
+
+    while (n > 0) {
+        w = write(fd, buf, n);
+        if (w == -1) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        buf += w;
+        n -= w;
+    }
+}
+
+/*
+ * @brief Indica se a linha é a escrita da função desbloqueia
+ */
+static int fanout_desbloqueio(const char* line, size_t n) {
+    return n == 2 && line[0] == '-' && line[1] == '\n';
+}
+
+/*
+ * @brief Entrega um registo ao buffer de cada saída (um registo binário só às
+ *        saídas que os aceitam)
+ */
+static void fanout_registo(Outbuf outs[], int binarios[], int numouts,
+                           const char* rec, size_t n) {
+    int i, binario = readln_binario_e(rec, n);
+
+    for (i = 0; i < numouts; i++) {
+        if (binarios[i] || !binario) outbuf_write(outs[i], rec, n);
+    }
+}
+
+/*
+ * @brief Regista nas ligações um carimbo do traçado e atualiza o seu último
+ *        salto
+ */
+static void fanout_carimbo(char* rec, int binarios[], int numouts) {
+    int i;
+    long long agora = stats_agora();
+
+    for (i = 0; i < numouts; i++) {
+        traco_entrega(rec, fanout_origem, fanout_destinos[i], binarios[i], agora);
+    }
+    traco_atualiza(rec, agora);
+}
+
+/*
+ * @brief Fanout linha a linha (cópia pelo espaço do utilizador)
+ *
+ * As linhas de cada saída são agrupadas num buffer de saída (outbuf.h), que é
+ * escrito quando a entrada fica parada, quando enche ou quando passa o prazo.
+ *
+ * @param fdi     Descritor de entrada
+ * @param fdos    Descritores de saída
+ * @param binarios binarios[i] == 1 se a saída i aceita registos binários
+ * @param numouts Número de saídas
+ * @param stop    Quando passa a diferente de 0 o ciclo termina
+ * @param modo    Modo dos buffers de saída (OUTBUF_DEBITO ou OUTBUF_LATENCIA)
+ * @param st      Contadores do fanout
+ *
+ * @return 0 (fim da entrada ou paragem pedida)
+ */
+int fanout_linhas(int fdi, int fdos[], int binarios[], int numouts,
+                  volatile int* stop, int modo, Stats st) {
+    int i, parada;
+    ssize_t bytes;
+    char* line;
+    Outbuf outs[numouts];
+
+    for (i = 0; i < numouts; i++) {
+        outs[i] = outbuf_init(fdos[i], modo);
+        outs[i]->stats = st;
+    }
+
+    while (!*stop && (bytes = stats_readln(st, fdi, &line)) > 0) {
+        if (!fanout_desbloqueio(line, bytes)) {
+            if (fanout_destinos != NULL && traco_e(line, bytes)) fanout_carimbo(line, binarios, numouts);
+            fanout_registo(outs, binarios, numouts, line, bytes);
+        }
+
+        /* Antes de esperar por mais entrada, escreve-se o que estiver
+           acumulado (todas as saídas ao mesmo tempo) */
+
+        parada = -1;
+        for (i = 0; i < numouts; i++) {
+            if (outs[i]->nrec == 0) continue;
+            if (parada == -1) parada = outbuf_parada(fdi);
+            if (parada || outbuf_expirou(outs[i])) outbuf_flush(outs[i]);
+        }
+    }
+
+    /* As linhas completas que já estavam no buffer foram lidas do FIFO antes
+       do pedido de paragem, por isso ainda são entregues */
+
+    while (readln_pending(fdi) && (bytes = stats_readln(st, fdi, &line)) > 0) {
+        if (!fanout_desbloqueio(line, bytes)) {
+            if (fanout_destinos != NULL && traco_e(line, bytes)) fanout_carimbo(line, binarios, numouts);
+            fanout_registo(outs, binarios, numouts, line, bytes);
+        }
+    }
+
+    for (i = 0; i < numouts; i++) {
+        outbuf_flush(outs[i]);
+        outbuf_free(outs[i]);
+    }
+
+    return 0;
+}
+
+/*
+ * @brief Consome n bytes da entrada sem os copiar
+ */
+static void fanout_consome(int fdi, int devnull, char* buf, size_t n) {
+    ssize_t r;
+
+    while (n > 0) {
+        r = splice(fdi, NULL, devnull, NULL, n, 0);
+        if (r <= 0) r = read(fdi, buf, n); // kernel sem splice para /dev/null
+        if (r <= 0) {
+            if (r == -1 && errno == EINTR) continue;
+            return;
+        }
+        n -= r;
+    }
+}
+
+/*
+ * @brief Indica se uma saída tem espaço para n bytes sem bloquear a meio
+ */
+static int fanout_espaco(int fd, size_t n) {
+    int queued, size;
+
+    size = fcntl(fd, F_GETPIPE_SZ);
+    if (size == -1 || ioctl(fd, FIONREAD, &queued) == -1) return 0;
+
+    return (size_t) (size - queued) >= n;
+}
+
+/*
+ * @brief Conta um bloco de linhas lido da entrada e escrito em cada saída
+ */
+static void fanout_conta(Stats st, contador linhas, size_t bytes, int numouts) {
+    stats_soma(&st->entrada, linhas);
+    stats_soma(&st->bentrada, bytes);
+    stats_soma(&st->saida, linhas * numouts);
+    stats_soma(&st->bsaida, bytes * numouts);
+}
+
+/*
+ * @brief Fim do último registo completo de um bloco (e antes de uma linha "-",
+ *        se a desbloqueia puder escrever no descritor)
+ *
+ * @param desbloq    1 para parar antes de uma linha "-" (fanouts em processos)
+ * @param nrec       Onde se coloca o número de registos até esse fim
+ * @param tembinarios Onde se coloca 1 se algum desses registos for binário
+ *
+ * @return Número de bytes até ao fim do último registo completo (0 se não
+ *         houver nenhum)
+ */
+static size_t fanout_fim(char* buf, size_t n, int desbloq, contador* nrec,
+                         int* tembinarios) {
+    size_t k = 0, r;
+    char* nl;
+
+    *nrec = 0;
+    *tembinarios = 0;
+
+    /* Só linhas: basta procurar o último '\n' */
+
+    if (memchr(buf, READLN_BINARIO, n) == NULL) {
+        nl = memrchr(buf, '\n', n);
+        if (nl == NULL) return 0;
+
+        k = nl - buf + 1;
+
+        nl = desbloq ? memmem(buf, k, "\n-\n", 3) : NULL;
+        if (nl != NULL) k = nl - buf + 1;
+
+        for (nl = buf; (nl = memchr(nl, '\n', buf + k - nl)); nl++) (*nrec)++;
+
+        return k;
+    }
+
+    /* Com binarios, os registos são percorridos um a um */
+
+    while (k < n && (r = readln_registo_tam(buf + k, n - k)) > 0) {
+        if (desbloq && k > 0 && fanout_desbloqueio(buf + k, r)) break;
+        *tembinarios |= readln_binario_e(buf + k, r);
+        *nrec += !stats_carimbo(buf + k, r);
+        k += r;
+    }
+
+    return k;
+}
+
+/*
+ * @brief Copia as linhas de um bloco de registos completos, sem os registos
+ *        binários
+ *
+ * @return Tamanho do bloco copiado
+ */
+static size_t fanout_sem_binarios(const char* buf, size_t k, char* conv) {
+    size_t i, r, n = 0;
+
+    for (i = 0; i < k; i += r) {
+        r = readln_registo_tam(buf + i, k - i);
+
+        if (!readln_binario_e(buf + i, r)) {
+            memcpy(conv + n, buf + i, r);
+            n += r;
+        }
+    }
+
+    return n;
+}
+
+/*
+ * @brief Escreve um registo em cada saída (um registo binário só às saídas
+ *        que os aceitam)
+ */
+static void fanout_entrega(int fdos[], int binarios[], int numouts,
+                           const char* rec, size_t n) {
+    int i, binario = readln_binario_e(rec, n);
+
+    for (i = 0; i < numouts; i++) {
+        if (binarios[i] || !binario) fanout_write(fdos[i], rec, n);
+    }
+}
+
+/*
+ * @brief Passa os primeiros k bytes da entrada para uma saída sem os copiar:
+ *        tee para o pipe auxiliar (vazio) e splice dele para a saída
+ *
+ * O pipe auxiliar só tem uma posição, por isso o tee leva no máximo um
+ * buffer da entrada. Se não levar os k bytes todos, o que levou é deitado
+ * fora e nada chega à saída. Se levar, fica lá um só buffer com exatamente
+ * k bytes, que o splice move inteiro para a saída: a saída recebe o bloco
+ * todo de uma vez ou não recebe nada.
+ *
+ * @return 1 se o bloco foi para a saída, 0 se não foi (deve ir com write)
+ */
+static int fanout_passa(int fdi, int aux[2], int devnull, int fdo, size_t k) {
+    ssize_t t = tee(fdi, aux[1], k, 0);
+    char lixo[FANOUT_CHUNK];
+
+    if (t == (ssize_t) k && splice(aux[0], NULL, fdo, NULL, k, 0) == t) return 1;
+
+    if (t > 0) fanout_consome(aux[0], devnull, lixo, t);
+
+    return 0;
+}
+
+/*
+ * @brief Fanout dentro do kernel com tee(2)/splice(2)
+ *
+ * Em cada iteração duplica-se até FANOUT_CHUNK bytes da entrada para um pipe
+ * auxiliar, lê-se essa cópia para encontrar o último registo completo (k
+ * bytes) e passam-se esses k bytes para cada saída (fanout_passa). Se houver
+ * registos binários no bloco, as saídas que não os aceitam recebem só as
+ * linhas, com write().
+ *
+ * O pipe auxiliar só tem uma posição, por isso cada bloco vem de um só buffer
+ * da entrada e chega a cada saída todo de uma vez ou não chega. Se uma saída
+ * não tiver espaço (ou o bloco não passar), é escrito com um write(), que
+ * para blocos de até PIPE_BUF bytes é atómico. No fim, os k bytes são
+ * consumidos da entrada.
+ *
+ * Um registo que não caiba num bloco (ou que ainda não tenha chegado todo) é
+ * consumido para um buffer e entregue com write() quando estiver completo.
+ *
+ * @param fdi     Descritor de entrada (pipe ou FIFO)
+ * @param fdos    Descritores de saída (pipes ou FIFOs)
+ * @param binarios binarios[i] == 1 se a saída i aceita registos binários
+ * @param numouts Número de saídas
+ * @param stop    Quando passa a diferente de 0 o ciclo termina
+ * @param st      Contadores do fanout
+ *
+ * @return 0 no fim da entrada ou quando é pedido para parar
+ *         -1 se o tee não for suportado (deve-se usar o fanout_linhas)
+ */
+int fanout_tee(int fdi, int fdos[], int binarios[], int numouts,
+               volatile int* stop, Stats st) {
+    int i, aux[2], devnull, tembinarios;
+    long long t0;
+    contador linhas;
+    ssize_t n, tam;
+    size_t k, skip, convlen, carrylen = 0, carrycap = FANOUT_CHUNK;
+    char buf[FANOUT_CHUNK];
+    char conv[FANOUT_CHUNK]; // bloco sem os registos binários
+    char* carry; // registo incompleto já consumido da entrada
+    char* novo;
+    char* nl;
+
+    /* Só se usa o tee se a entrada for um pipe. O pipe auxiliar fica com uma
+       só posição, para que cada tee para ele leve no máximo um buffer da
+       entrada (ver o tee para as saídas, mais abaixo) */
+
+    if (fcntl(fdi, F_GETPIPE_SZ) == -1 || pipe(aux) == -1) return -1;
+
+    if (fcntl(aux[1], F_SETPIPE_SZ, 1) == -1) {
+        close(aux[0]); close(aux[1]);
+        return -1;
+    }
+
+    if ((carry = malloc(carrycap)) == NULL) {
+        close(aux[0]); close(aux[1]);
+        return -1;
+    }
+
+    devnull = open("/dev/null", O_WRONLY);
+
+    while (!*stop || carrylen > 0) {
+
+        /* Duplicar o início da entrada para o pipe auxiliar (bloqueia até
+           haver dados) e ler essa cópia */
+
+        t0 = stats_agora();
+        n = tee(fdi, aux[1], FANOUT_CHUNK, 0);
+        stats_soma(&st->nsleitura, stats_agora() - t0);
+
+        if (n == -1 && errno == EINTR) continue;
+
+        if (n == -1 && carrylen == 0) {
+            close(aux[0]); close(aux[1]); close(devnull); free(carry);
+            return -1; // ainda nada foi consumido: o modo linhas continua
+        }
+
+        if (n <= 0) break;
+
+        n = read(aux[0], buf, n);
+
+        /* Completar um registo que tinha ficado a meio: até ao fim da linha
+           ou até ao tamanho do registo binário (ou do seu cabeçalho) */
+
+        if (carrylen > 0) {
+            tam = readln_binario_tam(carry, carrylen);
+
+            if (tam >= 0) {
+                k = (tam ? (size_t) tam : READLN_BINARIO_CAB) - carrylen;
+                if (k > (size_t) n) k = n;
+            }
+            else {
+                nl = memchr(buf, '\n', n);
+                k = nl ? (size_t) (nl - buf) + 1 : (size_t) n;
+            }
+
+            if (carrylen + k > carrycap) {
+                while (carrylen + k > carrycap) carrycap *= 2;
+                if ((novo = realloc(carry, carrycap)) == NULL) {
+                    perror("fanout"); // como um erro de leitura da entrada
+                    break;
+                }
+                carry = novo;
+            }
+
+            memcpy(carry + carrylen, buf, k);
+            carrylen += k;
+            fanout_consome(fdi, devnull, buf, k);
+
+            /* À espera do cabeçalho de um registo binário pode ter vindo uma
+               linha curta e o início da seguinte: o que sobra fica para
+               depois */
+
+            for (skip = 0; (k = readln_registo_tam(carry + skip, carrylen - skip)) > 0; skip += k) {
+                if (!fanout_desbloqueio(carry + skip, k)) {
+                    t0 = stats_agora();
+                    fanout_entrega(fdos, binarios, numouts, carry + skip, k);
+                    stats_soma(&st->nsescrita, stats_agora() - t0);
+                    fanout_conta(st, 1, k, numouts);
+                }
+            }
+
+            memmove(carry, carry + skip, carrylen - skip);
+            carrylen -= skip;
+            continue;
+        }
+
+        /* A linha da desbloqueia é consumida sem ser entregue */
+
+        if (fanout_desbloqueio(buf, n < 2 ? n : 2)) {
+            fanout_consome(fdi, devnull, buf, 2);
+            continue;
+        }
+
+        /* Fim do último registo completo do bloco (ou antes de uma linha "-") */
+
+        k = fanout_fim(buf, n, 1, &linhas, &tembinarios);
+
+        if (k == 0) { // nenhum registo completo: guarda-se o bloco
+            memcpy(carry, buf, n);
+            carrylen = n;
+            fanout_consome(fdi, devnull, buf, n);
+            continue;
+        }
+
+        /* Duplicar as k bytes para cada saída (sem os registos binários para
+           as que não os aceitam) */
+
+        fanout_conta(st, linhas, k, numouts);
+
+        t0 = stats_agora();
+        convlen = 0;
+
+        for (i = 0; i < numouts; i++) {
+            if (tembinarios && !binarios[i]) {
+                if (convlen == 0) convlen = fanout_sem_binarios(buf, k, conv);
+                fanout_write(fdos[i], conv, convlen);
+                continue;
+            }
+
+            /* O bloco passa todo ou não passa nada. Se não passar, vai
+               inteiro num write(), atómico por ter no máximo PIPE_BUF bytes,
+               para que nenhum outro escritor do FIFO (outra ligação ou um
+               inject) o parta */
+
+            if (!fanout_espaco(fdos[i], k) ||
+                !fanout_passa(fdi, aux, devnull, fdos[i], k)) {
+                fanout_write(fdos[i], buf, k);
+            }
+        }
+
+        stats_soma(&st->nsescrita, stats_agora() - t0);
+
+        fanout_consome(fdi, devnull, buf, k);
+    }
+
+    /* No fim da entrada, linhas curtas que começam como um registo binário
+       mas não chegaram a ter o seu cabeçalho (ver readln.h) já não vão ter */
+
+    if (carrylen > 0 && readln_binario_tam(carry, carrylen) == 0 &&
+        (nl = memrchr(carry, '\n', carrylen)) != NULL) {
+        fanout_entrega(fdos, binarios, numouts, carry, nl - carry + 1);
+        fanout_conta(st, 1, nl - carry + 1, numouts);
+    }
+
+    close(aux[0]);
+    close(aux[1]);
+    close(devnull);
+    free(carry);
+
+    return 0;
+}
+
+#endif
@@ -0,0 +1,460 @@
+#ifndef FIELD_H
+#define FIELD_H
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <limits.h>
+#include <string.h>
+#include <stdlib.h>
+
+/*
+ * Separação de uma linha em colunas (por omissão separadas por ':').
+ *
+ * O índice das colunas é construído de forma preguiçosa: campos_linha() só
+ * regista a linha e cada pedido de uma coluna continua a procura de
+ * separadores a partir de onde a anterior parou, até chegar à coluna pedida.
+ * Pedir a coluna 2 de uma linha com 60 colunas não percorre o resto da linha
+ * e pedir de novo uma coluna já encontrada é O(1).
+ *
+ * Os separadores são procurados 8 bytes de cada vez (SWAR): cada palavra é
+ * comparada com o separador repetido em todos os bytes e os bytes iguais
+ * são extraídos da máscara resultante. As colunas são devolvidas como vistas
+ * (ponteiro + tamanho) para a própria linha, sem cópias nem limite de
+ * tamanho.
+ *
+ * O valor numérico de cada coluna (campos_num, campos_valor) também só é
+ * calculado uma vez por linha, com o seu tipo: inteiro de 64 bits ou real
+ * (com parte decimal ou expoente, ver campos_converte).
+ */
+
+#define CAMPOS_DELIM ':'
+
+#define CAMPOS_AUTO 0 // tipo dos valores: o de cada valor (ver campos_tipo)
+#define CAMPOS_INT  1 // inteiro de 64 bits
+#define CAMPOS_REAL 2 // real (double)
+
+typedef struct campos {
+    const char* linha; // linha corrente (sem o '\n')
+    size_t      len;   // tamanho da linha
+    char        delim; // separador das colunas
+    size_t*     ini;   // ini[i]: início da coluna i+1
+    int         n;     // número de colunas cujo início já se conhece
+    int         cap;   // capacidade de ini
+    size_t      scan;  // onde continua a procura de separadores
+    int         fim;   // 1 se a linha já foi toda percorrida
+    long*       val;   // val[i]: valor numérico da coluna i+1 (truncado, se
+                       // for real)
+    double*     rval;  // rval[i]: valor real da coluna i+1 (CAMPOS_REAL)
+    unsigned char* tipo; // tipo[i]: CAMPOS_INT ou CAMPOS_REAL
+    unsigned*   gval;  // val[i] e tipo[i] são válidos se gval[i] == gen
+    unsigned    gen;   // muda a cada linha
+} *Campos;
+
+/*
+ * @brief Cria o estado do tokenizador
+ *
+ * @param delim Separador das colunas
+ */
+Campos campos_init(char delim) {
+    Campos c = malloc(sizeof(struct campos));
+
+    c->delim = delim;
+    c->cap = 64;
+    c->ini = malloc(sizeof(size_t) * c->cap);
+    c->val = malloc(sizeof(long) * c->cap);
+    c->rval = malloc(sizeof(double) * c->cap);
+    c->tipo = malloc(c->cap);
+    c->gval = calloc(c->cap, sizeof(unsigned));
+    c->gen = 1;
+    c->linha = "";
+    c->len = 0;
+    c->ini[0] = 0;
+    c->n = 1;
+    c->scan = 0;
+    c->fim = 1;
+
+    return c;
+}
+
+void campos_free(Campos c) {
+    free(c->ini);
+    free(c->val);
+    free(c->rval);
+    free(c->tipo);
+    free(c->gval);
+    free(c);
+}
+
+/*
+ * @brief Passa a trabalhar sobre uma nova linha (não percorre a linha)
+ *
+ * @param linha Linha (um '\n' no fim é ignorado); tem de se manter válida
+ *              enquanto se pedirem colunas
+ * @param len   Tamanho da linha
+ */
+void campos_linha(Campos c, const char* linha, size_t len) {
+    if (len > 0 && linha[len - 1] == '\n') len--;
+
+    c->linha = linha;
+    c->len = len;
+    c->ini[0] = 0;
+    c->n = 1;
+    c->scan = 0;
+    c->fim = 0;
+
+    if (++c->gen == 0) { // os valores antigos deixam de poder parecer válidos
+        memset(c->gval, 0, sizeof(unsigned) * c->cap);
+        c->gen = 1;
+    }
+}
+
+/*
+ * @brief Garante espaço para pelo menos n colunas
+ */
+static void campos_cresce(Campos c, int n) {
+    int antes = c->cap;
+
+    if (n <= c->cap) return;
+    while (n > c->cap) c->cap *= 2;
+
+    c->ini = realloc(c->ini, sizeof(size_t) * c->cap);
+    c->val = realloc(c->val, sizeof(long) * c->cap);
+    c->rval = realloc(c->rval, sizeof(double) * c->cap);
+    c->tipo = realloc(c->tipo, c->cap);
+    c->gval = realloc(c->gval, sizeof(unsigned) * c->cap);
+    memset(c->gval + antes, 0, sizeof(unsigned) * (c->cap - antes));
+}
+
+static void campos_novo(Campos c, size_t inicio) {
+    if (c->n == c->cap) campos_cresce(c, c->n + 1);
+    c->ini[c->n++] = inicio;
+}
+
+/*
+ * @brief Continua a procura de separadores até se conhecer o início da coluna
+ *        a seguir à pedida (ou até ao fim da linha)
+ */
+static void campos_procura(Campos c, int coluna) {
+    const char* s = c->linha;
+    size_t i = c->scan, len = c->len;
+    size_t* ini = c->ini;
+    int n = c->n;
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    const uint64_t baixos = 0x7f7f7f7f7f7f7f7fULL;
+    const uint64_t rep = 0x0101010101010101ULL * (unsigned char) c->delim;
+    uint64_t x, m;
+
+    while (i + 8 <= len) {
+        memcpy(&x, s + i, 8);
+        x ^= rep; // bytes iguais ao separador passam a 0
+
+        /* Bit mais alto de cada byte a 1 se o byte for 0 (sem falsos
+           positivos, ao contrário de (x - 0x01..) & ~x & 0x80..) */
+
+        m = ~(((x & baixos) + baixos) | x | baixos);
+
+        if (m) {
+            if (n + 8 > c->cap) { // cabem sempre os 8 de uma palavra
+                campos_cresce(c, n + 8);
+                ini = c->ini;
+            }
+            do {
+                ini[n++] = i + (__builtin_ctzll(m) >> 3) + 1;
+                m &= m - 1;
+            } while (m);
+        }
+
+        i += 8;
+
+        if (n > coluna) {
+            c->n = n;
+            c->scan = i;
+            return;
+        }
+    }
+#endif
+
+    c->n = n;
+
+    for (; i < len; i++) {
+        if (s[i] == c->delim) {
+            campos_novo(c, i + 1);
+            if (c->n > coluna) {
+                c->scan = i + 1;
+                return;
+            }
+        }
+    }
+
+    c->scan = len;
+    c->fim = 1;
+}
+
+/*
+ * @brief Devolve uma coluna da linha corrente
+ *
+ * @param coluna Número da coluna (a primeira é a 1)
+ * @param campo  Onde se coloca o ponteiro para o início da coluna
+ * @param tam    Onde se coloca o tamanho da coluna
+ *
+ * @return 1 se a coluna existir, 0 se não (a vista fica vazia)
+ */
+int campos_coluna(Campos c, int coluna, const char** campo, size_t* tam) {
+    if (c->n <= coluna && !c->fim) campos_procura(c, coluna);
+
+    if (coluna < 1 || coluna > c->n) {
+        *campo = c->linha + c->len;
+        *tam = 0;
+        return 0;
+    }
+
+    *campo = c->linha + c->ini[coluna - 1];
+    *tam = (coluna < c->n ? c->ini[coluna] - 1 : c->len) - c->ini[coluna - 1];
+
+    return 1;
+}
+
+/*
+ * @brief Converte os primeiros carateres de um campo num inteiro (como atoi,
+ *        mas sem precisar de '\0' no fim)
+ */
+long campos_atoi(const char* s, size_t n) {
+    size_t i = 0;
+    long v = 0;
+    int neg = 0;
+
+    while (i < n && (s[i] == ' ' || s[i] == '\t')) i++;
+    if (i < n && (s[i] == '-' || s[i] == '+')) neg = s[i++] == '-';
+    while (i < n && s[i] >= '0' && s[i] <= '9') v = v * 10 + (s[i++] - '0');
+
+    return neg ? -v : v;
+}
+
+/*
+ * @brief Indica se uma string é um número inteiro
+ */
+int campos_inteiro(const char* s) {
+    if (*s == '-' || *s == '+') s++;
+    if (*s == '\0') return 0;
+    while (*s >= '0' && *s <= '9') s++;
+    return *s == '\0';
+}
+
+/*
+ * @brief Lê o nome de um tipo de valores (int, real ou auto)
+ *
+ * @return CAMPOS_INT, CAMPOS_REAL, CAMPOS_AUTO ou -1 se for inválido
+ */
+int campos_tipo(const char* s) {
+    if (!strcmp(s, "int")) return CAMPOS_INT;
+    if (!strcmp(s, "real")) return CAMPOS_REAL;
+    if (!strcmp(s, "auto")) return CAMPOS_AUTO;
+    return -1;
+}
+
+/*
+ * @brief Lê o número de uma coluna nos argumentos de um operador
+ *
+ * @return Coluna (a primeira é 1) ou -1 se não for um inteiro positivo
+ */
+int campos_numcoluna(const char* s) {
+    size_t n = strlen(s);
+
+    if (n == 0 || n > 9 || strspn(s, "0123456789") != n || atoi(s) < 1) return -1;
+
+    return atoi(s);
+}
+
+static const double campos_pot10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/*
+ * @brief Indica se os 8 bytes de uma palavra são todos dígitos
+ */
+static inline int campos_oito_digitos(uint64_t x) {
+    return ((x & 0xf0f0f0f0f0f0f0f0ULL) |
+            (((x + 0x0606060606060606ULL) & 0xf0f0f0f0f0f0f0f0ULL) >> 4)) ==
+           0x3333333333333333ULL;
+}
+
+/*
+ * @brief Valor de 8 dígitos (o primeiro no byte mais baixo da palavra)
+ */
+static inline uint32_t campos_oito(uint64_t x) {
+    x = ((x & 0x0f0f0f0f0f0f0f0fULL) * 2561) >> 8;
+    x = ((x & 0x00ff00ff00ff00ffULL) * 6553601) >> 16;
+    return (uint32_t) (((x & 0x0000ffff0000ffffULL) * 42949672960001ULL) >> 32);
+}
+
+/*
+ * @brief Converte o início de um campo num número (como o atoi ou o strtod,
+ *        mas sem precisar de '\0' no fim): inteiro de 64 bits ou, se tiver
+ *        parte decimal ou expoente ou não couber em 64 bits, real
+ *
+ * Os dígitos são lidos 8 de cada vez (SWAR) quando há 8 seguidos e o resto
+ * sem comparações por dígito além de uma. Um real com até 19 algarismos
+ * significativos e um expoente que não passe de 22 sai de uma só
+ * multiplicação ou divisão exata (dá o mesmo que o strtod); os outros passam
+ * pelo strtod.
+ *
+ * @param v Onde se coloca o valor inteiro (um real fica truncado e saturado)
+ * @param r Onde se coloca o valor real (só com CAMPOS_REAL)
+ *
+ * @return CAMPOS_INT ou CAMPOS_REAL
+ */
+int campos_converte(const char* s, size_t n, long* v, double* r) {
+    size_t i = 0, ini;
+    uint64_t u = 0;
+    unsigned d;
+    int neg = 0, nd = 0, extra = 0, exp = 0, e = 0, eneg = 0, real = 0;
+    double x;
+
+    while (i < n && (s[i] == ' ' || s[i] == '\t')) i++;
+    ini = i;
+    if (i < n && (s[i] == '-' || s[i] == '+')) neg = s[i++] == '-';
+    while (i < n && s[i] == '0') i++; // zeros à esquerda
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    uint64_t w;
+
+    while (nd <= 11 && i + 8 <= n) {
+        memcpy(&w, s + i, 8);
+        if (!campos_oito_digitos(w)) break;
+        u = u * 100000000 + campos_oito(w);
+        nd += 8;
+        i += 8;
+    }
+#endif
+
+    for (; i < n && (d = (unsigned char) s[i] - '0') <= 9; i++) {
+        if (nd < 19) { u = u * 10 + d; nd++; }
+        else extra++; // não cabe: fica no expoente
+    }
+
+    /* Parte decimal (os algarismos a mais são ignorados) */
+
+    if (i < n && s[i] == '.') {
+        real = 1;
+        for (i++; i < n && (d = (unsigned char) s[i] - '0') <= 9; i++) {
+            if (u == 0 && d == 0) exp--;
+            else if (nd < 19) { u = u * 10 + d; nd++; exp--; }
+        }
+    }
+
+    /* Expoente (só se tiver pelo menos um dígito) */
+
+    if (i + 1 < n && (s[i] | 0x20) == 'e') {
+        size_t j = i + 1;
+        if (s[j] == '-' || s[j] == '+') eneg = s[j++] == '-';
+        if (j < n && (unsigned) ((unsigned char) s[j] - '0') <= 9) {
+            real = 1;
+            for (; j < n && (d = (unsigned char) s[j] - '0') <= 9; j++) {
+                if (e < 100000) e = e * 10 + d;
+            }
+            exp += eneg ? -e : e;
+            i = j;
+        }
+    }
+
+    if (!real && extra == 0 && u <= (uint64_t) LONG_MAX + neg) {
+        *v = neg ? (long) (0 - u) : (long) u;
+        return CAMPOS_INT;
+    }
+
+    exp += extra;
+
+    if (u < (1ULL << 53) && exp >= -22 && exp <= 22) {
+        x = exp < 0 ? (double) u / campos_pot10[-exp] : (double) u * campos_pot10[exp];
+        if (neg) x = -x;
+    }
+    else { // caso raro: strtod sobre uma cópia com '\0'
+        char pequeno[64], *copia = i - ini < sizeof(pequeno) ? pequeno : malloc(i - ini + 1);
+        memcpy(copia, s + ini, i - ini);
+        copia[i - ini] = '\0';
+        x = strtod(copia, NULL);
+        if (copia != pequeno) free(copia);
+    }
+
+    *r = x;
+    *v = x >= 9.2e18 ? LONG_MAX : x <= -9.2e18 ? LONG_MIN : (long) x;
+
+    return CAMPOS_REAL;
+}
+
+/*
+ * @brief Valor numérico de uma coluna, com o seu tipo, calculado no máximo
+ *        uma vez por linha
+ *
+ * @param v Onde se coloca o valor inteiro (o real truncado, se for real)
+ * @param r Onde se coloca o valor real (também com os inteiros)
+ *
+ * @return CAMPOS_INT, CAMPOS_REAL ou 0 se a coluna não existir (os valores
+ *         ficam 0)
+ */
+int campos_valor(Campos c, int coluna, long* v, double* r) {
+    const char* campo;
+    size_t tam;
+    int k = coluna - 1;
+
+    if (coluna >= 1 && coluna <= c->n && c->gval[k] == c->gen) {
+        *v = c->val[k];
+        *r = c->tipo[k] == CAMPOS_REAL ? c->rval[k] : (double) *v;
+        return c->tipo[k];
+    }
+
+    if (!campos_coluna(c, coluna, &campo, &tam)) {
+        *v = 0;
+        *r = 0;
+        return 0;
+    }
+
+    c->tipo[k] = campos_converte(campo, tam, v, r);
+    if (c->tipo[k] == CAMPOS_REAL) c->rval[k] = *r;
+    else *r = (double) *v;
+    c->val[k] = *v;
+    c->gval[k] = c->gen;
+
+    return c->tipo[k];
+}
+
+/*
+ * @brief Valor numérico de uma coluna como inteiro (um real fica truncado),
+ *        calculado no máximo uma vez por linha
+ *
+ * @return 1 se a coluna existir, 0 se não (o valor fica 0)
+ */
+int campos_num(Campos c, int coluna, long* v) {
+    double r;
+
+    if (coluna >= 1 && coluna <= c->n && c->gval[coluna - 1] == c->gen) {
+        *v = c->val[coluna - 1];
+        return 1;
+    }
+
+    return campos_valor(c, coluna, v, &r) != 0;
+}
+
+/*
+ * @brief Lê a opção "-d <separador>" do início dos argumentos de um operador
+ *
+ *        e.g. filter -d , 2 > 10
+ *
+ * @param delim Onde se coloca o separador (':' se não houver opção)
+ *
+ * @return Número de argumentos a saltar (0 ou 2)
+ */
+int campos_opcao(int argc, char const* argv[], char* delim) {
+    *delim = CAMPOS_DELIM;
+
+    if (argc >= 3 && !strcmp(argv[1], "-d") && argv[2][0] != '\0') {
+        *delim = argv[2][0];
+        return 2;
+    }
+
+    return 0;
+}
+
+#endif
@@ -8,11 +8,22 @@
 #include <limits.h>
 
 #include "readln.h"
+#include "filter.h"
+#include "outbuf.h"
+#include "stats.h"
+#include "traco.h"
+#include "anel.h"
 
 
-/*filter <coluna> <operador> <operando>
+/*filter <coluna> <operador> <operando> [and|or [not] <coluna> <operador> <operando> ...]
 Este programa reproduz as linhas que satisfazem uma condicão indicada nos seus argumentos. 
 =, >=, <=, >, <, !=.
+As comparações podem ser combinadas com and, or, not e parênteses (not > and > or).
+Se o operando for um número (inteiro ou real) a comparação é numérica, senão é entre strings.
+Com -d <separador> as colunas são separadas por outro caratere que não ':'.
+Com --type int|real|auto (antes ou depois da condição) escolhe-se como são comparados os
+números: por omissão (auto) como inteiros de 64 bits, ou como reais se o valor ou o operando
+for real (ver filter.h).
 
 ./a.out coluna "condição" valor-de-comparação
 
@@ -24,41 +35,48 @@ filter 2 ">" 20
 input a:10:c 
 output:
 
+filter 2 ">" 3 and 2 "<=" 10 or 1 = x
+input: a:5:c
+output: a:5:c
+
 */
 
 int main(int argc, char const *argv[]){
 
-   char buffer[PIPE_BUF];
-   char print[PIPE_BUF];
-   char final[PIPE_BUF];
-   int n, coluna = atoi(argv[1]), valor = atoi(argv[3]),s,cut;
-   char field[100];
+   Filter f = filter_init(argc, argv);
+   const char* final;
+   char* buffer;
+   ssize_t n, m;
+   Outbuf o = outbuf_init(1, outbuf_modo_env()); //escritas agrupadas (ver outbuf.h)
+   Stats s = stats_abre(); //contadores do nó (ver stats.h)
+   Carimbo tr = traco_abre(); //carimbos do traçado (ver traco.h)
+
+   if (f == NULL) {
+      fprintf(stderr, "utilização: filter [-d <separador>] [--type int|real|auto] <coluna> <operador> <operando> [and|or [not] ...] [--type int|real|auto]\n");
+      return 1;
+   }
 
+   o->stats = s;
+
+   anel_componente(o); //anéis em vez dos FIFOs, se o nó os usar (ver anel.h)
    
-   while((n = readln(0,buffer,PIPE_BUF)) >= 0) {  
+   while((n = stats_readln(s,0,&buffer)) > 0) {  
       if(n!=0) {     
 
-               //Achar a coluna
-               char *ptr = buffer;
-               cut = 0;
-               while ( sscanf(ptr, "%100[^:]%n", field, &s) == 1) {
-                  cut++;
-                  if(cut == coluna) sprintf(print,"%s",field); //achou a coluna, guardar valor no print
-                  ptr += s; /* avançar os characteres lidos */
-                  //if ( *ptr != ':' )  {  break; /* falhou*/  }
-                  ++ptr; /* salta o : */
-               }
+         if (readln_marca(buffer,n)) { outbuf_write(o,buffer,n); outbuf_idle(o,0); continue; } //marca de ordem das réplicas (ver replica.h)
+         if (traco_e(buffer,n)) { traco_entrada(&tr,buffer); continue; } //carimbo do registo seguinte
+
          //verifica o argumento e faz a comparação
-         sprintf(final,"%s\n",buffer);
-         if(strcmp(argv[2],"=") == 0) if(atoi(print) == valor) { write(1,final,strlen(final));  } 
-         if(strcmp(argv[2],">=") == 0) if(atoi(print) >= valor){ write(1,final,strlen(final)); } 
-         if(strcmp(argv[2],"<=") == 0) if(atoi(print) <= valor) { write(1,final,strlen(final)); }
-         if(strcmp(argv[2],">") == 0) if(atoi(print) > valor) { write(1,final,strlen(final)); } 
-         if(strcmp(argv[2],"<") == 0) if(atoi(print) < valor) { write(1,final,strlen(final)); }
-         if(strcmp(argv[2],"!=") == 0) if(atoi(print) != valor) { write(1,final,strlen(final)); }
+         m = filter_process(f, buffer, n, &final);
+         if (tr.ativo && traco_saida(&tr,m > 0)) outbuf_write(o,tr.buf,TRACO_TAM); //o carimbo vai à frente da saída
+         if (m > 0) outbuf_write(o,final,m);
+         else stats_soma(&s->descartados,1); //linha que não passou na condição
 
       }
+      outbuf_idle(o,0); //escreve o que estiver acumulado antes de esperar por input
    }
 
-  return 0; //nunca aqui vai chegar, mas é menos um warning ao compilar
+  outbuf_flush(o); //fim do input (EOF): escrever o que estiver acumulado
+
+  return 0;
 }
\ No newline at end of file
@@ -0,0 +1,391 @@
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <sys/types.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "field.h"
+
+/*
+ * Operador filter: reproduz as linhas que satisfazem uma condição sobre os
+ * valores das colunas.
+ *
+ * A condição é compilada uma única vez (filter_init) numa árvore de
+ * comparações, cada uma com a função de comparação já escolhida. Para cada
+ * linha, cada coluna só é procurada (field.h) quando uma comparação precisa
+ * dela, e o seu valor numérico é calculado no máximo uma vez.
+ *
+ * Gramática da condição (os elementos são argumentos separados):
+ *
+ *     expr   := termo { "or" termo }
+ *     termo  := fator { "and" fator }
+ *     fator  := "not" fator | "(" expr ")" | <coluna> <operador> <operando>
+ *
+ * Os operadores são =, !=, <, <=, > e >=. Se o operando for um número
+ * (inteiro ou real, e.g. 10, -2.5 ou 1e9), a comparação é numérica; caso
+ * contrário é uma comparação de strings.
+ *
+ * As comparações numéricas seguem o tipo dos valores (field.h), escolhido
+ * com --type: auto (por omissão) compara inteiros de 64 bits quando o valor
+ * da coluna e o operando são inteiros e reais quando um deles é real; int
+ * lê os valores como o atoi (um real fica truncado, também no operando) e
+ * real compara sempre como reais.
+ *
+ *     filter 2 <= 10
+ *     filter 2 > 3 and 2 <= 10
+ *     filter 1 = aprovado or not 2 < 10
+ *     filter -d , 2 > 3
+ *     filter --type real 3 >= 0.25
+ *
+ * Usado pelo programa filter e pelo motor de execução do controlador.
+ */
+
+#define FILTER_MAXCOL 64 // máximo de colunas diferentes numa condição
+
+enum { F_CMP, F_AND, F_OR, F_NOT };
+
+typedef int (*Comparador)(long a, long b);
+typedef int (*ComparadorReal)(double a, double b);
+
+static int cmp_eq(long a, long b) { return a == b; }
+static int cmp_ne(long a, long b) { return a != b; }
+static int cmp_lt(long a, long b) { return a < b; }
+static int cmp_le(long a, long b) { return a <= b; }
+static int cmp_gt(long a, long b) { return a > b; }
+static int cmp_ge(long a, long b) { return a >= b; }
+
+static int cmpr_eq(double a, double b) { return a == b; }
+static int cmpr_ne(double a, double b) { return a != b; }
+static int cmpr_lt(double a, double b) { return a < b; }
+static int cmpr_le(double a, double b) { return a <= b; }
+static int cmpr_gt(double a, double b) { return a > b; }
+static int cmpr_ge(double a, double b) { return a >= b; }
+
+/*
+ * Nó da árvore da condição. Numa comparação, 'slot' é o índice da coluna na
+ * tabela de colunas usadas pela condição.
+ */
+typedef struct cond {
+    int          tipo;     // F_CMP, F_AND, F_OR ou F_NOT
+    int          slot;     // coluna (índice em cols da struct filterop)
+    Comparador   cmp;      // função de comparação
+    ComparadorReal cmpr;   // função de comparação dos reais
+    int          numerico; // 1 se o operando for um número
+    int          real;     // 1 se o operando for um real
+    long         valor;    // operando numérico (truncado, se for real)
+    double       rvalor;   // operando real
+    const char*  str;      // operando string
+    size_t       strlen;
+    struct cond* esq;
+    struct cond* dir;
+} *Cond;
+
+typedef struct filterop {
+    Cond   raiz;                  // condição compilada
+    int    tipo;                  // tipo dos valores (--type): CAMPOS_AUTO,
+                                  // CAMPOS_INT ou CAMPOS_REAL
+    int    ncols;                 // colunas usadas pela condição
+    int    cols[FILTER_MAXCOL];   // número de cada coluna
+    Campos campos;                // colunas da linha corrente
+    /* valores da linha corrente */
+    const char* campo[FILTER_MAXCOL];
+    size_t      tam[FILTER_MAXCOL];
+    long        num[FILTER_MAXCOL];
+    double      rnum[FILTER_MAXCOL];
+    int         tiponum[FILTER_MAXCOL]; // tipo de num (0 se faltar a coluna)
+    int         temcampo[FILTER_MAXCOL];
+    int         temnum[FILTER_MAXCOL];
+    char*  buf;                   // linha com '\n' acrescentado (se faltar)
+    size_t cap;
+} *Filter;
+
+/*
+ * @brief Devolve o índice da coluna na tabela de colunas da condição,
+ *        acrescentando-a se ainda não existir
+ */
+static int filter_slot(Filter f, int coluna) {
+    int i;
+
+    for (i = 0; i < f->ncols; i++) {
+        if (f->cols[i] == coluna) return i;
+    }
+
+    if (f->ncols == FILTER_MAXCOL) return -1;
+
+    f->cols[f->ncols] = coluna;
+
+    return f->ncols++;
+}
+
+static Cond filter_expr(Filter f, int argc, char const* argv[], int* i);
+
+/*
+ * @brief Indica se um operando é um número (inteiro ou real, todo ele)
+ */
+static int filter_numero(const char* s) {
+    char* fim;
+
+    if (campos_inteiro(s)) return 1;
+    if (strspn(s, "0123456789+-.eE") != strlen(s)) return 0; // sem inf e nan
+
+    strtod(s, &fim);
+
+    return fim != s && *fim == '\0';
+}
+
+static Cond filter_no(int tipo, Cond esq, Cond dir) {
+    Cond c = calloc(1, sizeof(struct cond));
+    c->tipo = tipo;
+    c->esq = esq;
+    c->dir = dir;
+    return c;
+}
+
+/*
+ * @brief Liberta uma (sub)árvore da condição
+ */
+static void filter_liberta(Cond c) {
+    if (c == NULL) return;
+    filter_liberta(c->esq);
+    filter_liberta(c->dir);
+    free(c);
+}
+
+/*
+ * @brief fator := "not" fator | "(" expr ")" | <coluna> <operador> <operando>
+ */
+static Cond filter_fator(Filter f, int argc, char const* argv[], int* i) {
+    Cond c;
+    const char* op;
+    int coluna;
+
+    if (*i >= argc) return NULL;
+
+    if (!strcmp(argv[*i], "not")) {
+        (*i)++;
+        c = filter_fator(f, argc, argv, i);
+        return c ? filter_no(F_NOT, c, NULL) : NULL;
+    }
+
+    if (!strcmp(argv[*i], "(")) {
+        (*i)++;
+        c = filter_expr(f, argc, argv, i);
+        if (c == NULL || *i >= argc || strcmp(argv[*i], ")")) {
+            filter_liberta(c);
+            return NULL;
+        }
+        (*i)++;
+        return c;
+    }
+
+    if (*i + 2 >= argc || (coluna = campos_numcoluna(argv[*i])) == -1) return NULL;
+
+    c = filter_no(F_CMP, NULL, NULL);
+    c->slot = filter_slot(f, coluna);
+    op = argv[*i + 1];
+
+    if      (!strcmp(op, "="))  { c->cmp = cmp_eq; c->cmpr = cmpr_eq; }
+    else if (!strcmp(op, "!=")) { c->cmp = cmp_ne; c->cmpr = cmpr_ne; }
+    else if (!strcmp(op, "<"))  { c->cmp = cmp_lt; c->cmpr = cmpr_lt; }
+    else if (!strcmp(op, "<=")) { c->cmp = cmp_le; c->cmpr = cmpr_le; }
+    else if (!strcmp(op, ">"))  { c->cmp = cmp_gt; c->cmpr = cmpr_gt; }
+    else if (!strcmp(op, ">=")) { c->cmp = cmp_ge; c->cmpr = cmpr_ge; }
+    else c->slot = -1; // operador inválido
+
+    if (c->slot == -1) {
+        free(c);
+        return NULL;
+    }
+
+    c->numerico = filter_numero(argv[*i + 2]);
+    c->real = campos_converte(argv[*i + 2], strlen(argv[*i + 2]), &c->valor,
+                              &c->rvalor) == CAMPOS_REAL;
+    if (!c->real) c->rvalor = (double) c->valor;
+    c->str = argv[*i + 2];
+    c->strlen = strlen(c->str);
+
+    *i += 3;
+
+    return c;
+}
+
+/*
+ * @brief termo := fator { "and" fator }
+ */
+static Cond filter_termo(Filter f, int argc, char const* argv[], int* i) {
+    Cond c = filter_fator(f, argc, argv, i), d;
+
+    while (c != NULL && *i < argc && !strcmp(argv[*i], "and")) {
+        (*i)++;
+        d = filter_fator(f, argc, argv, i);
+        if (d == NULL) {
+            filter_liberta(c);
+            return NULL;
+        }
+        c = filter_no(F_AND, c, d);
+    }
+
+    return c;
+}
+
+/*
+ * @brief expr := termo { "or" termo }
+ */
+static Cond filter_expr(Filter f, int argc, char const* argv[], int* i) {
+    Cond c = filter_termo(f, argc, argv, i), d;
+
+    while (c != NULL && *i < argc && !strcmp(argv[*i], "or")) {
+        (*i)++;
+        d = filter_termo(f, argc, argv, i);
+        if (d == NULL) {
+            filter_liberta(c);
+            return NULL;
+        }
+        c = filter_no(F_OR, c, d);
+    }
+
+    return c;
+}
+
+/*
+ * @brief Cria o estado do operador, compilando a condição dos argumentos
+ *
+ *        e.g. filter [-d <separador>] [--type int|real|auto]
+ *                    <coluna> <operador> <operando> [and|or ...]
+ *                    [--type int|real|auto]
+ *
+ * Como no window, o --type pode vir antes da condição ou depois dela.
+ *
+ * @return Estado do operador ou NULL se a condição for inválida
+ */
+Filter filter_init(int argc, char const* argv[]) {
+    int i = 1, salta, tipo;
+    char delim;
+    Filter f = calloc(1, sizeof(struct filterop));
+
+    salta = campos_opcao(argc, argv, &delim);
+    argc -= salta;
+    argv += salta;
+
+    f->tipo = CAMPOS_AUTO;
+
+    if (argc >= 3 && !strcmp(argv[1], "--type")) {
+        if ((f->tipo = campos_tipo(argv[2])) == -1) {
+            free(f);
+            return NULL;
+        }
+        i = 3;
+    }
+    else if (argc >= 6 && !strcmp(argv[argc - 2], "--type") &&
+             (tipo = campos_tipo(argv[argc - 1])) != -1) {
+        f->tipo = tipo; // senão, os dois argumentos são parte da condição
+        argc -= 2;
+    }
+
+    f->raiz = filter_expr(f, argc, argv, &i);
+
+    if (f->raiz == NULL || i != argc) {
+        filter_liberta(f->raiz);
+        free(f);
+        return NULL;
+    }
+
+    f->campos = campos_init(delim);
+    f->cap = 256;
+    f->buf = malloc(f->cap);
+
+    return f;
+}
+
+/*
+ * @brief Avalia uma comparação sobre os valores da linha corrente
+ */
+static int filter_compara(Filter f, Cond c) {
+    int s = c->slot, r;
+    size_t n;
+
+    if (c->numerico) {
+        if (!f->temnum[s]) {
+            if (f->tipo == CAMPOS_INT) campos_num(f->campos, f->cols[s], &f->num[s]);
+            else f->tiponum[s] = campos_valor(f->campos, f->cols[s], &f->num[s],
+                                              &f->rnum[s]);
+            f->temnum[s] = 1;
+        }
+
+        if (f->tipo == CAMPOS_INT) return c->cmp(f->num[s], c->valor);
+
+        if (f->tipo == CAMPOS_REAL || c->real || f->tiponum[s] == CAMPOS_REAL) {
+            return c->cmpr(f->rnum[s], c->rvalor);
+        }
+
+        return c->cmp(f->num[s], c->valor);
+    }
+
+    if (!f->temcampo[s]) {
+        campos_coluna(f->campos, f->cols[s], &f->campo[s], &f->tam[s]);
+        f->temcampo[s] = 1;
+    }
+
+    n = f->tam[s] < c->strlen ? f->tam[s] : c->strlen;
+    r = memcmp(f->campo[s], c->str, n);
+    if (r == 0) r = (f->tam[s] > c->strlen) - (f->tam[s] < c->strlen);
+
+    return c->cmp(r, 0);
+}
+
+static int filter_avalia(Filter f, Cond c) {
+    switch (c->tipo) {
+        case F_CMP: return filter_compara(f, c);
+        case F_AND: return filter_avalia(f, c->esq) && filter_avalia(f, c->dir);
+        case F_OR:  return filter_avalia(f, c->esq) || filter_avalia(f, c->dir);
+        default:    return !filter_avalia(f, c->esq);
+    }
+}
+
+/*
+ * @brief Processa uma linha
+ *
+ * @param f    Estado do operador
+ * @param line Linha de entrada (com ou sem '\n' no fim)
+ * @param len  Tamanho da linha
+ * @param out  Onde se coloca o ponteiro para a linha de saída (válida até à
+ *             próxima chamada e enquanto a linha de entrada o for)
+ *
+ * @return Tamanho da linha de saída (com '\n') ou 0 se a linha for filtrada
+ */
+ssize_t filter_process(Filter f, const char* line, size_t len, const char** out) {
+    size_t n = len;
+
+    if (n > 0 && line[n - 1] == '\n') n--;
+    if (n == 0) return 0; // linhas vazias são ignoradas
+
+    /* As colunas só são procuradas quando a condição precisar delas */
+
+    campos_linha(f->campos, line, n);
+    memset(f->temcampo, 0, sizeof(int) * f->ncols);
+    memset(f->temnum, 0, sizeof(int) * f->ncols);
+
+    if (!filter_avalia(f, f->raiz)) return 0;
+
+    /* A linha passa tal como foi lida (só se acrescenta o '\n' se faltar) */
+
+    if (n < len) {
+        *out = line;
+        return len;
+    }
+
+    if (n + 1 > f->cap) {
+        while (n + 1 > f->cap) f->cap *= 2;
+        f->buf = realloc(f->buf, f->cap);
+    }
+
+    memcpy(f->buf, line, n);
+    f->buf[n] = '\n';
+    *out = f->buf;
+
+    return n + 1;
+}
+
+#endif
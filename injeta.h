@@ -0,0 +1,411 @@
+#ifndef INJETA_H
+#define INJETA_H
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+
+#include "stats.h"
+#include "traco.h"
+
+/*
+ * Inject nativo de um ficheiro (injectfile <id> <ficheiro> [--rate <R>]
+ * [--loop] no controlador).
+ *
+ * O inject normal executa um comando (e.g. cat) que lê o ficheiro para a sua
+ * memória e o escreve no FIFO in do nó: mais um exec e duas cópias de cada
+ * byte. Aqui o processo do inject (um fork do controlador, sem exec) mapeia o
+ * ficheiro (mmap) só para encontrar os fins de linha e passa os blocos para o
+ * FIFO com splice, sem os copiar para o espaço do utilizador.
+ *
+ * Cada bloco tem só linhas completas: o fim do bloco é o último '\n' antes do
+ * limite (ou o fim da primeira linha, se for maior que o limite). Se o FIFO
+ * aceitar só parte de um bloco, o resto segue logo a seguir, sem pausas a
+ * meio de uma linha. Se o nó tiver outros escritores (ligações que lhe chegam
+ * ou outros injects), os blocos têm no máximo PIPE_BUF bytes e são escritos
+ * com write, que é atómico (como no outbuf.h), para que nenhuma linha seja
+ * partida entre escritores. Um escritor que apareça depois (um connect para o
+ * nó ou outro inject) é anunciado pelo controlador numa região partilhada com
+ * o inject (mmap): o inject passa a blocos atómicos e o escritor novo só
+ * começa depois do fim do bloco não atómico em curso (ver injeta_avisa). Se
+ * o splice não for suportado (e.g. sistema de
+ * ficheiros sem splice), os blocos são escritos com write a partir do mmap.
+ *
+ * Com --rate, o ritmo é em registos/s (e.g. 500k) ou, com o sufixo b, em
+ * bytes/s (e.g. 200mb), com os sufixos k, m e g em potências de 10. O envio é
+ * feito em fatias de INJETA_FATIA ns: antes de cada bloco espera-se pelo
+ * instante em que o que já foi enviado devia ter sido enviado (relógio
+ * monótono desde o início), pelo que os atrasos de uma fatia são compensados
+ * nas seguintes e o ritmo médio não deriva.
+ *
+ * Com --loop, o ficheiro é enviado de novo desde o início até o inject ser
+ * terminado (o shutdown --drain pede-lhe com SIGTERM que pare no fim do bloco
+ * em que está). Um ficheiro sem '\n' no fim leva um no fim de cada passagem,
+ * na mesma escrita que a última linha (writev).
+ *
+ * Com o traçado (opção -t), o carimbo (traco.h) vai na mesma escrita que a sua
+ * linha (writev), à frente de uma linha em cada amostra, e os blocos entre
+ * carimbos vão com splice.
+ */
+
+#define INJETA_BLOCO (1 << 20) // máximo de bytes de cada splice
+#define INJETA_FATIA 1000000LL // granularidade do ritmo (ns)
+
+typedef struct injecao {
+    double ritmo;   // registos/s ou bytes/s (0 sem limite)
+    int    bytes;   // 1 se o ritmo é em bytes/s
+    int    ciclo;   // 1 para recomeçar no início do ficheiro (--loop)
+    int    atomico; // 1 se o nó tem outros escritores (blocos até PIPE_BUF)
+    int    amostra; // carimbo à frente de uma linha em cada amostra (0 sem
+                    // traçado)
+    struct injeta_partilha* partilha; // região partilhada com o controlador
+} Injecao;
+
+/*
+ * Região partilhada (mmap) entre o controlador e o processo do inject
+ */
+typedef struct injeta_partilha {
+    int atomico;    // 1 quando o nó passa a ter outros escritores (controlador)
+    int escrevendo; // 1 durante um bloco não atómico (inject)
+} *InjetaPartilha;
+
+static volatile sig_atomic_t injeta_parar = 0; // SIGTERM (shutdown --drain)
+
+/*
+ * @brief Lê um ritmo (e.g. 500k registos/s ou 200mb bytes/s)
+ *
+ * @param bytes Fica a 1 se o ritmo é em bytes/s
+ *
+ * @return Ritmo ou 0 se for inválido
+ */
+double injeta_ritmo(const char* s, int* bytes) {
+    char* fim;
+    double v = strtod(s, &fim);
+
+    if (*fim == 'k' || *fim == 'K') { v *= 1e3; fim++; }
+    else if (*fim == 'm' || *fim == 'M') { v *= 1e6; fim++; }
+    else if (*fim == 'g' || *fim == 'G') { v *= 1e9; fim++; }
+
+    *bytes = *fim == 'b' || *fim == 'B';
+    if (*bytes) fim++;
+
+    if (fim == s || *fim != '\0' || !(v > 0) || v > 1e15) return 0;
+
+    return v;
+}
+
+/*
+ * @brief Lê as opções do injectfile (a seguir ao ficheiro)
+ *
+ *        e.g. injectfile <id> <ficheiro> [--rate <R>] [--loop]
+ *
+ * @param options Opções (terminadas em NULL)
+ *
+ * @return 0 em caso de sucesso ou -1 se alguma opção for inválida
+ */
+int injeta_opcoes(char** options, Injecao* inj) {
+    int i;
+
+    memset(inj, 0, sizeof(Injecao));
+
+    for (i = 0; options[i] != NULL; i++) {
+        if (strcmp(options[i], "--loop") == 0) inj->ciclo = 1;
+        else if (strcmp(options[i], "--rate") == 0 && options[i + 1] != NULL) {
+            inj->ritmo = injeta_ritmo(options[++i], &inj->bytes);
+            if (inj->ritmo == 0) return -1;
+        }
+        else return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * @brief Fim do bloco que começa em off, no último '\n' até off + max (ou no
+ *        fim da primeira linha, se for maior)
+ */
+static size_t injeta_corta(const char* base, size_t off, size_t tam, size_t max) {
+    const char* p;
+
+    if (tam - off <= max) return tam;
+
+    p = memrchr(base + off, '\n', max);
+    if (p != NULL) return p - base + 1;
+
+    p = memchr(base + off + max, '\n', tam - off - max);
+
+    return p != NULL ? (size_t) (p - base + 1) : tam;
+}
+
+/*
+ * @brief Fim do bloco que começa em off, com no máximo maxlinhas linhas e max
+ *        bytes (pelo menos uma linha)
+ *
+ * @param linhas Fica com o número de linhas do bloco
+ */
+static size_t injeta_conta(const char* base, size_t off, size_t tam,
+                           long maxlinhas, size_t max, long* linhas) {
+    size_t fim = off, e;
+    const char* p;
+
+    for (*linhas = 0; fim < tam && *linhas < maxlinhas; (*linhas)++) {
+        p = memchr(base + fim, '\n', tam - fim);
+        e = p != NULL ? (size_t) (p - base + 1) : tam;
+        if (*linhas > 0 && e - off > max) break;
+        fim = e;
+    }
+
+    return fim;
+}
+
+/*
+ * @brief Envia o bloco [off, fim) do ficheiro para o FIFO
+ *
+ * @param copia Fica a 1 se o splice não for suportado (passa-se a usar write)
+ *
+ * @return 0 em caso de sucesso ou -1 em caso de erro
+ */
+static int injeta_envia(int fdi, int fdo, const char* base, size_t off,
+                        size_t fim, int* copia) {
+    loff_t o;
+    ssize_t n;
+
+    while (off < fim) {
+        if (!*copia) {
+            o = off;
+            n = splice(fdi, &o, fdo, NULL, fim - off, SPLICE_F_MOVE);
+            if (n == -1 && (errno == EINVAL || errno == ENOSYS)) {
+                *copia = 1;
+                continue;
+            }
+        }
+        else n = write(fdo, base + off, fim - off);
+
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+
+        off += n;
+    }
+
+    return 0;
+}
+
+/*
+ * @brief Escreve um bloco de linhas numa só escrita (atómica até PIPE_BUF
+ *        bytes), com o '\n' que falta no fim de um ficheiro
+ *
+ * @param nl 1 se o bloco é o fim de um ficheiro sem '\n' no fim
+ */
+static int injeta_escreve(int fdo, const char* bloco, size_t n, int nl) {
+    struct iovec v[2];
+
+    v[0].iov_base = (void*) bloco;
+    v[0].iov_len = n;
+    v[1].iov_base = "\n";
+    v[1].iov_len = 1;
+
+    return writev(fdo, v, 1 + nl) == (ssize_t) (n + nl) ? 0 : -1;
+}
+
+/*
+ * @brief Escreve uma linha com o carimbo à frente (uma só escrita)
+ *
+ * Como no traco_injeta, uma linha que com o carimbo não cabe em PIPE_BUF vai
+ * sem carimbo.
+ *
+ * @param nl 1 se a linha é o fim de um ficheiro sem '\n' no fim
+ */
+static int injeta_carimba(int fdo, const char* linha, size_t n, int nl) {
+    char carimbo[TRACO_TAM];
+    struct iovec v[3];
+    long long agora = stats_agora();
+
+    if (n + nl + TRACO_TAM > PIPE_BUF) return injeta_escreve(fdo, linha, n, nl);
+
+    traco_escreve(carimbo, agora, agora);
+    v[0].iov_base = carimbo;
+    v[0].iov_len = TRACO_TAM;
+    v[1].iov_base = (void*) linha;
+    v[1].iov_len = n;
+    v[2].iov_base = "\n";
+    v[2].iov_len = 1;
+
+    return writev(fdo, v, 2 + nl) == (ssize_t) (n + nl + TRACO_TAM) ? 0 : -1;
+}
+
+/*
+ * @brief Espera até ao instante em que o que já foi enviado devia ter sido
+ *        enviado ao ritmo pedido
+ */
+static void injeta_espera(long long t0, double enviados, double ritmo) {
+    long long prazo = t0 + (long long) (enviados / ritmo * 1e9);
+    long long agora = stats_agora();
+    struct timespec t;
+
+    if (agora >= prazo) return;
+
+    t.tv_sec = (prazo - agora) / 1000000000LL;
+    t.tv_nsec = (prazo - agora) % 1000000000LL;
+    nanosleep(&t, NULL);
+}
+
+/*
+ * @brief Cria a região partilhada com o processo de um inject (antes do fork)
+ *
+ * @param atomico 1 se o nó já tem outros escritores
+ *
+ * @return Região ou NULL em caso de erro (o inject não pode ser avisado)
+ */
+InjetaPartilha injeta_partilha(int atomico) {
+    InjetaPartilha p = mmap(NULL, sizeof(struct injeta_partilha), PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+    if (p == MAP_FAILED) return NULL;
+
+    p->atomico = atomico;
+    p->escrevendo = 0;
+
+    return p;
+}
+
+/*
+ * @brief Avisa um inject de que o nó vai ter outro escritor e espera que
+ *        acabe o bloco não atómico em curso (controlador)
+ *
+ * O inject marca o início de cada bloco não atómico e só depois vê se há
+ * aviso; o controlador marca o aviso e só depois vê se há um bloco a meio
+ * (ambos seq_cst). Assim, ou o inject vê o aviso antes do bloco ou o
+ * controlador espera pelo fim dele.
+ *
+ * @param pid   PID do processo do inject
+ * @param prazo Instante limite (ns, ver stats_agora)
+ *
+ * @return 0 em caso de sucesso ou -1 se o bloco não acabou até ao prazo
+ */
+int injeta_avisa(InjetaPartilha p, pid_t pid, long long prazo) {
+    __atomic_store_n(&p->atomico, 1, __ATOMIC_SEQ_CST);
+
+    while (__atomic_load_n(&p->escrevendo, __ATOMIC_SEQ_CST)) {
+        if (waitpid(pid, NULL, WNOHANG) != 0) return 0; // já terminou
+        if (stats_agora() >= prazo) return -1;
+        usleep(100);
+    }
+
+    return 0;
+}
+
+static void injeta_termina(int sinal) {
+    (void) sinal;
+    injeta_parar = 1;
+}
+
+/*
+ * @brief Envia o ficheiro para o FIFO do nó (processo do injectfile)
+ *
+ * @param fdi Ficheiro (regular)
+ * @param fdo FIFO in do nó
+ * @param inj Opções do injectfile
+ *
+ * @return Exit status do processo do inject
+ */
+int injeta_ficheiro(int fdi, int fdo, Injecao* inj) {
+    struct stat st;
+    size_t tam, off, fim, max, bloco;
+    long linhas, maxlinhas, conta = 0;
+    long long t0;
+    double enviados = 0, fatia;
+    int copia = 0, contar, nl, ultimo;
+    char* base;
+
+    if (fstat(fdi, &st) == -1 || !S_ISREG(st.st_mode)) return 1;
+    if ((tam = st.st_size) == 0) return 0;
+
+    base = mmap(NULL, tam, PROT_READ, MAP_PRIVATE, fdi, 0);
+    if (base == MAP_FAILED) return 1;
+
+    madvise(base, tam, MADV_SEQUENTIAL);
+    signal(SIGTERM, injeta_termina);
+
+    /* Blocos de linhas completas: no máximo PIPE_BUF bytes se houver outros
+       escritores (com o '\n' que falte no fim do ficheiro) e, com ritmo, o
+       que cabe numa fatia. As linhas só são contadas se o ritmo for em
+       registos ou houver carimbos */
+
+    nl = base[tam - 1] != '\n';
+    bloco = inj->atomico ? PIPE_BUF - nl : INJETA_BLOCO;
+    fatia = inj->ritmo * INJETA_FATIA / 1e9;
+    contar = (inj->ritmo > 0 && !inj->bytes) || inj->amostra > 0;
+    t0 = stats_agora();
+
+    do {
+        for (off = 0; off < tam && !injeta_parar; off = fim) {
+            if (inj->ritmo > 0) injeta_espera(t0, enviados, inj->ritmo);
+
+            /* Outro escritor anunciado pelo controlador: a partir daqui, só
+               blocos atómicos (ver injeta_avisa) */
+
+            if (!inj->atomico && inj->partilha != NULL) {
+                __atomic_store_n(&inj->partilha->escrevendo, 1, __ATOMIC_SEQ_CST);
+                if (__atomic_load_n(&inj->partilha->atomico, __ATOMIC_SEQ_CST)) {
+                    __atomic_store_n(&inj->partilha->escrevendo, 0, __ATOMIC_SEQ_CST);
+                    inj->atomico = 1;
+                    bloco = PIPE_BUF - nl;
+                }
+            }
+
+            max = bloco;
+            maxlinhas = LONG_MAX;
+            if (inj->ritmo > 0 && inj->bytes && fatia < max) max = fatia > 1 ? fatia : 1;
+            if (inj->ritmo > 0 && !inj->bytes) maxlinhas = fatia > 1 ? fatia : 1;
+
+            if (inj->amostra > 0 && conta % inj->amostra == 0) {
+                fim = injeta_conta(base, off, tam, 1, max, &linhas);
+                if (injeta_carimba(fdo, base + off, fim - off, nl && fim == tam) == -1) return 1;
+            }
+            else {
+                if (inj->amostra > 0 && inj->amostra - conta % inj->amostra < maxlinhas) {
+                    maxlinhas = inj->amostra - conta % inj->amostra;
+                }
+
+                if (contar) fim = injeta_conta(base, off, tam, maxlinhas, max, &linhas);
+                else {
+                    fim = injeta_corta(base, off, tam, max);
+                    linhas = 0;
+                }
+
+                ultimo = nl && fim == tam;
+
+                if (inj->atomico || copia || ultimo) {
+                    if (injeta_escreve(fdo, base + off, fim - off, ultimo) == -1) return 1;
+                }
+                else if (injeta_envia(fdi, fdo, base, off, fim, &copia) == -1) return 1;
+            }
+
+            if (!inj->atomico && inj->partilha != NULL) {
+                __atomic_store_n(&inj->partilha->escrevendo, 0, __ATOMIC_SEQ_CST);
+            }
+
+            conta += contar ? linhas : 0;
+            enviados += inj->bytes ? fim - off : linhas;
+        }
+
+    } while (inj->ciclo && !injeta_parar);
+
+    munmap(base, tam);
+
+    return 0;
+}
+
+#endif
@@ -0,0 +1,273 @@
+#ifndef OUTBUF_H
+#define OUTBUF_H
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <time.h>
+
+#include "readln.h"
+#include "stats.h"
+
+/*
+ * Buffer de saída partilhado pelos componentes (const, filter, window, spawn)
+ * e pelos fanouts.
+ *
+ * Em vez de um write() por linha, os registos (linhas completas) são
+ * acumulados e escritos de uma só vez quando:
+ *
+ *  - o próximo registo já não cabe no limite de bytes do buffer;
+ *  - se atinge o número máximo de registos;
+ *  - passou o prazo (latência máxima) desde o primeiro registo por escrever;
+ *  - a entrada ficou parada (não há mais nada para ler sem bloquear).
+ *
+ * Se a saída for um pipe/FIFO (que pode ter vários escritores, e.g. fanouts de
+ * vários nós para o mesmo nó), o limite é PIPE_BUF: cada escrita tem só
+ * registos completos e no máximo PIPE_BUF bytes, pelo que é atómica e nenhum
+ * registo é partido entre escritores. Um registo maior que PIPE_BUF é escrito
+ * sozinho (como antes).
+ *
+ * Há dois modos, escolhidos por nó no controlador (node <id> -m <modo> ...) e
+ * passados aos componentes na variável de ambiente OUTBUF_ENV:
+ *
+ *  - throughput (omissão): acumula até aos limites acima;
+ *  - latency: escreve cada registo assim que é produzido.
+ *
+ * Os registos e bytes escritos e o tempo passado nas escritas são somados aos
+ * contadores em stats (stats.h), por omissão os de stats_nulo.
+ *
+ * Em vez do descritor, as escritas podem ir para um destino próprio
+ * (outbuf_destino, e.g. o anel de saída de um componente, anel.h), que só
+ * tem um escritor e por isso usa o limite OUTBUF_GRANDE.
+ */
+
+#define OUTBUF_ENV     "SAIDA_MODO"
+#define OUTBUF_GRANDE  65536   // limite de bytes se a saída não for um pipe
+#define OUTBUF_MAXREC  1024    // máximo de registos por escrita
+#define OUTBUF_PRAZO   5000000 // latência máxima (ns) em modo throughput
+
+enum { OUTBUF_DEBITO, OUTBUF_LATENCIA };
+
+typedef struct outbuf {
+    int    fd;      // descritor de saída
+    int    modo;    // OUTBUF_DEBITO ou OUTBUF_LATENCIA
+    char*  buf;     // registos por escrever
+    size_t len;     // bytes no buffer
+    size_t limite;  // máximo de bytes por escrita
+    int    nrec;    // registos no buffer
+    int    maxrec;  // máximo de registos por escrita
+    long   prazo;   // latência máxima (ns)
+    struct timespec desde; // quando entrou o primeiro registo por escrever
+    Stats  stats;   // contadores do nó (stats.h)
+    int  (*escreve)(void*, const char*, size_t); // destino em vez do fd
+    void*  destino;
+} *Outbuf;
+
+/*
+ * @brief Converte o nome de um modo ("throughput" ou "latency")
+ *
+ * @return OUTBUF_DEBITO, OUTBUF_LATENCIA ou -1 se o nome for inválido
+ */
+int outbuf_modo(const char* nome) {
+    if (nome == NULL) return -1;
+    if (!strcmp(nome, "throughput")) return OUTBUF_DEBITO;
+    if (!strcmp(nome, "latency")) return OUTBUF_LATENCIA;
+    return -1;
+}
+
+const char* outbuf_nome(int modo) {
+    return modo == OUTBUF_LATENCIA ? "latency" : "throughput";
+}
+
+/*
+ * @brief Modo pedido pelo controlador (variável de ambiente OUTBUF_ENV)
+ */
+int outbuf_modo_env() {
+    int modo = outbuf_modo(getenv(OUTBUF_ENV));
+    return modo == -1 ? OUTBUF_DEBITO : modo;
+}
+
+/*
+ * @brief Cria um buffer de saída
+ *
+ * @param fd   Descritor de saída
+ * @param modo OUTBUF_DEBITO ou OUTBUF_LATENCIA
+ */
+Outbuf outbuf_init(int fd, int modo) {
+    struct stat st;
+    Outbuf o = malloc(sizeof(struct outbuf));
+
+    o->fd = fd;
+    o->modo = modo;
+    o->len = 0;
+    o->nrec = 0;
+    o->prazo = OUTBUF_PRAZO;
+    o->stats = &stats_nulo;
+    o->escreve = NULL;
+
+    if (fstat(fd, &st) == 0 && !S_ISFIFO(st.st_mode)) o->limite = OUTBUF_GRANDE;
+    else o->limite = PIPE_BUF;
+
+    o->maxrec = modo == OUTBUF_LATENCIA ? 1 : OUTBUF_MAXREC;
+    o->buf = malloc(o->limite);
+
+    return o;
+}
+
+void outbuf_free(Outbuf o) {
+    free(o->buf);
+    free(o);
+}
+
+/*
+ * @brief Escreve tudo, repetindo se for interrompido
+ */
+static int outbuf_escreve(int fd, const char* buf, size_t n) {
+    ssize_t w;
+
+    while (n > 0) {
+        w = write(fd, buf, n);
+        if (w == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        buf += w;
+        n -= w;
+    }
+
+    return 0;
+}
+
+/*
+ * @brief Escreve tudo no destino do buffer (o próprio ou o descritor)
+ */
+static int outbuf_envia(Outbuf o, const char* buf, size_t n) {
+    if (o->escreve != NULL) return o->escreve(o->destino, buf, n);
+    return outbuf_escreve(o->fd, buf, n);
+}
+
+/*
+ * @brief Passa a escrever num destino próprio em vez do descritor (deve ser
+ *        chamada antes da primeira escrita)
+ *
+ * @param escreve Escreve tudo (0 em caso de sucesso, -1 em caso de erro)
+ * @param destino Argumento passado a escreve
+ */
+void outbuf_destino(Outbuf o, int (*escreve)(void*, const char*, size_t), void* destino) {
+    o->escreve = escreve;
+    o->destino = destino;
+    o->limite = OUTBUF_GRANDE;
+    o->buf = realloc(o->buf, o->limite);
+}
+
+/*
+ * @brief Escreve os registos acumulados (uma só escrita)
+ *
+ * @return 0 em caso de sucesso, -1 em caso de erro
+ */
+int outbuf_flush(Outbuf o) {
+    int r = 0;
+    long long t;
+
+    if (o->len > 0) {
+        t = stats_agora();
+        r = outbuf_envia(o, o->buf, o->len);
+        stats_soma(&o->stats->nsescrita, stats_agora() - t);
+    }
+
+    o->len = 0;
+    o->nrec = 0;
+
+    return r;
+}
+
+/*
+ * @brief Acrescenta um registo (uma linha completa, com '\n')
+ *
+ * @return 0 em caso de sucesso, -1 em caso de erro de escrita
+ */
+int outbuf_write(Outbuf o, const char* rec, size_t len) {
+    int r = 0;
+    long long t;
+
+    if (!stats_carimbo(rec, len)) {
+        stats_soma(&o->stats->saida, 1);
+        stats_soma(&o->stats->bsaida, len);
+    }
+
+    /* O registo não cabe junto com os que já estão no buffer */
+
+    if (o->len + len > o->limite) r = outbuf_flush(o);
+
+    /* Registo maior que o limite: escreve-se diretamente */
+
+    if (len > o->limite) {
+        t = stats_agora();
+        r |= outbuf_envia(o, rec, len);
+        stats_soma(&o->stats->nsescrita, stats_agora() - t);
+        return r;
+    }
+
+    if (o->nrec == 0 && o->modo == OUTBUF_DEBITO) {
+        clock_gettime(CLOCK_MONOTONIC, &o->desde);
+    }
+
+    memcpy(o->buf + o->len, rec, len);
+    o->len += len;
+    o->nrec++;
+
+    if (o->nrec >= o->maxrec) r |= outbuf_flush(o);
+
+    return r;
+}
+
+/*
+ * @brief Indica se já passou o prazo do registo mais antigo por escrever
+ */
+int outbuf_expirou(Outbuf o) {
+    struct timespec t;
+
+    if (o->nrec == 0) return 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+
+    return (t.tv_sec - o->desde.tv_sec) * 1000000000L +
+           (t.tv_nsec - o->desde.tv_nsec) >= o->prazo;
+}
+
+/*
+ * @brief Indica se a próxima leitura de uma entrada (lida com o readln) teria
+ *        de bloquear
+ */
+int outbuf_parada(int fdin) {
+    struct pollfd p;
+    int v;
+
+    if (readln_pending(fdin)) return 0;
+    if ((v = readln_fonte_vazia(fdin)) != -1) return v;
+
+    p.fd = fdin;
+    p.events = POLLIN;
+
+    return poll(&p, 1, 0) <= 0 || !(p.revents & POLLIN);
+}
+
+/*
+ * @brief Deve ser chamada antes de cada leitura da entrada: escreve o que
+ *        estiver acumulado se a entrada estiver parada ou o prazo tiver
+ *        passado
+ *
+ * @param fdin Descritor de entrada (lido com o readln)
+ */
+void outbuf_idle(Outbuf o, int fdin) {
+    if (o->nrec > 0 && (outbuf_expirou(o) || outbuf_parada(fdin))) {
+        outbuf_flush(o);
+    }
+}
+
+#endif
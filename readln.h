@@ -1,9 +1,470 @@
 #ifndef READLN_H
 #define READLN_H
 
+#include <sys/types.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+
+/*
+ * Leitor de linhas com buffer.
+ *
+ * Cada descritor tem o seu próprio estado (struct lnbuf): os dados são lidos em
+ * blocos de READLN_BLOCK bytes e as linhas são procuradas dentro do buffer com
+ * memchr (que na glibc é vetorizado). Uma linha que atravesse o fim de um bloco
+ * é preservada (o resto do buffer é compactado para o início antes da leitura
+ * seguinte) e uma linha maior que o buffer faz com que este cresça, pelo que
+ * não há limite para o tamanho das linhas (nem mesmo PIPE_BUF).
+ *
+ * readln_view() devolve a linha como uma vista (ponteiro + tamanho) para o
+ * buffer interno, sem cópias. A vista é válida até à próxima chamada sobre o
+ * mesmo descritor. readln() mantém a interface antiga e copia a linha para o
+ * buffer do chamador.
+ *
+ * readln_registo() lê também os registos binários que os processos da rede
+ * põem no meio das linhas (os carimbos do traçado, traco.h, as marcas das
+ * réplicas, replica.h, e os pedidos de estado, window.h). Um registo binário
+ * começa pelo byte READLN_BINARIO, seguido de um tipo conhecido
+ * (READLN_CARIMBO, READLN_MARCA ou READLN_ESTADO), tem o seu tamanho total nos
+ * bytes 4 a 7 e é devolvido inteiro, em vez de terminar no primeiro '\n'. O
+ * tamanho não passa de READLN_BINARIO_MAX, pelo que o seu byte mais
+ * significativo não passa de 4, e nenhum caratere de texto é tão pequeno (o
+ * tab é 9): uma linha de texto que comece por READLN_BINARIO continua a ser
+ * lida como uma linha (se for mais curta do que READLN_BINARIO_CAB, só quando
+ * chegarem os bytes seguintes ou no fim da entrada).
+ *
+ * Um descritor pode ter uma fonte própria (readln_fonte): os blocos passam a
+ * vir dela em vez do read (e.g. o anel de entrada de um componente, anel.h).
+ */
+
+#define READLN_BLOCK 65536
+#define READLN_BINARIO     0x1e // primeiro byte de um registo binário (RS)
+#define READLN_BINARIO_CAB 8    // bytes necessários para saber o tamanho
+#define READLN_BINARIO_MAX (64 << 20) // tamanho máximo de um registo binário
+#define READLN_CARIMBO     'T'  // segundo byte de um carimbo (traco.h)
+#define READLN_MARCA       'M'  // segundo byte de uma marca de ordem (replica.h)
+#define READLN_ESTADO      'E'  // segundo byte de um pedido de estado (window.h)
+
+typedef struct lnbuf {
+    char*  buf;   // dados lidos
+    size_t cap;   // capacidade do buffer
+    size_t start; // início da próxima linha
+    size_t end;   // fim dos dados válidos
+    size_t scan;  // até onde já se procurou o '\n' (a partir de start)
+    ssize_t (*le)(void*, void*, size_t); // fonte em vez do read (ou NULL)
+    int   (*vazia)(void*); // 1 se a fonte não tem nada para ler já
+    void*  fonte;
+} *Lnbuf;
+
+static Lnbuf* readln_fds = NULL; // estado de cada descritor (indexado pelo fd)
+static int    readln_nfds = 0;
+
+/*
+ * @brief Devolve (criando se necessário) o estado de leitura de um descritor
+ *
+ * @param fildes Descritor de ficheiro
+ *
+ * @return Estado do descritor ou NULL em caso de erro
+ */
+static Lnbuf readln_state(int fildes) {
+	int i, n;
+	Lnbuf* fds;
+
+	if (fildes < 0) return NULL;
+
+	if (fildes >= readln_nfds) {
+		n = readln_nfds ? readln_nfds : 16;
+		while (n <= fildes) n *= 2;
+
+		fds = realloc(readln_fds, sizeof(Lnbuf) * n);
+		if (fds == NULL) return NULL;
+
+		for (i = readln_nfds; i < n; i++) fds[i] = NULL;
+
+		readln_fds = fds;
+		readln_nfds = n;
+	}
+
+	if (readln_fds[fildes] == NULL) {
+		Lnbuf l = malloc(sizeof(struct lnbuf));
+		if (l == NULL) return NULL;
+
+		l->buf = malloc(READLN_BLOCK);
+		if (l->buf == NULL) { free(l); return NULL; }
+
+		l->cap = READLN_BLOCK;
+		l->start = l->end = l->scan = 0;
+		l->le = NULL;
+		l->vazia = NULL;
+		l->fonte = NULL;
+		readln_fds[fildes] = l;
+	}
+
+	return readln_fds[fildes];
+}
+
+/*
+ * @brief Descarta o estado de leitura de um descritor
+ *
+ * Deve ser chamada quando um descritor é fechado ou reaproveitado para outro
+ * ficheiro, para que não se leiam dados que ficaram no buffer do anterior.
+ *
+ * @param fildes Descritor de ficheiro
+ */
+void readln_reset(int fildes) {
+	if (fildes >= 0 && fildes < readln_nfds && readln_fds[fildes] != NULL) {
+		free(readln_fds[fildes]->buf);
+		free(readln_fds[fildes]);
+		readln_fds[fildes] = NULL;
+	}
+}
+
+/*
+ * @brief Passa a ler um descritor a partir de uma fonte própria
+ *
+ * @param fildes Descritor de ficheiro
+ * @param le     Lê até n bytes da fonte, como o read (0 no fim)
+ * @param vazia  Indica se a próxima leitura da fonte teria de esperar
+ * @param fonte  Argumento passado a le e a vazia
+ *
+ * @return 0 em caso de sucesso, -1 em caso de erro
+ */
+int readln_fonte(int fildes, ssize_t (*le)(void*, void*, size_t),
+                 int (*vazia)(void*), void* fonte) {
+	Lnbuf l = readln_state(fildes);
+
+	if (l == NULL) return -1;
+
+	l->le = le;
+	l->vazia = vazia;
+	l->fonte = fonte;
+
+	return 0;
+}
+
+/*
+ * @brief Indica se a próxima leitura da fonte própria de um descritor teria
+ *        de esperar
+ *
+ * @return 1 ou 0, -1 se o descritor não tiver uma fonte própria
+ */
+int readln_fonte_vazia(int fildes) {
+	if (fildes < 0 || fildes >= readln_nfds || readln_fds[fildes] == NULL ||
+	    readln_fds[fildes]->vazia == NULL) {
+		return -1;
+	}
+
+	return readln_fds[fildes]->vazia(readln_fds[fildes]->fonte);
+}
+
+/*
+ * @brief Lê mais um bloco para o buffer do descritor
+ *
+ * Antes de ler, compacta os dados ainda não consumidos para o início do buffer
+ * e, se a linha corrente já ocupar todo o buffer, duplica a sua capacidade.
+ *
+ * @return Número de bytes lidos (0 no fim do ficheiro, -1 em caso de erro)
+ */
+static ssize_t readln_fill(int fildes, Lnbuf l) {
+	ssize_t n;
+
+	if (l->start > 0) {
+		memmove(l->buf, l->buf + l->start, l->end - l->start);
+		l->end -= l->start;
+		l->start = 0;
+	}
+
+	if (l->end == l->cap) {
+		char* nbuf = realloc(l->buf, l->cap * 2);
+		if (nbuf == NULL) return -1;
+		l->buf = nbuf;
+		l->cap *= 2;
+	}
+
+	do {
+		n = l->le != NULL ? l->le(l->fonte, l->buf + l->end, l->cap - l->end)
+		                  : read(fildes, l->buf + l->end, l->cap - l->end);
+	} while (n == -1 && errno == EINTR);
+
+	if (n > 0) l->end += n;
+
+	return n;
+}
+
+/*
+ * @brief Lê uma linha sem a copiar
+ *
+ * @param fildes Descritor de ficheiro de onde se lê
+ * @param line   Onde se coloca o ponteiro para o início da linha
+ *
+ * @return Tamanho da linha, incluindo o '\n' final (que pode faltar na última
+ *         linha de um ficheiro), 0 no fim do ficheiro e -1 em caso de erro
+ */
+ssize_t readln_view(int fildes, char** line) {
+	char* nl;
+	size_t len;
+	ssize_t n;
+	Lnbuf l = readln_state(fildes);
+
+	if (l == NULL) return -1;
+
+	for (;;) {
+		nl = memchr(l->buf + l->start + l->scan, '\n',
+		            l->end - l->start - l->scan);
+
+		if (nl != NULL) {
+			len = nl - (l->buf + l->start) + 1;
+			break;
+		}
+
+		l->scan = l->end - l->start;
+
+		/* Só se volta a ler quando não há nenhuma linha completa no buffer */
+
+		n = readln_fill(fildes, l);
+
+		if (n == -1) return -1;
+
+		if (n == 0) { // fim do ficheiro: devolve o que sobrar (sem '\n')
+			len = l->end - l->start;
+			if (len == 0) return 0;
+			break;
+		}
+	}
+
+	*line = l->buf + l->start;
+	l->start += len;
+	l->scan = 0;
+
+	return len;
+}
+
+/*
+ * @brief Tamanho de um registo binário a partir do seu início
+ *
+ * @return Tamanho total, 0 se ainda não houver bytes suficientes para o saber
+ *         ou -1 se não for binário (é uma linha de texto)
+ */
+static ssize_t readln_binario_tam(const char* p, size_t n) {
+	uint32_t tam;
+
+	if (n == 0 || (unsigned char) p[0] != READLN_BINARIO) return -1;
+	if (n < 2) return 0;
+
+	if (p[1] != READLN_CARIMBO && p[1] != READLN_MARCA &&
+	    p[1] != READLN_ESTADO) return -1;
+
+	if (n < READLN_BINARIO_CAB) return 0;
+	memcpy(&tam, p + 4, sizeof(tam));
+
+	return tam < READLN_BINARIO_CAB || tam > READLN_BINARIO_MAX ? -1 : (ssize_t) tam;
+}
+
+/*
+ * @brief Indica se um registo (lido com readln_registo) é binário
+ */
+static inline int readln_binario_e(const char* rec, size_t n) {
+	return readln_binario_tam(rec, n) > 0;
+}
+
+/*
+ * @brief Tamanho do primeiro registo completo (linha ou registo binário) de
+ *        um bloco
+ *
+ * @return Tamanho do registo ou 0 se o bloco não tiver um registo completo
+ */
+size_t readln_registo_tam(const char* buf, size_t n) {
+	ssize_t tam = readln_binario_tam(buf, n);
+	const char* nl;
+
+	if (tam >= 0) return tam > 0 && (size_t) tam <= n ? (size_t) tam : 0;
+
+	nl = memchr(buf, '\n', n);
+
+	return nl ? (size_t) (nl - buf) + 1 : 0;
+}
+
+/*
+ * @brief Indica se um registo é uma marca de ordem das réplicas de um nó
+ *        (replica.h), que os componentes devolvem tal como veio
+ */
+static inline int readln_marca(const char* rec, size_t n) {
+	return readln_binario_tam(rec, n) > 0 && rec[1] == READLN_MARCA;
+}
+
+/*
+ * @brief Indica se um registo é um pedido do controlador para o componente
+ *        guardar o seu estado (checkpoint, ver window.h)
+ */
+static inline int readln_estado(const char* rec, size_t n) {
+	return readln_binario_tam(rec, n) > 0 && rec[1] == READLN_ESTADO;
+}
+
+/*
+ * @brief Lê um registo sem o copiar: uma linha (como readln_view) ou um
+ *        registo binário
+ *
+ * @param fildes Descritor de ficheiro de onde se lê
+ * @param rec    Onde se coloca o ponteiro para o início do registo
+ *
+ * @return Tamanho do registo, 0 no fim do ficheiro e -1 em caso de erro (um
+ *         registo binário incompleto no fim do ficheiro é descartado)
+ */
+ssize_t readln_registo(int fildes, char** rec) {
+	size_t avail;
+	ssize_t n, tam;
+	Lnbuf l = readln_state(fildes);
+
+	if (l == NULL) return -1;
+
+	for (;;) {
+		avail = l->end - l->start;
+		tam = avail > 0 ? readln_binario_tam(l->buf + l->start, avail) : 0;
+
+		if (tam == -1) return readln_view(fildes, rec);
+
+		if (tam > 0 && avail >= (size_t) tam) {
+			*rec = l->buf + l->start;
+			l->start += tam;
+			l->scan = 0;
+			return tam;
+		}
+
+		n = readln_fill(fildes, l);
+
+		if (n == -1) return -1;
+
+		/* No fim do ficheiro, o que não chegou a ter o cabeçalho de um registo binário
+		   é uma linha (sem '\n') */
+
+		if (n == 0 && tam == 0 && avail > 0) return readln_view(fildes, rec);
+
+		if (n == 0) {
+			l->start = l->end;
+			l->scan = 0;
+			return 0;
+		}
+	}
+}
+
+/*
+ * @brief Indica se já há um registo completo (linha ou registo binário) no
+ *        buffer do descritor
+ *
+ * Quando devolve 1, a próxima chamada a readln_view()/readln_registo()/readln()
+ * sobre o descritor não bloqueia.
+ */
+int readln_pending(int fildes) {
+	Lnbuf l;
+	size_t avail;
+	ssize_t tam;
+
+	if (fildes < 0 || fildes >= readln_nfds || readln_fds[fildes] == NULL) {
+		return 0;
+	}
+
+	l = readln_fds[fildes];
+	avail = l->end - l->start;
+
+	tam = avail > 0 ? readln_binario_tam(l->buf + l->start, avail) : -1;
+
+	if (tam >= 0) return tam > 0 && avail >= (size_t) tam;
+
+	return memchr(l->buf + l->start, '\n', avail) != NULL;
+}
+
+/*
+ * @brief Retira todos os dados que estão no buffer de um descritor
+ *
+ * Serve para quem quer passar a ler o descritor diretamente (com read) sem
+ * perder o que o leitor de linhas já tinha lido.
+ *
+ * @param fildes Descritor de ficheiro
+ * @param data   Onde se coloca o ponteiro para os dados
+ *
+ * @return Número de bytes disponíveis em *data
+ */
+size_t readln_take(int fildes, char** data) {
+	size_t n;
+	Lnbuf l;
+
+	if (fildes < 0 || fildes >= readln_nfds || readln_fds[fildes] == NULL) {
+		return 0;
+	}
+
+	l = readln_fds[fildes];
+	n = l->end - l->start;
+	*data = l->buf + l->start;
+	l->start = l->end;
+	l->scan = 0;
+
+	return n;
+}
+
+/*
+ * @brief Põe dados à frente dos que estão no buffer de um descritor (são os
+ *        primeiros a ser lidos)
+ *
+ * O contrário do readln_take: serve para um processo continuar a leitura de
+ * outro (e.g. o que o window anterior já tinha lido, ver window.h).
+ *
+ * Os dados podem estar no próprio buffer do descritor (e.g. o que o
+ * readln_take devolveu): nesse caso são copiados antes de o buffer mudar.
+ *
+ * @param fildes Descritor de ficheiro
+ * @param data   Dados
+ * @param n      Número de bytes
+ *
+ * @return 0 em caso de sucesso, -1 em caso de erro
+ */
+int readln_devolve(int fildes, const char* data, size_t n) {
+	Lnbuf l = readln_state(fildes);
+	size_t avail, cap;
+	char* nbuf;
+	char* copia = NULL;
+
+	if (l == NULL) return -1;
+
+	if ((uintptr_t) data >= (uintptr_t) l->buf &&
+	    (uintptr_t) data < (uintptr_t) l->buf + l->cap) {
+		if ((copia = malloc(n)) == NULL) return -1;
+		memcpy(copia, data, n);
+		data = copia;
+	}
+
+	avail = l->end - l->start;
+
+	for (cap = l->cap; cap < avail + n; cap *= 2);
+
+	if (cap > l->cap) {
+		if ((nbuf = realloc(l->buf, cap)) == NULL) {
+			free(copia);
+			return -1;
+		}
+		l->buf = nbuf;
+		l->cap = cap;
+	}
+
+	memmove(l->buf + n, l->buf + l->start, avail);
+	memcpy(l->buf, data, n);
+	l->start = 0;
+	l->end = n + avail;
+	l->scan = 0;
+
+	free(copia);
+
+	return 0;
+}
+
 /*
  * @brief Lê uma linha
  *
+ * A linha é copiada para buf sem o '\n' e terminada com '\0'. Uma linha com
+ * mais de nbyte - 1 carateres é devolvida em vários pedaços, tal como
+ * acontecia com a leitura caratere a caratere.
+ *
  * @param fildes Descritor de ficheiro de onde se lê
  * @param buf    Buffer para onde se escreve os dados lidos
  * @param nbyte  Número máximo de bytes a ler
@@ -11,27 +472,31 @@
  * @return Retorna o número de bytes lidos
  */
 ssize_t readln(int fildes, void* buf, size_t nbyte) {
-	int i, n;
+	char* line;
+	ssize_t total, n;
 
-	for (i = 0; i < nbyte; i++) {
-		n = read(fildes, buf+i, 1);
+	if (nbyte == 0) return 0;
 
-		if (n == -1) {
-			return -1;
-		}
+	total = readln_view(fildes, &line);
 
-		if (n == 0) {
-            		break;
-        	}
+	if (total <= 0) {
+		((char*) buf)[0] = '\0';
+		return total;
+	}
 
-		if (((char*) buf)[i] == '\n') {
-		    break;
-		}
+	n = (line[total - 1] == '\n') ? total - 1 : total;
+
+	/* Linha demasiado grande: o resto fica para a próxima chamada */
+
+	if ((size_t) n > nbyte - 1) {
+		n = nbyte - 1;
+		readln_fds[fildes]->start -= total - n;
 	}
 
-	((char*) buf)[i] = '\0';
+	memcpy(buf, line, n);
+	((char*) buf)[n] = '\0';
 
-	return i;
+	return n;
 }
 
 #endif
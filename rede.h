@@ -0,0 +1,204 @@
+#ifndef REDE_H
+#define REDE_H
+
+#include <string.h>
+#include <stdlib.h>
+
+/*
+ * Registo dos nós da rede.
+ *
+ * Os nós são identificados nos comandos por um nome qualquer (e.g. "1",
+ * "20000" ou "fonte"). Internamente, cada nó ocupa um lugar (0 a
+ * REDE_MAXNOS - 1), que é o ID usado em todo o resto do controlador: índice
+ * dos arrays dos nós, nome dos FIFOs (./tmp/<lugar>in) e lugar dos contadores
+ * (stats.h). Os lugares dos nós removidos são reutilizados, por isso os
+ * lugares ocupados ficam sempre próximos de 0.
+ *
+ * Os nomes estão numa tabela de hash (endereçamento aberto, sondagem linear)
+ * que é refeita (e cresce) para manter a ocupação abaixo de metade. Para cada
+ * nó guarda-se também a lista dos nós que se ligam a ele (arestas inversas),
+ * para que remover ou alterar um nó custe O(grau) em vez de percorrer todas
+ * as ligações da rede.
+ */
+
+#define REDE_MAXNOS 65536 // nós ao mesmo tempo na rede
+
+#define REDE_VAZIO   -1 // posição da tabela nunca usada
+#define REDE_APAGADO -2 // posição de um nome removido (a procura continua)
+
+typedef struct rede_no {
+    char* nome; // NULL se o lugar estiver livre
+    int*  ins;  // nós que se ligam a este
+    int   nins, capins;
+} *RedeNo;
+
+static struct rede_no rede_nos[REDE_MAXNOS];
+static int  rede_livres[REDE_MAXNOS]; // pilha de lugares livres já usados
+static int  rede_nlivres = 0;
+static int  rede_usados = 0; // lugares já usados (0 a rede_usados - 1)
+static int* rede_tabela = NULL;
+static int  rede_cap = 0;    // tamanho da tabela (potência de 2)
+static int  rede_ocupadas = 0; // posições com nomes ou apagadas
+
+static unsigned rede_hash(const char* nome) {
+    unsigned h = 2166136261u; // FNV-1a
+
+    while (*nome) {
+        h ^= (unsigned char) *nome++;
+        h *= 16777619u;
+    }
+
+    return h;
+}
+
+/*
+ * @brief Posição do nome na tabela ou, se não estiver, onde deve ser posto
+ */
+static int rede_posicao(const char* nome) {
+    int i = rede_hash(nome) & (rede_cap - 1), livre = -1, l;
+
+    while ((l = rede_tabela[i]) != REDE_VAZIO) {
+        if (l == REDE_APAGADO) {
+            if (livre == -1) livre = i;
+        }
+        else if (strcmp(rede_nos[l].nome, nome) == 0) {
+            return i;
+        }
+        i = (i + 1) & (rede_cap - 1);
+    }
+
+    return livre != -1 ? livre : i;
+}
+
+/*
+ * @brief Refaz a tabela sem as posições apagadas, com o dobro do tamanho se
+ *        os nomes ocuparem mais de um quarto dela
+ */
+static void rede_refaz() {
+    int* antiga = rede_tabela;
+    int i, cap = rede_cap, vivos = rede_usados - rede_nlivres;
+
+    rede_cap = cap == 0 ? 64 : 4 * vivos > cap ? cap * 2 : cap;
+    rede_tabela = malloc(sizeof(int) * rede_cap);
+    for (i = 0; i < rede_cap; i++) rede_tabela[i] = REDE_VAZIO;
+    rede_ocupadas = 0;
+
+    for (i = 0; i < cap; i++) {
+        if (antiga[i] >= 0) {
+            rede_tabela[rede_posicao(rede_nos[antiga[i]].nome)] = antiga[i];
+            rede_ocupadas++;
+        }
+    }
+
+    free(antiga);
+}
+
+/*
+ * @brief Procura um nó pelo nome
+ *
+ * @return Lugar do nó ou -1 se não existir
+ */
+int rede_procura(const char* nome) {
+    int l;
+
+    if (nome == NULL || rede_cap == 0) return -1;
+
+    l = rede_tabela[rede_posicao(nome)];
+
+    return l >= 0 ? l : -1;
+}
+
+/*
+ * @brief Regista um nó novo (o nome ainda não pode existir)
+ *
+ * @return Lugar do nó ou -1 se a rede estiver cheia
+ */
+int rede_cria(const char* nome) {
+    int l, i;
+
+    if (rede_nlivres > 0) l = rede_livres[--rede_nlivres];
+    else if (rede_usados < REDE_MAXNOS) l = rede_usados++;
+    else return -1;
+
+    if (2 * (rede_ocupadas + 1) > rede_cap) rede_refaz();
+
+    i = rede_posicao(nome);
+    if (rede_tabela[i] == REDE_VAZIO) rede_ocupadas++;
+    rede_tabela[i] = l;
+
+    rede_nos[l].nome = strdup(nome);
+    rede_nos[l].nins = 0;
+
+    return l;
+}
+
+/*
+ * @brief Retira um nó do registo (o lugar fica livre)
+ */
+void rede_apaga(int l) {
+    rede_tabela[rede_posicao(rede_nos[l].nome)] = REDE_APAGADO;
+
+    free(rede_nos[l].nome);
+    rede_nos[l].nome = NULL;
+    rede_nos[l].nins = 0;
+
+    rede_livres[rede_nlivres++] = l;
+}
+
+/*
+ * @brief Nome de um nó (o que foi usado nos comandos)
+ */
+const char* rede_nome(int l) {
+    return rede_nos[l].nome;
+}
+
+/*
+ * @brief Número de lugares a percorrer para ver todos os nós (os lugares
+ *        livres têm rede_nome NULL)
+ */
+int rede_fim() {
+    return rede_usados;
+}
+
+/*
+ * @brief Regista a ligação de origem para destino no índice inverso
+ */
+void rede_entra(int destino, int origem) {
+    RedeNo d = &rede_nos[destino];
+
+    if (d->nins == d->capins) {
+        d->capins = d->capins > 0 ? d->capins * 2 : 4;
+        d->ins = realloc(d->ins, sizeof(int) * d->capins);
+    }
+
+    d->ins[d->nins++] = origem;
+}
+
+/*
+ * @brief Retira a ligação de origem para destino do índice inverso
+ */
+void rede_sai(int destino, int origem) {
+    RedeNo d = &rede_nos[destino];
+    int i;
+
+    for (i = 0; i < d->nins; i++) {
+        if (d->ins[i] == origem) {
+            d->ins[i] = d->ins[--d->nins];
+            return;
+        }
+    }
+}
+
+/*
+ * @brief Nós que se ligam a um nó
+ *
+ * @param ins Onde se coloca o array (válido até à próxima alteração)
+ *
+ * @return Número de nós
+ */
+int rede_entradas(int l, int** ins) {
+    *ins = rede_nos[l].ins;
+    return rede_nos[l].nins;
+}
+
+#endif
@@ -0,0 +1,561 @@
+#ifndef REPLICA_H
+#define REPLICA_H
+
+#include <sys/types.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+#include <pthread.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#include "readln.h"
+#include "outbuf.h"
+#include "stats.h"
+#include "traco.h"
+#include "field.h"
+
+/*
+ * Réplicas de um nó (node <id> -p <N>[:<coluna>] [-o] <cmd> ..., ver
+ * controlador.c).
+ *
+ * O processo do nó passa a ser um distribuidor: lança N processos com o
+ * componente (as réplicas), cada um com um pipe de entrada e um de saída,
+ * reparte por eles os registos que chegam ao nó e junta as suas saídas na
+ * saída do nó. Para o resto da rede (router, fanouts, motor, stats) o nó
+ * continua a ser um só processo com os FIFOs Xin e Xout.
+ *
+ * Repartição: por omissão, round-robin; com uma coluna, pelo hash (FNV-1a)
+ * do valor dessa coluna, para que os registos com a mesma chave vão todos
+ * para a mesma réplica e os operadores por chave continuem certos.
+ *
+ * Junção: sem -o, cada registo de cada réplica sai assim que chega. Com -o,
+ * a saída segue a ordem da entrada: o distribuidor põe a réplica de cada
+ * registo numa fila e a junção lê, por essa ordem, a resposta de cada
+ * registo. Os componentes internos (const, filter e window) devolvem a marca
+ * de ordem (READLN_MARCA) que vai a seguir a cada registo, que fecha a
+ * resposta (zero ou mais registos); os outros comandos (spawn, externos) têm
+ * de dar um registo por cada registo de entrada.
+ *
+ * Os carimbos do traçado (traco.h) vão para a réplica do registo seguinte e
+ * saem com o registo que vem a seguir da mesma réplica. As réplicas não têm
+ * contadores próprios: o distribuidor conta os registos lidos e escritos do
+ * nó. As réplicas terminam com o distribuidor (PR_SET_PDEATHSIG).
+ */
+
+#define REPLICA_MAX     64   // réplicas por nó
+#define REPLICA_MARCA   16   // bytes de uma marca de ordem
+#define REPLICA_VERIFICA 256 // registos entre verificações do prazo de todas
+                             // as réplicas
+
+typedef struct replica {
+    pid_t  pid;
+    Outbuf in;      // entrada da réplica (escrita pelo distribuidor)
+    int    out;     // saída da réplica (lida pela junção, -1 depois do EOF)
+    char*  buf;     // bytes lidos da saída (de ini a ini + len)
+    size_t ini, len, cap;
+} Replica;
+
+typedef struct replicas {
+    Replica r[REPLICA_MAX];
+    int     n;
+    int     coluna;  // coluna da chave (0 para round-robin)
+    char    delim;
+    int     ordem;   // 1 com -o
+    int     marcas;  // 1 se o componente devolve as marcas de ordem
+    Stats   st;      // contadores do nó
+    Outbuf  saida;   // saída do nó
+
+    /* Réplica de cada registo por responder (com -o) */
+    int*    fila;
+    size_t  fini, flen, fcap;
+    int     fim;     // 1 depois do EOF da entrada
+    pthread_mutex_t m;
+    pthread_cond_t  c;
+} *Replicas;
+
+static const char replica_marca[REPLICA_MARCA] = {
+    READLN_BINARIO, READLN_MARCA, 0, 0, REPLICA_MARCA, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, '\n'
+};
+
+/*
+ * @brief Lê a especificação das réplicas ("N" ou "N:coluna")
+ *
+ * @return 0 em caso de sucesso, -1 se for inválida
+ */
+int replica_spec(const char* s, int* n, int* coluna) {
+    char fim;
+
+    *coluna = 0;
+
+    if (s == NULL) return -1;
+    if (sscanf(s, "%d:%d%c", n, coluna, &fim) != 2 &&
+        (sscanf(s, "%d%c", n, &fim) != 1 || strchr(s, ':') != NULL)) return -1;
+
+    return *n >= 1 && *n <= REPLICA_MAX && *coluna >= 0 ? 0 : -1;
+}
+
+/*
+ * @brief Réplica de um registo: a seguinte (round-robin) ou a do hash da
+ *        coluna da chave (uma coluna que não exista vale "")
+ */
+static int replica_escolhe(Replicas R, const char* rec, size_t n) {
+    static int seguinte = 0;
+    unsigned h = 2166136261u;
+    size_t i = 0;
+    int col = 1;
+
+    if (R->coluna == 0) {
+        seguinte = (seguinte + 1) % R->n;
+        return seguinte;
+    }
+
+    if (n > 0 && rec[n - 1] == '\n') n--;
+
+    for (; i < n && col < R->coluna; i++) col += rec[i] == R->delim;
+
+    for (; col == R->coluna && i < n && rec[i] != R->delim; i++) {
+        h = (h ^ (unsigned char) rec[i]) * 16777619u;
+    }
+
+    return h % R->n;
+}
+
+/*
+ * @brief Lança as réplicas, cada uma com um pipe de entrada e um de saída
+ *
+ * @return 0 em caso de sucesso, -1 em caso de erro
+ */
+static int replica_lanca(Replicas R, char** cmd, int modo) {
+    int i, j, in[2], out[2];
+
+    for (i = 0; i < R->n; i++) {
+        if (pipe(in) == -1 || pipe(out) == -1) { perror("pipe réplica"); return -1; }
+
+        R->r[i].pid = fork();
+
+        if (R->r[i].pid == -1) { perror("fork réplica"); return -1; }
+
+        if (R->r[i].pid == 0) {
+            prctl(PR_SET_PDEATHSIG, SIGKILL);
+
+            dup2(in[0], 0);
+            dup2(out[1], 1);
+            close(in[0]); close(in[1]);
+            close(out[0]); close(out[1]);
+
+            for (j = 0; j < i; j++) { // pontas das réplicas anteriores
+                close(R->r[j].in->fd);
+                close(R->r[j].out);
+            }
+
+            execvp(cmd[0], cmd);
+            perror("exec réplica");
+            _exit(1);
+        }
+
+        close(in[0]);
+        close(out[1]);
+
+        R->r[i].in = outbuf_init(in[1], modo);
+        R->r[i].out = out[0];
+        R->r[i].cap = 65536;
+        R->r[i].buf = malloc(R->r[i].cap);
+        R->r[i].ini = R->r[i].len = 0;
+    }
+
+    return 0;
+}
+
+
+/******************************************************************************
+ *                               DISTRIBUIDOR                                 *
+ ******************************************************************************/
+
+/*
+ * @brief Põe a réplica de um registo na fila da ordem (-o)
+ */
+static void replica_fila_poe(Replicas R, int i) {
+    pthread_mutex_lock(&R->m);
+
+    if (R->flen == R->fcap) {
+        int* nova = malloc(sizeof(int) * R->fcap * 2);
+        size_t k;
+        for (k = 0; k < R->flen; k++) nova[k] = R->fila[(R->fini + k) % R->fcap];
+        free(R->fila);
+        R->fila = nova;
+        R->fini = 0;
+        R->fcap *= 2;
+    }
+
+    R->fila[(R->fini + R->flen++) % R->fcap] = i;
+
+    pthread_cond_signal(&R->c);
+    pthread_mutex_unlock(&R->m);
+}
+
+/*
+ * @brief Tira da fila a réplica do registo seguinte, esperando se preciso
+ *        (antes de esperar, escreve o que a junção tem acumulado)
+ *
+ * @return Réplica ou -1 se a entrada acabou e todos foram respondidos
+ */
+static int replica_fila_tira(Replicas R) {
+    int i = -1;
+
+    pthread_mutex_lock(&R->m);
+
+    if (R->flen == 0 && !R->fim) {
+        pthread_mutex_unlock(&R->m);
+        outbuf_flush(R->saida);
+        pthread_mutex_lock(&R->m);
+    }
+
+    while (R->flen == 0 && !R->fim) pthread_cond_wait(&R->c, &R->m);
+
+    if (R->flen > 0) {
+        i = R->fila[R->fini];
+        R->fini = (R->fini + 1) % R->fcap;
+        R->flen--;
+    }
+
+    pthread_mutex_unlock(&R->m);
+
+    return i;
+}
+
+/*
+ * @brief Thread que lê a entrada do nó e reparte os registos pelas réplicas
+ *        (no fim fecha as suas entradas, para que terminem)
+ */
+static void* replica_distribui(void* arg) {
+    Replicas R = arg;
+    char carimbo[TRACO_TAM];
+    int i, j, temcarimbo = 0;
+    long k = 0;
+    char* rec;
+    ssize_t n;
+
+    while ((n = stats_readln(R->st, 0, &rec)) > 0) {
+
+        /* O carimbo vai para a réplica do registo seguinte */
+
+        if (traco_e(rec, n)) {
+            memcpy(carimbo, rec, TRACO_TAM);
+            temcarimbo = 1;
+            continue;
+        }
+
+        i = replica_escolhe(R, rec, n);
+
+        if (temcarimbo) outbuf_write(R->r[i].in, carimbo, TRACO_TAM);
+        temcarimbo = 0;
+
+        outbuf_write(R->r[i].in, rec, n);
+
+        if (R->ordem) {
+            if (R->marcas) outbuf_write(R->r[i].in, replica_marca, REPLICA_MARCA);
+            replica_fila_poe(R, i);
+        }
+
+        /* Antes de esperar por input, tudo o que está acumulado é escrito;
+           senão só o que passou do prazo */
+
+        if (outbuf_parada(0)) {
+            for (j = 0; j < R->n; j++) outbuf_flush(R->r[j].in);
+        }
+        else if (++k % REPLICA_VERIFICA == 0) {
+            for (j = 0; j < R->n; j++) outbuf_idle(R->r[j].in, 0);
+        }
+        else outbuf_idle(R->r[i].in, 0);
+    }
+
+    for (i = 0; i < R->n; i++) {
+        outbuf_flush(R->r[i].in);
+        close(R->r[i].in->fd);
+    }
+
+    pthread_mutex_lock(&R->m);
+    R->fim = 1;
+    pthread_cond_signal(&R->c);
+    pthread_mutex_unlock(&R->m);
+
+    return NULL;
+}
+
+
+/******************************************************************************
+ *                                  JUNÇÃO                                    *
+ ******************************************************************************/
+
+/*
+ * @brief Lê mais um bloco da saída de uma réplica
+ *
+ * @return Bytes lidos, 0 no EOF (a saída é fechada)
+ */
+static ssize_t replica_le(Replica* r) {
+    ssize_t n;
+
+    if (r->ini > 0) {
+        memmove(r->buf, r->buf + r->ini, r->len);
+        r->ini = 0;
+    }
+
+    if (r->len == r->cap) {
+        r->cap *= 2;
+        r->buf = realloc(r->buf, r->cap);
+    }
+
+    do {
+        n = read(r->out, r->buf + r->len, r->cap - r->len);
+    } while (n == -1 && errno == EINTR);
+
+    if (n <= 0) {
+        close(r->out);
+        r->out = -1;
+        return 0;
+    }
+
+    r->len += n;
+
+    return n;
+}
+
+/*
+ * @brief Tamanho do próximo registo completo de uma réplica (com o carimbo
+ *        que tiver à frente)
+ *
+ * @return Tamanho ou 0 se ainda não estiver completo
+ */
+static size_t replica_registo(Replica* r) {
+    char* p = r->buf + r->ini;
+    size_t k = readln_registo_tam(p, r->len), t;
+
+    if (k > 0 && traco_e(p, k)) {
+        t = readln_registo_tam(p + k, r->len - k);
+        return t > 0 ? k + t : 0;
+    }
+
+    return k;
+}
+
+/*
+ * @brief Escreve na saída do nó os registos completos de um bloco (as marcas
+ *        de ordem não saem)
+ */
+static void replica_escreve(Replicas R, const char* p, size_t k) {
+    size_t t;
+
+    while (k > 0 && (t = readln_registo_tam(p, k)) > 0) {
+        if (!readln_marca(p, t)) outbuf_write(R->saida, p, t);
+        p += t;
+        k -= t;
+    }
+}
+
+/*
+ * @brief Escreve o que sobrou de uma réplica que terminou (uma linha sem
+ *        '\n' leva-o)
+ */
+static void replica_resto(Replicas R, Replica* r) {
+    size_t k;
+
+    while ((k = replica_registo(r)) > 0) {
+        replica_escreve(R, r->buf + r->ini, k);
+        r->ini += k;
+        r->len -= k;
+    }
+
+    if (r->len > 0 && readln_binario_tam(r->buf + r->ini, r->len) <= 0) {
+        if (r->ini + r->len == r->cap) r->buf = realloc(r->buf, ++r->cap);
+        r->buf[r->ini + r->len] = '\n';
+        outbuf_write(R->saida, r->buf + r->ini, r->len + 1);
+    }
+
+    r->len = 0;
+}
+
+/*
+ * @brief Junção sem ordem: cada registo sai assim que chega, de qualquer
+ *        réplica
+ */
+static void replica_junta(Replicas R) {
+    struct pollfd p[REPLICA_MAX];
+    int i, n, pr, abertas = R->n, ix[REPLICA_MAX];
+    size_t k;
+    Replica* r;
+
+    while (abertas > 0) {
+        for (i = n = 0; i < R->n; i++) {
+            if (R->r[i].out == -1) continue;
+            p[n].fd = R->r[i].out;
+            p[n].events = POLLIN;
+            ix[n++] = i;
+        }
+
+        /* Sem nada pronto, escreve-se o que estiver acumulado antes de
+           esperar */
+
+        if ((pr = poll(p, n, 0)) == 0) {
+            outbuf_flush(R->saida);
+            pr = poll(p, n, -1);
+        }
+        else if (outbuf_expirou(R->saida)) outbuf_flush(R->saida);
+
+        if (pr == -1) continue;
+
+        for (i = 0; i < n; i++) {
+            if (!(p[i].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+
+            r = &R->r[ix[i]];
+
+            if (replica_le(r) == 0) {
+                replica_resto(R, r);
+                abertas--;
+                continue;
+            }
+
+            while ((k = replica_registo(r)) > 0) {
+                replica_escreve(R, r->buf + r->ini, k);
+                r->ini += k;
+                r->len -= k;
+            }
+        }
+    }
+}
+
+/*
+ * @brief Junção pela ordem da entrada: a resposta de cada registo vem da sua
+ *        réplica (até à marca de ordem ou, sem marcas, um só registo)
+ */
+static void replica_ordena(Replicas R) {
+    struct pollfd p;
+    int i, completa;
+    size_t k, t;
+    Replica* r;
+
+    while ((i = replica_fila_tira(R)) != -1) {
+        r = &R->r[i];
+
+        for (completa = 0; !completa; ) {
+            char* q = r->buf + r->ini;
+
+            /* Resposta completa no buffer: até à marca ou um registo */
+
+            if (R->marcas) {
+                for (k = 0; (t = readln_registo_tam(q + k, r->len - k)) > 0; k += t) {
+                    if (readln_marca(q + k, t)) { completa = 1; k += t; break; }
+                }
+            }
+            else completa = (k = replica_registo(r)) > 0;
+
+            if (completa) {
+                replica_escreve(R, q, k);
+                r->ini += k;
+                r->len -= k;
+                break;
+            }
+
+            if (r->out == -1) break; // a réplica terminou: a resposta perde-se
+
+            /* Antes de esperar pela réplica, escreve-se o que está acumulado */
+
+            p.fd = r->out;
+            p.events = POLLIN;
+            if (poll(&p, 1, 0) == 0 || outbuf_expirou(R->saida)) outbuf_flush(R->saida);
+
+            replica_le(r);
+        }
+    }
+
+    /* O que as réplicas escreverem depois da última resposta (e.g. no EOF) */
+
+    for (i = 0; i < R->n; i++) {
+        while (R->r[i].out != -1) replica_le(&R->r[i]);
+        replica_resto(R, &R->r[i]);
+    }
+}
+
+/*
+ * @brief Fecha os descritores herdados do controlador (o processo do nó não
+ *        faz exec, por isso o O_CLOEXEC não os fecha), menos o stdin, o
+ *        stdout e o stderr
+ */
+void replica_fecha_herdados() {
+    int fd;
+
+#ifdef SYS_close_range
+    if (syscall(SYS_close_range, 3, ~0U, 0) == 0) return;
+#endif
+
+    for (fd = 3; fd < sysconf(_SC_OPEN_MAX); fd++) close(fd);
+}
+
+/*
+ * @brief Corre um nó com réplicas (no processo do nó, com a entrada e a
+ *        saída do nó no stdin e stdout)
+ *
+ * @param cmd    Comando do componente (argv, terminado em NULL)
+ * @param n      Número de réplicas
+ * @param coluna Coluna da chave (0 para round-robin)
+ * @param ordem  1 para manter a ordem da entrada
+ * @param marcas 1 se o componente devolve as marcas de ordem
+ *
+ * @return Exit status do processo do nó
+ */
+int replica_corre(char** cmd, int n, int coluna, int ordem, int marcas) {
+    struct replicas R;
+    pthread_t th;
+    int argc, i;
+
+    memset(&R, 0, sizeof(R));
+    R.n = n;
+    R.coluna = coluna;
+    R.ordem = ordem;
+    R.marcas = marcas;
+    R.fcap = 1024;
+    R.fila = malloc(sizeof(int) * R.fcap);
+    pthread_mutex_init(&R.m, NULL);
+    pthread_cond_init(&R.c, NULL);
+
+    for (argc = 0; cmd[argc] != NULL; argc++);
+    campos_opcao(argc, (char const**) cmd, &R.delim);
+
+    /* Os contadores são do distribuidor: as réplicas não os recebem */
+
+    R.st = stats_abre();
+    unsetenv(STATS_ENV);
+    unsetenv(STATS_ENV_NO);
+
+    R.saida = outbuf_init(1, outbuf_modo_env());
+    R.saida->stats = R.st;
+
+    if (replica_lanca(&R, cmd, outbuf_modo_env()) != 0) return 1;
+
+    signal(SIGPIPE, SIG_IGN);
+
+    if (pthread_create(&th, NULL, replica_distribui, &R) != 0) {
+        perror("pthread_create réplica");
+        return 1;
+    }
+
+    if (ordem) replica_ordena(&R);
+    else replica_junta(&R);
+
+    outbuf_flush(R.saida);
+
+    pthread_join(th, NULL);
+
+    for (i = 0; i < n; i++) waitpid(R.r[i].pid, NULL, 0);
+
+    return 0;
+}
+
+#endif
@@ -0,0 +1,1559 @@
+#ifndef ROUTER_H
+#define ROUTER_H
+
+#include <sys/types.h>
+#include <sys/epoll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <limits.h>
+
+#include "fanout.h"
+#include "stats.h"
+#include "traco.h"
+#include "rede.h"
+#include "anel.h"
+#include "bytes.h"
+
+/*
+ * Encaminhador (router) das ligações entre nós, dentro do controlador.
+ *
+ * Em vez de um processo de fanout por ligação, uma só thread do controlador
+ * serve todas as ligações: lê os FIFOs "Xout" dos nós com ligações e escreve
+ * nos FIFOs "Yin" dos destinos, com todos os descritores não bloqueantes e
+ * multiplexados num epoll.
+ *
+ * Cada nó de origem tem uma rota (o seu FIFO de saída, o registo incompleto
+ * lido e os destinos) e cada nó de destino tem uma saída com a fila dos bytes
+ * por escrever, partilhada por todas as rotas que lhe escrevem. A fila
+ * absorve um destino lento: só quando passa de ROUTER_FILA bytes é que as
+ * rotas que lhe escrevem deixam de ler (e os seus nós acabam por bloquear na
+ * escrita), voltando a ler quando desce para metade. As outras saídas e rotas
+ * continuam a andar.
+ *
+ * Cada escrita tem só registos completos e no máximo PIPE_BUF bytes (ou um
+ * só registo maior), tal como nos fanouts, para que seja atómica em relação a
+ * outros escritores do mesmo FIFO (e.g. o inject). Os registos
+ * binários (ver readln.h) não são entregues aos destinos que não os aceitam.
+ * A desbloqueia só escreve para os fanouts em processos, por isso uma linha
+ * "-" é entregue como qualquer outra.
+ *
+ * Rotas e saídas só são tocadas pela thread do router. Os comandos do
+ * controlador (router_liga, router_corta, router_remove) são edições enviadas
+ * por um canal (um pipe com ponteiros para as edições, também no epoll) e
+ * aplicadas pela thread entre dois eventos, quando cada rota só tem lido um
+ * registo incompleto: uma mudança de destinos aplica-se sempre numa fronteira
+ * de registo, sem perder nem repetir registos e sem parar o nó de origem. O
+ * controlador espera pela confirmação (um byte num segundo pipe) para que o
+ * comando seguinte já veja a edição feita.
+ *
+ * Uma rota sem destinos fica parada (não lê) em vez de fechar o FIFO, para
+ * que o nó não receba SIGPIPE e os seus registos esperem por uma nova ligação.
+ *
+ * Para terminar a rede sem perder registos (shutdown --drain), o controlador
+ * drena a rota de cada nó que já terminou (router_drena) e espera que as
+ * saídas dos nós seguintes fiquem escritas e fechadas (router_escreve), para
+ * que estes recebam EOF.
+ *
+ * Os contadores do fanout de cada nó (stats.h) contam os registos lidos pela
+ * rota e os entregues às filas dos destinos (somados por destino). Com o
+ * traçado (traco.h), cada carimbo conta nos histogramas das ligações da rota
+ * antes de ser entregue.
+ *
+ * Um nó criado com anéis (node <id> -a ..., anel.h) não tem FIFO de saída
+ * para o router: a sua rota lê o anel de saída (esperando pelo eventfd do
+ * anel no epoll) e a saída para ele escreve no anel de entrada, sem o corte
+ * em PIPE_BUF (o router é o único escritor do anel). O FIFO de entrada do nó
+ * mantém-se para os injects: uma rota de repasse lê-o e entrega o que lá
+ * estiver, tal como está, à mesma saída. A saída de um nó com anéis existe
+ * enquanto o nó existir (o repasse é mais uma referência) e, quando fecha,
+ * fecha o anel (o componente recebe EOF, router_fecha).
+ *
+ * Cada ligação (de uma rota para uma saída) tem uma capacidade e uma política
+ * para quando a fila do destino passa dessa capacidade (connect ... --cap
+ * <bytes> --overflow <política>):
+ *  - block (por omissão): a rota deixa de ler, como acima;
+ *  - drop-newest: os registos que chegam são descartados;
+ *  - drop-oldest: os registos ficam na fila da ligação, que guarda no máximo
+ *    a capacidade, descartando os mais antigos;
+ *  - spill: os registos vão para ficheiros no disco (segmentos de
+ *    ROUTER_SEGMENTO bytes em ./tmp), lidos de volta por ordem.
+ * Só a política block pára a rota, por isso um destino lento com outra
+ * política não atrasa os outros destinos do mesmo nó. Enquanto uma ligação
+ * tiver registos à espera (na sua fila ou no disco), os que chegam vão para
+ * trás deles, e passam para a fila do destino, por ordem, à medida que esta
+ * desce abaixo da capacidade (router_repoe). Quando a ligação é desfeita (ou
+ * a rota drenada), o que ainda tiver à espera vai todo para a fila do destino.
+ * Os registos descartados e os bytes que foram para o disco são contados por
+ * ligação (router_ligacoes).
+ */
+
+#define ROUTER_BLOCO    65536     // leitura de cada FIFO de saída
+#define ROUTER_FILA     (1 << 20) // capacidade por omissão de cada ligação:
+                                  // bytes por escrever a partir dos quais as
+                                  // rotas que escrevem numa saída param
+#define ROUTER_CAPMAX   (1ULL << 50) // capacidade máxima de uma ligação
+#define ROUTER_SEGMENTO (64 << 20) // bytes de cada ficheiro do disco (spill)
+#define ROUTER_EVENTOS  64
+
+/* Políticas de uma ligação quando a fila do destino passa da capacidade */
+
+enum { ROUTER_BLOQUEIA, ROUTER_DESCARTA_ANTIGOS, ROUTER_DESCARTA_NOVOS,
+       ROUTER_DISCO };
+
+static const char* router_politicas[] = { "block", "drop-oldest", "drop-newest",
+                                          "spill" };
+
+typedef struct saida {
+    int    id;      // ID do nó de destino
+    int    fd;      // FIFO de entrada do destino (não bloqueante)
+    int    binarios; // 1 se o destino aceita registos binários
+    char*  buf;     // bytes por escrever (de ini a ini + len)
+    size_t ini, len, cap;
+    size_t resto;   // bytes que faltam de um registo escrito a meio
+    int    refs;    // rotas que escrevem nesta saída
+    int    espera;  // 1 se está no epoll à espera de espaço no FIFO
+    Anel   anel;    // anel de entrada do destino (NULL se for o FIFO)
+    struct rota* entrada; // repasse do FIFO de entrada (nós com anéis)
+} *Saida;
+
+typedef struct ligacao {
+    Saida    s;        // destino
+    int      origem;   // ID do nó de origem
+    size_t   cap;      // bytes na fila do destino a partir dos quais se
+                       // aplica a política
+    int      politica; // ROUTER_BLOQUEIA, ROUTER_DESCARTA_ANTIGOS, ...
+    char*    buf;      // registos à espera (drop-oldest) ou lidos do disco
+    size_t   ini, len, capbuf; // (spill), de ini a ini + len
+    int      fdw, fdr; // segmentos do disco em escrita e em leitura (ou -1)
+    unsigned segw, segr;
+    size_t   tamw;     // bytes do segmento em escrita
+    size_t   disco;    // bytes no disco ainda por ler
+    int      ipendente; // posição em router_pendentes (-1 se não estiver)
+    contador descartados, bdescartados; // registos e bytes descartados
+    contador derramados; // bytes que foram para o disco
+} *Ligacao;
+
+typedef struct rota {
+    int    id;      // ID do nó de origem
+    int    fd;      // FIFO de saída do nó (não bloqueante)
+    Saida* outs;    // destinos
+    Ligacao* ligs;  // ligações para os destinos (ligs[i]->s == outs[i])
+    int    numouts;
+    char*  buf;     // registo incompleto (e o que falta entregar)
+    size_t len, cap;
+    int    parada;  // 1 se não lê até os destinos terem espaço
+    int    iparada; // posição em router_paradas (se estiver parada)
+    Stats  st;      // contadores do fanout do nó
+    Anel   anel;    // anel de saída do nó (fd é então o eventfd do anel)
+    int    repasse; // 1 se repassa o FIFO de entrada de um nó com anéis
+} *Rota;
+
+static Rota  router_rotas[REDE_MAXNOS];  // rotas indexadas pelo ID da origem
+static Saida router_saidas[REDE_MAXNOS]; // saídas indexadas pelo ID do destino
+static Anel  router_aneis[REDE_MAXNOS];  // anéis de saída dos nós com anéis
+static int   router_ep = -1;             // epoll (-1 se o router não corre)
+static Rota* router_paradas = NULL;      // rotas paradas
+static int   router_nparadas = 0, router_capparadas = 0;
+static Ligacao* router_pendentes = NULL; // ligações com registos à espera
+static int   router_npendentes = 0, router_cappendentes = 0;
+static char* router_conv = NULL;         // blocos sem os registos binários
+static size_t router_capconv = 0;
+static int   router_canal[2];         // edições (controlador -> router)
+static int   router_feito[2];         // confirmações (router -> controlador)
+static pthread_t router_thread;
+
+/* No epoll, cada descritor é identificado pelo ID do nó e pelo tipo */
+
+#define ROUTER_EV(id, tipo) ((uint64_t) (id) << 2 | (tipo))
+#define ROUTER_EV_CANAL     UINT64_MAX
+
+enum { ROUTER_EV_ROTA, ROUTER_EV_SAIDA, ROUTER_EV_REPASSE };
+
+enum { ROUTER_LIGA, ROUTER_CORTA, ROUTER_REMOVE, ROUTER_DRENA, ROUTER_ESCREVE,
+       ROUTER_ANEL, ROUTER_FECHA, ROUTER_LIGACOES };
+
+/*
+ * Estado de uma ligação (router_ligacoes)
+ */
+typedef struct router_ligacao {
+    int      origem, destino, politica;
+    size_t   cap;
+    size_t   fila;    // bytes na fila do destino (de todas as rotas)
+    size_t   espera;  // bytes à espera na fila da ligação
+    size_t   disco;   // bytes à espera no disco
+    contador descartados, bdescartados, derramados;
+} RouterLigacao;
+
+/*
+ * Edição pedida pelo controlador (vive na pilha de quem a pede até à
+ * confirmação)
+ */
+typedef struct edicao {
+    int    tipo;    // ROUTER_LIGA, ROUTER_CORTA, ROUTER_REMOVE, ...
+    int    id;      // ID do nó
+    int*   outs;    // destinos (ROUTER_LIGA)
+    int*   binarios;
+    int    numouts;
+    Stats  st;      // contadores do fanout do nó
+    int    erro;    // resultado (escrito pela thread do router)
+    Anel   entrada; // anéis do nó (ROUTER_ANEL)
+    Anel   saida;
+    size_t* caps;   // capacidade de cada destino, 0 por omissão (ROUTER_LIGA)
+    int*   politicas;
+    RouterLigacao* ligacoes; // estado das ligações (ROUTER_LIGACOES, malloc)
+    int    nligacoes;
+} *Edicao;
+
+/* Tempo até as edições estarem aplicadas, visto pelo controlador */
+
+contador router_edicoes = 0;
+contador router_nsedicoes = 0;
+contador router_maxedicao = 0;
+
+/*
+ * @brief Indica se as ligações são servidas pelo router
+ */
+int router_ativo() {
+    return router_ep != -1;
+}
+
+/*
+ * @brief Lê uma política de uma ligação (e.g. drop-oldest)
+ *
+ * @return Política ou -1 se for inválida
+ */
+int router_politica(const char* nome) {
+    int i;
+
+    for (i = 0; i < (int) (sizeof(router_politicas) / sizeof(char*)); i++) {
+        if (strcmp(nome, router_politicas[i]) == 0) return i;
+    }
+
+    return -1;
+}
+
+/*
+ * @brief Lê a capacidade de uma ligação (bytes, ver bytes.h)
+ *
+ * @return Capacidade ou 0 se for inválida
+ */
+size_t router_capacidade(const char* s) {
+    return bytes_converte(s, ROUTER_CAPMAX);
+}
+
+
+/******************************************************************************
+ *                                 SAÍDAS                                     *
+ ******************************************************************************/
+
+/*
+ * @brief Registos completos do início de um bloco até max bytes (ou um só
+ *        registo maior)
+ *
+ * @return Bytes desses registos ou 0 se o primeiro registo estiver incompleto
+ */
+static size_t router_prefixo(const char* p, size_t len, size_t max) {
+    size_t k = 0, r, m = len < max ? len : max;
+    const char* nl;
+
+    if (memchr(p, READLN_BINARIO, m) == NULL) { // só linhas
+        nl = memrchr(p, '\n', m);
+        if (nl != NULL) return nl - p + 1;
+    }
+    else {
+        while ((r = readln_registo_tam(p + k, m - k)) > 0) k += r;
+        if (k > 0) return k;
+    }
+
+    return readln_registo_tam(p, len);
+}
+
+/*
+ * @brief Número de registos de um bloco de registos completos
+ */
+static contador router_conta(const char* p, size_t len) {
+    size_t i, r;
+    contador n = 0;
+
+    for (i = 0; i < len && (r = readln_registo_tam(p + i, len - i)) > 0; i += r) n++;
+
+    return n;
+}
+
+/*
+ * @brief Tamanho de uma escrita a partir do início de um bloco de registos
+ *        completos: registos até PIPE_BUF bytes (ou um só registo maior)
+ */
+static size_t router_corte(const char* p, size_t len) {
+    return len <= PIPE_BUF ? len : router_prefixo(p, len, PIPE_BUF);
+}
+
+/*
+ * @brief Tamanho da próxima escrita de uma saída (o resto de um registo
+ *        escrito a meio ou o corte a partir do início da fila)
+ */
+static size_t saida_corte(Saida s) {
+    if (s->anel != NULL) return s->len; // o router é o único escritor
+    return s->resto > 0 ? s->resto : router_corte(s->buf + s->ini, s->len);
+}
+
+/*
+ * @brief Descritor pelo qual a saída espera por espaço (o FIFO ou o eventfd
+ *        do anel)
+ */
+static int saida_fd(Saida s) {
+    return s->anel != NULL ? s->anel->efd : s->fd;
+}
+
+/*
+ * @brief Escreve sem bloquear no FIFO ou no anel do destino (como o write)
+ */
+static ssize_t saida_write(Saida s, const char* buf, size_t n) {
+    size_t w;
+
+    if (s->anel == NULL) return write(s->fd, buf, n);
+
+    if ((w = anel_escreve_nb(s->anel, buf, n)) == 0) {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    return w;
+}
+
+/*
+ * @brief Escreve o que o FIFO do destino aceitar sem bloquear
+ *
+ * O que fica por escrever faz com que a saída espere (no epoll) por espaço no
+ * FIFO. Se o destino já não tiver leitores, a fila é descartada.
+ */
+static void saida_escreve(Saida s) {
+    struct epoll_event ev;
+    ssize_t w;
+    size_t n;
+
+    if (s->anel != NULL && s->espera) anel_limpa(s->anel);
+
+    while (s->len > 0) {
+        n = saida_corte(s);
+        w = saida_write(s, s->buf + s->ini, n);
+
+        if (w == -1) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN) s->len = s->resto = 0; // sem leitores
+
+            /* Anel cheio: o componente só avisa (no eventfd) se vir a marca
+               de espera, e pode ter lido entretanto */
+
+            else if (s->anel != NULL && anel_espera_espaco(s->anel)) continue;
+            break;
+        }
+
+        s->resto = s->anel != NULL ? 0 : n - w;
+        s->ini += w;
+        s->len -= w;
+    }
+
+    if (s->len == 0) s->ini = 0;
+
+    if (s->len > 0 && !s->espera) {
+        ev.events = s->anel != NULL ? EPOLLIN : EPOLLOUT;
+        ev.data.u64 = ROUTER_EV(s->id, ROUTER_EV_SAIDA);
+        epoll_ctl(router_ep, EPOLL_CTL_ADD, saida_fd(s), &ev);
+        s->espera = 1;
+    }
+    else if (s->len == 0 && s->espera) {
+        epoll_ctl(router_ep, EPOLL_CTL_DEL, saida_fd(s), NULL);
+        s->espera = 0;
+    }
+}
+
+/*
+ * @brief Acrescenta um bloco de registos completos à fila de uma saída
+ *        (sem os binarios, se o destino não os aceitar)
+ */
+static void saida_poe(Saida s, const char* buf, size_t k, int tembinarios) {
+    if (s->ini > 0 && s->ini + s->len + k > s->cap) {
+        memmove(s->buf, s->buf + s->ini, s->len);
+        s->ini = 0;
+    }
+
+    if (s->len + k > s->cap) {
+        while (s->len + k > s->cap) s->cap *= 2;
+        s->buf = realloc(s->buf, s->cap);
+    }
+
+    if (tembinarios && !s->binarios) {
+        s->len += fanout_sem_binarios(buf, k, s->buf + s->ini + s->len);
+    }
+    else {
+        memcpy(s->buf + s->ini + s->len, buf, k);
+        s->len += k;
+    }
+}
+
+/*
+ * @brief Entrega um bloco de registos completos a uma saída
+ *
+ * Com a fila vazia (o caso normal), o bloco é escrito diretamente no FIFO e
+ * só o que não couber vai para a fila.
+ */
+static void saida_envia(Saida s, const char* buf, size_t k, int tembinarios) {
+    ssize_t w;
+    size_t n;
+
+    if (s->len == 0 && !(tembinarios && !s->binarios)) {
+        while (k > 0) {
+            n = s->anel != NULL ? k : router_corte(buf, k);
+            w = saida_write(s, buf, n);
+
+            if (w == -1) {
+                if (errno == EINTR) continue;
+                if (errno != EAGAIN) return; // sem leitores
+                break;
+            }
+
+            buf += w;
+            k -= w;
+
+            if ((size_t) w < n) { // registo maior que PIPE_BUF escrito a meio
+                if (s->anel == NULL) s->resto = n - w;
+                break;
+            }
+        }
+    }
+
+    if (k > 0) saida_poe(s, buf, k, tembinarios);
+}
+
+/*
+ * @brief Devolve a saída de um nó, criando-a (e abrindo o FIFO) se preciso
+ *
+ * @return Saída ou NULL se o FIFO não puder ser aberto
+ */
+static Saida saida_obtem(int id, int binarios) {
+    char in[32];
+    Saida s = router_saidas[id];
+
+    if (s == NULL) {
+        s = calloc(1, sizeof(struct saida));
+        s->id = id;
+
+        /* O FIFO tem sempre um leitor (o controlador mantém-no aberto), pelo
+           que o open não bloqueia nem falha por falta dele */
+
+        sprintf(in, "./tmp/%din", id);
+        s->fd = open(in, O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+
+        if (s->fd == -1) {
+            perror("open fifo router");
+            free(s);
+            return NULL;
+        }
+
+        s->cap = ROUTER_BLOCO;
+        s->buf = malloc(s->cap);
+        router_saidas[id] = s;
+    }
+
+    s->binarios = binarios;
+    s->refs++;
+
+    return s;
+}
+
+/*
+ * @brief Fecha uma saída (a fila que ainda tiver perde-se)
+ */
+static void saida_fecha(Saida s) {
+    if (s->espera) epoll_ctl(router_ep, EPOLL_CTL_DEL, saida_fd(s), NULL);
+    if (s->anel != NULL) anel_fecha(s->anel); // o componente recebe EOF
+    else close(s->fd);
+    router_saidas[s->id] = NULL;
+    free(s->buf);
+    free(s);
+}
+
+/*
+ * @brief Larga uma referência a uma saída; sem rotas, a saída é fechada
+ *        assim que a fila estiver escrita
+ */
+static void saida_larga(Saida s) {
+    if (--s->refs == 0 && s->len == 0) saida_fecha(s);
+}
+
+
+/******************************************************************************
+ *                                LIGAÇÕES                                    *
+ ******************************************************************************/
+
+/*
+ * @brief Cria a ligação de uma rota para uma saída
+ *
+ * @param cap      Capacidade (0 para ROUTER_FILA)
+ * @param politica ROUTER_BLOQUEIA, ROUTER_DESCARTA_ANTIGOS, ...
+ */
+static Ligacao ligacao_cria(Saida s, int origem, size_t cap, int politica) {
+    Ligacao l = calloc(1, sizeof(struct ligacao));
+
+    l->s = s;
+    l->origem = origem;
+    l->cap = cap > 0 ? cap : ROUTER_FILA;
+    l->politica = politica;
+    l->fdw = l->fdr = -1;
+    l->ipendente = -1;
+
+    return l;
+}
+
+/*
+ * @brief Indica se a ligação tem registos à espera (na sua fila ou no disco)
+ */
+static int ligacao_espera(Ligacao l) {
+    return l->len > 0 || l->disco > 0;
+}
+
+/*
+ * @brief Põe (ou tira) a ligação na lista das que têm registos à espera
+ */
+static void ligacao_pendente(Ligacao l, int pendente) {
+    if ((l->ipendente != -1) == pendente) return;
+
+    if (pendente) {
+        if (router_npendentes == router_cappendentes) {
+            router_cappendentes = router_cappendentes > 0 ? 2 * router_cappendentes : 16;
+            router_pendentes = realloc(router_pendentes, sizeof(Ligacao) * router_cappendentes);
+        }
+        l->ipendente = router_npendentes;
+        router_pendentes[router_npendentes++] = l;
+    }
+    else {
+        router_pendentes[l->ipendente] = router_pendentes[--router_npendentes];
+        router_pendentes[l->ipendente]->ipendente = l->ipendente;
+        l->ipendente = -1;
+    }
+}
+
+/*
+ * @brief Abre um segmento do disco de uma ligação (./tmp/<origem>-<destino>.<seg>.disco)
+ */
+static int ligacao_segmento(Ligacao l, unsigned seg, int flags) {
+    char nome[64];
+
+    sprintf(nome, "./tmp/%d-%d.%u.disco", l->origem, l->s->id, seg);
+
+    if (flags == -1) return unlink(nome); // apagar
+
+    return open(nome, flags | O_CLOEXEC, 0600);
+}
+
+/*
+ * @brief Fecha e apaga os segmentos do disco de uma ligação
+ */
+static void ligacao_fecha_disco(Ligacao l) {
+    unsigned seg;
+
+    if (l->fdw == -1 && l->fdr == -1) return;
+
+    if (l->fdw != -1) close(l->fdw);
+    if (l->fdr != -1) close(l->fdr);
+    for (seg = l->segr; seg != l->segw + 1; seg++) ligacao_segmento(l, seg, -1);
+
+    l->fdw = l->fdr = -1;
+    l->segr = l->segw = l->segw + 1;
+    l->tamw = l->disco = 0;
+}
+
+/*
+ * @brief Acrescenta registos à fila da ligação
+ */
+static void ligacao_poe(Ligacao l, const char* buf, size_t k) {
+    if (l->ini > 0 && l->ini + l->len + k > l->capbuf) {
+        memmove(l->buf, l->buf + l->ini, l->len);
+        l->ini = 0;
+    }
+
+    if (l->len + k > l->capbuf) {
+        if (l->capbuf == 0) l->capbuf = ROUTER_BLOCO;
+        while (l->len + k > l->capbuf) l->capbuf *= 2;
+        l->buf = realloc(l->buf, l->capbuf);
+    }
+
+    memcpy(l->buf + l->ini + l->len, buf, k);
+    l->len += k;
+}
+
+/*
+ * @brief Escreve registos no fim do disco da ligação (num segmento novo a
+ *        cada ROUTER_SEGMENTO bytes)
+ *
+ * Se o disco falhar, os registos são descartados (e contados).
+ */
+static void ligacao_derrama(Ligacao l, const char* buf, size_t k) {
+    size_t n = 0;
+    ssize_t w;
+
+    if (l->fdw != -1 && l->tamw >= ROUTER_SEGMENTO) {
+        close(l->fdw);
+        l->fdw = -1;
+        l->segw++;
+    }
+
+    if (l->fdw == -1) {
+        l->fdw = ligacao_segmento(l, l->segw, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND);
+        l->tamw = 0;
+    }
+
+    while (l->fdw != -1 && n < k) {
+        w = write(l->fdw, buf + n, k - n);
+        if (w == -1 && errno == EINTR) continue;
+        if (w == -1) break;
+        n += w;
+    }
+
+    if (n < k) { // o disco só tem registos inteiros
+        perror(l->fdw == -1 ? "open disco router" : "write disco router");
+        if (n > 0) ftruncate(l->fdw, l->tamw);
+        l->descartados += router_conta(buf, k);
+        l->bdescartados += k;
+        return;
+    }
+
+    l->tamw += k;
+    l->disco += k;
+    l->derramados += k;
+}
+
+/*
+ * @brief Lê um bloco do disco para o fim da fila da ligação
+ *
+ * @return Bytes lidos (0 se não houver mais ou em caso de erro)
+ */
+static size_t ligacao_le_disco(Ligacao l) {
+    ssize_t n;
+
+    while (l->disco > 0) {
+        if (l->fdr == -1) l->fdr = ligacao_segmento(l, l->segr, O_RDONLY);
+        if (l->fdr == -1) break;
+
+        if (l->ini + l->len + ROUTER_BLOCO > l->capbuf) {
+            if (l->ini > 0) memmove(l->buf, l->buf + l->ini, l->len);
+            l->ini = 0;
+            while (l->len + ROUTER_BLOCO > l->capbuf) {
+                l->capbuf = l->capbuf > 0 ? 2 * l->capbuf : 2 * ROUTER_BLOCO;
+            }
+            l->buf = realloc(l->buf, l->capbuf);
+        }
+
+        n = read(l->fdr, l->buf + l->ini + l->len, ROUTER_BLOCO);
+
+        if (n == -1 && errno == EINTR) continue;
+        if (n == -1) break;
+
+        if (n == 0) { // fim de um segmento já fechado: passa ao seguinte
+            if (l->segr == l->segw) break;
+            close(l->fdr);
+            l->fdr = -1;
+            ligacao_segmento(l, l->segr++, -1);
+            continue;
+        }
+
+        l->len += n;
+        l->disco -= n;
+
+        if (l->disco == 0) ligacao_fecha_disco(l); // o próximo começa vazio
+
+        return n;
+    }
+
+    if (l->disco > 0) { // segmento perdido: o resto do disco é descartado
+        perror("read disco router");
+        l->bdescartados += l->disco;
+        ligacao_fecha_disco(l);
+    }
+
+    return 0;
+}
+
+/*
+ * @brief Descarta os registos mais antigos da fila da ligação até caber na
+ *        capacidade (fica sempre o último)
+ */
+static void ligacao_apara(Ligacao l) {
+    size_t r;
+
+    while (l->len > l->cap) {
+        r = readln_registo_tam(l->buf + l->ini, l->len);
+        if (r == 0 || r == l->len) break;
+
+        l->ini += r;
+        l->len -= r;
+        l->descartados++;
+        l->bdescartados += r;
+    }
+}
+
+/*
+ * @brief Entrega um bloco de registos completos a uma ligação
+ *
+ * Com a política block, ou com a fila do destino abaixo da capacidade e nada
+ * à espera, o bloco vai para a saída. Senão aplica-se a política.
+ *
+ * @param nrec Número de registos do bloco
+ */
+static void ligacao_envia(Ligacao l, const char* buf, size_t k, contador nrec,
+                          int tembinarios) {
+    Saida s = l->s;
+
+    if (l->politica == ROUTER_BLOQUEIA || (!ligacao_espera(l) && s->len <= l->cap)) {
+        saida_envia(s, buf, k, tembinarios);
+        return;
+    }
+
+    if (l->politica == ROUTER_DESCARTA_NOVOS) {
+        l->descartados += nrec;
+        l->bdescartados += k;
+        return;
+    }
+
+    /* O que fica à espera já vai sem os registos binários que o destino não
+       aceita */
+
+    if (tembinarios && !s->binarios) {
+        if (k > router_capconv) {
+            router_capconv = k;
+            router_conv = realloc(router_conv, router_capconv);
+        }
+        k = fanout_sem_binarios(buf, k, router_conv);
+        buf = router_conv;
+    }
+
+    if (l->politica == ROUTER_DISCO) ligacao_derrama(l, buf, k);
+    else {
+        ligacao_poe(l, buf, k);
+        ligacao_apara(l);
+    }
+
+    ligacao_pendente(l, ligacao_espera(l));
+}
+
+/*
+ * @brief Passa registos à espera na ligação para a fila do destino, por
+ *        ordem, até esta chegar à capacidade
+ */
+static void ligacao_repoe(Ligacao l) {
+    Saida s = l->s;
+    size_t k;
+
+    while (s->len < l->cap && ligacao_espera(l)) {
+        k = l->len > 0 ? router_prefixo(l->buf + l->ini, l->len, l->cap - s->len) : 0;
+
+        if (k == 0) { // fila vazia ou registo a meio: continua no disco
+            if (ligacao_le_disco(l) == 0) break;
+            continue;
+        }
+
+        saida_poe(s, l->buf + l->ini, k, 0);
+        l->ini += k;
+        l->len -= k;
+    }
+
+    if (l->len == 0) l->ini = 0;
+
+    saida_escreve(s);
+    ligacao_pendente(l, ligacao_espera(l));
+}
+
+/*
+ * @brief Passa tudo o que está à espera na ligação para a fila do destino
+ *        (a ligação vai ser desfeita ou passa a bloquear)
+ */
+static void ligacao_esvazia(Ligacao l) {
+    do {
+        if (l->len > 0) saida_poe(l->s, l->buf + l->ini, l->len, 0);
+        l->ini = l->len = 0;
+    } while (ligacao_le_disco(l) > 0);
+
+    ligacao_fecha_disco(l);
+    ligacao_pendente(l, 0);
+    saida_escreve(l->s);
+}
+
+/*
+ * @brief Desfaz uma ligação (o que tem à espera vai para a fila do destino)
+ */
+static void ligacao_liberta(Ligacao l) {
+    ligacao_esvazia(l);
+    free(l->buf);
+    free(l);
+}
+
+/*
+ * @brief Passa para os destinos os registos à espera nas ligações cujos
+ *        destinos desceram abaixo da capacidade
+ */
+static void router_repoe() {
+    int i;
+
+    for (i = router_npendentes - 1; i >= 0; i--) { // ligacao_repoe pode tirar a i
+        if (router_pendentes[i]->s->len < router_pendentes[i]->cap) {
+            ligacao_repoe(router_pendentes[i]);
+        }
+    }
+}
+
+
+/******************************************************************************
+ *                                  ROTAS                                     *
+ ******************************************************************************/
+
+/*
+ * @brief Deixa de ler (ou volta a ler) o FIFO de uma rota
+ */
+static void rota_para(Rota r, int parada) {
+    struct epoll_event ev;
+
+    if (r->parada == parada) return;
+
+    r->parada = parada;
+
+    if (parada) {
+        if (router_nparadas == router_capparadas) {
+            router_capparadas = router_capparadas > 0 ? 2 * router_capparadas : 16;
+            router_paradas = realloc(router_paradas, sizeof(Rota) * router_capparadas);
+        }
+        r->iparada = router_nparadas;
+        router_paradas[router_nparadas++] = r;
+    }
+    else {
+        router_paradas[r->iparada] = router_paradas[--router_nparadas];
+        router_paradas[r->iparada]->iparada = r->iparada;
+    }
+
+    ev.events = parada ? 0 : EPOLLIN;
+    ev.data.u64 = ROUTER_EV(r->id, r->repasse ? ROUTER_EV_REPASSE : ROUTER_EV_ROTA);
+    epoll_ctl(router_ep, EPOLL_CTL_MOD, r->fd, &ev);
+
+    /* O que já está no anel não volta a ser avisado */
+
+    if (!parada && r->anel != NULL) eventfd_write(r->fd, 1);
+}
+
+/*
+ * @brief Indica se algum destino de uma rota (numa ligação que bloqueia)
+ *        passou da capacidade da ligação
+ */
+static int rota_cheia(Rota r) {
+    int i;
+
+    for (i = 0; i < r->numouts; i++) {
+        if (r->ligs[i]->politica == ROUTER_BLOQUEIA &&
+            r->outs[i]->len > r->ligs[i]->cap) return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * @brief Volta a ler as rotas paradas cujos destinos (nas ligações que
+ *        bloqueiam) já desceram para metade da capacidade
+ */
+static void router_retoma() {
+    int i, j;
+    Rota r;
+
+    for (i = router_nparadas - 1; i >= 0; i--) { // rota_para(r, 0) tira a rota i
+        r = router_paradas[i];
+        if (r->numouts == 0) continue;
+
+        for (j = 0; j < r->numouts && (r->ligs[j]->politica != ROUTER_BLOQUEIA ||
+                                       r->outs[j]->len <= r->ligs[j]->cap / 2); j++);
+        if (j == r->numouts) rota_para(r, 0);
+    }
+}
+
+/*
+ * @brief Regista nas ligações da rota os carimbos do traçado (traco.h) de um
+ *        bloco de registos completos e atualiza o seu último salto
+ */
+static void rota_carimbos(Rota r, char* buf, size_t k) {
+    size_t i, t;
+    int j;
+    long long agora = stats_agora();
+
+    for (i = 0; i < k && (t = readln_registo_tam(buf + i, k - i)) > 0; i += t) {
+        if (!traco_e(buf + i, t)) continue;
+
+        for (j = 0; j < r->numouts; j++) {
+            traco_entrega(buf + i, r->id, r->outs[j]->id, r->outs[j]->binarios, agora);
+        }
+        traco_atualiza(buf + i, agora);
+    }
+}
+
+/*
+ * @brief Entrega aos destinos os registos completos que a rota já leu
+ */
+static void rota_entrega(Rota r) {
+    int i, tembinarios;
+    size_t ini = 0, k;
+    contador nrec;
+
+    while (ini < r->len) {
+        if (r->repasse) { // entrada de um nó com anéis: passa tal como está
+            if ((k = fanout_fim(r->buf + ini, r->len - ini, 0, &nrec, &tembinarios)) == 0) break;
+            saida_envia(r->outs[0], r->buf + ini, k, 0);
+            ini += k;
+            continue;
+        }
+
+        k = fanout_fim(r->buf + ini, r->len - ini, 0, &nrec, &tembinarios);
+        if (k == 0) break;
+
+        if (tembinarios && traco_regiao != NULL) rota_carimbos(r, r->buf + ini, k);
+
+        for (i = 0; i < r->numouts; i++) {
+            ligacao_envia(r->ligs[i], r->buf + ini, k, nrec, tembinarios);
+        }
+
+        fanout_conta(r->st, nrec, k, r->numouts);
+        ini += k;
+    }
+
+    r->len -= ini;
+    memmove(r->buf, r->buf + ini, r->len);
+
+    for (i = 0; i < r->numouts; i++) saida_escreve(r->outs[i]);
+
+    if (rota_cheia(r)) rota_para(r, 1);
+}
+
+/*
+ * @brief Lê um bloco do FIFO de uma rota e entrega os registos completos
+ */
+static void rota_le(Rota r) {
+    ssize_t n;
+
+    if (r->len == r->cap) { // registo maior que o buffer
+        r->cap *= 2;
+        r->buf = realloc(r->buf, r->cap);
+    }
+
+    /* Anel: lê-se um bloco de cada vez, como nos FIFOs, e volta-se a ler
+       depois dos outros eventos (aviso ao próprio eventfd) enquanto houver
+       dados; sem dados, espera-se pelo aviso do componente */
+
+    if (r->anel != NULL) {
+        anel_limpa(r->anel);
+
+        if ((n = anel_le_nb(r->anel, r->buf + r->len, r->cap - r->len)) > 0) {
+            r->len += n;
+            rota_entrega(r);
+        }
+
+        if (!r->parada && (anel_ocupado(r->anel) > 0 || anel_espera_dados(r->anel))) {
+            eventfd_write(r->fd, 1);
+        }
+        return;
+    }
+
+    do {
+        n = read(r->fd, r->buf + r->len, r->cap - r->len);
+    } while (n == -1 && errno == EINTR);
+
+    if (n <= 0) return;
+
+    r->len += n;
+    rota_entrega(r);
+}
+
+/*
+ * @brief Fecha uma rota (o que ainda estiver no FIFO perde-se)
+ */
+static void rota_fecha(Rota r) {
+    int i;
+
+    if (r->parada) rota_para(r, 0);
+    epoll_ctl(router_ep, EPOLL_CTL_DEL, r->fd, NULL);
+    if (r->anel == NULL) close(r->fd);
+
+    if (r->repasse) r->outs[0]->entrada = NULL;
+    else router_rotas[r->id] = NULL;
+
+    for (i = 0; i < r->numouts; i++) {
+        ligacao_liberta(r->ligs[i]);
+        saida_larga(r->outs[i]);
+    }
+
+    free(r->outs);
+    free(r->ligs);
+    free(r->buf);
+    free(r);
+}
+
+
+/******************************************************************************
+ *                                 EDIÇÕES                                    *
+ ******************************************************************************/
+
+/*
+ * @brief Substitui os destinos de uma rota (criando-a se ainda não existir)
+ *
+ * O que a rota já leu e ainda não é um registo completo mantém-se e vai para
+ * os novos destinos, tal como tudo o que ainda está no FIFO do nó. As
+ * ligações para os destinos que se mantêm ficam com o que têm à espera (e os
+ * contadores), com a capacidade e a política novas.
+ */
+static int edita_liga(Edicao e) {
+    int i, j, k, politica;
+    char out[32];
+    size_t cap;
+    struct epoll_event ev;
+    Saida novas[e->numouts > 0 ? e->numouts : 1];
+    Ligacao ligs[e->numouts > 0 ? e->numouts : 1];
+    Rota r = router_rotas[e->id];
+
+    if (r == NULL && e->numouts == 0) return 0;
+
+    /* Nova rota: o FIFO é aberto para leitura e escrita, para que não dê EOF
+       (nem acorde o epoll) quando o nó fecha a sua ponta. Com anéis, a rota
+       espera pelo eventfd do anel de saída */
+
+    if (r == NULL) {
+        r = calloc(1, sizeof(struct rota));
+        r->id = e->id;
+        r->st = e->st;
+
+        if ((r->anel = router_aneis[e->id]) != NULL) {
+            r->fd = r->anel->efd;
+        }
+        else {
+            sprintf(out, "./tmp/%dout", e->id);
+            r->fd = open(out, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+        }
+
+        if (r->fd == -1) {
+            perror("open fifo router");
+            free(r);
+            return 1;
+        }
+
+        r->cap = ROUTER_BLOCO;
+        r->buf = malloc(r->cap);
+
+        ev.events = EPOLLIN;
+        ev.data.u64 = ROUTER_EV(e->id, ROUTER_EV_ROTA);
+        epoll_ctl(router_ep, EPOLL_CTL_ADD, r->fd, &ev);
+
+        /* O que o componente escreveu antes da ligação não foi avisado */
+
+        if (r->anel != NULL) eventfd_write(r->fd, 1);
+
+        router_rotas[e->id] = r;
+    }
+
+    /* As saídas novas são obtidas antes de se largarem as antigas, para que
+       um destino que se mantém não seja fechado */
+
+    for (i = j = 0; i < e->numouts; i++) {
+        if ((novas[j] = saida_obtem(e->outs[i], e->binarios[i])) == NULL) continue;
+
+        cap = e->caps != NULL && e->caps[i] > 0 ? e->caps[i] : ROUTER_FILA;
+        politica = e->politicas != NULL ? e->politicas[i] : ROUTER_BLOQUEIA;
+
+        for (k = 0; k < r->numouts && r->outs[k] != novas[j]; k++);
+
+        if (k < r->numouts) { // a ligação mantém-se
+            ligs[j] = r->ligs[k];
+            r->ligs[k] = NULL;
+            ligs[j]->cap = cap;
+            ligs[j]->politica = politica;
+            if (politica == ROUTER_BLOQUEIA) ligacao_esvazia(ligs[j]);
+            else if (politica == ROUTER_DESCARTA_ANTIGOS) ligacao_apara(ligs[j]);
+        }
+        else ligs[j] = ligacao_cria(novas[j], e->id, cap, politica);
+
+        j++;
+    }
+
+    for (i = 0; i < r->numouts; i++) {
+        if (r->ligs[i] != NULL) ligacao_liberta(r->ligs[i]);
+        saida_larga(r->outs[i]);
+    }
+
+    r->outs = realloc(r->outs, sizeof(Saida) * (j > 0 ? j : 1));
+    r->ligs = realloc(r->ligs, sizeof(Ligacao) * (j > 0 ? j : 1));
+    memcpy(r->outs, novas, sizeof(Saida) * j);
+    memcpy(r->ligs, ligs, sizeof(Ligacao) * j);
+    r->numouts = j;
+
+    /* Sem destinos (ou com um destino cheio) a rota não lê */
+
+    rota_para(r, j == 0 || rota_cheia(r));
+
+    return 0;
+}
+
+/*
+ * @brief Descarta o que estiver a meio de um registo na rota de um nó e na
+ *        saída para ele (o processo do nó foi substituído)
+ */
+static int edita_corta(Edicao e) {
+    Rota r = router_rotas[e->id];
+    Saida s = router_saidas[e->id];
+
+    if (r != NULL) r->len = 0;
+
+    if (s != NULL && s->resto > 0) {
+        s->ini += s->resto;
+        s->len -= s->resto;
+        s->resto = 0;
+    }
+
+    return 0;
+}
+
+/*
+ * @brief Retira um nó: fecha a sua rota e descarta a fila dos registos por
+ *        escrever nele (tal como as linhas no FIFO de um nó terminado com
+ *        SIGKILL)
+ */
+static int edita_remove(Edicao e) {
+    Saida s = router_saidas[e->id];
+
+    if (router_rotas[e->id] != NULL) rota_fecha(router_rotas[e->id]);
+    router_aneis[e->id] = NULL;
+
+    if (s != NULL) {
+        s->len = s->resto = 0;
+        if (s->entrada != NULL) rota_fecha(s->entrada); // larga a saída
+        else if (s->refs == 0) saida_fecha(s);
+    }
+
+    return 0;
+}
+
+/*
+ * @brief Entrega o que ainda estiver no FIFO (ou anel) de uma rota e fecha-a
+ *        (o resto de um registo incompleto perde-se)
+ *
+ * O FIFO está aberto para leitura e escrita, por isso nunca dá EOF: lê-se até
+ * estar vazio. As saídas ficam abertas até as filas estarem escritas.
+ */
+static void rota_drena(Rota r) {
+    ssize_t n;
+    size_t k;
+    contador nrec = 0;
+    char* nl;
+    int i;
+
+    for (;;) {
+        if (r->len == r->cap) {
+            r->cap *= 2;
+            r->buf = realloc(r->buf, r->cap);
+        }
+
+        if (r->anel != NULL) n = anel_le_nb(r->anel, r->buf + r->len, r->cap - r->len);
+        else n = read(r->fd, r->buf + r->len, r->cap - r->len);
+
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) break;
+
+        r->len += n;
+        rota_entrega(r);
+    }
+
+    /* Linhas curtas que começam como um registo binário mas não chegaram a
+       ter o seu cabeçalho (ver readln.h) já não vão ter: são linhas */
+
+    if (r->len > 0 && readln_binario_tam(r->buf, r->len) == 0 &&
+        (nl = memrchr(r->buf, '\n', r->len)) != NULL) {
+        k = nl - r->buf + 1;
+        for (nl = r->buf; (nl = memchr(nl, '\n', r->buf + k - nl)); nl++) nrec++;
+
+        if (r->repasse) saida_envia(r->outs[0], r->buf, k, 0);
+        for (i = 0; !r->repasse && i < r->numouts; i++) {
+            ligacao_envia(r->ligs[i], r->buf, k, nrec, 0);
+        }
+
+        if (!r->repasse) fanout_conta(r->st, nrec, k, r->numouts);
+        for (i = 0; i < r->numouts; i++) saida_escreve(r->outs[i]);
+    }
+
+    rota_fecha(r);
+}
+
+/*
+ * @brief Entrega o que ainda estiver no FIFO de um nó que já terminou e fecha
+ *        a sua rota
+ */
+static int edita_drena(Edicao e) {
+    if (router_rotas[e->id] != NULL) rota_drena(router_rotas[e->id]);
+    return 0;
+}
+
+/*
+ * @brief Passa a servir um nó com anéis: a saída para o nó passa a existir
+ *        desde já (escreve no anel de entrada), com o repasse do seu FIFO de
+ *        entrada, e a rota do nó lerá o anel de saída
+ */
+static int edita_anel(Edicao e) {
+    char in[32];
+    struct epoll_event ev;
+    Saida s;
+    Rota r = calloc(1, sizeof(struct rota));
+
+    sprintf(in, "./tmp/%din", e->id);
+    r->fd = open(in, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+
+    if (r->fd == -1) {
+        perror("open fifo router");
+        free(r);
+        return 1;
+    }
+
+    s = calloc(1, sizeof(struct saida));
+    s->id = e->id;
+    s->fd = -1;
+    s->anel = e->entrada;
+    s->cap = ROUTER_BLOCO;
+    s->buf = malloc(s->cap);
+    s->refs = 1;
+    s->entrada = r;
+
+    r->id = e->id;
+    r->repasse = 1;
+    r->st = &stats_nulo;
+    r->cap = ROUTER_BLOCO;
+    r->buf = malloc(r->cap);
+    r->outs = malloc(sizeof(Saida));
+    r->outs[0] = s;
+    r->ligs = malloc(sizeof(Ligacao));
+    r->ligs[0] = ligacao_cria(s, e->id, 0, ROUTER_BLOQUEIA);
+    r->numouts = 1;
+
+    ev.events = EPOLLIN;
+    ev.data.u64 = ROUTER_EV(e->id, ROUTER_EV_REPASSE);
+    epoll_ctl(router_ep, EPOLL_CTL_ADD, r->fd, &ev);
+
+    router_saidas[e->id] = s;
+    router_aneis[e->id] = e->saida;
+
+    return 0;
+}
+
+/*
+ * @brief Fecha a entrada de um nó com anéis: entrega o que estiver no FIFO
+ *        de entrada e larga a saída, que fecha o anel quando não tiver mais
+ *        rotas nem fila
+ */
+static int edita_fecha(Edicao e) {
+    Saida s = router_saidas[e->id];
+
+    if (s != NULL && s->entrada != NULL) rota_drena(s->entrada);
+
+    return 0;
+}
+
+/*
+ * @brief Indica se ainda há rotas que escrevem para um nó ou registos na
+ *        fila (o repasse de um nó com anéis não conta)
+ */
+static int edita_escreve(Edicao e) {
+    Saida s = router_saidas[e->id];
+
+    return s != NULL && (s->len > 0 || s->refs > (s->entrada != NULL));
+}
+
+/*
+ * @brief Copia o estado das ligações de um nó (ou de todos, com o ID -1)
+ */
+static int edita_ligacoes(Edicao e) {
+    int id, i, fim = e->id != -1 ? e->id + 1 : rede_fim(), cap = 0;
+    RouterLigacao* rl;
+    Ligacao l;
+    Rota r;
+
+    e->ligacoes = NULL;
+    e->nligacoes = 0;
+
+    for (id = e->id != -1 ? e->id : 0; id < fim; id++) {
+        if ((r = router_rotas[id]) == NULL) continue;
+
+        for (i = 0; i < r->numouts; i++) {
+            if (e->nligacoes == cap) {
+                cap = cap > 0 ? 2 * cap : 16;
+                e->ligacoes = realloc(e->ligacoes, sizeof(RouterLigacao) * cap);
+            }
+
+            l = r->ligs[i];
+            rl = &e->ligacoes[e->nligacoes++];
+            rl->origem = id;
+            rl->destino = l->s->id;
+            rl->politica = l->politica;
+            rl->cap = l->cap;
+            rl->fila = l->s->len;
+            rl->espera = l->len;
+            rl->disco = l->disco;
+            rl->descartados = l->descartados;
+            rl->bdescartados = l->bdescartados;
+            rl->derramados = l->derramados;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * @brief Aplica as edições que estiverem no canal e confirma cada uma
+ */
+static void router_edicoes_canal() {
+    Edicao es[64];
+    ssize_t n;
+    int i;
+
+    while ((n = read(router_canal[0], es, sizeof(es))) > 0) {
+        for (i = 0; i < n / (ssize_t) sizeof(Edicao); i++) {
+            if (es[i]->tipo == ROUTER_LIGA) es[i]->erro = edita_liga(es[i]);
+            else if (es[i]->tipo == ROUTER_CORTA) es[i]->erro = edita_corta(es[i]);
+            else if (es[i]->tipo == ROUTER_REMOVE) es[i]->erro = edita_remove(es[i]);
+            else if (es[i]->tipo == ROUTER_DRENA) es[i]->erro = edita_drena(es[i]);
+            else if (es[i]->tipo == ROUTER_ANEL) es[i]->erro = edita_anel(es[i]);
+            else if (es[i]->tipo == ROUTER_FECHA) es[i]->erro = edita_fecha(es[i]);
+            else if (es[i]->tipo == ROUTER_LIGACOES) es[i]->erro = edita_ligacoes(es[i]);
+            else es[i]->erro = edita_escreve(es[i]);
+
+            write(router_feito[1], "", 1);
+        }
+    }
+}
+
+/*
+ * @brief Ciclo da thread do router
+ */
+static void* router_ciclo(void* arg) {
+    struct epoll_event evs[ROUTER_EVENTOS];
+    sigset_t pipe;
+    int i, n, id, tipo;
+    Saida s;
+    Rota r;
+
+    /* Escrever num destino que já terminou dá EPIPE nesta thread, em vez de
+       terminar o controlador (o sinal fica pendente só nela) */
+
+    sigemptyset(&pipe);
+    sigaddset(&pipe, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipe, NULL);
+
+    for (;;) {
+        n = epoll_wait(router_ep, evs, ROUTER_EVENTOS, -1);
+
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait router");
+            return NULL;
+        }
+
+        for (i = 0; i < n; i++) {
+            if (evs[i].data.u64 == ROUTER_EV_CANAL) {
+                router_edicoes_canal();
+                continue;
+            }
+
+            id = evs[i].data.u64 >> 2;
+            tipo = evs[i].data.u64 & 3;
+
+            /* Os descritores de uma rota ou saída que entretanto mudou podem
+               ainda dar eventos: são ignorados */
+
+            if (tipo == ROUTER_EV_SAIDA) {
+                if ((s = router_saidas[id]) == NULL) continue;
+                saida_escreve(s);
+                if (s->refs == 0 && s->len == 0) saida_fecha(s);
+            }
+            else if (tipo == ROUTER_EV_REPASSE) {
+                if ((s = router_saidas[id]) != NULL && (r = s->entrada) != NULL &&
+                    !r->parada) rota_le(r);
+            }
+            else if ((r = router_rotas[id]) != NULL && !r->parada) {
+                rota_le(r);
+            }
+        }
+
+        if (router_npendentes > 0) router_repoe();
+        if (router_nparadas > 0) router_retoma();
+    }
+
+    return NULL;
+}
+
+
+/******************************************************************************
+ *                        INTERFACE PARA O CONTROLADOR                        *
+ ******************************************************************************/
+
+/*
+ * @brief Inicia o router (a thread, o epoll e o canal das edições)
+ *
+ * @return 0 em caso de sucesso
+ *         1 em caso de erro
+ */
+int router_init() {
+    struct epoll_event ev;
+
+    router_ep = epoll_create1(EPOLL_CLOEXEC);
+
+    if (router_ep == -1) { perror("epoll_create1"); return 1; }
+
+    if (pipe2(router_canal, O_CLOEXEC) == -1 ||
+        pipe2(router_feito, O_CLOEXEC) == -1) {
+        perror("pipe router");
+        return 1;
+    }
+
+    fcntl(router_canal[0], F_SETFL, O_NONBLOCK);
+
+    ev.events = EPOLLIN;
+    ev.data.u64 = ROUTER_EV_CANAL;
+    epoll_ctl(router_ep, EPOLL_CTL_ADD, router_canal[0], &ev);
+
+    if (pthread_create(&router_thread, NULL, router_ciclo, NULL)) {
+        perror("pthread_create");
+        close(router_ep);
+        router_ep = -1;
+        return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * @brief Envia uma edição ao router e espera que seja aplicada
+ *
+ * @return Resultado da edição (0 em caso de sucesso)
+ */
+static int router_pede(Edicao e) {
+    long long t = stats_agora();
+    char c;
+
+    write(router_canal[1], &e, sizeof(Edicao));
+    while (read(router_feito[0], &c, 1) == -1 && errno == EINTR);
+
+    t = stats_agora() - t;
+    router_edicoes++;
+    router_nsedicoes += t;
+    if ((contador) t > router_maxedicao) router_maxedicao = t;
+
+    return e->erro;
+}
+
+/*
+ * @brief Define os destinos das ligações que partem de um nó (substitui os
+ *        anteriores)
+ *
+ * @param id        ID do nó de origem
+ * @param outs      IDs dos nós de destino
+ * @param binarios  binarios[i] == 1 se o destino i aceita registos binários
+ * @param caps      Capacidade da ligação para o destino i (0 para
+ *                  ROUTER_FILA; NULL para todas)
+ * @param politicas Política da ligação para o destino i (NULL para block)
+ * @param numouts   Número de destinos (0 para a rota parar)
+ * @param st        Contadores do fanout do nó
+ *
+ * @return 0 em caso de sucesso
+ *         1 em caso de erro
+ */
+int router_liga(int id, int* outs, int* binarios, size_t* caps, int* politicas,
+                int numouts, Stats st) {
+    struct edicao e = { .tipo = ROUTER_LIGA, .id = id, .outs = outs, .binarios = binarios,
+                        .numouts = numouts, .st = st, .caps = caps,
+                        .politicas = politicas };
+    return router_pede(&e);
+}
+
+/*
+ * @brief Estado das ligações que partem de um nó (ou de todos)
+ *
+ * @param id       ID do nó de origem (-1 para todos)
+ * @param ligacoes Onde se coloca o array com o estado de cada ligação
+ *                 (malloc, a libertar por quem chama)
+ *
+ * @return Número de ligações
+ */
+int router_ligacoes(int id, RouterLigacao** ligacoes) {
+    struct edicao e = { .tipo = ROUTER_LIGACOES, .id = id };
+    router_pede(&e);
+    *ligacoes = e.ligacoes;
+    return e.nligacoes;
+}
+
+/*
+ * @brief Descarta os registos a meio de um nó cujo processo foi substituído
+ *        (para que o novo processo não receba nem pareça escrever o fim de
+ *        um registo do anterior)
+ */
+void router_corta(int id) {
+    struct edicao e = { .tipo = ROUTER_CORTA, .id = id };
+    router_pede(&e);
+}
+
+/*
+ * @brief Retira um nó do router (quando o nó é removido)
+ */
+void router_remove(int id) {
+    struct edicao e = { .tipo = ROUTER_REMOVE, .id = id };
+    router_pede(&e);
+}
+
+/*
+ * @brief Entrega os registos que ficaram no FIFO de saída de um nó que já
+ *        terminou e fecha a sua rota (shutdown --drain)
+ */
+void router_drena(int id) {
+    struct edicao e = { .tipo = ROUTER_DRENA, .id = id };
+    router_pede(&e);
+}
+
+/*
+ * @brief Passa a servir um nó com anéis (antes de qualquer ligação dele ou
+ *        para ele; os anéis são do controlador e têm de existir até ao
+ *        router_remove)
+ *
+ * @param id      ID do nó
+ * @param entrada Anel de entrada do nó (escrito pelo router)
+ * @param saida   Anel de saída do nó (lido pelo router)
+ *
+ * @return 0 em caso de sucesso
+ *         1 em caso de erro
+ */
+int router_aneis_no(int id, Anel entrada, Anel saida) {
+    struct edicao e = { .tipo = ROUTER_ANEL, .id = id, .entrada = entrada, .saida = saida };
+    return router_pede(&e);
+}
+
+/*
+ * @brief Fecha a entrada de um nó com anéis: o nó recebe EOF quando já não
+ *        houver rotas que lhe escrevem nem registos na fila
+ *        (shutdown --drain)
+ */
+void router_fecha(int id) {
+    struct edicao e = { .tipo = ROUTER_FECHA, .id = id };
+    router_pede(&e);
+}
+
+/*
+ * @brief Indica se o router ainda tem o FIFO de entrada de um nó aberto (há
+ *        rotas que lhe escrevem ou registos na fila)
+ */
+int router_escreve(int id) {
+    struct edicao e = { .tipo = ROUTER_ESCREVE, .id = id };
+    return router_pede(&e);
+}
+
+#endif
@@ -1,3 +1,5 @@
+#define _GNU_SOURCE
+
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <string.h>
@@ -6,85 +8,496 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <limits.h>
+#include <signal.h>
+#include <spawn.h>
+#include <poll.h>
 #include <sys/wait.h>
+#include <sys/signalfd.h>
 
 #include "readln.h"
+#include "field.h"
+#include "outbuf.h"
+#include "stats.h"
 
-/*spawn <cmd> <args...>
+/*spawn [-d <separador>] [-j <N>] [-u] [-c] <cmd> <args...>
 Este programa reproduz todas as linhas, executando o comando indicado uma vez para cada uma delas,
 e acrescentando uma nova coluna com o respetivo exit status.
 spawn mailx -s $3 x@y.com
 substituir $n pelo valor da coluna
 
-./a.out mailx -s \$3 x@y.com 
+./a.out mailx -s \$3 x@y.com
+Com -d <separador> as colunas são separadas por outro caratere que não ':'.
+
+Com -j N há até N comandos a correr ao mesmo tempo (por omissão 1). As linhas
+continuam a sair pela ordem de entrada, a não ser com -u, em que cada linha sai
+assim que o seu comando termina.
+Um comando morto por um sinal tem exit status 128 + número do sinal; um comando
+que não pode ser executado tem exit status 127.
 
+Os comandos são lançados com posix_spawn (sem copiar o processo) com o stdin,
+stdout e stderr em /dev/null. O fim de cada um é recebido por um signalfd
+(SIGCHLD), ao mesmo tempo que se espera por mais input.
 
+Com -c (coprocesso) o comando é lançado uma só vez e cada linha é-lhe escrita
+no stdin: a linha inteira ou, se houver argumentos $n, os valores dessas
+colunas separados pelo separador (os $n não são passados ao comando). Por cada
+linha escrita o comando tem de responder com uma linha no stdout (sem a reter
+num buffer, e.g. com fflush ou stdbuf -oL), que é acrescentada como nova
+coluna em vez do exit status. Com -j N há até N linhas à espera de resposta.
+Se o comando terminar, é lançado de novo: a linha mais antiga à espera fica
+com a coluna vazia e as outras são reenviadas.
+
+spawn -c ./classifica.sh $3
+input: a:b:15
+output: a:b:15:<resposta do classifica.sh a "15">
 */
 
+extern char** environ;
+
+/* Um comando lançado: ocupa o seu lugar até a linha de resultado ser escrita */
+typedef struct lugar {
+	pid_t  pid;     // PID do comando (0 se já terminou)
+	int    ocupado; // 1 desde que é lançado até a sua linha ser escrita
+	int    status;  // exit status (quando pid == 0)
+	char*  linha;   // linha de entrada (sem '\n')
+	size_t len, cap;
+	long long inicio; // quando o comando foi lançado / a linha foi enviada (ns)
+} Lugar;
+
+static Lugar* lugares;   // njobs lugares
+static int njobs = 1;    // máximo de comandos a correr ao mesmo tempo
+static int ordenado = 1; // 0 com -u
+static long long proximo = 0; // número de ordem da próxima linha a lançar
+static long long cabeca = 0;  // número de ordem da próxima linha a escrever
+static int livres;            // lugares livres (modo -u)
+
+static char delim = CAMPOS_DELIM;
+static Outbuf saida;
+static Stats st; //contadores do nó (ver stats.h)
+static char* final = NULL; //linha de saída
+static size_t capfinal = 0;
+
+//escreve a linha de um lugar com o exit status e liberta o lugar
+static void escreve(Lugar* l) {
+	size_t m;
+
+	if(l->len + 16 > capfinal) {
+		while(l->len + 16 > capfinal) capfinal = capfinal ? capfinal*2 : PIPE_BUF;
+		final = realloc(final, capfinal);
+	}
+	memcpy(final, l->linha, l->len);
+	m = l->len + sprintf(final + l->len, "%c%i\n", delim, l->status); //adicionar o exit status
+	outbuf_write(saida, final, m);
+
+	l->ocupado = 0;
+	livres++;
+}
+
+//em modo ordenado escreve as linhas cujos comandos já terminaram, pela ordem de entrada
+static void escreve_por_ordem() {
+	Lugar* l;
+
+	while(cabeca < proximo) {
+		l = &lugares[cabeca % njobs];
+		if(!l->ocupado || l->pid != 0) break;
+		escreve(l);
+		cabeca++;
+	}
+}
+
+//exit status de um comando que terminou
+static int exit_status(int status) {
+	if(WIFEXITED(status)) return WEXITSTATUS(status);
+	if(WIFSIGNALED(status)) return 128 + WTERMSIG(status);
+	return 255;
+}
+
+//soma a latência de um comando (ou de uma resposta do coprocesso) aos contadores
+static void latencia(Lugar* l) {
+	stats_soma(&st->spawns, 1);
+	stats_soma(&st->nsspawn, stats_agora() - l->inicio);
+}
+
+//espera por input ou pelo fim de um comando, contando o tempo como espera por input
+static int espera(struct pollfd p[2]) {
+	long long t = stats_agora();
+	int r = poll(p, 2, -1);
+
+	if(p[0].fd >= 0) stats_soma(&st->nsleitura, stats_agora() - t);
+
+	return r;
+}
+
+//recolhe todos os comandos que já terminaram (sem bloquear)
+static void recolhe() {
+	int i, status;
+	pid_t pid;
+
+	while((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+		for(i=0;i<njobs;i++) {
+			if(lugares[i].ocupado && lugares[i].pid == pid) {
+				lugares[i].pid = 0;
+				lugares[i].status = exit_status(status);
+				latencia(&lugares[i]);
+				if(!ordenado) escreve(&lugares[i]);
+				break;
+			}
+		}
+	}
+
+	if(ordenado) escreve_por_ordem();
+}
+
+//lugar para o próximo comando (NULL se estiverem todos ocupados)
+static Lugar* lugar_livre() {
+	int i;
+
+	if(ordenado) { //o lugar é fixo: a janela de reordenação tem njobs linhas
+		Lugar* l = &lugares[proximo % njobs];
+		return l->ocupado ? NULL : l;
+	}
+
+	if(livres == 0) return NULL;
+	for(i=0;i<njobs;i++) if(!lugares[i].ocupado) return &lugares[i];
+
+	return NULL;
+}
+
+
+/* Modo coprocesso (-c) */
+
+static char** coargs;         // comando do coprocesso (sem os $n)
+static pid_t copid = 0;       // PID do coprocesso (0 se não estiver a correr)
+static int coin = -1;         // stdin do coprocesso
+static int coout = -1;        // stdout do coprocesso
+static int emvoo = 0;         // linhas escritas à espera de resposta
+static char* carga = NULL;    // linha a escrever no coprocesso
+static size_t capcarga = 0;
+
+//linha a escrever no coprocesso: a linha toda ou os valores dos $n
+static size_t co_carga(Campos campos, Lugar* l, int total, int colunas[]) {
+	int i, k = 0;
+	size_t tam, n = 0;
+	const char* campo;
+
+	campos_linha(campos, l->linha, l->len);
+
+	for(i=0;i<=total;i++) {
+		if(i < total && colunas[i] == 0) continue;
+		if(i == total && k > 0) break;
+		if(i < total) campos_coluna(campos, colunas[i], &campo, &tam);
+		else { campo = l->linha; tam = l->len; } //sem $n: a linha toda
+
+		if(n + tam + 2 > capcarga) {
+			while(n + tam + 2 > capcarga) capcarga = capcarga ? capcarga*2 : PIPE_BUF;
+			carga = realloc(carga, capcarga);
+		}
+		if(k++ > 0) carga[n++] = delim;
+		memcpy(carga + n, campo, tam);
+		n += tam;
+	}
+
+	carga[n++] = '\n';
+
+	return n;
+}
+
+//lança o coprocesso com pipes para o stdin e o stdout
+static int co_inicia() {
+	int a[2], b[2], ret;
+	posix_spawn_file_actions_t fa;
+
+	if(pipe2(a, O_CLOEXEC) == -1) return -1;
+	if(pipe2(b, O_CLOEXEC) == -1) { close(a[0]); close(a[1]); return -1; }
+
+	posix_spawn_file_actions_init(&fa);
+	posix_spawn_file_actions_adddup2(&fa, a[0], 0);
+	posix_spawn_file_actions_adddup2(&fa, b[1], 1);
+	posix_spawn_file_actions_addopen(&fa, 2, "/dev/null", O_WRONLY, 0);
+
+	ret = posix_spawnp(&copid, coargs[0], &fa, NULL, coargs, environ);
+	posix_spawn_file_actions_destroy(&fa);
+
+	close(a[0]);
+	close(b[1]);
+
+	if(ret != 0) {
+		close(a[1]); close(b[0]);
+		copid = 0;
+		return -1;
+	}
+
+	coin = a[1];
+	coout = b[0];
+	readln_reset(coout); //o descritor pode ter sido de um coprocesso anterior
+
+	return 0;
+}
+
+//escreve a linha de um lugar com a resposta do coprocesso e liberta o lugar
+static void co_escreve(Lugar* l, const char* resp, size_t tam) {
+	size_t m = l->len + tam + 2;
+
+	if(m > capfinal) {
+		while(m > capfinal) capfinal = capfinal ? capfinal*2 : PIPE_BUF;
+		final = realloc(final, capfinal);
+	}
+	memcpy(final, l->linha, l->len);
+	final[l->len] = delim;
+	memcpy(final + l->len + 1, resp, tam);
+	final[m-1] = '\n';
+	outbuf_write(saida, final, m);
+	latencia(l);
+
+	l->ocupado = 0;
+	cabeca++;
+	emvoo--;
+}
+
+//escreve a linha no coprocesso; devolve -1 se ele terminou e não pode ser lançado de novo
+static int co_envia(Campos campos, Lugar* l, int total, int colunas[]) {
+	size_t n = co_carga(campos, l, total, colunas);
+
+	//se terminou sem linhas à espera, nenhuma resposta se perdeu: basta lançá-lo de novo
+	if(copid != 0 && emvoo == 1 && waitpid(copid, NULL, WNOHANG) == copid) {
+		close(coin);
+		close(coout);
+		copid = 0;
+	}
+
+	if(copid == 0 && co_inicia() == -1) return -1;
+
+	return outbuf_escreve(coin, carga, n);
+}
+
+//o coprocesso terminou: a linha mais antiga fica sem resposta, é lançado um novo e as outras são reenviadas
+static void co_reinicia(Campos campos, int total, int colunas[]) {
+	long long i;
+
+	if(copid != 0) {
+		close(coin);
+		close(coout);
+		waitpid(copid, NULL, 0);
+		copid = 0;
+	}
+
+	while(emvoo > 0) {
+		co_escreve(&lugares[cabeca % njobs], "", 0);
+
+		if(co_inicia() == 0) {
+			for(i=cabeca;i<proximo;i++) {
+				if(co_envia(campos, &lugares[i % njobs], total, colunas) == -1) break;
+			}
+			if(i == proximo) return;
+			close(coin); close(coout);
+			waitpid(copid, NULL, 0);
+			copid = 0;
+		}
+	}
+}
+
+//ciclo do modo coprocesso
+static int coprocesso(Campos campos, int total, int colunas[]) {
+	ssize_t n;
+	char* buffer;
+	Lugar* l;
+	struct pollfd p[2];
+
+	signal(SIGPIPE, SIG_IGN); //escrever num coprocesso que terminou dá EPIPE
+
+	if(co_inicia() == -1) fprintf(stderr, "spawn: não foi possível executar %s\n", coargs[0]);
+
+	for(;;) {
+		//respostas já lidas
+		if(emvoo > 0 && readln_pending(coout)) {
+			n = readln_view(coout, &buffer);
+			if(buffer[n-1] == '\n') n--;
+			co_escreve(&lugares[cabeca % njobs], buffer, n);
+			continue;
+		}
+
+		//esperar por input (se houver lugar) ou por uma resposta
+		if(emvoo == njobs || !readln_pending(0)) {
+			if(emvoo == njobs) outbuf_flush(saida); //vai bloquear
+			else outbuf_idle(saida, 0);
+			p[0].fd = emvoo < njobs ? 0 : -1; p[0].events = POLLIN;
+			p[1].fd = emvoo > 0 && copid != 0 ? coout : -1; p[1].events = POLLIN;
+			if(espera(p) == -1) continue;
+
+			if(p[1].revents & (POLLIN | POLLHUP)) {
+				n = readln_view(coout, &buffer);
+				if(n <= 0 || buffer[n-1] != '\n') co_reinicia(campos, total, colunas); //terminou
+				else co_escreve(&lugares[cabeca % njobs], buffer, n-1);
+				continue;
+			}
+			if(!(p[0].revents & (POLLIN | POLLHUP))) continue;
+		}
+
+		if((n = stats_readln(st,0,&buffer)) <= 0) break; //fim do input (EOF)
+		if(n > 0 && buffer[n-1] == '\n') n--; //tirar \n
+		if(n == 0) continue;
+
+		//guardar a linha no lugar e escrevê-la no coprocesso
+		l = &lugares[proximo % njobs];
+		if((size_t) n > l->cap) { l->cap = n; l->linha = realloc(l->linha, n); }
+		memcpy(l->linha, buffer, n);
+		l->len = n;
+		l->ocupado = 1;
+		l->inicio = stats_agora();
+		proximo++;
+		emvoo++;
+
+		if(co_envia(campos, l, total, colunas) == -1) co_reinicia(campos, total, colunas);
+	}
+
+	//fim do input: ler as respostas que faltam
+	while(emvoo > 0) {
+		n = copid != 0 ? readln_view(coout, &buffer) : -1;
+		if(n <= 0 || buffer[n-1] != '\n') co_reinicia(campos, total, colunas);
+		else co_escreve(&lugares[cabeca % njobs], buffer, n-1);
+	}
+	outbuf_flush(saida);
+
+	return 0;
+}
+
+//lê o SIGCHLD (bloqueia até chegar, se ainda não estiver pendente) e recolhe os comandos que terminaram
+static void fim_comandos(int sfd) {
+	struct signalfd_siginfo si;
+
+	read(sfd, &si, sizeof(si));
+	recolhe();
+}
+
 int main(int argc, char const *argv[]){
 
+	int i, j, sfd, ret, coproc = 0;
+	ssize_t n;
+	size_t tam;
+	const char* campo;
+	char *buffer;
+	Lugar* l;
+	sigset_t mask, vazia;
+	posix_spawn_file_actions_t fa;
+	posix_spawnattr_t attr;
+	struct pollfd p[2];
+
+	//opções: -d <separador>, -j <N>, -u
+	for(i=1;i<argc && argv[i][0]=='-';i++) {
+		if(!strcmp(argv[i],"-d") && i+1<argc) delim = argv[++i][0];
+		else if(!strcmp(argv[i],"-j") && i+1<argc) njobs = atoi(argv[++i]);
+		else if(!strcmp(argv[i],"-u")) ordenado = 0;
+		else if(!strcmp(argv[i],"-c")) coproc = 1;
+		else break;
+	}
+	argc -= i-1; argv += i-1;
+
 	int total = argc-1;
-	int coluna =0, achei=0; //guardar o $n
-	int i,n,cut,s, pid,status;
-	char *cmd[total]; //guarda o comando a executar
-	char *tmp;
-	char buffer[PIPE_BUF];
-	char print[PIPE_BUF];
-	char final[PIPE_BUF];
-	char field[PIPE_BUF];
-
-	//verificação de erros do numero de argumentos (ou assume-se que o input é sempre correcto?)
-	//if(argc < 2) { write(2,"Sem argumentos!!",16); return 2; }
+	char *cmd[total+1]; //guarda o comando a executar (terminado em NULL)
+	int colunas[total+1]; //colunas[i] = n se o argumento i for $n, 0 senão
+	char *valores[total+1]; //valor da coluna de cada $n
+	Campos campos = campos_init(delim);
+
+	if(total < 1 || njobs < 1) { fprintf(stderr, "utilização: spawn [-d <separador>] [-j <N>] [-u] [-c] <cmd> <args...>\n"); return 1; }
+
+	saida = outbuf_init(1, outbuf_modo_env()); //escritas agrupadas (ver outbuf.h)
+	st = stats_abre();
+	saida->stats = st;
+	lugares = calloc(njobs, sizeof(Lugar));
+	livres = njobs;
 
 	//passar argumentos para array ; remover ./a.out
-	//--argc; ++argv;
-	for(i=0;i<argc;i++) {
-		    if(i+1 == argc) cmd[argc] = NULL;
-		    else cmd[i] = argv[i+1];
-		}
-	//verificar se $n aparece, se sim, remover $ e guardar a sua respectiva coluna 
+	//verificar se $n aparece, se sim, guardar a sua respectiva coluna
 	for(i=0;i<total;i++) {
-		tmp = cmd[i]; 
-		if (*tmp == '$'){ // se começa por $
-			tmp++;    // avanço um caracter e fico a apontar para o primeiro dígito
-			coluna = atoi(tmp); //número da coluna armazenado em coluna.
-			achei = 1;
-			break; //sair do ciclo ao achar
-		}
-		coluna++;
+		cmd[i] = (char*) argv[i+1];
+		colunas[i] = (cmd[i][0] == '$') ? atoi(cmd[i]+1) : 0;
+		valores[i] = NULL;
+	}
+	cmd[total] = NULL;
+
+	//modo coprocesso: o comando é lançado sem os $n
+	if(coproc) {
+		coargs = malloc(sizeof(char*) * (total+1));
+		for(i=0,j=0;i<total;i++) if(colunas[i] == 0) coargs[j++] = cmd[i];
+		coargs[j] = NULL;
+		if(j == 0) { fprintf(stderr, "spawn: falta o comando\n"); return 1; }
+		return coprocesso(campos, total, colunas);
 	}
 
+	//o SIGCHLD passa a ser lido de um descritor (os comandos não herdam a máscara)
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &mask, NULL);
+	sfd = signalfd(-1, &mask, SFD_CLOEXEC);
+
+	sigemptyset(&vazia);
+	posix_spawnattr_init(&attr);
+	posix_spawnattr_setsigmask(&attr, &vazia);
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK);
+
+	//stdin, stdout e stderr do comando em /dev/null
+	posix_spawn_file_actions_init(&fa);
+	posix_spawn_file_actions_addopen(&fa, 0, "/dev/null", O_RDONLY, 0);
+	posix_spawn_file_actions_addopen(&fa, 1, "/dev/null", O_WRONLY, 0);
+	posix_spawn_file_actions_addopen(&fa, 2, "/dev/null", O_WRONLY, 0);
+
 	//processar input
-   while((n = readln(0,buffer,PIPE_BUF)) >= 0) {  
-      if(n!=0) {   
-    	//Achar a(s) coluna(s)
-    	char *ptr = buffer;
-    	cut = 0;
-    	while ( sscanf(ptr, "%[^:]%n", field, &s) == 1) {
-        	cut++;
-        	if(cut == coluna) sprintf(print,"%s",field); //achou a coluna, guardar valor no print
-        	ptr += s; // avançar os characteres lidos
-         	++ptr; // salta o : 
-      	}
-		//mudar comando a executar com valor da coluna já convertido, caso haja algum $n
-    	if(achei) cmd[coluna] = print; 
-    	//faz fork e o filho executa o comando com os valores alterados
-      	pid = fork(); //guardar pid filho
-      	if(pid==0) { 
-      		int devNull = open("/dev/null", O_WRONLY); 
-      		dup2(devNull,1); //mandar output para /dev/null
-      		dup2(devNull,2); //stderr putput para /dev/null
-      		execvp(cmd[0],cmd); 
-      	}
-		//pai faz waitpid e guarda exit status
-     	waitpid(pid,&status,0);
-     	//buffer[n-1] = '\0'; //tirar /n
-      	if(WIFEXITED(status)) { sprintf(final,"%s:%i\n",buffer,WEXITSTATUS(status)); } //adicionar o exit status
-		write(1,final,strlen(final));
-	}
-	//else { pause(); }
- 	}
-
-  return 0; //nunca aqui vai chegar, mas é menos um warning ao compilar
-
-}
\ No newline at end of file
+	for(;;) {
+		//todos os lugares ocupados: esperar que um comando termine
+		if((l = lugar_livre()) == NULL) {
+			outbuf_flush(saida); //vai bloquear: escrever o que estiver acumulado
+			fim_comandos(sfd);
+			continue;
+		}
+
+		//sem linha no buffer: esperar por input ou pelo fim de um comando
+		if(!readln_pending(0)) {
+			outbuf_idle(saida, 0);
+			p[0].fd = 0; p[0].events = POLLIN;
+			p[1].fd = sfd; p[1].events = POLLIN;
+			if(espera(p) == -1) continue;
+			if(p[1].revents & POLLIN) fim_comandos(sfd);
+			if(!(p[0].revents & (POLLIN | POLLHUP))) continue;
+		}
+
+		if((n = stats_readln(st,0,&buffer)) <= 0) break; //fim do input (EOF)
+		if(n > 0 && buffer[n-1] == '\n') n--; //tirar \n
+		if(n == 0) continue;
+
+		//guardar a linha no lugar (o buffer do readln muda na próxima leitura)
+		if((size_t) n > l->cap) { l->cap = n; l->linha = realloc(l->linha, n); }
+		memcpy(l->linha, buffer, n);
+		l->len = n;
+
+		//mudar comando a executar com o valor das colunas de cada $n
+		campos_linha(campos, l->linha, l->len);
+		for(i=0;i<total;i++) {
+			if(colunas[i] > 0) {
+				campos_coluna(campos, colunas[i], &campo, &tam);
+				valores[i] = realloc(valores[i], tam+1);
+				memcpy(valores[i], campo, tam);
+				valores[i][tam] = '\0';
+				cmd[i] = valores[i];
+			}
+		}
+
+		//lançar o comando (o posix_spawn só volta depois do exec)
+		l->ocupado = 1;
+		l->inicio = stats_agora();
+		livres--;
+		proximo++;
+		ret = posix_spawnp(&l->pid, cmd[0], &fa, &attr, cmd, environ);
+		if(ret != 0) { //não foi possível executar o comando
+			l->pid = 0;
+			l->status = 127;
+			if(!ordenado) escreve(l);
+			else escreve_por_ordem();
+		}
+	}
+
+	//fim do input: esperar pelos comandos que ainda estão a correr
+	while(livres < njobs) fim_comandos(sfd);
+	outbuf_flush(saida);
+
+	return 0;
+}
@@ -0,0 +1,194 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <time.h>
+
+#include "readln.h"
+
+/*
+ * Contadores de execução de cada nó, numa região de memória partilhada.
+ *
+ * O controlador cria o ficheiro STATS_FICHEIRO (mapeado com MAP_SHARED) com
+ * um par de contadores por ID de nó: os do componente e os do fanout que parte
+ * dele. Os fanouts (filhos do controlador) e as tarefas do motor usam a região
+ * do controlador; os componentes mapeiam o ficheiro indicado na variável de
+ * ambiente STATS_ENV e escrevem no lugar STATS_ENV_NO.
+ *
+ * Cada contador tem um só escritor (o processo ou tarefa do nó), pelo que é
+ * atualizado com uma leitura e uma escrita relaxadas (sem instruções atómicas
+ * de leitura-escrita); o controlador só lê. Os contadores de tempo usam o
+ * relógio monótono (vDSO) e só são atualizados à volta de chamadas que podem
+ * bloquear (uma leitura do kernel ou uma escrita de um buffer inteiro), nunca
+ * por linha.
+ *
+ * Sem região (e.g. um componente corrido fora do controlador), os contadores
+ * vão para stats_nulo, para que quem os atualiza não precise de testes.
+ */
+
+#define STATS_ENV      "STATS_FICHEIRO"
+#define STATS_ENV_NO   "STATS_NO"
+#define STATS_FICHEIRO "./tmp/stats"
+#define STATS_MAXNOS   65536 // um lugar por ID de nó (REDE_MAXNOS)
+
+typedef unsigned long long contador;
+
+/* Alinhado a 128 bytes: escritores de lugares diferentes nunca partilham
+   linhas de cache */
+typedef struct __attribute__((aligned(128))) stats {
+    contador entrada;     // registos lidos
+    contador saida;       // registos escritos (somados por saída no fanout)
+    contador bentrada;    // bytes lidos
+    contador bsaida;      // bytes escritos
+    contador descartados; // registos lidos que não deram saída (filter) ou
+                          // que o motor não entregou (fanout)
+    contador nsleitura;   // ns à espera de input
+    contador nsescrita;   // ns em escritas
+    contador spawns;      // comandos terminados / respostas do coprocesso
+    contador nsspawn;     // soma das latências desses comandos (ns)
+} *Stats;
+
+typedef struct stats_lugar {
+    struct stats comp;   // componente (processo ou tarefa do motor)
+    struct stats fanout; // ligação que parte do nó
+} *StatsLugar;
+
+struct stats stats_nulo;          // contadores sem região (descartados)
+StatsLugar stats_regiao = NULL;   // STATS_MAXNOS lugares
+
+/*
+ * @brief Soma n a um contador (só o escritor do contador a pode usar)
+ */
+static inline void stats_soma(contador* c, contador n) {
+    __atomic_store_n(c, __atomic_load_n(c, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+}
+
+/*
+ * @brief Tempo do relógio monótono em ns
+ */
+static inline long long stats_agora() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+/*
+ * @brief Mapeia (criando-o se pedido) o ficheiro dos contadores
+ */
+static StatsLugar stats_mapeia(const char* ficheiro, int cria) {
+    int fd;
+    size_t tam = sizeof(struct stats_lugar) * STATS_MAXNOS;
+    void* r;
+
+    fd = cria ? open(ficheiro, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0666)
+              : open(ficheiro, O_RDWR | O_CLOEXEC);
+    if (fd == -1) return NULL;
+
+    if (cria && ftruncate(fd, tam) == -1) { close(fd); return NULL; }
+
+    r = mmap(NULL, tam, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    return r == MAP_FAILED ? NULL : r;
+}
+
+/*
+ * @brief Cria a região dos contadores (controlador)
+ *
+ * @return 0 em caso de sucesso, -1 em caso de erro
+ */
+int stats_cria(const char* ficheiro) {
+    stats_regiao = stats_mapeia(ficheiro, 1);
+    return stats_regiao == NULL ? -1 : 0;
+}
+
+/*
+ * @brief Contadores de um nó na região do controlador
+ *
+ * @param id     ID do nó
+ * @param fanout 1 para os contadores do fanout que parte do nó
+ */
+Stats stats_no(int id, int fanout) {
+    if (stats_regiao == NULL || id < 0 || id >= STATS_MAXNOS) return &stats_nulo;
+    return fanout ? &stats_regiao[id].fanout : &stats_regiao[id].comp;
+}
+
+/*
+ * @brief Põe a zero os contadores de um nó (quando o nó é criado)
+ */
+void stats_zera(int id) {
+    if (stats_regiao != NULL && id >= 0 && id < STATS_MAXNOS) {
+        memset(&stats_regiao[id], 0, sizeof(struct stats_lugar));
+    }
+}
+
+/*
+ * @brief Contadores de um componente, a partir das variáveis de ambiente
+ *        postas pelo controlador
+ */
+Stats stats_abre() {
+    const char* ficheiro = getenv(STATS_ENV);
+    const char* no = getenv(STATS_ENV_NO);
+
+    if (ficheiro == NULL || no == NULL) return &stats_nulo;
+
+    stats_regiao = stats_mapeia(ficheiro, 0);
+
+    return stats_no(atoi(no), 0);
+}
+
+/*
+ * @brief Cópia consistente (contador a contador) de um conjunto de contadores
+ */
+void stats_le(Stats s, struct stats* copia) {
+    copia->entrada = __atomic_load_n(&s->entrada, __ATOMIC_RELAXED);
+    copia->saida = __atomic_load_n(&s->saida, __ATOMIC_RELAXED);
+    copia->bentrada = __atomic_load_n(&s->bentrada, __ATOMIC_RELAXED);
+    copia->bsaida = __atomic_load_n(&s->bsaida, __ATOMIC_RELAXED);
+    copia->descartados = __atomic_load_n(&s->descartados, __ATOMIC_RELAXED);
+    copia->nsleitura = __atomic_load_n(&s->nsleitura, __ATOMIC_RELAXED);
+    copia->nsescrita = __atomic_load_n(&s->nsescrita, __ATOMIC_RELAXED);
+    copia->spawns = __atomic_load_n(&s->spawns, __ATOMIC_RELAXED);
+    copia->nsspawn = __atomic_load_n(&s->nsspawn, __ATOMIC_RELAXED);
+}
+
+/*
+ * @brief Indica se um registo é um carimbo do traçado (traco.h), que não conta
+ *        como registo lido nem escrito
+ */
+static inline int stats_carimbo(const char* rec, size_t n) {
+    return readln_binario_tam(rec, n) > 0 && rec[1] == READLN_CARIMBO;
+}
+
+/*
+ * @brief readln_registo que conta o registo lido e, se for preciso ler do
+ *        kernel, o tempo à espera
+ */
+ssize_t stats_readln(Stats s, int fd, char** line) {
+    ssize_t n;
+    long long t;
+
+    if (readln_pending(fd)) {
+        n = readln_registo(fd, line);
+    }
+    else {
+        t = stats_agora();
+        n = readln_registo(fd, line);
+        stats_soma(&s->nsleitura, stats_agora() - t);
+    }
+
+    if (n > 0 && !stats_carimbo(*line, n)) {
+        stats_soma(&s->entrada, 1);
+        stats_soma(&s->bentrada, n);
+    }
+
+    return n;
+}
+
+#endif
@@ -0,0 +1,210 @@
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "../bench/comum.h"
+
+/* O controlador a ler os comandos de um pipe (como em cat rede.txt |
+./controlador).
+
+1. O readln do controlador lê à frente várias linhas de comandos de uma vez;
+um processo criado por fork sem exec (o distribuidor das réplicas, o fanout)
+não pode ver essas linhas como registos. Corre
+
+	1 (window com réplicas, -p 2:1 -o) -> 2 (tee)
+
+injeta N registos no nó 1 e verifica que o tee recebe exatamente esses
+registos, pela mesma ordem, cada um com a coluna acrescentada pelo window.
+
+2. O fim dos comandos (EOF ou uma linha vazia, como no fim de
+testes/redeNotas.txt) com o router dentro do controlador: a rede tem de
+terminar com os registos todos entregues, como com shutdown --drain. Compara
+os ficheiros escritos pelos tee da rede nos dois casos.
+
+utilização: ./testes/teste_pipe [registos]
+*/
+
+#define DADOS "./tmp/teste_pipe.txt"
+#define SAIDA "./tmp/teste_pipe.out"
+#define RESPOSTAS "./tmp/teste_pipe.log"
+#define REDE "./testes/redeNotas.txt"
+
+const char* saidas[] = { "alunosAprovados.txt", "alunosOral.txt", "alunosExame.txt",
+                         "resultadosAlunos.txt" };
+
+#define NSAIDAS ((int) (sizeof(saidas) / sizeof(char*)))
+
+/*
+ * @brief Corre o controlador com os comandos escritos de uma vez num pipe
+ *        (o controlador lê os comandos seguintes com o primeiro)
+ *
+ * @return 0 se o controlador terminou sem erro
+ */
+int controlador(const char* comandos, size_t n) {
+	char* args[] = { "controlador", NULL };
+	int cmd, ctl, estado;
+
+	ctl = comum_controlador(args, RESPOSTAS, 0, &cmd);
+	write(cmd, comandos, n);
+	close(cmd);
+
+	waitpid(ctl, &estado, 0);
+
+	if (!WIFEXITED(estado) || WEXITSTATUS(estado) != 0) {
+		fprintf(stderr, "o controlador terminou com erro (ver %s)\n", RESPOSTAS);
+		return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * @brief Lê um ficheiro inteiro (malloc)
+ *
+ * @return Conteúdo do ficheiro ou NULL se não existir
+ */
+char* le_ficheiro(const char* nome, long* n) {
+	char* s;
+	FILE* f = fopen(nome, "r");
+
+	if (f == NULL) return NULL;
+
+	fseek(f, 0, SEEK_END);
+	*n = ftell(f);
+	rewind(f);
+	s = malloc(*n + 1);
+	*n = fread(s, 1, *n, f);
+	fclose(f);
+
+	return s;
+}
+
+/*
+ * @brief Teste 1: as réplicas do window com os comandos lidos à frente
+ */
+int teste_replicas(long n) {
+	char linha[256], esperada[256], comandos[512];
+	long i, erros = 0;
+	FILE* f;
+
+	f = fopen(DADOS, "w");
+	for (i = 0; i < n; i++) fprintf(f, "%ld:1\n", i);
+	fclose(f);
+
+	snprintf(comandos, sizeof(comandos), "node 1 -p 2:1 -o window 3 sum 2\n"
+	         "node 2 tee %s\nconnect 1 2\ninject 1 cat %s\nshutdown --drain\n",
+	         SAIDA, DADOS);
+
+	if (controlador(comandos, strlen(comandos)) != 0) return 1;
+
+	/* Cada linha do tee é a linha injetada com mais uma coluna */
+
+	if ((f = fopen(SAIDA, "r")) == NULL) {
+		perror(SAIDA);
+		return 1;
+	}
+
+	for (i = 0; fgets(linha, sizeof(linha), f) != NULL; i++) {
+		snprintf(esperada, sizeof(esperada), "%ld:1:", i);
+		if (i >= n || strncmp(linha, esperada, strlen(esperada)) != 0) {
+			if (erros++ < 5) fprintf(stderr, "linha %ld inesperada: %s", i + 1, linha);
+		}
+	}
+
+	fclose(f);
+
+	if (i != n) fprintf(stderr, "o tee recebeu %ld de %ld registos\n", i, n);
+
+	if (erros > 0 || i != n) return 1;
+
+	printf("teste_pipe: réplicas ok (%ld registos)\n", n);
+
+	unlink(DADOS);
+	unlink(SAIDA);
+
+	return 0;
+}
+
+/*
+ * @brief Teste 2: o fim dos comandos sem shutdown
+ */
+int teste_fim(void) {
+	char *rede, *drena, *esperado[NSAIDAS], *obtido;
+	long n, nesperado[NSAIDAS], nobtido, total = 0;
+	int i, erros = 0;
+
+	if ((rede = le_ficheiro(REDE, &n)) == NULL) {
+		perror(REDE);
+		return 1;
+	}
+
+	/* Referência: os mesmos comandos, sem a linha vazia do fim e com um
+	   shutdown --drain */
+
+	drena = malloc(n + 32);
+	while (n > 0 && rede[n - 1] == '\n') n--;
+	memcpy(drena, rede, n);
+	strcpy(drena + n, "\nshutdown --drain\n");
+
+	for (i = 0; i < NSAIDAS; i++) unlink(saidas[i]);
+	if (controlador(drena, strlen(drena)) != 0) return 1;
+
+	for (i = 0; i < NSAIDAS; i++) {
+		esperado[i] = le_ficheiro(saidas[i], &nesperado[i]);
+		if (esperado[i] == NULL) nesperado[i] = 0;
+		total += nesperado[i];
+		unlink(saidas[i]);
+	}
+
+	if (total == 0) {
+		fprintf(stderr, "a rede de %s não escreveu nada com shutdown --drain\n", REDE);
+		return 1;
+	}
+
+	/* O ficheiro tal como está, terminado por uma linha vazia */
+
+	rede[n] = '\n';
+	rede[n + 1] = '\n';
+	if (controlador(rede, n + 2) != 0) return 1;
+
+	for (i = 0; i < NSAIDAS; i++) {
+		obtido = le_ficheiro(saidas[i], &nobtido);
+		if (obtido == NULL) nobtido = 0;
+		if (nobtido != nesperado[i] || memcmp(obtido, esperado[i], nobtido) != 0) {
+			fprintf(stderr, "%s: %ld bytes, esperados %ld\n", saidas[i], nobtido,
+			        nesperado[i]);
+			erros++;
+		}
+		free(obtido);
+		free(esperado[i]);
+	}
+
+	free(rede);
+	free(drena);
+
+	if (erros > 0) return 1;
+
+	printf("teste_pipe: fim dos comandos ok (%ld bytes)\n", total);
+
+	return 0;
+}
+
+int main(int argc, char const *argv[]){
+
+	long n = argc > 1 ? atol(argv[1]) : 1000;
+
+	if (comum_pronto(NULL) != 0) return 1;
+
+	if (teste_replicas(n) != 0 || teste_fim() != 0) {
+		printf("teste_pipe: FALHOU\n");
+		return 1;
+	}
+
+	unlink(RESPOSTAS);
+
+	return 0;
+}
@@ -0,0 +1,479 @@
+#ifndef TRACO_H
+#define TRACO_H
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+
+#include "readln.h"
+#include "stats.h"
+
+/*
+ * Traçado da latência de ponta a ponta (opção -t do controlador).
+ *
+ * Com o traçado ligado, o inject põe um carimbo à frente de um em cada N
+ * registos que escreve. O carimbo é um registo binário (ver
+ * readln.h) que leva dois instantes do relógio
+ * monótono: a origem (quando o registo foi injetado) e o último salto (quando
+ * saiu do nó ou da ligação anterior). Os instantes vão em hexadecimal, com um
+ * '\n' no fim, para que o carimbo seja também uma linha para quem lê linha a
+ * linha (a thread de entrada do motor):
+ *
+ *     0   u8   READLN_BINARIO
+ *     1   u8   TRACO_MARCA
+ *     2   u16  0
+ *     4   u32  TRACO_TAM
+ *     8   u64  0
+ *     16  16 dígitos hex: origem (ns)
+ *     32  16 dígitos hex: último salto (ns)
+ *     48  '\n'
+ *
+ * Cada componente interno (const, filter e window, em processos ou no motor)
+ * guarda o carimbo e, quando processa o registo seguinte, regista no
+ * histograma do nó o tempo desde o último salto (fila de entrada e
+ * processamento) e no histograma total o tempo desde a origem. Se o registo
+ * der saída, o carimbo vai à frente dela com o último salto atualizado.
+ *
+ * Quem entrega os registos (router, fanouts em processos e motor) regista em
+ * cada ligação o tempo desde o último salto e atualiza-o. Os carimbos só são
+ * entregues aos componentes internos (os outros destinos, e.g. tee, não
+ * recebem binarios), e nesse caso o tempo desde a origem vai para o histograma
+ * total do destino.
+ *
+ * Os histogramas estão numa região partilhada (como os contadores, stats.h),
+ * criada pelo controlador só com o traçado ligado, com um par de histogramas
+ * por nó e uma tabela de ligações. Cada histograma tem escala logarítmica com
+ * TRACO_SUB baldes por potência de 2 (erro relativo até 1/TRACO_SUB, como um
+ * histograma HDR) e é atualizado com somas atómicas, porque o total de um nó
+ * externo recebe de vários escritores. Sem traçado não há carimbos e o custo
+ * é só o teste do primeiro byte de cada registo, que já é feito para os
+ * outros registos binários (readln.h).
+ */
+
+#define TRACO_ENV       "TRACO_FICHEIRO"
+#define TRACO_FICHEIRO  "./tmp/traco"
+#define TRACO_MARCA     READLN_CARIMBO
+#define TRACO_TAM       49
+#define TRACO_SUB       8     // baldes por potência de 2
+#define TRACO_BITS      3     // log2(TRACO_SUB)
+#define TRACO_BALDES    256   // até 2^34 ns (17 s); acima fica no último
+#define TRACO_MAXNOS    STATS_MAXNOS
+#define TRACO_MAXARESTAS 16384
+
+typedef struct histo {
+    contador n;      // amostras
+    contador soma;   // ns
+    contador max;    // ns
+    contador baldes[TRACO_BALDES];
+} *Histo;
+
+typedef struct traco_aresta {
+    int origem, destino;
+    int usada;       // escrito pelo controlador (só passa a 1)
+    struct histo h;
+} *TracoAresta;
+
+typedef struct traco_lugar {
+    struct histo no;    // tempo no nó (desde o último salto)
+    struct histo total; // tempo desde a origem (o inject)
+} *TracoLugar;
+
+typedef struct traco_regiao {
+    struct traco_lugar   nos[TRACO_MAXNOS];
+    struct traco_aresta  arestas[TRACO_MAXARESTAS];
+} *TracoRegiao;
+
+TracoRegiao traco_regiao = NULL;
+int traco_amostra = 0; // um carimbo em cada traco_amostra registos injetados
+                       // (controlador, 0 sem traçado)
+
+
+/******************************************************************************
+ *                                 CARIMBOS                                   *
+ ******************************************************************************/
+
+/*
+ * @brief Indica se um registo (lido com readln_registo) é um carimbo
+ */
+static inline int traco_e(const char* rec, size_t n) {
+    return n >= TRACO_TAM && readln_binario_tam(rec, n) == TRACO_TAM &&
+           rec[1] == TRACO_MARCA;
+}
+
+static long long traco_hex(const char* p) {
+    long long v = 0;
+    int i;
+
+    for (i = 0; i < 16; i++) {
+        v = v << 4 | (p[i] <= '9' ? p[i] - '0' : p[i] - 'a' + 10);
+    }
+
+    return v;
+}
+
+static void traco_poe_hex(char* p, long long v) {
+    int i;
+
+    for (i = 15; i >= 0; i--, v >>= 4) p[i] = "0123456789abcdef"[v & 15];
+}
+
+/*
+ * @brief Escreve um carimbo (TRACO_TAM bytes)
+ */
+void traco_escreve(char* buf, long long origem, long long ultimo) {
+    uint32_t tam = TRACO_TAM;
+
+    memset(buf, 0, 16);
+    buf[0] = READLN_BINARIO;
+    buf[1] = TRACO_MARCA;
+    memcpy(buf + 4, &tam, 4);
+    traco_poe_hex(buf + 16, origem);
+    traco_poe_hex(buf + 32, ultimo);
+    buf[48] = '\n';
+}
+
+/*
+ * @brief Instantes de um carimbo
+ */
+void traco_le(const char* rec, long long* origem, long long* ultimo) {
+    *origem = traco_hex(rec + 16);
+    *ultimo = traco_hex(rec + 32);
+}
+
+/*
+ * @brief Muda o último salto de um carimbo
+ */
+void traco_atualiza(char* rec, long long ultimo) {
+    traco_poe_hex(rec + 32, ultimo);
+}
+
+
+/******************************************************************************
+ *                               HISTOGRAMAS                                  *
+ ******************************************************************************/
+
+/*
+ * @brief Balde de um valor: os TRACO_SUB primeiros valores têm um balde cada
+ *        e cada potência de 2 seguinte é dividida em TRACO_SUB baldes
+ */
+static int histo_balde(unsigned long long v) {
+    int msb, b;
+
+    if (v < TRACO_SUB) return v;
+
+    msb = 63 - __builtin_clzll(v);
+    b = (msb - TRACO_BITS + 1) * TRACO_SUB + (int) ((v >> (msb - TRACO_BITS)) & (TRACO_SUB - 1));
+
+    return b < TRACO_BALDES ? b : TRACO_BALDES - 1;
+}
+
+/*
+ * @brief Valor do meio de um balde
+ */
+static long long histo_valor(int b) {
+    int e = b / TRACO_SUB - 1;
+    long long base;
+
+    if (b < TRACO_SUB) return b;
+
+    base = (long long) (TRACO_SUB + b % TRACO_SUB) << e;
+
+    return base + (1LL << e) / 2;
+}
+
+/*
+ * @brief Regista uma amostra (ns; negativas contam como 0)
+ */
+void histo_regista(Histo h, long long ns) {
+    contador max;
+
+    if (h == NULL) return;
+    if (ns < 0) ns = 0;
+
+    __atomic_fetch_add(&h->n, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->soma, ns, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->baldes[histo_balde(ns)], 1, __ATOMIC_RELAXED);
+
+    max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+    while ((contador) ns > max &&
+           !__atomic_compare_exchange_n(&h->max, &max, ns, 1, __ATOMIC_RELAXED,
+                                        __ATOMIC_RELAXED));
+}
+
+/*
+ * @brief Cópia de um histograma (balde a balde)
+ */
+void histo_le(Histo h, struct histo* copia) {
+    int i;
+
+    copia->n = __atomic_load_n(&h->n, __ATOMIC_RELAXED);
+    copia->soma = __atomic_load_n(&h->soma, __ATOMIC_RELAXED);
+    copia->max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+    for (i = 0; i < TRACO_BALDES; i++) {
+        copia->baldes[i] = __atomic_load_n(&h->baldes[i], __ATOMIC_RELAXED);
+    }
+}
+
+/*
+ * @brief Percentil de um histograma (ns, com o erro do balde)
+ *
+ * @param p Percentil entre 0 e 1
+ */
+long long histo_percentil(struct histo* h, double p) {
+    contador alvo = h->n * p, soma = 0;
+    int i;
+
+    for (i = 0; i < TRACO_BALDES; i++) {
+        soma += h->baldes[i];
+        if (soma > alvo) break;
+    }
+
+    if (i == TRACO_BALDES) return h->max;
+
+    return histo_valor(i) < (long long) h->max ? histo_valor(i) : (long long) h->max;
+}
+
+
+/******************************************************************************
+ *                                  REGIÃO                                    *
+ ******************************************************************************/
+
+/*
+ * @brief Mapeia (criando-o se pedido) o ficheiro dos histogramas
+ */
+static TracoRegiao traco_mapeia(const char* ficheiro, int cria) {
+    int fd;
+    void* r;
+
+    fd = cria ? open(ficheiro, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0666)
+              : open(ficheiro, O_RDWR | O_CLOEXEC);
+    if (fd == -1) return NULL;
+
+    if (cria && ftruncate(fd, sizeof(struct traco_regiao)) == -1) {
+        close(fd);
+        return NULL;
+    }
+
+    r = mmap(NULL, sizeof(struct traco_regiao), PROT_READ | PROT_WRITE,
+             MAP_SHARED, fd, 0);
+    close(fd);
+
+    return r == MAP_FAILED ? NULL : r;
+}
+
+/*
+ * @brief Cria a região dos histogramas (controlador)
+ *
+ * @return 0 em caso de sucesso, -1 em caso de erro
+ */
+int traco_cria(const char* ficheiro) {
+    traco_regiao = traco_mapeia(ficheiro, 1);
+    return traco_regiao == NULL ? -1 : 0;
+}
+
+/*
+ * @brief Histograma de um nó
+ *
+ * @param total 1 para o tempo desde a origem, 0 para o tempo no nó
+ */
+Histo traco_no(int id, int total) {
+    if (traco_regiao == NULL || id < 0 || id >= TRACO_MAXNOS) return NULL;
+    return total ? &traco_regiao->nos[id].total : &traco_regiao->nos[id].no;
+}
+
+static unsigned traco_hash(int origem, int destino) {
+    return ((unsigned) origem * 2654435761u ^ (unsigned) destino * 40503u) %
+           TRACO_MAXARESTAS;
+}
+
+/*
+ * @brief Histograma de uma ligação
+ *
+ * As ligações estão numa tabela de dispersão com procura linear e nunca saem
+ * dela, para que possam ser procuradas sem locks enquanto o controlador
+ * acrescenta outras. Só o controlador as pode criar.
+ *
+ * @param cria 1 para criar a ligação se ainda não existir (controlador)
+ *
+ * @return Histograma ou NULL se não existir (ou a tabela estiver cheia)
+ */
+Histo traco_aresta(int origem, int destino, int cria) {
+    unsigned i, h;
+    TracoAresta a;
+
+    if (traco_regiao == NULL) return NULL;
+
+    for (i = 0, h = traco_hash(origem, destino); i < TRACO_MAXARESTAS; i++) {
+        a = &traco_regiao->arestas[(h + i) % TRACO_MAXARESTAS];
+
+        if (!__atomic_load_n(&a->usada, __ATOMIC_ACQUIRE)) {
+            if (!cria) return NULL;
+            a->origem = origem;
+            a->destino = destino;
+            __atomic_store_n(&a->usada, 1, __ATOMIC_RELEASE);
+            return &a->h;
+        }
+
+        if (a->origem == origem && a->destino == destino) return &a->h;
+    }
+
+    return NULL;
+}
+
+/*
+ * @brief Põe a zero os histogramas de um nó e das ligações que lhe tocam
+ *        (quando o nó é criado)
+ */
+void traco_zera(int id) {
+    int i;
+    TracoAresta a;
+
+    if (traco_regiao == NULL || id < 0 || id >= TRACO_MAXNOS) return;
+
+    memset(&traco_regiao->nos[id], 0, sizeof(struct traco_lugar));
+
+    for (i = 0; i < TRACO_MAXARESTAS; i++) {
+        a = &traco_regiao->arestas[i];
+        if (a->usada && (a->origem == id || a->destino == id)) {
+            memset(&a->h, 0, sizeof(struct histo));
+        }
+    }
+}
+
+/*
+ * @brief Regista a entrega de um carimbo numa ligação (router, fanouts e
+ *        motor): o tempo desde o último salto e, se o destino não aceitar
+ *        carimbos (o carimbo fica por ali), o tempo desde a origem no total
+ *        do destino
+ */
+void traco_entrega(const char* rec, int origem, int destino, int aceita, long long agora) {
+    long long o, u;
+
+    traco_le(rec, &o, &u);
+    histo_regista(traco_aresta(origem, destino, 0), agora - u);
+    if (!aceita) histo_regista(traco_no(destino, 1), agora - o);
+}
+
+
+/******************************************************************************
+ *                               COMPONENTES                                  *
+ ******************************************************************************/
+
+/* Carimbo do próximo registo de um componente */
+typedef struct carimbo {
+    int       ativo;  // 1 se o próximo registo tem carimbo
+    long long origem, ultimo;
+    Histo     no, total;
+    char      buf[TRACO_TAM]; // carimbo da saída
+} Carimbo;
+
+/*
+ * @brief Carimbo de um componente, com os histogramas do nó a partir das
+ *        variáveis de ambiente postas pelo controlador (sem traçado ficam a
+ *        NULL e os carimbos só são passados à frente)
+ */
+Carimbo traco_abre() {
+    Carimbo c;
+    const char* ficheiro = getenv(TRACO_ENV);
+    const char* no = getenv(STATS_ENV_NO);
+
+    memset(&c, 0, sizeof(Carimbo));
+
+    if (ficheiro != NULL && no != NULL && (traco_regiao = traco_mapeia(ficheiro, 0)) != NULL) {
+        c.no = traco_no(atoi(no), 0);
+        c.total = traco_no(atoi(no), 1);
+    }
+
+    return c;
+}
+
+/*
+ * @brief Guarda o carimbo lido (vale para o registo seguinte)
+ */
+void traco_entrada(Carimbo* c, const char* rec) {
+    traco_le(rec, &c->origem, &c->ultimo);
+    c->ativo = 1;
+}
+
+/*
+ * @brief Regista o registo carimbado que acabou de ser processado e, se deu
+ *        saída, prepara o carimbo que vai à frente dela (em c->buf)
+ *
+ * @param saiu 1 se o registo deu saída
+ *
+ * @return TRACO_TAM se há carimbo para escrever, 0 se não
+ */
+size_t traco_saida(Carimbo* c, int saiu) {
+    long long agora = stats_agora();
+
+    c->ativo = 0;
+    histo_regista(c->no, agora - c->ultimo);
+    histo_regista(c->total, agora - c->origem);
+
+    if (!saiu) return 0;
+
+    traco_escreve(c->buf, c->origem, agora);
+
+    return TRACO_TAM;
+}
+
+
+/******************************************************************************
+ *                                  INJECT                                    *
+ ******************************************************************************/
+
+/*
+ * @brief Copia as linhas de fdi para fdo pondo um carimbo à frente de uma em
+ *        cada amostra (processo do inject)
+ *
+ * Cada escrita tem só registos completos (e cada carimbo vai na mesma escrita
+ * que a sua linha) e é feita quando o buffer enche ou antes de esperar por
+ * mais input.
+ */
+void traco_injeta(int fdi, int fdo, int amostra) {
+    char buf[PIPE_BUF];
+    char* line;
+    ssize_t n;
+    size_t len = 0, preciso;
+    long long conta = 0;
+    int carimba;
+
+    while ((n = readln_view(fdi, &line)) > 0) {
+        carimba = conta++ % amostra == 0;
+        preciso = n + (carimba ? TRACO_TAM : 0) + (line[n - 1] != '\n');
+
+        if (len + preciso > sizeof(buf) && len > 0) {
+            write(fdo, buf, len);
+            len = 0;
+        }
+
+        if (preciso > sizeof(buf)) { // linha maior que o buffer: sem carimbo
+            write(fdo, line, n);
+            if (line[n - 1] != '\n') write(fdo, "\n", 1);
+        }
+        else {
+            if (carimba) {
+                long long agora = stats_agora();
+                traco_escreve(buf + len, agora, agora);
+                len += TRACO_TAM;
+            }
+            memcpy(buf + len, line, n);
+            len += n;
+            if (line[n - 1] != '\n') buf[len++] = '\n';
+        }
+
+        if (!readln_pending(fdi) && len > 0) {
+            write(fdo, buf, len);
+            len = 0;
+        }
+    }
+
+    if (len > 0) write(fdo, buf, len);
+}
+
+#endif
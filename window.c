@@ -8,11 +8,25 @@
 #include <limits.h>
 
 #include "readln.h"
+#include "window.h"
+#include "outbuf.h"
+#include "stats.h"
+#include "traco.h"
+#include "anel.h"
 
 /*window <coluna> <operacao> <linhas>
 Este programa reproduz todas as linhas acrescentando-lhe uma nova coluna com o resultado de uma
 operacão  é calculada sobre os valores da coluna indicada nas linhas anteriores.
 avg, max, min, sum
+Com -d <separador> as colunas são separadas por outro caratere que não ':'.
+Com --by <coluna> há uma janela para cada valor dessa coluna (a chave) e com
+--mem <bytes> (por omissão 256m) as chaves que há mais tempo não aparecem
+saem quando as janelas passam desse limite (ver window.h).
+Com --type int|real|auto escolhe-se o tipo dos valores: por omissão (auto) inteiros de
+64 bits até aparecer um valor real (e.g. 2.5), e a partir daí reais.
+As opções --by, --mem e --type podem vir antes de <coluna> ou depois de <linhas>.
+A pedido do controlador (checkpoint e change), o estado das janelas é guardado num ficheiro
+e, com a variável de ambiente WINDOW_ESTADO, é restaurado no arranque (ver window.h).
 
 ./a.out 1 sum 3
 
@@ -29,102 +43,62 @@ output: 5:c:d:25
 
 int main(int argc, char const *argv[]){
 
-	int linhas = atoi(argv[3]);
-	int coluna = atoi(argv[1]);
-	int stored[linhas]; //armazena valores
-	int cut,n,i,res,first=0,s;
-	char buffer[PIPE_BUF];
-	char print[PIPE_BUF];
-	char final[PIPE_BUF];
-	char field[100];
-	
-	//AVG
-	int do_avg(){
-		if(first == 0) { first++; return 0; } //quando começa dá sempre 0
-		if(first == 1) {first++; return stored[0]; } //quando só tem uma coluna dá o valor dessa coluna
-		else if(first < linhas) { //a partir dai enquanto que não houver buffer, utiliza as x linhas existentes
-					int avg = 0;
-					for(i=0;i<first;i++) {
-					avg = avg + stored[i];
-					}
-					avg = avg / first ;
-					first++;
-					return avg; }
-		int avg = 0;
-		for(i=0;i<linhas;i++) {
-			avg = avg + stored[i];
-		}
-		avg = avg / linhas ;
-		return avg;
-	}
-	//MAX
-	int do_max(){
-		if(first == 0) { first++;	for(i=0;i<linhas;i++) { stored[i] = res; } } //incialização para máximo
-		int max;
-		max = stored[0];
-		for(i=1;i<linhas;i++) {
-			if(max < stored[i]) max = stored[i];
-		}
-		return max;
-	}
-	//min
-	int do_min(){
-		if(first == 0) { first++;	for(i=0;i<linhas;i++) { stored[i] = res; } } //incialização para min
-		int min;
-		min = stored[0];
-		for(i=1;i<linhas;i++) {
-			if(min > stored[i]) min = stored[i];
-		}
-		return min;
-	}
-	//SUM
-	int do_sum(){
-		if(first == 0)  { for(i=1;i<linhas;i++) { stored[i] = 0; } first++; } //inicializar todos os valores a 0
-		int sum = 0;
-		for(i=0;i<linhas;i++) {
-			sum = sum + stored[i];
-		}
-		return sum;
-	}
+	Window w = window_init(argc, argv);
+	const char* final;
+	char* buffer;
+	ssize_t n, m;
+	Outbuf o = outbuf_init(1, outbuf_modo_env()); //escritas agrupadas (ver outbuf.h)
+	Stats s = stats_abre(); //contadores do nó (ver stats.h)
+	Carimbo tr = traco_abre(); //carimbos do traçado (ver traco.h)
 
-	//faz operação
-	void do_op() {
-		if(strcmp(argv[2],"avg") == 0) res = do_avg();
-		if(strcmp(argv[2],"max") == 0) res = do_max();
-		if(strcmp(argv[2],"min") == 0) res = do_min();
-		if(strcmp(argv[2],"sum") == 0) res = do_sum();
+	if (w == NULL) {
+		fprintf(stderr, "utilização: window [-d <separador>] [opções] <coluna> <operacao> <linhas> [opções]\n"
+		                "opções: --by <coluna>, --mem <bytes>, --type int|real|auto\n");
+		return 1;
 	}
 
-	//adiciona um novo valor ao array e tira o mais antigo
-	void novo_valor(int a){
-		for(i=linhas;i>=1;i--) {
-			stored[i] = stored[i-1];
+	o->stats = s;
+
+	anel_componente(o); //anéis em vez dos FIFOs, se o nó os usar (ver anel.h)
+
+	if (getenv(WINDOW_ESTADO_ENV) != NULL) { //estado do window anterior (change ou node -r)
+		char* resto;
+		size_t r;
+		if (window_restaura(w, getenv(WINDOW_ESTADO_ENV), &resto, &r) == -1) {
+			fprintf(stderr, "window: estado inválido em %s\n", getenv(WINDOW_ESTADO_ENV));
 		}
-		stored[0] = a;
+		if (r > 0) readln_devolve(0, resto, r); //o que o anterior já tinha lido
+		free(resto);
 	}
 
-   while((n = readln(0,buffer,PIPE_BUF)) >= 0) {  
+   while((n = stats_readln(s,0,&buffer)) > 0) {  
       if(n!=0) {  
          
-      //Achar a coluna
-      char *ptr = buffer;
-      cut = 0;
-      while ( sscanf(ptr, "%100[^:]%n", field, &s) == 1) {
-         cut++;
-         if(cut == coluna) sprintf(print,"%s\n",field); //achou a coluna, guardar valor no print
-         ptr += s; /* avançar os characteres lidos */
-         ++ptr; /* salta o : */
-      }
-      //fazer as operações
-      res = atoi(print); //guardar valor para inteiro
-      novo_valor(res); //adiciona novo valor
-      do_op(); //faz as contas e actualiza res(ultado)
-      //buffer[n-1] = '\0'; //tirar /n
-	  sprintf(final,"%s:%i\n",buffer,res); //acrescentar resultado fim da linha
-	  write(1,final,strlen(final));
+	  if (readln_marca(buffer,n)) { outbuf_write(o,buffer,n); outbuf_idle(o,0); continue; } //marca de ordem das réplicas (ver replica.h)
+	  if (traco_e(buffer,n)) { traco_entrada(&tr,buffer); continue; } //carimbo do registo seguinte
+	  if (readln_estado(buffer,n)) { //pedido de estado do controlador (ver window.h)
+		  char ficheiro[PATH_MAX], *resto = NULL;
+		  size_t r = 0;
+		  int termina;
+		  if (window_pedido_le(buffer, n, ficheiro, &termina) == -1) continue; //inválido ou para o processo anterior
+		  outbuf_flush(o);
+		  if (termina) r = readln_take(0, &resto); //o resto vai para o próximo window
+		  if (window_guarda(w, ficheiro, resto, r) == 0 && termina) return 0;
+		  if (r > 0) readln_devolve(0, resto, r); //não foi guardado: continua
+		  continue;
+	  }
+
+      //fazer as operações e acrescentar resultado fim da linha
+	  m = window_process(w, buffer, n, &final);
+	  if (m == -1) { outbuf_flush(o); fprintf(stderr, "window: sem memória para a janela de uma chave\n"); return 1; }
+	  if (tr.ativo && traco_saida(&tr,m > 0)) outbuf_write(o,tr.buf,TRACO_TAM); //o carimbo vai à frente da saída
+	  if (m > 0) outbuf_write(o,final,m);
 	}
+	outbuf_idle(o,0); //escreve o que estiver acumulado antes de esperar por input
 
   }
 
-  return 0; //nunca aqui vai chegar, mas é menos um warning ao compilar
+  outbuf_flush(o); //fim do input (EOF): escrever o que estiver acumulado
+
+  return 0;
 }
\ No newline at end of file
@@ -0,0 +1,1040 @@
+#ifndef WINDOW_H
+#define WINDOW_H
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <limits.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "field.h"
+#include "readln.h"
+#include "bytes.h"
+
+/*
+ * Operador window: reproduz as linhas acrescentando uma coluna com o resultado
+ * de uma operação (avg, max, min, sum) sobre os valores de uma coluna nas
+ * últimas linhas.
+ *
+ * Os últimos valores ficam num buffer circular (no heap, por isso a janela
+ * pode ter milhões de linhas) e o resultado é atualizado de forma incremental
+ * em O(1) amortizado por linha:
+ *
+ *  - sum/avg: soma corrente, a que se soma o valor novo e se subtrai o que
+ *    sai da janela;
+ *  - max/min: fila monótona com as posições dos valores candidatos a máximo
+ *    ou mínimo (por ordem decrescente ou crescente); cada valor entra e sai
+ *    da fila no máximo uma vez.
+ *
+ * Os resultados são os da implementação original, com t linhas já vistas:
+ *
+ *  - sum, max, min: sobre os últimos min(t, linhas) valores;
+ *  - avg: 0 na primeira linha e depois a média dos últimos min(t - 1,
+ *    linhas) valores (truncada, com valores inteiros).
+ *
+ * Os valores são inteiros de 64 bits ou reais (field.h), conforme --type:
+ * int (um valor real fica truncado, como na implementação original), real
+ * ou auto (por omissão: inteiros até aparecer o primeiro valor real, e a
+ * partir daí reais, com os valores que estão nas janelas convertidos). A
+ * soma dos inteiros é de 128 bits (a soma de uma janela de contadores de 64
+ * bits não transborda) e a dos reais é long double.
+ *
+ * Com --by <coluna>, cada valor da coluna da chave tem a sua própria janela
+ * (o resultado de cada linha é o da janela da sua chave). As janelas ficam
+ * numa tabela de hash de endereçamento aberto (sondagem linear, 8 bytes por
+ * entrada: hash e índice da janela); as chaves são guardadas uma só vez numa
+ * zona contígua (compactada quando metade for de chaves que já saíram) e as
+ * janelas, todas do mesmo tamanho (estado, anel e fila), vêm de um pool de
+ * blocos (de até WINDOW_BLOCO bytes, com pelo menos uma janela) com uma lista
+ * de livres. Com mais memória do que o limite (--mem, por omissão
+ * WINDOW_MEMORIA), sai a chave que há mais tempo não aparece (lista LRU): se
+ * voltar, a sua janela recomeça vazia; o mesmo acontece se não houver memória
+ * para um bloco novo. O limite conta o custo de cada chave (janela, duas
+ * entradas da tabela e nome) e tem de chegar para uma chave; como a tabela e
+ * a zona das chaves crescem para o dobro, a memória reservada pode passar um
+ * pouco do limite.
+ *
+ * O estado das janelas pode ser guardado num ficheiro e restaurado por outro
+ * window (ver window_guarda), para que um change do nó não o perca.
+ *
+ * Usado pelo programa window e pelo motor de execução do controlador.
+ */
+
+enum { W_NENHUMA, W_AVG, W_MAX, W_MIN, W_SUM };
+
+#define WINDOW_MEMORIA (256L << 20) // limite da memória das janelas por chave
+#define WINDOW_BLOCO   (1L << 20)   // bytes por bloco do pool (no máximo)
+#define WINDOW_NADA    0            // índice nulo (os índices começam em 1)
+
+#define WINDOW_ESTADO_ENV   "WINDOW_ESTADO" // ficheiro a restaurar no arranque
+#define WINDOW_ESTADO_MAGIA "WINEST01"
+#define WINDOW_ESTADO_CAB   12              // bytes do pedido antes do ficheiro
+
+/*
+ * Valor de uma linha: inteiro ou real, conforme o operador (real em Window)
+ */
+typedef union valor {
+    long   i;
+    double r;
+} Valor;
+
+/*
+ * Estado de uma janela (a única ou a de uma chave). Os últimos valores (o da
+ * linha i em anel[i % linhas]) e, em max/min, a fila com as posições no anel
+ * das linhas candidatas vêm logo a seguir (ver janela_anel e janela_fila)
+ */
+typedef struct janela {
+    union {
+        __int128    i;
+        long double r;
+    }          soma;     // soma dos valores na janela (sum/avg)
+    long long  t;        // número de linhas já vistas
+    long       pos;      // posição da linha corrente no anel (t % linhas)
+    long       cabeca;   // posição do primeiro índice da fila (max/min)
+    long       nfila;    // número de índices na fila
+    Valor      primeiro; // valor da primeira linha (avg)
+    uint32_t   hash;     // hash da chave (--by)
+    uint32_t   chave;    // início da chave na zona das chaves
+    uint32_t   tamchave; // tamanho da chave
+    uint32_t   ant;      // chave usada antes desta (LRU) ou o livre seguinte
+    uint32_t   seg;      // chave usada depois desta (LRU)
+} *Janela;
+
+/*
+ * Entrada da tabela de hash das chaves (janela == WINDOW_NADA se vazia)
+ */
+typedef struct window_entrada {
+    uint32_t hash;
+    uint32_t janela;
+} WindowEntrada;
+
+/*
+ * Janelas por chave (--by)
+ */
+typedef struct window_chaves {
+    int            coluna;   // coluna da chave
+    size_t         limite;   // memória máxima (bytes)
+    size_t         memoria;  // memória das chaves presentes (bytes)
+    size_t         tamjanela; // bytes de uma janela (estado, anel e fila)
+    WindowEntrada* tabela;   // tabela de hash (potência de 2)
+    uint32_t       captabela;
+    uint32_t       nchaves;  // chaves presentes
+    char**         blocos;   // pool: 2^bitsbloco janelas por bloco
+    uint32_t       nblocos;
+    uint32_t       bitsbloco;
+    uint32_t       usadas;   // janelas já tiradas do pool
+    uint32_t       livres;   // lista das janelas livres (ligadas por ant)
+    uint32_t       recente;  // chave usada mais recentemente (cabeça da LRU)
+    uint32_t       antiga;   // chave que há mais tempo não aparece
+    char*          nomes;    // zona das chaves
+    size_t         tamnomes; // bytes ocupados (com os das chaves que saíram)
+    size_t         capnomes;
+    size_t         lixo;     // bytes das chaves que saíram
+    long long      saidas;   // chaves que saíram por falta de memória
+} *WindowChaves;
+
+typedef struct windowop {
+    int        coluna;   // coluna com os valores
+    int        operacao; // W_AVG, W_MAX, W_MIN ou W_SUM
+    long       linhas;   // tamanho da janela
+    Janela     j;        // janela corrente (a única, sem --by)
+    WindowChaves chaves; // janelas por chave (--by) ou NULL
+    int        tipo;     // tipo dos valores (--type): CAMPOS_INT, CAMPOS_REAL
+                         // ou CAMPOS_AUTO
+    int        real;     // 1 se os valores já são tratados como reais
+    __int128   res;      // último resultado (inteiro)
+    double     resr;     // último resultado (real)
+    Campos     campos;   // colunas da linha corrente
+    char       delim;    // separador das colunas
+    char*      buf;      // cópia da linha de entrada e linha de saída
+    size_t     cap;      // capacidade do buffer
+} *Window;
+
+/*
+ * @brief Bytes de uma janela: o estado, o anel e, em max/min, a fila
+ *        (múltiplo de 16, o alinhamento da soma)
+ */
+static size_t janela_tamanho(int operacao, long linhas) {
+    size_t t = sizeof(struct janela);
+
+    if (operacao != W_NENHUMA) t += sizeof(Valor) * linhas;
+    if (operacao == W_MAX || operacao == W_MIN) t += sizeof(long) * linhas;
+
+    return (t + 15) & ~(size_t) 15;
+}
+
+static inline Valor* janela_anel(Janela j) {
+    return (Valor*) (j + 1);
+}
+
+static inline long* janela_fila(Window w, Janela j) {
+    return (long*) ((Valor*) (j + 1) + w->linhas);
+}
+
+/*
+ * @brief Memória contada por chave: a janela, duas entradas da tabela (que
+ *        fica no máximo meio cheia) e o nome
+ */
+static inline size_t chaves_custo(WindowChaves C, size_t tamchave) {
+    return C->tamjanela + 2 * sizeof(WindowEntrada) + tamchave;
+}
+
+/*
+ * @brief Lê uma opção do window (--by, --mem ou --type) e o seu valor
+ *
+ * @param i Posição da opção (avança para a do valor)
+ *
+ * @return 0 em caso de sucesso ou -1 se a opção for desconhecida ou o valor
+ *         inválido
+ */
+static int window_opcao(int argc, char const* argv[], int* i, int* por,
+                        size_t* limite, int* tipo) {
+    if (*i + 1 >= argc) return -1;
+
+    if (strcmp(argv[*i], "--by") == 0) {
+        if ((*por = campos_numcoluna(argv[*i + 1])) == -1) return -1;
+    }
+    else if (strcmp(argv[*i], "--mem") == 0) {
+        if ((*limite = bytes_converte(argv[*i + 1], UINT32_MAX)) == 0) return -1;
+    }
+    else if (strcmp(argv[*i], "--type") == 0) {
+        if ((*tipo = campos_tipo(argv[*i + 1])) == -1) return -1;
+    }
+    else return -1;
+
+    (*i)++;
+
+    return 0;
+}
+
+/*
+ * @brief Cria o estado do operador a partir dos argumentos
+ *
+ *        e.g. window [-d <separador>] [opções] <coluna> <operacao> <linhas>
+ *                    [opções]
+ *
+ * As opções (--by <coluna da chave>, --mem <bytes> e --type int|real|auto)
+ * podem vir antes de <coluna> ou depois de <linhas>, como o --type no filter.
+ *
+ * @return Estado do operador ou NULL se os argumentos forem inválidos
+ */
+Window window_init(int argc, char const* argv[]) {
+    Window w;
+    char delim;
+    int i, p, coluna, por = 0, tipo = CAMPOS_AUTO, salta = campos_opcao(argc, argv, &delim);
+    size_t limite = WINDOW_MEMORIA;
+    long linhas;
+
+    argc -= salta;
+    argv += salta;
+
+    for (i = 1; i < argc && strncmp(argv[i], "--", 2) == 0; i++) {
+        if (window_opcao(argc, argv, &i, &por, &limite, &tipo) == -1) return NULL;
+    }
+
+    p = i; // <coluna> <operacao> <linhas>
+
+    if (argc - p < 3 || (coluna = campos_numcoluna(argv[p])) == -1) return NULL;
+    if ((linhas = atol(argv[p + 2])) < 1 || linhas > LONG_MAX / 32) return NULL;
+
+    for (i = p + 3; i < argc; i++) {
+        if (window_opcao(argc, argv, &i, &por, &limite, &tipo) == -1) return NULL;
+    }
+
+    w = calloc(1, sizeof(struct windowop));
+    w->delim = delim;
+    w->coluna = coluna;
+    w->linhas = linhas;
+    w->tipo = tipo;
+    w->real = tipo == CAMPOS_REAL;
+
+    if      (strcmp(argv[p + 1], "avg") == 0) w->operacao = W_AVG;
+    else if (strcmp(argv[p + 1], "max") == 0) w->operacao = W_MAX;
+    else if (strcmp(argv[p + 1], "min") == 0) w->operacao = W_MIN;
+    else if (strcmp(argv[p + 1], "sum") == 0) w->operacao = W_SUM;
+    else w->operacao = W_NENHUMA; // acrescenta o próprio valor
+
+    if (por > 0) {
+        WindowChaves C = calloc(1, sizeof(struct window_chaves));
+        C->coluna = por;
+        C->limite = limite;
+        C->tamjanela = janela_tamanho(w->operacao, w->linhas);
+        while (C->tamjanela << (C->bitsbloco + 1) <=
+               (limite < WINDOW_BLOCO ? limite : WINDOW_BLOCO)) C->bitsbloco++;
+        C->captabela = 1024;
+        C->tabela = calloc(C->captabela, sizeof(WindowEntrada));
+        C->capnomes = 4096;
+        C->nomes = malloc(C->capnomes);
+        w->chaves = C;
+
+        /* O limite tem de chegar para a janela de uma chave */
+
+        if (C->tabela == NULL || C->nomes == NULL || chaves_custo(C, 0) > limite) {
+            free(C->tabela);
+            free(C->nomes);
+            free(C);
+            free(w);
+            return NULL;
+        }
+    }
+    else {
+        w->j = calloc(1, janela_tamanho(w->operacao, w->linhas));
+        if (w->j == NULL) { free(w); return NULL; }
+    }
+
+    w->campos = campos_init(delim);
+    w->cap = 256;
+    w->buf = malloc(w->cap);
+
+    return w;
+}
+
+
+/******************************************************************************
+ *                          JANELAS POR CHAVE (--by)                          *
+ ******************************************************************************/
+
+/*
+ * @brief Janela com um dado índice no pool
+ */
+static inline Janela chaves_janela(WindowChaves C, uint32_t ix) {
+    ix--;
+    return (Janela) (C->blocos[ix >> C->bitsbloco] +
+                     (size_t) (ix & ((1u << C->bitsbloco) - 1)) * C->tamjanela);
+}
+
+static inline uint32_t chaves_hash(const char* k, size_t n) {
+    uint32_t h = 2166136261u;
+    size_t i;
+
+    for (i = 0; i < n; i++) h = (h ^ (unsigned char) k[i]) * 16777619u;
+
+    return h;
+}
+
+/*
+ * @brief Posição ideal de um hash na tabela
+ */
+static inline uint32_t chaves_lugar(WindowChaves C, uint32_t h) {
+    return (h ^ (h >> 15)) & (C->captabela - 1);
+}
+
+/*
+ * @brief Tira uma janela do pool (da lista de livres ou de um bloco novo)
+ *
+ * @return Índice da janela ou WINDOW_NADA se não houver memória para um
+ *         bloco novo
+ */
+static uint32_t chaves_aloca(WindowChaves C) {
+    uint32_t ix = C->livres;
+    char **blocos, *bloco;
+
+    if (ix != WINDOW_NADA) {
+        C->livres = chaves_janela(C, ix)->ant;
+        return ix;
+    }
+
+    if (C->usadas == C->nblocos << C->bitsbloco) {
+        blocos = realloc(C->blocos, sizeof(char*) * (C->nblocos + 1));
+        if (blocos == NULL) return WINDOW_NADA;
+        C->blocos = blocos;
+        if ((bloco = malloc(C->tamjanela << C->bitsbloco)) == NULL) return WINDOW_NADA;
+        C->blocos[C->nblocos++] = bloco;
+    }
+
+    return ++C->usadas;
+}
+
+/*
+ * @brief Junta as chaves presentes no início da zona das chaves (sem memória
+ *        para a cópia, a zona fica como está)
+ */
+static void chaves_compacta(WindowChaves C) {
+    char* nomes = malloc(C->capnomes);
+    size_t t = 0;
+    uint32_t ix;
+    Janela j;
+
+    if (nomes == NULL) return;
+
+    for (ix = C->recente; ix != WINDOW_NADA; ix = j->ant) {
+        j = chaves_janela(C, ix);
+        memcpy(nomes + t, C->nomes + j->chave, j->tamchave);
+        j->chave = t;
+        t += j->tamchave;
+    }
+
+    free(C->nomes);
+    C->nomes = nomes;
+    C->tamnomes = t;
+    C->lixo = 0;
+}
+
+/*
+ * @brief Guarda o nome de uma chave nova
+ *
+ * @param ini Onde se coloca o início do nome na zona das chaves
+ *
+ * @return 0 em caso de sucesso, -1 se não houver memória
+ */
+static int chaves_nome(WindowChaves C, const char* k, size_t n, uint32_t* ini) {
+    size_t cap;
+    char* nomes;
+
+    if (C->tamnomes + n > C->capnomes) {
+        if (C->lixo > C->tamnomes / 2) chaves_compacta(C);
+
+        for (cap = C->capnomes; C->tamnomes + n > cap; cap *= 2);
+        if (cap > C->capnomes) {
+            if ((nomes = realloc(C->nomes, cap)) == NULL) return -1;
+            C->nomes = nomes;
+            C->capnomes = cap;
+        }
+    }
+
+    memcpy(C->nomes + C->tamnomes, k, n);
+    *ini = C->tamnomes;
+    C->tamnomes += n;
+
+    return 0;
+}
+
+/*
+ * @brief Põe uma chave à cabeça da LRU (a usada mais recentemente)
+ */
+static inline void chaves_usa(WindowChaves C, uint32_t ix, Janela j) {
+    if (C->recente == ix) return;
+
+    chaves_janela(C, j->seg)->ant = j->ant;
+    if (j->ant != WINDOW_NADA) chaves_janela(C, j->ant)->seg = j->seg;
+    else C->antiga = j->seg;
+
+    j->ant = C->recente;
+    j->seg = WINDOW_NADA;
+    chaves_janela(C, C->recente)->seg = ix;
+    C->recente = ix;
+}
+
+/*
+ * @brief Tira a chave que há mais tempo não aparece (a janela volta ao pool)
+ */
+static void chaves_expulsa(WindowChaves C) {
+    uint32_t ix = C->antiga, i, k, d, mascara = C->captabela - 1;
+    Janela j = chaves_janela(C, ix);
+
+    C->antiga = j->seg;
+    if (j->seg != WINDOW_NADA) chaves_janela(C, j->seg)->ant = WINDOW_NADA;
+    else C->recente = WINDOW_NADA;
+
+    /* Sai da tabela: as entradas seguintes que a sondagem só encontra
+       passando por esta recuam, para não deixar buracos */
+
+    for (i = chaves_lugar(C, j->hash); C->tabela[i].janela != ix; i = (i + 1) & mascara);
+
+    for (k = (i + 1) & mascara; C->tabela[k].janela != WINDOW_NADA; k = (k + 1) & mascara) {
+        d = chaves_lugar(C, C->tabela[k].hash);
+        if (((k - d) & mascara) >= ((k - i) & mascara)) {
+            C->tabela[i] = C->tabela[k];
+            i = k;
+        }
+    }
+
+    C->tabela[i].janela = WINDOW_NADA;
+
+    C->memoria -= chaves_custo(C, j->tamchave);
+    C->lixo += j->tamchave;
+    C->nchaves--;
+    C->saidas++;
+
+    j->ant = C->livres;
+    C->livres = ix;
+}
+
+/*
+ * @brief Duplica a tabela de hash
+ *
+ * @return 0 em caso de sucesso, -1 se não houver memória (fica a anterior)
+ */
+static int chaves_cresce(WindowChaves C) {
+    WindowEntrada* antiga = C->tabela;
+    WindowEntrada* nova = calloc((size_t) C->captabela * 2, sizeof(WindowEntrada));
+    uint32_t i, k, cap = C->captabela;
+
+    if (nova == NULL) return -1;
+
+    C->captabela *= 2;
+    C->tabela = nova;
+
+    for (i = 0; i < cap; i++) {
+        if (antiga[i].janela == WINDOW_NADA) continue;
+        k = chaves_lugar(C, antiga[i].hash);
+        while (C->tabela[k].janela != WINDOW_NADA) k = (k + 1) & (C->captabela - 1);
+        C->tabela[k] = antiga[i];
+    }
+
+    free(antiga);
+
+    return 0;
+}
+
+/*
+ * @brief Janela de uma chave (criada vazia se a chave for nova)
+ *
+ * @return Janela ou NULL se não houver memória (para o pool, a tabela ou o
+ *         nome da chave) nem chaves que possam sair
+ */
+static Janela window_chave(WindowChaves C, const char* k, size_t n) {
+    uint32_t h = chaves_hash(k, n), i, ix, mascara = C->captabela - 1;
+    Janela j;
+
+    for (i = chaves_lugar(C, h); (ix = C->tabela[i].janela) != WINDOW_NADA;
+         i = (i + 1) & mascara) {
+        if (C->tabela[i].hash != h) continue;
+        j = chaves_janela(C, ix);
+        if (j->tamchave == n && memcmp(C->nomes + j->chave, k, n) == 0) {
+            chaves_usa(C, ix, j);
+            return j;
+        }
+    }
+
+    /* Chave nova: saem as que há mais tempo não aparecem até haver memória */
+
+    while (C->nchaves > 0 && C->memoria + chaves_custo(C, n) > C->limite) {
+        chaves_expulsa(C);
+    }
+
+    if (2 * (C->nchaves + 1) > C->captabela && chaves_cresce(C) != 0) return NULL;
+
+    while ((ix = chaves_aloca(C)) == WINDOW_NADA) {
+        if (C->nchaves == 0) return NULL;
+        chaves_expulsa(C);
+    }
+
+    j = chaves_janela(C, ix);
+    memset(j, 0, sizeof(struct janela));
+
+    if (chaves_nome(C, k, n, &j->chave) != 0) { // a janela volta ao pool
+        j->ant = C->livres;
+        C->livres = ix;
+        return NULL;
+    }
+
+    j->hash = h;
+    j->tamchave = n;
+
+    mascara = C->captabela - 1;
+    for (i = chaves_lugar(C, h); C->tabela[i].janela != WINDOW_NADA; i = (i + 1) & mascara);
+
+    C->tabela[i].hash = h;
+    C->tabela[i].janela = ix;
+
+    j->ant = C->recente;
+    j->seg = WINDOW_NADA;
+    if (C->recente != WINDOW_NADA) chaves_janela(C, C->recente)->seg = ix;
+    else C->antiga = ix;
+    C->recente = ix;
+
+    C->memoria += chaves_custo(C, n);
+    C->nchaves++;
+
+    return j;
+}
+
+/*
+ * @brief Memória de facto reservada pelas janelas por chave (pool, tabela e
+ *        zona das chaves), em bytes
+ */
+size_t window_memoria(Window w) {
+    WindowChaves C = w->chaves;
+
+    if (C == NULL) return janela_tamanho(w->operacao, w->linhas);
+
+    return ((size_t) C->nblocos * C->tamjanela << C->bitsbloco) +
+           (size_t) C->captabela * sizeof(WindowEntrada) + C->capnomes;
+}
+
+
+/******************************************************************************
+ *                                OPERAÇÕES                                   *
+ ******************************************************************************/
+
+//compara dois valores: 1 se x ganha a a (é maior, em max, ou menor, em min)
+static inline int valor_ganha(Window w, Valor x, Valor a, int max) {
+	if (w->real) return max ? x.r > a.r : x.r < a.r;
+	return max ? x.i > a.i : x.i < a.i;
+}
+
+//resultado com o valor de uma linha
+static inline void valor_res(Window w, Valor a) {
+	if (w->real) w->resr = a.r;
+	else w->res = a.i;
+}
+
+//SUM e AVG: soma dos últimos min(t, linhas) valores
+static void soma_valor(Window w, Janela j, Valor a) {
+	Valor* anel = janela_anel(j);
+	if (w->real) {
+		if (j->t >= w->linhas) j->soma.r -= anel[j->pos].r; // sai o mais antigo
+		j->soma.r += a.r;
+	}
+	else {
+		if (j->t >= w->linhas) j->soma.i -= anel[j->pos].i;
+		j->soma.i += a.i;
+	}
+	anel[j->pos] = a;
+}
+
+//AVG
+static void do_avg(Window w, Janela j, Valor a) {
+	if (j->t == 0) { j->primeiro = a; w->res = 0; w->resr = 0; return; } //quando começa dá sempre 0
+	if (w->real) {
+		if (j->t < w->linhas) w->resr = (j->soma.r - j->primeiro.r) / j->t; //janela ainda incompleta: sem a primeira linha
+		else w->resr = j->soma.r / w->linhas;
+	}
+	else {
+		if (j->t < w->linhas) w->res = (j->soma.i - j->primeiro.i) / j->t;
+		else w->res = j->soma.i / w->linhas;
+	}
+}
+
+//MAX e MIN: a fila tem as posições no anel por ordem de chegada e os seus
+//valores por ordem monótona
+static Valor do_extremo(Window w, Janela j, Valor a, int max) {
+	Valor* anel = janela_anel(j);
+	long* fila = janela_fila(w, j);
+	long k = w->linhas, fim;
+
+	/* A posição do mais antigo é a que vai ser reescrita: se ainda estiver
+	   à cabeça da fila, sai */
+
+	if (j->nfila > 0 && j->t >= k && fila[j->cabeca] == j->pos) {
+		if (++j->cabeca == k) j->cabeca = 0;
+		j->nfila--;
+	}
+
+	anel[j->pos] = a;
+
+	/* Os valores que já não podem ser o extremo saem pelo fim da fila */
+
+	fim = j->cabeca + j->nfila;
+	if (fim >= k) fim -= k;
+
+	while (j->nfila > 0) {
+		fim = fim == 0 ? k - 1 : fim - 1;
+		if (valor_ganha(w, anel[fila[fim]], a, max)) {
+			if (++fim == k) fim = 0;
+			break;
+		}
+		j->nfila--;
+	}
+
+	fila[fim] = j->pos;
+	j->nfila++;
+
+	return anel[fila[j->cabeca]];
+}
+
+//faz operação
+static void do_op(Window w, Janela j, Valor a) {
+	switch (w->operacao) {
+		case W_AVG: soma_valor(w, j, a); do_avg(w, j, a); break;
+		case W_SUM: soma_valor(w, j, a);
+		            if (w->real) w->resr = j->soma.r;
+		            else w->res = j->soma.i;
+		            break;
+		case W_MAX: valor_res(w, do_extremo(w, j, a, 1)); break;
+		case W_MIN: valor_res(w, do_extremo(w, j, a, 0)); break;
+		default:    valor_res(w, a);
+	}
+	j->t++;
+	if (w->operacao != W_NENHUMA && ++j->pos == w->linhas) j->pos = 0;
+}
+
+//passa uma janela para valores reais
+static void janela_real(Window w, Janela j) {
+	Valor* anel = janela_anel(j);
+	long k, n = j->t < w->linhas ? j->t : w->linhas;
+	long double soma = (long double) j->soma.i;
+	double primeiro = (double) j->primeiro.i;
+
+	if (w->operacao == W_NENHUMA) n = 0;
+
+	for (k = 0; k < n; k++) {
+		double v = (double) anel[k].i;
+		anel[k].r = v;
+	}
+
+	j->soma.r = soma;
+	j->primeiro.r = primeiro;
+}
+
+/*
+ * @brief Passa o operador para valores reais (--type auto, no primeiro valor
+ *        real), convertendo todas as janelas
+ */
+static void window_real(Window w) {
+	WindowChaves C = w->chaves;
+	uint32_t ix;
+	Janela j;
+
+	if (C == NULL) janela_real(w, w->j);
+	else {
+		for (ix = C->recente; ix != WINDOW_NADA; ix = j->ant) {
+			j = chaves_janela(C, ix);
+			janela_real(w, j);
+		}
+	}
+
+	w->real = 1;
+}
+
+/*
+ * @brief Escreve o separador, o último resultado e o '\n'
+ *
+ * @return Bytes escritos (no máximo 48)
+ */
+static int window_escreve_res(Window w, char* p) {
+	char dig[48];
+	int n = 0, k = 0;
+	unsigned __int128 u;
+
+	if (w->real) return sprintf(p, "%c%.15g\n", w->delim, w->resr);
+
+	if (w->res >= LLONG_MIN && w->res <= LLONG_MAX) {
+		return sprintf(p, "%c%lld\n", w->delim, (long long) w->res);
+	}
+
+	/* Soma fora dos 64 bits */
+
+	p[n++] = w->delim;
+	if (w->res < 0) p[n++] = '-';
+	u = w->res < 0 ? -(unsigned __int128) w->res : (unsigned __int128) w->res;
+	do { dig[k++] = '0' + (int) (u % 10); u /= 10; } while (u > 0);
+	while (k > 0) p[n++] = dig[--k];
+	p[n++] = '\n';
+
+	return n;
+}
+
+/*
+ * @brief Processa uma linha
+ *
+ * @param w    Estado do operador
+ * @param line Linha de entrada (com ou sem '\n' no fim)
+ * @param len  Tamanho da linha
+ * @param out  Onde se coloca o ponteiro para a linha de saída (válida até à
+ *             próxima chamada)
+ *
+ * @return Tamanho da linha de saída (com '\n'), 0 se não houver saída ou -1
+ *         se não houver memória para a janela de uma chave nova
+ */
+ssize_t window_process(Window w, const char* line, size_t len, const char** out) {
+	long valor;
+	double real;
+	size_t n = len;
+
+	if (n > 0 && line[n - 1] == '\n') n--;
+	if (n == 0) return 0; // linhas vazias são ignoradas
+
+	if (n + 64 > w->cap) {
+		while (n + 64 > w->cap) w->cap *= 2;
+		w->buf = realloc(w->buf, w->cap);
+	}
+
+	//Achar a coluna (uma coluna que falte vale 0) e o valor com o seu tipo
+	campos_linha(w->campos, line, n);
+	if (w->tipo == CAMPOS_INT) campos_num(w->campos, w->coluna, &valor);
+	else if (campos_valor(w->campos, w->coluna, &valor, &real) == CAMPOS_REAL &&
+	         !w->real) window_real(w);
+
+	//janela da chave da linha (uma coluna que falte vale "")
+	if (w->chaves != NULL) {
+		const char* chave;
+		size_t tam;
+		campos_coluna(w->campos, w->chaves->coluna, &chave, &tam);
+		w->j = window_chave(w->chaves, chave, tam);
+		if (w->j == NULL) return -1;
+	}
+
+	//fazer as operações
+	do_op(w, w->j, w->real ? (Valor) { .r = real } : (Valor) { .i = valor }); //adiciona o novo valor e actualiza res(ultado)
+
+	memcpy(w->buf, line, n);
+	n += window_escreve_res(w, w->buf + n); //acrescentar resultado fim da linha
+	*out = w->buf;
+
+	return n;
+}
+
+/******************************************************************************
+ *                            ESTADO (CHECKPOINT)                             *
+ ******************************************************************************/
+
+/*
+ * O controlador pede o estado pondo um pedido no FIFO de entrada do nó. O
+ * pedido segue na ordem dos registos, por isso o estado guardado é o que o
+ * window tem depois de processar os registos que chegaram antes dele. O
+ * pedido é um registo binário (ver readln.h):
+ *
+ *     0   u8   READLN_BINARIO
+ *     1   u8   READLN_ESTADO
+ *     2   u8   1 se o window termina depois de guardar o estado (change)
+ *     3   u8   0
+ *     4   u32  tamanho do pedido
+ *     8   u32  pid do processo a quem o pedido se destina
+ *     12       caminho do ficheiro (sem '\0')
+ *
+ * Se o pedido não chegar a tempo (e.g. o window está atrasado por um destino
+ * lento), o change substitui o processo na mesma e o pedido fica no FIFO: o
+ * novo window, que tem outro pid, ignora-o, em vez de guardar o estado e
+ * terminar.
+ *
+ * O ficheiro (binário, para o mesmo computador) tem os últimos min(t, linhas)
+ * valores de cada janela, do mais antigo para o mais recente, com a chave
+ * (--by) e pela ordem da LRU (a chave que há mais tempo não aparece primeiro):
+ *
+ *     WINDOW_ESTADO_MAGIA, real (u32), por chave (u32), janelas (u64)
+ *     por janela: tamanho da chave (u32), chave, valores (u64), Valor[]
+ *     resto (u64) e os bytes da entrada já lidos e ainda por processar
+ *
+ * Ao restaurar, os valores de cada janela passam outra vez pela operação, sem
+ * saída, o que refaz a soma e a fila do max/min em O(valores), sem voltar a
+ * injetar o histórico na rede. O novo window pode ter outra operação, outro
+ * tamanho (ficam os últimos valores que cabem) ou outro tipo (os valores são
+ * convertidos). Janelas por chave não passam para uma janela única, nem o
+ * contrário: nesse caso o window começa vazio.
+ */
+
+/*
+ * @brief Escreve o pedido de estado (controlador)
+ *
+ * @param buf      Onde se escreve (WINDOW_ESTADO_CAB + PATH_MAX bytes)
+ * @param ficheiro Ficheiro onde o window guarda o estado
+ * @param termina  1 se o window termina depois de o guardar
+ * @param destino  Pid do processo do window
+ *
+ * @return Tamanho do pedido
+ */
+size_t window_pedido(char* buf, const char* ficheiro, int termina, pid_t destino) {
+	uint32_t tam = WINDOW_ESTADO_CAB + strlen(ficheiro), pid = destino;
+
+	buf[0] = READLN_BINARIO;
+	buf[1] = READLN_ESTADO;
+	buf[2] = termina;
+	buf[3] = 0;
+	memcpy(buf + 4, &tam, sizeof(tam));
+	memcpy(buf + 8, &pid, sizeof(pid));
+	memcpy(buf + WINDOW_ESTADO_CAB, ficheiro, tam - WINDOW_ESTADO_CAB);
+
+	return tam;
+}
+
+/*
+ * @brief Lê um pedido de estado (window)
+ *
+ * @param ficheiro Onde se copia o ficheiro (PATH_MAX bytes)
+ * @param termina  Fica a 1 se o window termina depois de guardar o estado
+ *
+ * @return 0 em caso de sucesso ou -1 se o pedido for inválido ou para outro
+ *         processo (o window que este substituiu)
+ */
+int window_pedido_le(const char* pedido, size_t tam, char* ficheiro, int* termina) {
+	uint32_t pid;
+
+	if (tam <= WINDOW_ESTADO_CAB || tam - WINDOW_ESTADO_CAB >= PATH_MAX) return -1;
+
+	memcpy(&pid, pedido + 8, sizeof(pid));
+	if ((pid_t) pid != getpid()) return -1;
+
+	tam -= WINDOW_ESTADO_CAB;
+	memcpy(ficheiro, pedido + WINDOW_ESTADO_CAB, tam);
+	ficheiro[tam] = '\0';
+	*termina = pedido[2] == 1;
+
+	return 0;
+}
+
+/*
+ * @brief Escreve uma janela: a chave e os valores do mais antigo para o mais
+ *        recente
+ */
+static void janela_guarda(Window w, Janela j, const char* chave, uint32_t tamchave,
+                          FILE* f) {
+	Valor* anel = janela_anel(j);
+	uint64_t n = j->t < w->linhas ? (uint64_t) j->t : (uint64_t) w->linhas;
+
+	if (w->operacao == W_NENHUMA) n = 0;
+
+	fwrite(&tamchave, sizeof(tamchave), 1, f);
+	fwrite(chave, 1, tamchave, f);
+	fwrite(&n, sizeof(n), 1, f);
+
+	if (n < (uint64_t) w->linhas) fwrite(anel, sizeof(Valor), n, f);
+	else {
+		fwrite(anel + j->pos, sizeof(Valor), w->linhas - j->pos, f);
+		fwrite(anel, sizeof(Valor), j->pos, f);
+	}
+}
+
+/*
+ * @brief Guarda o estado das janelas num ficheiro
+ *
+ * @param ficheiro Ficheiro (escrito com outro nome e mudado no fim, para que
+ *                 quem espera por ele nunca o veja incompleto)
+ * @param resto    Bytes da entrada já lidos e ainda por processar (o novo
+ *                 window processa-os primeiro) ou NULL
+ * @param nresto   Número de bytes do resto
+ *
+ * @return 0 em caso de sucesso ou -1 em caso de erro
+ */
+int window_guarda(Window w, const char* ficheiro, const char* resto, size_t nresto) {
+	char tmp[PATH_MAX + 8];
+	WindowChaves C = w->chaves;
+	uint32_t cab[2] = { w->real, C != NULL }, ix;
+	uint64_t janelas = C != NULL ? C->nchaves : 1, r = nresto;
+	Janela j;
+	FILE* f;
+	int erro;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", ficheiro);
+
+	if ((f = fopen(tmp, "w")) == NULL) return -1;
+	setvbuf(f, NULL, _IOFBF, 1 << 20);
+
+	fwrite(WINDOW_ESTADO_MAGIA, 1, 8, f);
+	fwrite(cab, sizeof(cab), 1, f);
+	fwrite(&janelas, sizeof(janelas), 1, f);
+
+	if (C == NULL) janela_guarda(w, w->j, NULL, 0, f);
+	else {
+		for (ix = C->antiga; ix != WINDOW_NADA; ix = j->seg) {
+			j = chaves_janela(C, ix);
+			janela_guarda(w, j, C->nomes + j->chave, j->tamchave, f);
+		}
+	}
+
+	fwrite(&r, sizeof(r), 1, f);
+	if (nresto > 0) fwrite(resto, 1, nresto, f);
+
+	erro = ferror(f);
+	if (fclose(f) != 0 || erro || rename(tmp, ficheiro) != 0) {
+		unlink(tmp);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * @brief Restaura o estado das janelas guardado por window_guarda (num window
+ *        acabado de criar)
+ *
+ * @param ficheiro Ficheiro com o estado
+ * @param resto    Onde se coloca o resto da entrada do window anterior
+ *                 (malloc, NULL se não houver)
+ * @param nresto   Onde se coloca o número de bytes do resto
+ *
+ * @return Número de janelas restauradas ou -1 se o ficheiro for inválido
+ */
+long window_restaura(Window w, const char* ficheiro, char** resto, size_t* nresto) {
+	char magia[8], *chave = NULL;
+	uint32_t cab[2], tamchave;
+	uint64_t janelas, n, k, r, capv = 0;
+	size_t capchave = 0;
+	long restauradas = 0;
+	int compativel;
+	Valor* v = NULL;
+	Valor a;
+	Janela j;
+	FILE* f;
+
+	*resto = NULL;
+	*nresto = 0;
+
+	if ((f = fopen(ficheiro, "r")) == NULL) return -1;
+	setvbuf(f, NULL, _IOFBF, 1 << 20);
+
+	if (fread(magia, 1, 8, f) != 8 || memcmp(magia, WINDOW_ESTADO_MAGIA, 8) ||
+	    fread(cab, sizeof(cab), 1, f) != 1 || fread(&janelas, sizeof(janelas), 1, f) != 1) {
+		fclose(f);
+		return -1;
+	}
+
+	if (cab[0] && w->tipo != CAMPOS_INT && !w->real) window_real(w);
+	compativel = (cab[1] != 0) == (w->chaves != NULL);
+
+	for (; janelas > 0; janelas--) {
+		if (fread(&tamchave, sizeof(tamchave), 1, f) != 1) break;
+		if (tamchave > capchave) chave = realloc(chave, capchave = tamchave);
+		if (fread(chave, 1, tamchave, f) != tamchave ||
+		    fread(&n, sizeof(n), 1, f) != 1) break;
+		if (n > capv) v = realloc(v, sizeof(Valor) * (capv = n));
+		if (fread(v, sizeof(Valor), n, f) != n) break;
+
+		if (!compativel) continue;
+
+		j = w->chaves != NULL ? window_chave(w->chaves, chave, tamchave) : w->j;
+		if (j == NULL) break;
+
+		/* Só os últimos valores que cabem na janela, no tipo do window */
+
+		for (k = n > (uint64_t) w->linhas ? n - w->linhas : 0; k < n; k++) {
+			a = v[k];
+			if (cab[0] && !w->real) {
+				a.i = v[k].r >= 9.2e18 ? LONG_MAX : v[k].r <= -9.2e18 ? LONG_MIN : (long) v[k].r;
+			}
+			else if (!cab[0] && w->real) a.r = (double) v[k].i;
+			do_op(w, j, a);
+		}
+
+		restauradas++;
+	}
+
+	free(chave);
+	free(v);
+
+	if (janelas > 0 || fread(&r, sizeof(r), 1, f) != 1) {
+		fclose(f);
+		return -1;
+	}
+
+	if (r > 0) {
+		*resto = malloc(r);
+		if (fread(*resto, 1, r, f) != r) {
+			free(*resto);
+			*resto = NULL;
+			fclose(f);
+			return -1;
+		}
+		*nresto = r;
+	}
+
+	fclose(f);
+
+	return restauradas;
+}
+
+/*
+ * @brief Liberta o estado do operador
+ */
+void window_free(Window w) {
+	WindowChaves C = w->chaves;
+	uint32_t i;
+
+	if (C != NULL) {
+		for (i = 0; i < C->nblocos; i++) free(C->blocos[i]);
+		free(C->blocos);
+		free(C->tabela);
+		free(C->nomes);
+		free(C);
+	}
+	else free(w->j);
+
+	campos_free(w->campos);
+	free(w->buf);
+	free(w);
+}
+
+#endif